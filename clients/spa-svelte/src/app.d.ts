@@ -23,6 +23,9 @@ interface ChatMessage {
   _html: string;
   _metaInfoArray?: string[];
   _metaVisible?: boolean;
+  _htmlBlocks?: string[]; // while streaming with host rendering: closed blocks
+  _htmlTail?: string;     // ... and the still open one
+  _mdKey?: string;        // host's cache key of _html (GET /host/markdown/<key>)
 }
 
 interface AppInstance {
@@ -37,4 +40,89 @@ interface AppInstance {
   port: number;
   status: string;
   last_heartbeat: number;
-}
\ No newline at end of file
+}
+
+interface EmbedderRestartReport {
+  status: string; // running | success | error
+  message?: string;
+  projectId: string;
+  oldAppKey: string;
+  newAppKey?: string;
+  appKey?: string;
+  host?: string;
+  port?: number;
+  phase: string;
+  phases: { name: string; atMs: number; [key: string]: any }[];
+  totalMs?: number;
+}
+
+interface ProjectInfo {
+  settingsPath: string;
+  projectId: string;
+  sourceRoots: string[];
+  embedder: any;
+  mtime: number;
+  size: number;
+}
+
+// Embedder process features the host has turned on; rolling restart, replicas and Unix
+// sockets all need socketActivation, which the bundled embedder doesn't support
+interface EmbedderCapabilities {
+  socketActivation: boolean;
+  replicas: number;
+  unixSockets: boolean;
+}
+
+interface HostPrefs {
+  version: number;
+  serverUrl: string;
+  uiPrefs: Record<string, string>;
+  embedder?: EmbedderCapabilities;
+  projects?: Record<string, ProjectInfo | { error: string }>;
+}
+
+interface HostPrefsDelta {
+  version: number;
+  serverUrl?: string;
+  embedder?: EmbedderCapabilities;
+  uiPrefs?: Record<string, string>;
+  removed?: string[];
+}
+
+// A file in the host's attachment spool, sent in chat requests by digest
+interface HostAttachment {
+  path?: string;
+  digest: string;
+  filename: string;
+  size: number;
+  error?: string;
+}
+
+// Full-text search over the conversations the host keeps (/host/search, searchChats)
+interface ChatSearchHit {
+  conversationId: string;
+  message: number;
+  role: 'user' | 'assistant';
+  score: number;
+  snippet: string;
+}
+
+interface ChatSearchResult {
+  hits: ChatSearchHit[];
+  micros: number;
+}
+
+// Host-rendered html for a streamed answer (ChatStreamRelay)
+interface MdDelta {
+  type: "md_delta";
+  seq: number;
+  append: string;
+  tail: string;
+  final?: boolean;
+  key?: string;
+}
+
+interface StartupProfile {
+  enabled: boolean;
+  phases: { phase: string; source: string; atMs: number; pageMs?: number; thread: string }[];
+}
@@ -1,13 +1,27 @@
 declare interface Window {
   apiServerUrl: string | undefined;
+  // Injected by the host before any page script runs, kept current through __hostPrefsApply
+  __hostPrefs?: HostPrefs;
+  __hostPrefsApply?: (delta: HostPrefsDelta) => void;
   cppApi: {
     setServerUrl: (url: string | undefined) => any;
     getServerUrl: () => Promise<string | undefined>;
     setPersistentKey: (key: string, value: string) => Promise<void>;
     getPersistentKey: (key: string) => Promise<string | null>;
+    setPersistentKeys: (items: Record<string, string>) => Promise<void>;
+    getPersistentKeys: (keys: string[]) => Promise<Record<string, string | null>>;
+    getHostPrefs: () => Promise<HostPrefs | null>;
     getSettingsFileProjectId: (path: string) => Promise<string | null>;
-    startEmbedder: (executablePath: string, settingsFilePath: string) => Promise<{ status: string; message: string, appKey: string, projectId: string }>;
-    stopEmbedder: (appKey: string, host: string, port: number) => Promise<{ status: string; message: string }>;
+    getSettingsFilesProjects: (paths: string[]) => Promise<Record<string, ProjectInfo | { error: string }> | null>;
+    startEmbedder: (executablePath: string, settingsFilePath: string) => Promise<{ status: string; message: string, appKey: string, projectId: string, host?: string, port?: number }>;
+    stopEmbedder: (appKey: string, host?: string, port?: number) => Promise<{ status: string; message: string }>;
+    restartEmbedder: (appKey: string, executablePath?: string, settingsFilePath?: string, drainMs?: number) => Promise<EmbedderRestartReport>;
+    getEmbedderRestartStatus: (projectId: string) => Promise<EmbedderRestartReport | null>;
+    reportStartupMark: (phase: string, pageMs: number) => Promise<null>;
+    getStartupProfile: () => Promise<StartupProfile | null>;
+    pickAttachmentFiles: () => Promise<string[]>;
+    ingestAttachments: (paths: string[]) => Promise<HostAttachment[] | { error: string }>;
+    searchChats: (query: string, limit?: number) => Promise<ChatSearchResult | { error: string }>;
   };
   // hljs: {
   //   highlightAll: () => any;
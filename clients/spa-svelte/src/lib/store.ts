@@ -3,6 +3,8 @@ import { writable } from 'svelte/store';
 export const temperature = writable<number>(0.1);
 export const settings = writable<SettingsType>({ completionApis: [], currentApi: "" });
 export const messages = writable<ChatMessage[]>([]);
+// Host-side conversation (webview only): synced = messages the host already has
+export const conversation = writable<{ id: string; synced: number }>({ id: "", synced: 0 });
 export const instances = writable<AppInstance[]>([]);
 export const curInstance = writable<string>("");
 export const contextSizeRatio = writable<number>(0.7);
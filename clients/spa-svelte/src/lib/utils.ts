@@ -60,10 +60,86 @@ export function apiUrl(path: string) {
   return base + path;
 }
 
+// Expands the host's columnar layout (payloadcodec.h) back into arrays of objects
+export function fromColumnar(v: any): any {
+  if (Array.isArray(v)) return v.map(fromColumnar);
+  if (!v || typeof v !== "object") return v;
+  if (typeof v.$table === "number" && v.columns) {
+    const rows: any[] = Array.from({ length: v.$table }, () => ({}));
+    for (const [key, col] of Object.entries<any>(v.columns)) {
+      if (Array.isArray(col)) {
+        for (let i = 0; i < rows.length; i++) {
+          if (col[i] !== null) rows[i][key] = fromColumnar(col[i]);
+        }
+      } else {
+        for (let i = 0; i < rows.length; i++) rows[i][key] = col.dirs[col.dir[i]] + col.name[i];
+      }
+    }
+    return rows;
+  }
+  for (const k of Object.keys(v)) v[k] = fromColumnar(v[k]);
+  return v;
+}
+
+// GET of a JSON api; inside the webview large responses come columnar from the host
+export async function fetchJson(path: string): Promise<any> {
+  const res = await fetch(apiUrl(path), window.cppApi ? { headers: { Accept: `${Consts.ColumnarJson}, application/json` } } : {});
+  const data = await res.json();
+  return res.headers.get("Content-Type")?.startsWith(Consts.ColumnarJson) ? fromColumnar(data) : data;
+}
+
+type ApiAnswer = { ok: boolean; status: number; data: any };
+
+// Inside the webview the GETs of the first screen go to the host as one /host/batch;
+// apiGet() serves their answers for a few seconds after, then fetches on its own.
+const prefetched = new Map<string, { until: number; answer: Promise<ApiAnswer> }>();
+
+export function prefetchApi(paths: string[]) {
+  if (!window.cppApi) return;
+  const batch = fetch(apiUrl("/host/batch"), {
+    method: "POST",
+    headers: { "Content-Type": "application/json" },
+    body: JSON.stringify({ requests: paths.map((path) => ({ id: path, path, timeoutMs: 5000 })) }),
+  }).then((res) => {
+    if (!res.ok) throw new Error(`HTTP ${res.status}: ${res.statusText}`);
+    return res.json();
+  });
+  const until = performance.now() + 5000;
+  for (const path of paths) {
+    const answer = batch.then((data) => {
+      const item = data.responses.find((r: any) => r.id === path);
+      return { ok: 200 <= item.status && item.status < 300, status: item.status, data: item.body };
+    });
+    answer.catch(() => prefetched.delete(path));
+    prefetched.set(path, { until, answer });
+  }
+}
+
+export async function apiGet(path: string): Promise<ApiAnswer> {
+  const hit = prefetched.get(path);
+  if (hit && performance.now() < hit.until) {
+    try {
+      return await hit.answer;
+    } catch {
+      // fetched below
+    }
+  }
+  prefetched.delete(path);
+  const res = await fetch(apiUrl(path));
+  const text = await res.text();
+  let data: any = text;
+  try {
+    data = JSON.parse(text);
+  } catch {
+    // not JSON
+  }
+  return { ok: res.ok, status: res.status, data };
+}
+
 export async function testConnection() {
   try {
-    const res = await fetch(apiUrl("/api/health"));
-    if (res && res.ok) {
+    const res = await apiGet("/api/health");
+    if (res.ok) {
       return true;
     }
   } catch (err: any) {
@@ -72,6 +148,45 @@ export async function testConnection() {
   return false;
 }
 
+// Inside the webview the host pushes state changes over one event stream (/host/events)
+// instead of the page polling for them. Returns the function that unsubscribes.
+type HostEventHandler = (data: any) => void;
+const hostHandlers = new Map<string, Set<HostEventHandler>>();
+let hostEvents: EventSource | null = null;
+let hostTopics = "";
+
+function reopenHostEvents() {
+  const topics = [...hostHandlers.keys()].sort().join(",");
+  if (topics === hostTopics) return;
+  hostEvents?.close();
+  hostEvents = null;
+  hostTopics = topics;
+  if (!topics) return;
+  hostEvents = new EventSource(apiUrl(`/host/events?topics=${topics}`));
+  for (const topic of hostHandlers.keys()) {
+    hostEvents.addEventListener(topic, (e) => {
+      const data = JSON.parse((e as MessageEvent).data);
+      hostHandlers.get(topic)?.forEach((handler) => handler(data));
+    });
+  }
+}
+
+export function onHostEvent(topic: string, handler: HostEventHandler): () => void {
+  if (!window.cppApi) return () => {};
+  if (!hostHandlers.has(topic)) hostHandlers.set(topic, new Set());
+  hostHandlers.get(topic)!.add(handler);
+  // Components subscribing together share one connection
+  queueMicrotask(reopenHostEvents);
+  return () => {
+    const handlers = hostHandlers.get(topic);
+    handlers?.delete(handler);
+    if (handlers?.size === 0) {
+      hostHandlers.delete(topic);
+      queueMicrotask(reopenHostEvents);
+    }
+  };
+}
+
 export function isPtInRect(rc: DOMRect, x: number, y: number) {
   return rc.x <= x && x < rc.x + rc.width && rc.y <= y && y < rc.y + rc.height;
 }
@@ -130,6 +245,7 @@ export function fnv1a64(str: string): string {
 
 
 export const Consts = {
+  ColumnarJson: "application/vnd.phenix.columnar+json",
   CurrentApiKey: "api",
   TemperatureKey: "temperature",
   ThemeKey: "theme",
@@ -139,14 +255,47 @@ export const Consts = {
   ApiOptionsSortedKey: "ApiOptionsSortedKey",
   ApiOptionsGroupedKey: "ApiOptionsGroupedKey",
   EmbedderExecutablePath: "EmbedderExecutablePath",
-  EmbedderSettingsFilePaths: "EmbedderSettingsFilePaths"
+  EmbedderSettingsFilePaths: "EmbedderSettingsFilePaths",
+  ConversationIdKey: "conversationId"
 };
 
+// Counts calls across the webview bind bridge, to see what startup costs.
+export const bridgeStats = { roundTrips: 0 };
+
+let hostPrefsReady: Promise<HostPrefs | undefined> | null = null;
+
+// The host preloads window.__hostPrefs before navigation. A reloaded page still carries the
+// snapshot from app start, so it is refreshed once with a single call.
+export function hostPrefs(): Promise<HostPrefs | undefined> {
+  if (!window.cppApi) return Promise.resolve(undefined);
+  if (!hostPrefsReady) {
+    const nav = performance.getEntriesByType("navigation")[0] as PerformanceNavigationTiming | undefined;
+    if (window.__hostPrefs && nav?.type !== "reload") {
+      hostPrefsReady = Promise.resolve(window.__hostPrefs);
+    } else {
+      bridgeStats.roundTrips++;
+      hostPrefsReady = window.cppApi
+        .getHostPrefs()
+        .then((p) => {
+          if (p && (!window.__hostPrefs || window.__hostPrefs.version <= p.version)) window.__hostPrefs = p;
+          return window.__hostPrefs;
+        })
+        .catch((error) => {
+          clog("getHostPrefs failed", error);
+          return window.__hostPrefs;
+        });
+    }
+  }
+  return hostPrefsReady;
+}
+
 export async function setPersistentKey(key: string, value: string, sendToCpp = true) {
   try {
     clog(`setPersistentKey ${key}`, value, sendToCpp, window.cppApi);
     localStorage.setItem(key, value);
     if (sendToCpp && window.cppApi) {
+      if (window.__hostPrefs) window.__hostPrefs.uiPrefs[key] = value;
+      bridgeStats.roundTrips++;
       await window.cppApi.setPersistentKey(key, value);
       clog(`Saved persistent key ${key} to C++`, value);
     }
@@ -160,7 +309,13 @@ export async function getPersistentKey(key: string, readFromCpp = true): Promise
     clog(`getPersistentKey ${key}`, readFromCpp, window.cppApi);
     let val = localStorage.getItem(key);
     if (readFromCpp && window.cppApi) {
-      val = await window.cppApi.getPersistentKey(key);
+      const prefs = await hostPrefs();
+      if (prefs) {
+        val = prefs.uiPrefs[key] ?? null;
+      } else {
+        bridgeStats.roundTrips++;
+        val = await window.cppApi.getPersistentKey(key);
+      }
       clog(`Loaded persistent key ${key} from C++`, val);
       if (val != null) {
         localStorage.setItem(key, val);
@@ -173,6 +328,46 @@ export async function getPersistentKey(key: string, readFromCpp = true): Promise
   return null;
 }
 
+export async function getPersistentKeys(keys: string[]): Promise<Record<string, string | null>> {
+  const res: Record<string, string | null> = {};
+  try {
+    let fromCpp: Record<string, string | null> | null = null;
+    if (window.cppApi) {
+      const prefs = await hostPrefs();
+      if (prefs) {
+        fromCpp = Object.fromEntries(keys.map((k) => [k, prefs.uiPrefs[k] ?? null]));
+      } else {
+        bridgeStats.roundTrips++;
+        fromCpp = await window.cppApi.getPersistentKeys(keys);
+      }
+    }
+    for (const key of keys) {
+      const val = fromCpp ? (fromCpp[key] ?? null) : localStorage.getItem(key);
+      if (fromCpp && val != null) localStorage.setItem(key, val);
+      res[key] = val;
+    }
+  } catch (error) {
+    clog(`Unable to get persistent keys`, keys, error);
+  }
+  return res;
+}
+
+export async function setPersistentKeys(items: Record<string, string>) {
+  try {
+    clog(`setPersistentKeys`, items);
+    for (const [key, value] of Object.entries(items)) {
+      localStorage.setItem(key, value);
+      if (window.__hostPrefs) window.__hostPrefs.uiPrefs[key] = value;
+    }
+    if (window.cppApi) {
+      bridgeStats.roundTrips++;
+      await window.cppApi.setPersistentKeys(items);
+    }
+  } catch (error) {
+    clog(`Unable to set persistent keys`, items, error);
+  }
+}
+
 
 export function apiOptionsGroupedSorted(
   ao: { value: string, label: string; _price: number, group: string, desc?: string, hint?: string }[],
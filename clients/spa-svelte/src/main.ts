@@ -2,8 +2,15 @@ import { mount } from 'svelte'
 import './app.css'
 import App from './App.svelte'
 
+// Startup trace: no-ops unless the host runs with --startup-profile
+const startupMark = (phase: string) => window.cppApi?.reportStartupMark?.(phase, performance.now());
+startupMark('script-start');
+
 const app = mount(App, {
   target: document.getElementById('app')!,
 })
+startupMark('mounted');
+// The frame after the next one has been painted
+requestAnimationFrame(() => requestAnimationFrame(() => startupMark('first-paint')));
 
 export default app
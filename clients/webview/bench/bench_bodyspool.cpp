@@ -0,0 +1,113 @@
+// Host memory while a large POST body goes through the proxy: spooled to the upstream as
+// it arrives (BodySpool, bodyspool.h) or read whole and copied into the upstream request
+// as before. The client side is played as httplib's content reader (16 KiB reads), the
+// upstream side as the sender's content provider (64 KiB reads), optionally slow so that
+// the spool spills. Peak RSS only grows, so each mode runs in a process of its own.
+//
+//   bench_bodyspool spooled|buffered [MiB] [upstream us per MiB]
+#include "bodyspool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+  // Peak resident set size in KiB (0 where getrusage isn't available)
+  long peakKb()
+  {
+#ifdef _WIN32
+    return 0;
+#else
+    rusage u{};
+    getrusage(RUSAGE_SELF, &u);
+#ifdef __APPLE__
+    return u.ru_maxrss / 1024;
+#else
+    return u.ru_maxrss;
+#endif
+#endif
+  }
+
+  char byteAt(size_t i) { return static_cast<char>(i % 251); }
+
+  bool readClient(size_t size, const std::function<bool(const char *, size_t)> &receiver)
+  {
+    std::vector<char> buf(16384);
+    for (size_t off = 0; off < size;) {
+      const size_t n = (std::min)(buf.size(), size - off);
+      for (size_t i = 0; i < n; ++i) buf[i] = byteAt(off + i);
+      if (!receiver(buf.data(), n)) return false;
+      off += n;
+    }
+    return true;
+  }
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+  const std::string mode = 1 < argc ? argv[1] : "spooled";
+  const size_t size = static_cast<size_t>(2 < argc ? std::atoll(argv[2]) : 256) << 20;
+  const int upstreamUsPerMb = 3 < argc ? std::atoi(argv[3]) : 0;
+  if (mode != "spooled" && mode != "buffered") {
+    std::printf("usage: bench_bodyspool spooled|buffered [MiB] [upstream us per MiB]\n");
+    return 1;
+  }
+
+  const long before = peakKb();
+  size_t upstreamGot = 0;
+  bool ok = true;
+  auto upstreamTake = [&](const char *data, size_t n) {
+    for (size_t i = 0; i < n; i += 4093) {
+      if (data[i] != byteAt(upstreamGot + i)) ok = false;
+    }
+    if (upstreamUsPerMb && (upstreamGot + n) >> 20 != upstreamGot >> 20) {
+      std::this_thread::sleep_for(std::chrono::microseconds(upstreamUsPerMb));
+    }
+    upstreamGot += n;
+    };
+
+  uint64_t spilled = 0;
+  const auto start = std::chrono::steady_clock::now();
+  if (mode == "buffered") {
+    std::string body;
+    readClient(size, [&body](const char *data, size_t n) { body.append(data, n); return true; });
+    const std::string request = body;
+    for (size_t off = 0; off < request.size(); off += 65536) {
+      upstreamTake(request.data() + off, (std::min)(size_t(65536), request.size() - off));
+    }
+  } else {
+    BodySpool spool(size, 1 << 20);
+    std::thread sender([&] {
+      std::vector<char> buf(64 * 1024);
+      for (size_t sent = 0; sent < size;) {
+        const auto k = spool.read(buf.data(), (std::min)(size - sent, buf.size()));
+        if (k <= 0) {
+          ok = false;
+          break;
+        }
+        upstreamTake(buf.data(), static_cast<size_t>(k));
+        sent += static_cast<size_t>(k);
+      }
+      spool.cancel();
+      });
+    const bool read = readClient(size, [&spool](const char *data, size_t n) { return spool.append(data, n); });
+    spool.finish(read);
+    sender.join();
+    spilled = spool.totals().second;
+  }
+  const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+  std::printf("%-8s %5zu MiB body%s: upstream got %zu bytes%s, spilled %llu MiB, %.0f ms, peak RSS %ld KiB (+%ld)\n",
+    mode.c_str(), size >> 20, upstreamUsPerMb ? " (slow upstream)" : "", upstreamGot, ok && upstreamGot == size ? "" : " (BAD)",
+    static_cast<unsigned long long>(spilled >> 20), ms, peakKb(), peakKb() - before);
+  return ok && upstreamGot == size ? 0 : 1;
+}
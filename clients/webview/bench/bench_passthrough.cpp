@@ -0,0 +1,95 @@
+// Host memory while a large download goes through the proxy: relayed as it arrives with
+// streamGet (passthrough.h) or held whole as the GET proxy did before (timedGet, then
+// set_content). Peak RSS only grows, so each mode runs in a process of its own.
+//
+//   bench_passthrough streamed|buffered [MiB]
+#include "passthrough.h"
+#include "stubbackend.h"
+#include <cstdio>
+#include <cstdlib>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+  // Peak resident set size in KiB (0 where getrusage isn't available)
+  long peakKb()
+  {
+#ifdef _WIN32
+    return 0;
+#else
+    rusage u{};
+    getrusage(RUSAGE_SELF, &u);
+#ifdef __APPLE__
+    return u.ru_maxrss / 1024;
+#else
+    return u.ru_maxrss;
+#endif
+#endif
+  }
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+  const std::string mode = 1 < argc ? argv[1] : "streamed";
+  const size_t entitySize = static_cast<size_t>(2 < argc ? std::atoll(argv[2]) : 1024) << 20;
+  if (mode != "streamed" && mode != "buffered") {
+    std::printf("usage: bench_passthrough streamed|buffered [MiB]\n");
+    return 1;
+  }
+
+  StubBackend upstream;
+  upstream.server().Get("/api/download", [entitySize](const httplib::Request &, httplib::Response &res) {
+    res.set_content_provider(entitySize, "application/octet-stream", [](size_t offset, size_t length, httplib::DataSink &sink) {
+      std::string buf((std::min)(length, size_t(64 * 1024)), static_cast<char>(offset % 251));
+      return sink.write(buf.data(), buf.size());
+      });
+    });
+  const int upstreamPort = upstream.listenTcp();
+
+  UpstreamPool pool;
+  AdaptiveTimeouts timeouts;
+  const TimeoutPolicy policy = { std::chrono::seconds(1), std::chrono::seconds(30), std::chrono::seconds(30), std::chrono::minutes(10) };
+  StubBackend proxy;
+  proxy.server().Get("/api/.*", [&](const httplib::Request &req, httplib::Response &res) {
+    if (mode == "buffered") {
+      auto reply = timedGet(pool, timeouts, "127.0.0.1", upstreamPort, req.target, policy, Deadline(policy.total));
+      res.status = reply.status;
+      res.set_content(reply.body, reply.contentType);
+      return;
+    }
+    const int status = streamGet(pool, timeouts, "127.0.0.1", upstreamPort, req, res, policy, Deadline(policy.total));
+    if (status) res.status = status;
+    });
+  const int proxyPort = proxy.listenTcp();
+  if (upstreamPort <= 0 || proxyPort <= 0) {
+    std::printf("Cannot start the stub servers\n");
+    return 1;
+  }
+
+  const long before = peakKb();
+  const auto start = std::chrono::steady_clock::now();
+  size_t received = 0;
+  int status = 0;
+  httplib::Client cli("127.0.0.1", proxyPort);
+  cli.set_read_timeout(std::chrono::minutes(10));
+  auto result = cli.Get("/api/download?file=x",
+    [&status](const httplib::Response &r) {
+      status = r.status;
+      return true;
+    },
+    [&received](const char *, size_t len) {
+      received += len; // the page's side isn't what is measured
+      return true;
+    });
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  proxy.stop();
+  upstream.stop();
+
+  std::printf("%-8s %6zu MiB entity: status %d, received %zu bytes%s, %.1f s (%.0f MB/s), peak RSS %ld KiB (+%ld)\n",
+    mode.c_str(), entitySize >> 20, status, received, result && received == entitySize ? "" : " (INCOMPLETE)",
+    seconds, received / seconds / 1e6, peakKb(), peakKb() - before);
+  return result && received == entitySize ? 0 : 1;
+}
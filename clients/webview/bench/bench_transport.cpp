@@ -0,0 +1,101 @@
+// The proxy's requests to an embedder over loopback TCP and over its Unix domain socket
+// (see UpstreamPool::setUnixSocket), with pooled keep-alive connections and with a new
+// connection per request, for small, medium and large answers.
+//
+//   bench_transport [requests per client]
+#include "upstreampool.h"
+#include "stubbackend.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+  void run(UpstreamPool &pool, int port, bool unixSocket, size_t size, int clients, int requests, bool keepAlive)
+  {
+    std::vector<double> latencies;
+    std::mutex mutex;
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int c = 0; c < clients; ++c) {
+      threads.emplace_back([&] {
+        std::vector<double> own;
+        for (int i = 0; i < requests; ++i) {
+          const auto t0 = std::chrono::steady_clock::now();
+          const std::string path = "/api/blob?size=" + std::to_string(size);
+          bool ok = false;
+          if (keepAlive) {
+            auto cli = pool.acquire("127.0.0.1", port);
+            auto res = cli->Get(path);
+            ok = res && res->status == 200 && res->body.size() == size;
+            if (!ok) cli.discard();
+          } else {
+            auto cli = pool.connect("127.0.0.1", port);
+            auto res = cli->Get(path);
+            ok = res && res->status == 200 && res->body.size() == size;
+          }
+          if (!ok) std::printf("request failed\n");
+          own.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count());
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        latencies.insert(latencies.end(), own.begin(), own.end());
+        });
+    }
+    for (auto &t : threads) t.join();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::sort(latencies.begin(), latencies.end());
+    std::printf("%-4s %8zu B %2d client(s) %-9s  p50 %8.1f us  p99 %8.1f us  %8.0f req/s  %8.1f MB/s\n",
+      unixSocket ? "unix" : "tcp", size, clients, keepAlive ? "keepalive" : "new conn",
+      latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100],
+      latencies.size() / seconds, latencies.size() * size / seconds / 1e6);
+  }
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+#ifdef _WIN32
+  std::printf("Unix domain sockets aren't used on Windows\n");
+  return 0;
+#else
+  const int requests = 1 < argc ? std::atoi(argv[1]) : 2000;
+  auto blob = [](const httplib::Request &req, httplib::Response &res) {
+    const size_t size = std::strtoull(req.get_param_value("size").c_str(), nullptr, 10);
+    res.set_content(std::string(size, 'x'), "application/json");
+    };
+  StubBackend tcp;
+  tcp.server().Get("/api/blob", blob);
+  const int port = tcp.listenTcp();
+  StubBackend uds;
+  uds.server().Get("/api/blob", blob);
+  const std::string path = (std::filesystem::temp_directory_path() / "bench_transport.sock").string();
+  if (port <= 0 || !uds.listenUnix(path)) {
+    std::printf("Cannot start the stub embedders\n");
+    return 1;
+  }
+
+  UpstreamPool pool;
+  for (size_t size : { size_t(200), size_t(64 * 1024), size_t(1 << 20) }) {
+    const int n = size < 100000 ? requests : requests / 10;
+    for (int clients : { 1, 8 }) {
+      for (bool unixSocket : { false, true }) {
+        // The same host:port, reached either way, as the proxy does
+        if (unixSocket) pool.setUnixSocket("127.0.0.1", port, path);
+        else pool.removeUnixSocket("127.0.0.1", port);
+        run(pool, port, unixSocket, size, clients, n, true);
+      }
+    }
+  }
+  for (bool unixSocket : { false, true }) {
+    if (unixSocket) pool.setUnixSocket("127.0.0.1", port, path);
+    else pool.removeUnixSocket("127.0.0.1", port);
+    run(pool, port, unixSocket, 200, 1, requests, false);
+  }
+  uds.stop();
+  std::filesystem::remove(path);
+  return 0;
+#endif
+}
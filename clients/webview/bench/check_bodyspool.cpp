@@ -0,0 +1,141 @@
+// Behaviour check of BodySpool (bodyspool.h): bytes come out in the order they went in
+// however they are split between memory and the spill file, and the ends of a body
+// (complete, cut short, too large, given up by the upstream) are reported as such.
+// Exits with 1 if any case fails.
+#include "bodyspool.h"
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+  char byteAt(size_t i) { return static_cast<char>((i * 7 + i / 251) % 256); }
+
+  int failures = 0;
+
+  void expect(const char *name, bool ok, const std::string &detail = "")
+  {
+    std::printf("%-52s %s%s%s\n", name, ok ? "ok" : "FAIL", detail.empty() ? "" : ": ", detail.c_str());
+    if (!ok) ++failures;
+  }
+
+  std::string pattern(size_t from, size_t n)
+  {
+    std::string s(n, '\0');
+    for (size_t i = 0; i < n; ++i) s[i] = byteAt(from + i);
+    return s;
+  }
+
+  // Everything the spool hands out until its end; `last` is the final read() result
+  std::string drain(BodySpool &spool, size_t readSize, long long &last)
+  {
+    std::string out;
+    std::vector<char> buf(readSize);
+    while (0 < (last = spool.read(buf.data(), buf.size()))) {
+      out.append(buf.data(), static_cast<size_t>(last));
+    }
+    return out;
+  }
+
+  // A client and an upstream at random speeds: the spool goes from memory to the file and
+  // back to memory (once the file is read out) many times
+  void randomTransfer(unsigned seed)
+  {
+    const size_t total = 8 << 20;
+    BodySpool spool(total, 64 * 1024);
+    std::string received;
+    long long last = 0;
+    std::thread upstream([&spool, &received, &last, seed] {
+      std::mt19937 rng(seed + 1);
+      std::vector<char> buf(100000);
+      for (;;) {
+        const size_t n = std::uniform_int_distribution<size_t>(1, buf.size())(rng);
+        last = spool.read(buf.data(), n);
+        if (last <= 0) break;
+        received.append(buf.data(), static_cast<size_t>(last));
+        if (rng() % 8 == 0) std::this_thread::sleep_for(std::chrono::microseconds(rng() % 2000));
+      }
+      });
+    std::mt19937 rng(seed);
+    bool ok = true;
+    for (size_t sent = 0; sent < total && ok;) {
+      const size_t n = (std::min)(std::uniform_int_distribution<size_t>(1, 50000)(rng), total - sent);
+      const auto chunk = pattern(sent, n);
+      ok = spool.append(chunk.data(), chunk.size());
+      sent += n;
+      if (rng() % 8 == 0) std::this_thread::sleep_for(std::chrono::microseconds(rng() % 2000));
+    }
+    spool.finish(ok);
+    upstream.join();
+    const auto [in, spilled] = spool.totals();
+    const std::string name = "random split, seed " + std::to_string(seed);
+    expect(name.c_str(), ok && last == 0 && received == pattern(0, total) && in == total,
+      std::to_string(received.size()) + " bytes, " + std::to_string(spilled) + " spilled");
+  }
+
+} // anonymous namespace
+
+int main()
+{
+  {
+    // Memory up to 10 bytes, then the file; what comes while the file isn't read out goes
+    // there too, and once it is, memory is used again
+    BodySpool spool(1 << 20, 10);
+    std::vector<char> buf(64);
+    spool.append("0123456", 7);    // memory
+    spool.append("789abc", 6);     // over 10 in memory: file
+    spool.append("d", 1);          // file not read out: file, even though it would fit in memory
+    std::string out;
+    long long n = spool.read(buf.data(), 4);
+    out.append(buf.data(), static_cast<size_t>((std::max)(n, 0ll)));
+    while (out.size() < 14 && 0 < (n = spool.read(buf.data(), buf.size()))) {
+      out.append(buf.data(), static_cast<size_t>(n));
+    }
+    spool.append("ef", 2);         // file read out: memory again
+    spool.finish(true);
+    long long last = 0;
+    out += drain(spool, 3, last);
+    const auto [in, spilled] = spool.totals();
+    expect("memory, then file, then memory again, in order", out == "0123456789abcdef" && last == 0 && in == 16 && spilled == 7, out);
+  }
+
+  for (unsigned seed = 1; seed <= 4; ++seed) {
+    randomTransfer(seed);
+  }
+
+  {
+    BodySpool spool(1 << 20, 4);
+    spool.append("abcdefgh", 8);
+    spool.finish(false);
+    long long last = 0;
+    const auto out = drain(spool, 5, last);
+    expect("body cut short: data, then -1", out == "abcdefgh" && last == -1);
+  }
+
+  {
+    BodySpool spool(16, 8);
+    const bool first = spool.append("0123456789", 10);
+    const bool second = spool.append("0123456789", 10);
+    char c;
+    expect("over maxBytes: refused", first && !second && spool.tooLarge() && spool.read(&c, 1) == -1);
+  }
+
+  {
+    BodySpool spool(1 << 20, 8);
+    long long result = 1;
+    std::thread upstream([&spool, &result] {
+      char c;
+      result = spool.read(&c, 1); // waits: nothing has come yet
+      });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    spool.cancel();
+    upstream.join();
+    expect("cancelled: waiting read ends, appends refused", result == -1 && !spool.append("x", 1));
+  }
+
+  std::printf("%s\n", failures ? "FAILED" : "all passed");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,145 @@
+// Behaviour check of streamGet (passthrough.h) end to end: a stub embedder, a proxy server
+// relaying its GETs with streamGet and a client. The entity is larger than the relay
+// buffer, so ranges start past what is buffered; the stub answers ranges itself on one
+// route and ignores them on another, where streamGet has to skip to the offset. Exits with
+// 1 if any case fails.
+#include "passthrough.h"
+#include "stubbackend.h"
+#include <cstdio>
+#include <functional>
+
+namespace {
+
+  constexpr size_t entitySize = 3 * (1 << 20) + 123;
+
+  char byteAt(size_t i) { return static_cast<char>(i % 251); }
+
+  // The entity's bytes [first, first + n) as they are expected
+  bool same(const std::string &body, size_t first, size_t n)
+  {
+    if (body.size() != n) return false;
+    for (size_t i = 0; i < n; ++i) {
+      if (body[i] != byteAt(first + i)) return false;
+    }
+    return true;
+  }
+
+  bool writePattern(size_t offset, size_t length, httplib::DataSink &sink)
+  {
+    std::string buf((std::min)(length, size_t(64 * 1024)), '\0');
+    for (size_t i = 0; i < buf.size(); ++i) buf[i] = byteAt(offset + i);
+    return sink.write(buf.data(), buf.size());
+  }
+
+  int failures = 0;
+
+  void expect(const char *name, bool ok, const std::string &detail = "")
+  {
+    std::printf("%-44s %s%s%s\n", name, ok ? "ok" : "FAIL", detail.empty() ? "" : ": ", detail.c_str());
+    if (!ok) ++failures;
+  }
+
+} // anonymous namespace
+
+int main()
+{
+  StubBackend upstream;
+  auto &stub = upstream.server();
+  // Ranges answered by httplib: 206 from the offset asked for
+  stub.Get("/api/download", [](const httplib::Request &req, httplib::Response &res) {
+    res.set_header("ETag", "\"v1\"");
+    if (req.get_header_value("If-None-Match") == "\"v1\"") {
+      res.status = 304;
+      return;
+    }
+    res.set_content_provider(entitySize, "application/octet-stream", writePattern);
+    });
+  // Ranges ignored: always the whole entity with 200
+  stub.Get("/api/whole", [](const httplib::Request &, httplib::Response &res) {
+    res.status = 200;
+    res.set_content_provider(entitySize, "application/octet-stream", writePattern);
+    });
+  // Length unknown
+  stub.Get("/api/chunked", [](const httplib::Request &, httplib::Response &res) {
+    res.set_chunked_content_provider("application/octet-stream", [](size_t offset, httplib::DataSink &sink) {
+      if (offset == entitySize) {
+        sink.done();
+        return true;
+      }
+      return writePattern(offset, entitySize - offset, sink);
+      });
+    });
+  const int upstreamPort = upstream.listenTcp();
+
+  UpstreamPool pool;
+  AdaptiveTimeouts timeouts;
+  const TimeoutPolicy policy = { std::chrono::seconds(1), std::chrono::seconds(5), std::chrono::seconds(5), std::chrono::seconds(60) };
+  StubBackend proxy;
+  proxy.server().Get("/api/.*", [&](const httplib::Request &req, httplib::Response &res) {
+    const int status = streamGet(pool, timeouts, "127.0.0.1", upstreamPort, req, res, policy, Deadline(policy.total));
+    if (status) res.status = status;
+    });
+  const int proxyPort = proxy.listenTcp();
+  if (upstreamPort <= 0 || proxyPort <= 0) {
+    std::printf("Cannot start the stub servers\n");
+    return 1;
+  }
+
+  httplib::Client cli("127.0.0.1", proxyPort);
+  auto get = [&cli](const std::string &path, const httplib::Headers &headers = {}) { return cli.Get(path, headers); };
+
+  if (auto res = get("/api/download?file=x")) {
+    expect("whole entity", res->status == 200 && same(res->body, 0, entitySize), std::to_string(res->body.size()) + " bytes");
+    expect("entity headers passed on", res->get_header_value("ETag") == "\"v1\"" && res->get_header_value("Accept-Ranges") == "bytes");
+  } else {
+    expect("whole entity", false, "no answer");
+  }
+
+  const size_t first = 1000000;
+  const size_t last = 1999999;
+  const std::string range = "bytes=" + std::to_string(first) + "-" + std::to_string(last);
+  const std::string contentRange = "bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" + std::to_string(entitySize);
+  for (const char *path : { "/api/download", "/api/whole" }) {
+    auto res = get(path, { {"Range", range} });
+    const std::string name = std::string("range from ") + (path == std::string("/api/whole") ? "a whole entity" : "a 206 upstream");
+    expect(name.c_str(), res && res->status == 206 && res->get_header_value("Content-Range") == contentRange && same(res->body, first, last - first + 1),
+      res ? std::to_string(res->status) + ", " + res->get_header_value("Content-Range") : "no answer");
+  }
+
+  for (const char *path : { "/api/download", "/api/whole" }) {
+    auto res = get(path, { {"Range", "bytes=-500"} });
+    const std::string name = std::string("suffix range, ") + path;
+    expect(name.c_str(), res && res->status == 206 && same(res->body, entitySize - 500, 500));
+    res = get(path, { {"Range", "bytes=2900000-"} });
+    const std::string open = std::string("open-ended range, ") + path;
+    expect(open.c_str(), res && res->status == 206 && same(res->body, 2900000, entitySize - 2900000));
+  }
+
+  // Several ranges aren't forwarded: httplib cuts each from the whole entity, in order
+  if (auto res = get("/api/whole", { {"Range", "bytes=0-9,400000-400009"} })) {
+    auto part = [](size_t from) { std::string s; for (size_t i = 0; i < 10; ++i) s += byteAt(from + i); return s; };
+    const size_t a = res->body.find(part(0));
+    const size_t b = res->body.find(part(400000));
+    expect("multiple ranges", res->status == 206 && res->get_header_value("Content-Type").rfind("multipart/byteranges", 0) == 0 &&
+      a != std::string::npos && b != std::string::npos && a < b);
+  } else {
+    expect("multiple ranges", false, "no answer");
+  }
+
+  if (auto res = get("/api/chunked")) {
+    expect("unknown length, relayed chunked", res->status == 200 && same(res->body, 0, entitySize), std::to_string(res->body.size()) + " bytes");
+  } else {
+    expect("unknown length, relayed chunked", false, "no answer");
+  }
+
+  if (auto res = get("/api/download", { {"If-None-Match", "\"v1\""} })) {
+    expect("conditional GET passed on", res->status == 304 && res->body.empty(), std::to_string(res->status));
+  } else {
+    expect("conditional GET passed on", false, "no answer");
+  }
+
+  proxy.stop();
+  upstream.stop();
+  std::printf("%s\n", failures ? "FAILED" : "all passed");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,61 @@
+#ifndef STUBBACKEND_H
+#define STUBBACKEND_H
+
+#include <httplib.h>
+#include <cstdio>
+#include <string>
+#include <thread>
+#ifndef _WIN32
+#include <sys/socket.h>
+#endif
+
+// An embedder stand-in for the benchmarks and checks: an httplib server on a thread of its
+// own, on an ephemeral loopback port or on a Unix domain socket. Routes are set up on
+// server() before listening.
+class StubBackend {
+public:
+  StubBackend() = default;
+  ~StubBackend() { stop(); }
+
+  StubBackend(const StubBackend &) = delete;
+  StubBackend &operator=(const StubBackend &) = delete;
+
+  httplib::Server &server() { return svr_; }
+
+  // The port it listens on, -1 if binding failed
+  int listenTcp() {
+    const int port = svr_.bind_to_any_port("127.0.0.1");
+    if (0 < port) start();
+    return port;
+  }
+
+#ifndef _WIN32
+  bool listenUnix(const std::string &path) {
+    std::remove(path.c_str());
+    svr_.set_address_family(AF_UNIX);
+    if (!svr_.bind_to_port(path, 80)) {
+      return false;
+    }
+    start();
+    return true;
+  }
+#endif
+
+  void stop() {
+    if (thread_.joinable()) {
+      svr_.stop();
+      thread_.join();
+    }
+  }
+
+private:
+  void start() {
+    thread_ = std::thread([this] { svr_.listen_after_bind(); });
+    svr_.wait_until_ready();
+  }
+
+  httplib::Server svr_;
+  std::thread thread_;
+};
+
+#endif // STUBBACKEND_H
@@ -0,0 +1,710 @@
+#include "appconfig.h"
+#include <utils_log/logger.hpp>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+  bool syncFile(FILE *f) {
+#ifdef _WIN32
+    return _commit(_fileno(f)) == 0;
+#else
+    return fsync(fileno(f)) == 0;
+#endif
+  }
+
+  void syncParentDir(const std::string &path) {
+#ifndef _WIN32
+    auto dir = fs::path(path).parent_path();
+    int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+    if (fd != -1) {
+      fsync(fd);
+      close(fd);
+    }
+#endif
+  }
+
+  void replayJournal(AppConfig &prefs, const std::string &prefsPath) {
+    std::ifstream in(PrefsWriter::journalPath(prefsPath));
+    if (!in.is_open()) {
+      return;
+    }
+    size_t n = 0;
+    std::string line;
+    while (std::getline(in, line)) {
+      if (line.empty()) continue;
+      try {
+        auto j = nlohmann::json::parse(line);
+        prefs.uiPrefs[j.at("key").get<std::string>()] = j.at("value").get<std::string>();
+        ++n;
+      } catch (const std::exception &) {
+        break; // torn tail of an interrupted append
+      }
+    }
+    if (n) {
+      LOG_MSG << "Replayed" << n << "journaled ui pref change(s)";
+    }
+  }
+
+  bool readFile(const std::string &path, std::string &out) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f.is_open()) {
+      return false;
+    }
+    std::stringstream ss;
+    ss << f.rdbuf();
+    out = ss.str();
+    return true;
+  }
+
+  void applyPrefsJson(AppConfig &prefs, const nlohmann::json &j) {
+    if (j.contains("window") && j["window"].is_object()) {
+      const auto &w = j["window"];
+      if (w.contains("width") && w["width"].is_number_integer()) {
+        prefs.width = w["width"].get<int>();
+      }
+      if (w.contains("height") && w["height"].is_number_integer()) {
+        prefs.height = w["height"].get<int>();
+      }
+    }
+    if (j.contains("api") && j["api"].is_object()) {
+      const auto &w = j["api"];
+      if (w.contains("host") && w["host"].is_string()) {
+        prefs.host = w["host"];
+      }
+      if (w.contains("port") && w["port"].is_number_integer()) {
+        prefs.port = w["port"].get<int>();
+      }
+      if (w.contains("timeouts") && w["timeouts"].is_object()) {
+        for (const auto &[route, t] : w["timeouts"].items()) {
+          if (!t.is_object()) continue;
+          auto &rt = prefs.timeouts[route];
+          for (auto [key, ms] : { std::pair{"connectMs", &rt.connectMs}, {"firstByteMs", &rt.firstByteMs}, {"idleMs", &rt.idleMs}, {"totalMs", &rt.totalMs} }) {
+            if (t.contains(key) && t[key].is_number_integer()) {
+              *ms = t[key].get<int>();
+            }
+          }
+        }
+      }
+      if (w.contains("hedgeGets") && w["hedgeGets"].is_boolean()) {
+        prefs.hedgeGets = w["hedgeGets"].get<bool>();
+      }
+      if (w.contains("maxBodyMB") && w["maxBodyMB"].is_number_integer()) {
+        prefs.maxBodyMB = w["maxBodyMB"].get<int>();
+      }
+      if (w.contains("spillKB") && w["spillKB"].is_number_integer()) {
+        prefs.spillKB = w["spillKB"].get<int>();
+      }
+      if (w.contains("streamRoutes") && w["streamRoutes"].is_array()) {
+        prefs.streamRoutes.clear();
+        for (const auto &route : w["streamRoutes"]) {
+          if (route.is_string() && !route.get<std::string>().empty()) {
+            prefs.streamRoutes.push_back(route.get<std::string>());
+          }
+        }
+      }
+    }
+    if (j.contains("embedder") && j["embedder"].is_object()) {
+      const auto &e = j["embedder"];
+      if (e.contains("socketActivation") && e["socketActivation"].is_boolean()) {
+        prefs.socketActivation = e["socketActivation"].get<bool>();
+      }
+      if (e.contains("replicas") && e["replicas"].is_number_integer()) {
+        prefs.replicas = e["replicas"].get<int>();
+      }
+      if (e.contains("unixSockets") && e["unixSockets"].is_boolean()) {
+        prefs.unixSockets = e["unixSockets"].get<bool>();
+      }
+    }
+    if (j.contains("persistence") && j["persistence"].is_object()) {
+      const auto &p = j["persistence"];
+      if (p.contains("debounceMs") && p["debounceMs"].is_number_integer()) {
+        prefs.persistDebounceMs = p["debounceMs"].get<int>();
+      }
+      if (p.contains("journal") && p["journal"].is_boolean()) {
+        prefs.persistJournal = p["journal"].get<bool>();
+      }
+    }
+    if (j.contains("projects") && j["projects"].is_object()) {
+      const auto &p = j["projects"];
+      if (p.contains("persistCache") && p["persistCache"].is_boolean()) {
+        prefs.projectCache = p["persistCache"].get<bool>();
+      }
+    }
+    if (j.contains("chat") && j["chat"].is_object()) {
+      const auto &c = j["chat"];
+      if (c.contains("renderMarkdown") && c["renderMarkdown"].is_boolean()) {
+        prefs.renderMarkdown = c["renderMarkdown"].get<bool>();
+      }
+      if (c.contains("streamMode") && c["streamMode"].is_string()) {
+        prefs.streamMode = c["streamMode"].get<std::string>();
+      }
+      if (c.contains("frameMs") && c["frameMs"].is_number_integer()) {
+        prefs.streamFrameMs = c["frameMs"].get<int>();
+      }
+      if (c.contains("frameBytes") && c["frameBytes"].is_number_integer()) {
+        prefs.streamFrameBytes = c["frameBytes"].get<int>();
+      }
+      if (c.contains("historyTokens") && c["historyTokens"].is_object()) {
+        for (const auto &[api, tokens] : c["historyTokens"].items()) {
+          if (tokens.is_number_integer()) {
+            prefs.historyTokens[api] = tokens.get<int>();
+          }
+        }
+      }
+    }
+    if (j.contains("uiPrefs") && j["uiPrefs"].is_array()) {
+      for (const auto &item : j["uiPrefs"]) {
+        if (item.contains("key") && item.contains("value") &&
+            item["key"].is_string() && item["value"].is_string()) {
+          prefs.uiPrefs.insert({
+            item["key"].get<std::string>(),
+            item["value"].get<std::string>()
+            });
+        }
+      }
+    }
+  }
+
+  void normalizePrefs(AppConfig &prefs) {
+    if (prefs.host == "localhost") prefs.host = "127.0.0.1";
+    prefs.width = (std::min)((std::max)(prefs.width, 200), 1400);
+    prefs.height = (std::min)((std::max)(prefs.height, 300), 1000);
+    prefs.replicas = (std::min)((std::max)(prefs.replicas, 1), 8);
+    prefs.maxBodyMB = (std::min)((std::max)(prefs.maxBodyMB, 1), 2047); // spill file offsets are longs
+    prefs.spillKB = (std::min)((std::max)(prefs.spillKB, 64), 1 << 20);
+    prefs.persistDebounceMs = (std::min)((std::max)(prefs.persistDebounceMs, 0), 10000);
+    if (prefs.streamMode != "latency") prefs.streamMode = "throughput";
+    prefs.streamFrameMs = (std::min)((std::max)(prefs.streamFrameMs, 0), 1000);
+    prefs.streamFrameBytes = (std::min)((std::max)(prefs.streamFrameBytes, 1), 1 << 20);
+    for (auto &item : prefs.historyTokens) {
+      item.second = (std::max)(item.second, 0);
+    }
+    for (auto &[route, t] : prefs.timeouts) {
+      for (int *ms : { &t.connectMs, &t.firstByteMs, &t.idleMs, &t.totalMs }) {
+        *ms = (std::min)((std::max)(*ms, 0), 3600 * 1000);
+      }
+    }
+  }
+
+} // anonymous namespace
+
+nlohmann::json AppConfig::toJson() const
+{
+  nlohmann::json j;
+  j["window"] = {
+      {"width", width},
+      {"height", height}
+  };
+  j["api"] = {
+      {"host", host},
+      {"port", port},
+      {"hedgeGets", hedgeGets},
+      {"streamRoutes", streamRoutes},
+      {"maxBodyMB", maxBodyMB},
+      {"spillKB", spillKB},
+      {"timeouts", nlohmann::json::object()}
+  };
+  for (const auto &[route, t] : timeouts) {
+    j["api"]["timeouts"][route] = {
+      {"connectMs", t.connectMs},
+      {"firstByteMs", t.firstByteMs},
+      {"idleMs", t.idleMs},
+      {"totalMs", t.totalMs}
+    };
+  }
+  j["embedder"] = {
+      {"socketActivation", socketActivation},
+      {"replicas", replicas},
+      {"unixSockets", unixSockets}
+  };
+  j["persistence"] = {
+      {"debounceMs", persistDebounceMs},
+      {"journal", persistJournal}
+  };
+  j["projects"] = {
+      {"persistCache", projectCache}
+  };
+  j["chat"] = {
+      {"renderMarkdown", renderMarkdown},
+      {"streamMode", streamMode},
+      {"frameMs", streamFrameMs},
+      {"frameBytes", streamFrameBytes},
+      {"historyTokens", historyTokens}
+  };
+  j["uiPrefs"] = nlohmann::json::array();
+  for (const auto &item : uiPrefs) {
+    j["uiPrefs"].push_back({
+      {"key", item.first},
+      {"value", item.second}
+    });
+  }
+  return j;
+}
+
+nlohmann::json AppConfig::toUiJson() const
+{
+  nlohmann::json j;
+  j["version"] = version;
+  j["serverUrl"] = "http://" + host + ":" + std::to_string(port);
+  j["uiPrefs"] = nlohmann::json::object();
+  for (const auto &item : uiPrefs) {
+    j["uiPrefs"][item.first] = item.second;
+  }
+  j["embedder"] = embedderUiJson();
+  return j;
+}
+
+nlohmann::json AppConfig::embedderUiJson() const
+{
+  // What the page may offer: without socket activation there is one process per project
+  // on the port it bound itself, so no rolling restart, replicas or Unix sockets
+  return {
+    {"socketActivation", socketActivation},
+    {"replicas", socketActivation ? replicas : 1},
+    {"unixSockets", socketActivation && unixSockets},
+  };
+}
+
+nlohmann::json AppConfig::uiDelta(const AppConfig &prev, const AppConfig &next)
+{
+  nlohmann::json j;
+  bool changed = false;
+  j["version"] = next.version;
+  if (prev.host != next.host || prev.port != next.port) {
+    j["serverUrl"] = "http://" + next.host + ":" + std::to_string(next.port);
+    changed = true;
+  }
+  if (prev.embedderUiJson() != next.embedderUiJson()) {
+    j["embedder"] = next.embedderUiJson();
+    changed = true;
+  }
+  j["uiPrefs"] = nlohmann::json::object();
+  for (const auto &item : next.uiPrefs) {
+    auto it = prev.uiPrefs.find(item.first);
+    if (it == prev.uiPrefs.end() || it->second != item.second) {
+      j["uiPrefs"][item.first] = item.second;
+      changed = true;
+    }
+  }
+  j["removed"] = nlohmann::json::array();
+  for (const auto &item : prev.uiPrefs) {
+    if (!next.uiPrefs.count(item.first)) {
+      j["removed"].push_back(item.first);
+      changed = true;
+    }
+  }
+  return changed ? j : nlohmann::json();
+}
+
+void fetchOrCreatePrefsJson(AppConfig &prefs, const std::string &prefsPath)
+{
+  LOG_START;
+  std::ifstream f(prefsPath);
+  if (f.is_open()) {
+    std::stringstream ss;
+    ss << f.rdbuf();
+    try {
+      applyPrefsJson(prefs, nlohmann::json::parse(ss.str()));
+    } catch (const std::exception &e) {
+      LOG_MSG << "Error parsing appconfig.json:" << e.what();
+    }
+  } else {
+    if (writeFileAtomically(prefsPath, prefs.toJson().dump(2) + "\n")) {
+      LOG_MSG << "Created default appconfig.json at:" << prefsPath;
+    } else {
+      LOG_MSG << "Failed to create appconfig.json at:" << prefsPath;
+    }
+  }
+  replayJournal(prefs, prefsPath);
+  normalizePrefs(prefs);
+}
+
+bool reloadPrefsJson(AppConfig &prefs, const std::string &prefsPath, std::string &error)
+{
+  std::string content;
+  if (!readFile(prefsPath, content)) {
+    error = "cannot read " + prefsPath;
+    return false;
+  }
+  AppConfig next;
+  try {
+    auto j = nlohmann::json::parse(content);
+    if (!j.is_object()) {
+      error = "top level is not an object";
+      return false;
+    }
+    applyPrefsJson(next, j);
+  } catch (const std::exception &e) {
+    error = e.what();
+    return false;
+  }
+  if (next.host.empty()) {
+    error = "api.host is empty";
+    return false;
+  }
+  if (next.port <= 0 || 65535 < next.port) {
+    error = "api.port out of range: " + std::to_string(next.port);
+    return false;
+  }
+  replayJournal(next, prefsPath);
+  normalizePrefs(next);
+  prefs = std::move(next);
+  return true;
+}
+
+ConfigStore::ConfigStore(AppConfig initial)
+{
+  current_.store(std::make_shared<const AppConfig>(std::move(initial)));
+}
+
+ConfigStore::Snapshot ConfigStore::update(const std::function<void(AppConfig &)> &fn)
+{
+  std::lock_guard<std::mutex> lock(writeMutex_);
+  auto prev = current_.load(std::memory_order_acquire);
+  AppConfig next = *prev;
+  fn(next);
+  return publish(std::move(next), prev);
+}
+
+ConfigStore::Snapshot ConfigStore::replace(AppConfig cfg)
+{
+  std::lock_guard<std::mutex> lock(writeMutex_);
+  auto prev = current_.load(std::memory_order_acquire);
+  return publish(std::move(cfg), prev);
+}
+
+void ConfigStore::subscribe(Listener listener)
+{
+  std::lock_guard<std::mutex> lock(listenersMutex_);
+  listeners_.push_back(std::move(listener));
+}
+
+ConfigStore::Snapshot ConfigStore::publish(AppConfig &&cfg, const Snapshot &prev)
+{
+  cfg.version = prev->version + 1;
+  Snapshot next = std::make_shared<const AppConfig>(std::move(cfg));
+  current_.store(next, std::memory_order_release);
+  std::vector<Listener> listeners;
+  {
+    std::lock_guard<std::mutex> lock(listenersMutex_);
+    listeners = listeners_;
+  }
+  for (const auto &l : listeners) {
+    try {
+      l(prev, next);
+    } catch (const std::exception &ex) {
+      LOG_MSG << "Config listener failed:" << ex.what();
+    }
+  }
+  return next;
+}
+
+bool writeFileAtomically(const std::string &path, const std::string &content)
+{
+  const std::string tmpPath = path + ".tmp";
+  FILE *f = std::fopen(tmpPath.c_str(), "wb");
+  if (!f) {
+    return false;
+  }
+  bool ok = std::fwrite(content.data(), 1, content.size(), f) == content.size();
+  ok = ok && std::fflush(f) == 0 && syncFile(f);
+  ok = std::fclose(f) == 0 && ok;
+  std::error_code ec;
+  if (ok) {
+    fs::rename(tmpPath, path, ec); // replaces the target atomically
+    ok = !ec;
+  }
+  if (!ok) {
+    fs::remove(tmpPath, ec);
+    return false;
+  }
+  syncParentDir(path);
+  return true;
+}
+
+PrefsWriter::PrefsWriter(std::string path, SnapshotFn snapshot, std::chrono::milliseconds debounce, bool journal)
+  : path_(std::move(path))
+  , snapshot_(std::move(snapshot))
+  , debounce_(debounce)
+  , maxDelay_((std::max)(debounce * 10, std::chrono::milliseconds(2000)))
+  , journal_(journal)
+{
+  thread_ = std::thread([this] { run(); });
+}
+
+PrefsWriter::~PrefsWriter()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void PrefsWriter::markDirty()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto now = std::chrono::steady_clock::now();
+    if (writtenGen_ == dirtyGen_) {
+      firstChange_ = now;
+    }
+    lastChange_ = now;
+    ++dirtyGen_;
+  }
+  cv_.notify_all();
+}
+
+void PrefsWriter::record(const std::string &key, const std::string &value)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (journal_) {
+      pendingJournal_.emplace_back(key, value);
+    }
+    unwritten_[key] = { value, dirtyGen_ + 1 };
+  }
+  markDirty();
+}
+
+bool PrefsWriter::isOwnWrite(const std::string &content) const
+{
+  const size_t hash = std::hash<std::string>{}(content);
+  std::lock_guard<std::mutex> lock(ownWritesMutex_);
+  return std::find(ownWrites_.begin(), ownWrites_.end(), hash) != ownWrites_.end();
+}
+
+std::unordered_map<std::string, std::string> PrefsWriter::unwrittenPrefs() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unordered_map<std::string, std::string> res;
+  for (const auto &[key, item] : unwritten_) {
+    res[key] = item.first;
+  }
+  return res;
+}
+
+void PrefsWriter::flush()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  const uint64_t target = dirtyGen_;
+  flushRequested_ = true;
+  cv_.notify_all();
+  flushedCv_.wait(lock, [this, target] { return target <= writtenGen_ && pendingJournal_.empty(); });
+}
+
+void PrefsWriter::run()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this] {
+      return stop_ || flushRequested_ || !pendingJournal_.empty() || writtenGen_ < dirtyGen_;
+      });
+    if (!pendingJournal_.empty()) {
+      // Journal entries go out immediately, only the full snapshot is debounced
+      auto entries = std::move(pendingJournal_);
+      pendingJournal_.clear();
+      lock.unlock();
+      appendJournal(entries);
+      lock.lock();
+      continue;
+    }
+    if (writtenGen_ < dirtyGen_) {
+      const auto deadline = (std::min)(lastChange_ + debounce_, firstChange_ + maxDelay_);
+      if (!stop_ && !flushRequested_ && std::chrono::steady_clock::now() < deadline) {
+        cv_.wait_until(lock, deadline); // further changes push the deadline out
+        continue;
+      }
+      const uint64_t gen = dirtyGen_;
+      lock.unlock();
+      const bool written = writeSnapshot();
+      lock.lock();
+      writtenGen_ = gen;
+      if (written) {
+        std::erase_if(unwritten_, [gen](const auto &item) { return item.second.second <= gen; });
+      }
+      flushedCv_.notify_all();
+      continue;
+    }
+    flushRequested_ = false;
+    flushedCv_.notify_all();
+    if (stop_) {
+      break;
+    }
+  }
+}
+
+void PrefsWriter::appendJournal(const std::vector<std::pair<std::string, std::string>> &entries)
+{
+  const auto jpath = journalPath(path_);
+  FILE *f = std::fopen(jpath.c_str(), "ab");
+  if (!f) {
+    LOG_MSG << "Failed to open" << jpath;
+    return;
+  }
+  for (const auto &e : entries) {
+    const auto line = nlohmann::json{ {"key", e.first}, {"value", e.second} }.dump() + "\n";
+    std::fwrite(line.data(), 1, line.size(), f);
+  }
+  std::fflush(f);
+  syncFile(f);
+  std::fclose(f);
+}
+
+bool PrefsWriter::writeSnapshot()
+{
+  std::string content;
+  try {
+    content = snapshot_().dump(2) + "\n";
+  } catch (const std::exception &ex) {
+    LOG_MSG << "Failed to serialize appconfig:" << ex.what();
+    return false;
+  }
+  const auto t0 = std::chrono::steady_clock::now();
+  // Noted before the rename so a watcher woken by it already recognizes the content
+  const size_t hash = std::hash<std::string>{}(content);
+  {
+    std::lock_guard<std::mutex> lock(ownWritesMutex_);
+    ownWrites_.push_back(hash);
+    if (ownWritesKept < ownWrites_.size()) ownWrites_.pop_front();
+  }
+  if (!writeFileAtomically(path_, content)) {
+    LOG_MSG << "Failed to update" << path_;
+    std::lock_guard<std::mutex> lock(ownWritesMutex_);
+    if (auto it = std::find(ownWrites_.rbegin(), ownWrites_.rend(), hash); it != ownWrites_.rend()) {
+      ownWrites_.erase(std::next(it).base());
+    }
+    return false;
+  }
+  // Compaction: the snapshot now holds everything the journal recorded so far
+  std::error_code ec;
+  fs::remove(journalPath(path_), ec);
+  LOG_MSG << "Updated appconfig.json in"
+    << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count() << "ms";
+  return true;
+}
+
+ConfigWatcher::ConfigWatcher(std::string path, ConfigStore &store, const PrefsWriter &writer)
+  : path_(std::move(path))
+  , store_(store)
+  , writer_(writer)
+{
+  thread_ = std::thread([this] { run(); });
+}
+
+ConfigWatcher::~ConfigWatcher()
+{
+  stop();
+}
+
+void ConfigWatcher::stop()
+{
+  stop_ = true;
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void ConfigWatcher::run()
+{
+  // Editors and our own writer replace the file by rename, so the directory is what
+  // gets watched (a watch on the file itself would stay on the old inode).
+  const auto file = fs::path(path_);
+  const auto dir = file.parent_path().empty() ? fs::path(".") : file.parent_path();
+  const auto name = file.filename().string();
+  // Editors often produce several events per save; reload once they settle.
+  constexpr auto settle = std::chrono::milliseconds(100);
+  bool pending = false;
+  std::chrono::steady_clock::time_point pendingSince;
+
+#ifdef __linux__
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  int wd = fd == -1 ? -1 : inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+  if (wd != -1) {
+    LOG_MSG << "Watching" << path_ << "for changes (inotify)";
+    alignas(inotify_event) char buf[4096];
+    while (!stop_) {
+      pollfd pfd{ fd, POLLIN, 0 };
+      if (poll(&pfd, 1, 200) > 0) {
+        ssize_t len;
+        while ((len = read(fd, buf, sizeof(buf))) > 0) {
+          for (char *p = buf; p < buf + len; ) {
+            auto *ev = reinterpret_cast<inotify_event *>(p);
+            if (ev->len && name == ev->name) {
+              pending = true;
+              pendingSince = std::chrono::steady_clock::now();
+            }
+            p += sizeof(inotify_event) + ev->len;
+          }
+        }
+      }
+      if (pending && settle <= std::chrono::steady_clock::now() - pendingSince) {
+        pending = false;
+        reload();
+      }
+    }
+    close(fd);
+    return;
+  }
+  if (fd != -1) close(fd);
+  LOG_MSG << "inotify unavailable, polling" << path_ << "for changes";
+#endif
+
+  std::error_code ec;
+  auto lastWrite = fs::last_write_time(file, ec);
+  while (!stop_) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    auto t = fs::last_write_time(file, ec);
+    if (!ec && t != lastWrite) {
+      lastWrite = t;
+      pending = true;
+      pendingSince = std::chrono::steady_clock::now();
+    }
+    if (pending && settle <= std::chrono::steady_clock::now() - pendingSince) {
+      pending = false;
+      reload();
+    }
+  }
+}
+
+void ConfigWatcher::reload()
+{
+  std::string content;
+  if (!readFile(path_, content) || writer_.isOwnWrite(content)) {
+    return;
+  }
+  AppConfig next;
+  std::string error;
+  if (!reloadPrefsJson(next, path_, error)) {
+    LOG_MSG << "Ignoring invalid appconfig.json change:" << error;
+    return;
+  }
+  // Prefs set in the app since the last write aren't in the file yet; an edit made meanwhile
+  // must not revert them. The writer still has them marked dirty and writes them out next.
+  const auto unwritten = writer_.unwrittenPrefs();
+  for (const auto &[key, value] : unwritten) {
+    next.uiPrefs[key] = value;
+  }
+  auto snap = store_.replace(std::move(next));
+  LOG_MSG << "Reloaded appconfig.json, config version" << snap->version << LOG_NOSPACE << ", kept" << unwritten.size() << "unwritten pref(s)";
+}
@@ -0,0 +1,190 @@
+#ifndef APP_CONFIG_H
+#define APP_CONFIG_H
+
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <atomic>
+
+// Timeouts of proxied requests to one route, in ms; 0 takes the learned value (deadline.h)
+struct RouteTimeoutConfig {
+  int connectMs = 0;
+  int firstByteMs = 0; // until the response starts
+  int idleMs = 0;      // between chunks of the body (SSE events)
+  int totalMs = 0;
+};
+
+// Immutable once published through ConfigStore; changes are made on a copy.
+struct AppConfig {
+  uint64_t version = 0; // bumped by ConfigStore on every publish
+  int width = 700;
+  int height = 900;
+  int port = 8590;
+  std::string host = "127.0.0.1";
+  // Per route ("/api/chat", ...), "default" for the rest. Limits left at 0 are learned from
+  // the route's latencies, which suits short requests; chat answers stream for minutes at
+  // the model's pace, so their first-byte and idle limits are fixed and generous.
+  std::unordered_map<std::string, RouteTimeoutConfig> timeouts = { {"default", {3000, 0, 0, 0}}, {"/api/chat", {0, 120000, 60000, 600000}} };
+  bool hedgeGets = true;        // resend a slow GET to another replica of the project, first answer wins
+  // GETs under these routes are relayed as they arrive instead of buffered (see passthrough.h)
+  std::vector<std::string> streamRoutes = { "/api/download" };
+  int maxBodyMB = 256;          // proxied POST bodies above this are refused (413)
+  int spillKB = 1024;           // POST body the upstream hasn't taken yet, kept in memory up to this, then on disk
+  // Host binds embedder ports and hands the sockets over (LISTEN_FDS). Off by default: the
+  // bundled embedder binds its own port and ignores inherited sockets, so rolling restart,
+  // replicas and Unix sockets stay unsupported until an embedder that serves them is used.
+  bool socketActivation = false;
+  int replicas = 1;             // embedder processes started per project (more need socketActivation)
+  bool unixSockets = true;      // with socketActivation, also hand embedders a Unix domain socket and proxy over it
+  int persistDebounceMs = 300;  // quiet period before a burst of changes is written out
+  bool persistJournal = false;  // append each ui pref change to appconfig.json.journal first
+  bool projectCache = true;     // keep the parsed embedder settings files in projects.cache.json
+  bool renderMarkdown = true;   // render streamed chat answers on the host when the page asks for it
+  std::string streamMode = "throughput"; // chat relay: "latency" forwards every event, "throughput" coalesces
+  int streamFrameMs = 16;       // throughput mode: content merged per frame ...
+  int streamFrameBytes = 2048;  // ... or per this much text
+  // Chat history budget in tokens per api id ("default" for the rest), 0 = send everything
+  std::unordered_map<std::string, int> historyTokens = { {"default", 64000} };
+  std::unordered_map<std::string, std::string> uiPrefs;
+
+  nlohmann::json toJson() const;
+  // What the page sees: {version, serverUrl, uiPrefs: {key: value}, embedder: {...}}
+  nlohmann::json toUiJson() const;
+  // {socketActivation, replicas, unixSockets} as actually in effect, for the page to gate on
+  nlohmann::json embedderUiJson() const;
+  // Same shape with only what changed from prev (plus "removed" keys), null if nothing did.
+  static nlohmann::json uiDelta(const AppConfig &prev, const AppConfig &next);
+};
+
+// Loads prefsPath into prefs (creating the file with defaults if missing), then replays
+// the changes journaled after the last full write.
+void fetchOrCreatePrefsJson(AppConfig &prefs, const std::string &prefsPath);
+
+// Strict variant used for hot reloads: false (prefs untouched) if the file is unreadable,
+// not valid JSON or holds out of range values.
+bool reloadPrefsJson(AppConfig &prefs, const std::string &prefsPath, std::string &error);
+
+// RCU-style holder of the current AppConfig. Readers take a snapshot without locking
+// and keep using it for as long as they like; writers copy, modify and publish a new
+// version. Writers are serialized among themselves only.
+class ConfigStore {
+public:
+  using Snapshot = std::shared_ptr<const AppConfig>;
+  using Listener = std::function<void(const Snapshot &prev, const Snapshot &next)>;
+
+  explicit ConfigStore(AppConfig initial);
+
+  Snapshot get() const { return current_.load(std::memory_order_acquire); }
+
+  // Applies fn to a copy of the current config and publishes the result.
+  Snapshot update(const std::function<void(AppConfig &)> &fn);
+  // Publishes cfg as a whole, e.g. after reloading the file.
+  Snapshot replace(AppConfig cfg);
+
+  // Called after every publish, on the publishing thread.
+  void subscribe(Listener listener);
+
+private:
+  Snapshot publish(AppConfig &&cfg, const Snapshot &prev);
+
+  std::atomic<Snapshot> current_;
+  std::mutex writeMutex_;
+  std::mutex listenersMutex_;
+  std::vector<Listener> listeners_;
+};
+
+// temp file + fsync + rename, so readers and crashes only ever see a complete file.
+bool writeFileAtomically(const std::string &path, const std::string &content);
+
+// Write-behind persistence of AppConfig. Callers update the in-memory config and mark it
+// dirty; a background thread coalesces bursts of changes and writes one snapshot once
+// no change arrived for the debounce period (or at the latest after maxDelay).
+// With the journal enabled every recorded ui pref is appended right away, and the
+// journal is compacted (truncated) after each successful snapshot.
+class PrefsWriter {
+public:
+  using SnapshotFn = std::function<nlohmann::json()>;
+
+  PrefsWriter(std::string path, SnapshotFn snapshot,
+    std::chrono::milliseconds debounce = std::chrono::milliseconds(300), bool journal = false);
+  ~PrefsWriter();
+
+  PrefsWriter(const PrefsWriter &) = delete;
+  PrefsWriter &operator=(const PrefsWriter &) = delete;
+
+  void markDirty();
+  void record(const std::string &key, const std::string &value);
+  // Blocks until everything marked so far is on disk.
+  void flush();
+
+  static std::string journalPath(const std::string &path) { return path + ".journal"; }
+
+  // Ui prefs recorded but not yet in a written snapshot; a reload from disk keeps them.
+  std::unordered_map<std::string, std::string> unwrittenPrefs() const;
+
+  // Lets a file watcher tell our own writes apart from external edits. The last few are
+  // kept, since the watcher may only get to a write after the next one has landed.
+  bool isOwnWrite(const std::string &content) const;
+
+private:
+  void run();
+  void appendJournal(const std::vector<std::pair<std::string, std::string>> &entries);
+  bool writeSnapshot();
+
+  const std::string path_;
+  const SnapshotFn snapshot_;
+  const std::chrono::milliseconds debounce_;
+  const std::chrono::milliseconds maxDelay_;
+  const bool journal_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::condition_variable flushedCv_;
+  std::vector<std::pair<std::string, std::string>> pendingJournal_;
+  std::unordered_map<std::string, std::pair<std::string, uint64_t>> unwritten_; // value, dirtyGen_ it was recorded at
+  uint64_t dirtyGen_ = 0;
+  uint64_t writtenGen_ = 0;
+  bool flushRequested_ = false;
+  bool stop_ = false;
+  std::chrono::steady_clock::time_point firstChange_;
+  std::chrono::steady_clock::time_point lastChange_;
+  static constexpr size_t ownWritesKept = 8;
+  mutable std::mutex ownWritesMutex_;
+  std::deque<size_t> ownWrites_; // content hashes, oldest first
+  std::thread thread_;
+};
+
+// Reloads appconfig.json when it is changed on disk (inotify on Linux, mtime polling
+// elsewhere), validates it and publishes it to the store. Our own writes are skipped.
+class ConfigWatcher {
+public:
+  ConfigWatcher(std::string path, ConfigStore &store, const PrefsWriter &writer);
+  ~ConfigWatcher();
+
+  ConfigWatcher(const ConfigWatcher &) = delete;
+  ConfigWatcher &operator=(const ConfigWatcher &) = delete;
+
+  // No reloads are published after this returns.
+  void stop();
+
+private:
+  void run();
+  void reload();
+
+  const std::string path_;
+  ConfigStore &store_;
+  const PrefsWriter &writer_;
+  std::atomic<bool> stop_{ false };
+  std::thread thread_;
+};
+
+#endif // APP_CONFIG_H
@@ -0,0 +1,255 @@
+#include "attachstore.h"
+#include <utils_log/logger.hpp>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <atomic>
+#include <future>
+#include <chrono>
+#include <array>
+#include <cstring>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+  // FIPS 180-4 SHA-256, incremental
+  class Sha256 {
+  public:
+    void update(const void *data, size_t len) {
+      auto p = static_cast<const uint8_t *>(data);
+      total_ += len;
+      while (len) {
+        const size_t n = (std::min)(len, sizeof(block_) - used_);
+        std::memcpy(block_ + used_, p, n);
+        used_ += n;
+        p += n;
+        len -= n;
+        if (used_ == sizeof(block_)) {
+          transform(block_);
+          used_ = 0;
+        }
+      }
+    }
+
+    std::string hexDigest() {
+      const uint64_t bits = total_ * 8;
+      const uint8_t pad = 0x80;
+      update(&pad, 1);
+      const uint8_t zero = 0;
+      while (used_ != 56) update(&zero, 1);
+      uint8_t len[8];
+      for (int i = 0; i < 8; ++i) len[i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+      update(len, 8);
+      std::stringstream ss;
+      for (uint32_t v : h_) ss << std::hex << std::setfill('0') << std::setw(8) << v;
+      return ss.str();
+    }
+
+  private:
+    static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void transform(const uint8_t *b) {
+      static const uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+      };
+      uint32_t w[64];
+      for (int i = 0; i < 16; ++i) {
+        w[i] = (uint32_t(b[i * 4]) << 24) | (uint32_t(b[i * 4 + 1]) << 16) | (uint32_t(b[i * 4 + 2]) << 8) | b[i * 4 + 3];
+      }
+      for (int i = 16; i < 64; ++i) {
+        const uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        const uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+      }
+      uint32_t a = h_[0], bb = h_[1], c = h_[2], d = h_[3], e = h_[4], f = h_[5], g = h_[6], h = h_[7];
+      for (int i = 0; i < 64; ++i) {
+        const uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+        const uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & bb) ^ (a & c) ^ (bb & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = bb; bb = a; a = t1 + t2;
+      }
+      h_[0] += a; h_[1] += bb; h_[2] += c; h_[3] += d;
+      h_[4] += e; h_[5] += f; h_[6] += g; h_[7] += h;
+    }
+
+    std::array<uint32_t, 8> h_ = {
+      0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    uint8_t block_[64];
+    size_t used_ = 0;
+    uint64_t total_ = 0;
+  };
+
+} // anonymous namespace
+
+nlohmann::json AttachmentStore::Blob::toJson() const
+{
+  return {
+    {"digest", digest},
+    {"filename", filename},
+    {"size", size}
+  };
+}
+
+AttachmentStore::AttachmentStore(std::string dir, uintmax_t maxBytes)
+  : dir_(std::move(dir)), maxBytes_(maxBytes)
+{
+  std::error_code ec;
+  fs::create_directories(dir_, ec);
+  // Left over from an interrupted ingest
+  for (const auto &entry : fs::directory_iterator(dir_, ec)) {
+    if (entry.path().extension() == ".tmp") {
+      fs::remove(entry.path(), ec);
+    }
+  }
+}
+
+bool AttachmentStore::isDigest(const std::string &s)
+{
+  return s.size() == 64 && s.find_first_not_of("0123456789abcdef") == std::string::npos;
+}
+
+std::string AttachmentStore::pathOf(const std::string &digest) const
+{
+  return (fs::path(dir_) / digest.substr(0, 2) / digest).string();
+}
+
+std::string AttachmentStore::tempPath() const
+{
+  static std::atomic<uint64_t> counter{ 0 };
+  const auto ticks = std::chrono::steady_clock::now().time_since_epoch().count();
+  return (fs::path(dir_) / ("incoming-" + std::to_string(ticks) + "-" + std::to_string(counter++) + ".tmp")).string();
+}
+
+void AttachmentStore::commit(const std::string &tmp, const std::string &digest)
+{
+  const auto dest = pathOf(digest);
+  std::error_code ec;
+  if (fs::exists(dest, ec)) {
+    fs::remove(tmp, ec); // already have it
+    return;
+  }
+  fs::create_directories(fs::path(dest).parent_path(), ec);
+  fs::rename(tmp, dest, ec);
+  if (ec) {
+    fs::remove(tmp, ec);
+    if (!fs::exists(dest)) {
+      throw std::runtime_error("Cannot store attachment " + digest);
+    }
+  }
+}
+
+AttachmentStore::Blob AttachmentStore::ingestFile(const std::string &path)
+{
+  std::ifstream in(path, std::ios::binary);
+  if (!in.is_open()) {
+    throw std::runtime_error("Cannot open file: " + path);
+  }
+  const auto tmp = tempPath();
+  std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+  if (!out.is_open()) {
+    throw std::runtime_error("Cannot write to " + dir_);
+  }
+  Sha256 sha;
+  Blob blob;
+  std::vector<char> buf(64 * 1024);
+  while (in) {
+    in.read(buf.data(), buf.size());
+    const auto n = static_cast<size_t>(in.gcount());
+    if (n == 0) break;
+    blob.size += n;
+    if (maxBytes_ < blob.size) {
+      out.close();
+      std::error_code ec;
+      fs::remove(tmp, ec);
+      throw std::runtime_error("File too large: " + path);
+    }
+    sha.update(buf.data(), n);
+    out.write(buf.data(), n);
+  }
+  out.close();
+  if (in.bad() || !out) {
+    std::error_code ec;
+    fs::remove(tmp, ec);
+    throw std::runtime_error("Failed to read " + path);
+  }
+  blob.digest = sha.hexDigest();
+  blob.filename = fs::path(path).filename().string();
+  commit(tmp, blob.digest);
+  return blob;
+}
+
+AttachmentStore::Blob AttachmentStore::ingestData(const std::string &filename, const std::string &data)
+{
+  if (maxBytes_ < data.size()) {
+    throw std::runtime_error("Attachment too large: " + filename);
+  }
+  Sha256 sha;
+  sha.update(data.data(), data.size());
+  Blob blob{ sha.hexDigest(), filename, data.size() };
+  std::error_code ec;
+  if (fs::exists(pathOf(blob.digest), ec)) {
+    return blob;
+  }
+  const auto tmp = tempPath();
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), data.size());
+    if (!out) {
+      fs::remove(tmp, ec);
+      throw std::runtime_error("Cannot write to " + dir_);
+    }
+  }
+  commit(tmp, blob.digest);
+  return blob;
+}
+
+nlohmann::json AttachmentStore::ingestFiles(const std::vector<std::string> &paths, unsigned workers)
+{
+  nlohmann::json res = nlohmann::json::array();
+  for (const auto &path : paths) {
+    res.push_back({ {"path", path} });
+  }
+  std::atomic<size_t> next{ 0 };
+  auto work = [&] {
+    for (size_t i; (i = next++) < paths.size();) {
+      try {
+        res[i].update(ingestFile(paths[i]).toJson());
+      } catch (const std::exception &ex) {
+        res[i]["error"] = ex.what();
+      }
+    }
+    };
+  std::vector<std::future<void>> pool;
+  const size_t n = (std::min)(static_cast<size_t>((std::max)(workers, 1u)), paths.size());
+  for (size_t i = 1; i < n; ++i) {
+    pool.push_back(std::async(std::launch::async, work));
+  }
+  work();
+  for (auto &f : pool) f.get();
+  return res;
+}
+
+std::optional<std::string> AttachmentStore::read(const std::string &digest) const
+{
+  if (!isDigest(digest)) {
+    return std::nullopt;
+  }
+  std::ifstream in(pathOf(digest), std::ios::binary);
+  if (!in.is_open()) {
+    return std::nullopt;
+  }
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
@@ -0,0 +1,46 @@
+#ifndef ATTACHMENT_STORE_H
+#define ATTACHMENT_STORE_H
+
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+#include <optional>
+#include <cstdint>
+
+// Content-addressed spool for chat attachments, <dir>/<2 hex>/<sha256>. Files are
+// hashed while they are copied in, so each one is read once; identical content is
+// stored once, whatever its name and however often it is attached. Chat requests then
+// carry {filename, digest} instead of the content.
+class AttachmentStore {
+public:
+  struct Blob {
+    std::string digest;
+    std::string filename;
+    uintmax_t size = 0;
+
+    nlohmann::json toJson() const;
+  };
+
+  AttachmentStore(std::string dir, uintmax_t maxBytes = 64ull * 1024 * 1024);
+
+  static bool isDigest(const std::string &s);
+
+  // Throws on unreadable or too large files.
+  Blob ingestFile(const std::string &path);
+  Blob ingestData(const std::string &filename, const std::string &data);
+  // On up to `workers` threads. One result per path, in order: the blob or {"error": ...},
+  // both with "path".
+  nlohmann::json ingestFiles(const std::vector<std::string> &paths, unsigned workers = 4);
+
+  std::optional<std::string> read(const std::string &digest) const;
+
+private:
+  std::string pathOf(const std::string &digest) const;
+  std::string tempPath() const;
+  void commit(const std::string &tmp, const std::string &digest);
+
+  const std::string dir_;
+  const uintmax_t maxBytes_;
+};
+
+#endif // ATTACHMENT_STORE_H
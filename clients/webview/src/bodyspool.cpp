@@ -0,0 +1,103 @@
+#include "bodyspool.h"
+#include <algorithm>
+#include <cstring>
+
+BodySpool::~BodySpool()
+{
+  if (file_) std::fclose(file_); // a tmpfile() is removed on close
+}
+
+bool BodySpool::append(const char *data, size_t len)
+{
+  bool ok = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (cancelled_ || failed_ || tooLarge_) {
+      return false;
+    }
+    if (maxBytes_ < received_ + len) {
+      tooLarge_ = true;
+    } else if (fileRead_ == fileWritten_ && buffered_ + len <= spillBytes_) {
+      // Nothing waits on disk, so it can follow what's in memory
+      memory_.emplace_back(data, len);
+      buffered_ += len;
+    } else {
+      if (!file_) file_ = std::tmpfile();
+      failed_ = !file_ || std::fseek(file_, static_cast<long>(fileWritten_), SEEK_SET) != 0 || std::fwrite(data, 1, len, file_) != len;
+      fileWritten_ += len;
+      spilled_ += len;
+    }
+    received_ += len;
+    ok = !tooLarge_ && !failed_;
+  }
+  cv_.notify_all();
+  return ok;
+}
+
+void BodySpool::finish(bool complete)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = true;
+    complete_ = complete && !tooLarge_ && !failed_;
+  }
+  cv_.notify_all();
+}
+
+long long BodySpool::read(char *buf, size_t n)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this] { return finished_ || cancelled_ || tooLarge_ || failed_ || buffered_ || fileRead_ < fileWritten_; });
+  if (cancelled_ || tooLarge_ || failed_) {
+    return -1;
+  }
+  if (buffered_) {
+    const auto &front = memory_.front();
+    const size_t k = (std::min)(n, front.size() - memoryFront_);
+    std::memcpy(buf, front.data() + memoryFront_, k);
+    memoryFront_ += k;
+    buffered_ -= k;
+    if (memoryFront_ == front.size()) {
+      memory_.pop_front();
+      memoryFront_ = 0;
+    }
+    return static_cast<long long>(k);
+  }
+  if (fileRead_ < fileWritten_) {
+    const size_t want = static_cast<size_t>((std::min)(static_cast<uint64_t>(n), fileWritten_ - fileRead_));
+    if (std::fflush(file_) != 0 || std::fseek(file_, static_cast<long>(fileRead_), SEEK_SET) != 0 || std::fread(buf, 1, want, file_) != want) {
+      failed_ = true;
+      return -1;
+    }
+    fileRead_ += want;
+    // All of it read: the file is written over from its start again
+    if (fileRead_ == fileWritten_) {
+      fileRead_ = fileWritten_ = 0;
+    }
+    return static_cast<long long>(want);
+  }
+  return complete_ ? 0 : -1;
+}
+
+void BodySpool::cancel()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancelled_ = true;
+    memory_.clear();
+    buffered_ = 0;
+  }
+  cv_.notify_all();
+}
+
+bool BodySpool::tooLarge() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return tooLarge_;
+}
+
+std::pair<uint64_t, uint64_t> BodySpool::totals() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return { received_, spilled_ };
+}
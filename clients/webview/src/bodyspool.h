@@ -0,0 +1,59 @@
+#ifndef BODYSPOOL_H
+#define BODYSPOOL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+
+// Request body on its way to the upstream. The proxy reads it from the client (httplib's
+// content reader) while another thread sends the upstream request from it, so the body
+// goes through as it arrives and is never held whole. What the upstream hasn't taken yet
+// stays in memory up to spillBytes and goes to a temporary file beyond that, so a slow
+// upstream costs disk rather than memory. Bodies above maxBytes are refused.
+class BodySpool {
+public:
+  BodySpool(size_t maxBytes, size_t spillBytes) : maxBytes_(maxBytes), spillBytes_(spillBytes) {}
+  BodySpool(const BodySpool &) = delete;
+  BodySpool &operator=(const BodySpool &) = delete;
+  ~BodySpool();
+
+  // Client side. False when the body grew over maxBytes, the spill file failed or the
+  // upstream side gave up: reading the client should stop.
+  bool append(const char *data, size_t len);
+  // No more data; complete == false if the client's body didn't arrive whole
+  void finish(bool complete);
+
+  // Upstream side: up to n bytes, in order, waiting for them. 0 at the end of a complete
+  // body, -1 when it ended incomplete or was refused.
+  long long read(char *buf, size_t n);
+  // The upstream request ended before taking everything
+  void cancel();
+
+  bool tooLarge() const;
+  // {received, spilled} in bytes
+  std::pair<uint64_t, uint64_t> totals() const;
+
+private:
+  const size_t maxBytes_;
+  const size_t spillBytes_;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::string> memory_; // not yet read, oldest first
+  size_t memoryFront_ = 0;         // read from memory_.front()
+  size_t buffered_ = 0;            // bytes in memory_ not yet read
+  std::FILE *file_ = nullptr;      // data after memory_, once spilled
+  uint64_t fileWritten_ = 0;
+  uint64_t fileRead_ = 0;
+  uint64_t received_ = 0;
+  uint64_t spilled_ = 0;
+  bool finished_ = false;
+  bool complete_ = false;
+  bool cancelled_ = false;
+  bool tooLarge_ = false;
+  bool failed_ = false;
+};
+
+#endif // BODYSPOOL_H
@@ -0,0 +1,570 @@
+#include "chatsearch.h"
+#include "convstore.h"
+#include "appconfig.h"
+#include "mappedfile.h"
+#include <utils_log/logger.hpp>
+#include <filesystem>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <cctype>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+  constexpr char fileMagic[8] = { 'P', 'X', 'C', 'S', 'I', 'D', 'X', '1' };
+
+  // All offsets are from the start of the file and multiples of 8
+  struct FileHeader {
+    char magic[8];
+    uint64_t generation;
+    uint64_t totalLength;
+    uint32_t convs;
+    uint32_t docs;
+    uint32_t terms;
+    uint32_t reserved;
+    uint64_t convsOffset;    // ConvEntry[convs]
+    uint64_t docsOffset;     // Doc[docs]
+    uint64_t termsOffset;    // TermEntry[terms], sorted by term
+    uint64_t stringsOffset;  // conversation ids and terms
+    uint64_t postingsOffset;
+    uint64_t fileSize;
+  };
+
+  struct ConvEntry {
+    uint32_t offset;
+    uint32_t length;
+  };
+
+  enum DocFlags : uint32_t {
+    Searchable = 1,
+    Assistant = 2,
+    Removed = 4
+  };
+
+  constexpr double k1 = 1.2;
+  constexpr double b = 0.75;
+
+  void putVarint(std::string &out, uint32_t v) {
+    while (0x80 <= v) {
+      out.push_back(static_cast<char>(v | 0x80));
+      v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+  }
+
+  // f(doc, tf) for each posting; stops at a malformed one
+  template <typename F>
+  void forEachPosting(std::string_view bytes, F f) {
+    auto p = reinterpret_cast<const uint8_t *>(bytes.data());
+    const auto end = p + bytes.size();
+    auto next = [&](uint32_t &v) {
+      v = 0;
+      for (int shift = 0; p < end && shift < 35; shift += 7) {
+        const uint8_t c = *p++;
+        v |= static_cast<uint32_t>(c & 0x7f) << shift;
+        if (!(c & 0x80)) return true;
+      }
+      return false;
+      };
+    uint32_t doc = 0, delta, tf;
+    while (p < end && next(delta) && next(tf)) {
+      doc += delta;
+      f(doc, tf);
+    }
+  }
+
+  void pad8(std::string &out) {
+    out.append((8 - out.size() % 8) % 8, '\0');
+  }
+
+  template <typename T>
+  void putPod(std::string &out, const T &v) {
+    out.append(reinterpret_cast<const char *>(&v), sizeof(v));
+  }
+
+  inline bool isWordByte(unsigned char c) {
+    return std::isalnum(c) || c == '_' || 0x80 <= c;
+  }
+
+  inline bool isUpper(unsigned char c) { return 'A' <= c && c <= 'Z'; }
+  inline bool isLower(unsigned char c) { return 'a' <= c && c <= 'z'; }
+  inline bool isDigit(unsigned char c) { return '0' <= c && c <= '9'; }
+
+  std::string lowered(std::string_view s) {
+    std::string res(s);
+    for (auto &c : res) {
+      if (isUpper(c)) c = static_cast<char>(c - 'A' + 'a');
+    }
+    return res;
+  }
+
+  // Around the first match of any of the terms, on utf-8 boundaries, one line
+  std::string snippetOf(const std::string &text, const std::vector<std::string> &terms, size_t width = 200) {
+    const auto lower = lowered(text);
+    size_t pos = std::string::npos;
+    for (const auto &t : terms) {
+      pos = (std::min)(pos, lower.find(t));
+    }
+    size_t start = pos == std::string::npos || pos < 60 ? 0 : pos - 60;
+    while (start < text.size() && (static_cast<unsigned char>(text[start]) & 0xc0) == 0x80) ++start;
+    size_t end = (std::min)(text.size(), start + width);
+    while (start < end && end < text.size() && (static_cast<unsigned char>(text[end]) & 0xc0) == 0x80) --end;
+    std::string res = start ? "..." : "";
+    for (size_t i = start; i < end; ++i) {
+      const char c = text[i];
+      res.push_back(c == '\n' || c == '\r' || c == '\t' ? ' ' : c);
+    }
+    if (end < text.size()) res += "...";
+    return res;
+  }
+
+} // anonymous namespace
+
+struct ChatSearchIndex::TermEntry {
+  uint32_t offset; // in strings
+  uint32_t length;
+  uint32_t df;
+  uint32_t reserved;
+  uint64_t postingsOffset; // in postings
+  uint64_t postingsLength;
+};
+
+ChatSearchIndex::ChatSearchIndex(std::string path)
+  : path_(std::move(path))
+{
+}
+
+ChatSearchIndex::~ChatSearchIndex()
+{
+  unmap();
+}
+
+std::vector<std::string> ChatSearchIndex::terms(std::string_view text)
+{
+  std::vector<std::string> res;
+  auto add = [&res](std::string_view w) {
+    if (2 <= w.size() && w.size() <= 48) {
+      res.push_back(lowered(w));
+    }
+    };
+  size_t i = 0;
+  while (i < text.size()) {
+    while (i < text.size() && !isWordByte(text[i])) ++i;
+    size_t j = i;
+    while (j < text.size() && isWordByte(text[j])) ++j;
+    if (i == j) break;
+    const auto word = text.substr(i, j - i);
+    add(word);
+    // snake_case, camelCase, HTTPServer
+    std::vector<std::string_view> parts;
+    size_t start = 0;
+    for (size_t k = 0; k <= word.size(); ++k) {
+      const bool end = k == word.size();
+      bool split = end || word[k] == '_';
+      if (!split && 0 < k) {
+        const unsigned char c = word[k], prev = word[k - 1];
+        split = isUpper(c) && (isLower(prev) || isDigit(prev) ||
+          (isUpper(prev) && k + 1 < word.size() && isLower(word[k + 1])));
+      }
+      if (split) {
+        if (start < k) parts.push_back(word.substr(start, k - start));
+        start = !end && word[k] == '_' ? k + 1 : k;
+      }
+    }
+    if (1 < parts.size()) {
+      for (const auto &p : parts) add(p);
+    }
+    i = j;
+  }
+  return res;
+}
+
+void ChatSearchIndex::reset()
+{
+  unmap();
+  convNames_.clear();
+  convIds_.clear();
+  convDocs_.clear();
+  docs_.clear();
+  totalLength_ = 0;
+  searchable_ = 0;
+  delta_.clear();
+  dirty_ = false;
+}
+
+void ChatSearchIndex::unmap()
+{
+  if (mapping_) {
+    unmapFile(mapping_, mappingSize_);
+    mapping_ = nullptr;
+    mappingSize_ = 0;
+  }
+  baseTerms_ = nullptr;
+  baseTermCount_ = 0;
+  baseStrings_ = nullptr;
+  basePostings_ = nullptr;
+}
+
+bool ChatSearchIndex::load(uint64_t generation)
+{
+  std::error_code ec;
+  const auto size = static_cast<size_t>(fs::file_size(path_, ec));
+  if (ec || size < sizeof(FileHeader)) {
+    return false;
+  }
+  mapping_ = mapFile(path_, size);
+  if (!mapping_) {
+    return false;
+  }
+  mappingSize_ = size;
+  const auto base = static_cast<const char *>(mapping_);
+  FileHeader h;
+  std::memcpy(&h, base, sizeof(h));
+  auto fits = [size](uint64_t offset, uint64_t length) {
+    return offset % 8 == 0 && offset <= size && length <= size - offset;
+    };
+  if (std::memcmp(h.magic, fileMagic, sizeof(fileMagic)) != 0 || h.fileSize != size || h.generation != generation ||
+      !fits(h.convsOffset, uint64_t(h.convs) * sizeof(ConvEntry)) || !fits(h.docsOffset, uint64_t(h.docs) * sizeof(Doc)) ||
+      !fits(h.termsOffset, uint64_t(h.terms) * sizeof(TermEntry)) ||
+      !fits(h.stringsOffset, 0) || !fits(h.postingsOffset, 0) || h.postingsOffset < h.stringsOffset) {
+    unmap();
+    return false;
+  }
+  const uint64_t stringsSize = h.postingsOffset - h.stringsOffset;
+  const uint64_t postingsSize = size - h.postingsOffset;
+  baseStrings_ = base + h.stringsOffset;
+  basePostings_ = reinterpret_cast<const uint8_t *>(base + h.postingsOffset);
+  baseTerms_ = reinterpret_cast<const TermEntry *>(base + h.termsOffset);
+  baseTermCount_ = h.terms;
+  bool valid = true;
+  for (uint32_t i = 0; i < h.terms && valid; ++i) {
+    const auto &t = baseTerms_[i];
+    valid = uint64_t(t.offset) + t.length <= stringsSize && t.postingsOffset + t.postingsLength <= postingsSize;
+  }
+  const auto convs = reinterpret_cast<const ConvEntry *>(base + h.convsOffset);
+  for (uint32_t i = 0; i < h.convs && valid; ++i) {
+    valid = uint64_t(convs[i].offset) + convs[i].length <= stringsSize;
+    if (valid) {
+      convNames_.emplace_back(baseStrings_ + convs[i].offset, convs[i].length);
+      convIds_[convNames_.back()] = i;
+    }
+  }
+  convDocs_.resize(convNames_.size());
+  docs_.resize(h.docs);
+  if (h.docs) {
+    std::memcpy(docs_.data(), base + h.docsOffset, h.docs * sizeof(Doc));
+  }
+  for (uint32_t i = 0; i < h.docs && valid; ++i) {
+    const auto &d = docs_[i];
+    valid = d.conv < convDocs_.size() && d.message == convDocs_[d.conv].size();
+    if (valid) {
+      convDocs_[d.conv].push_back(i);
+      if (d.flags & Searchable) {
+        ++searchable_;
+      }
+    }
+  }
+  totalLength_ = h.totalLength;
+  if (!valid) {
+    reset();
+  }
+  return valid;
+}
+
+void ChatSearchIndex::open(const ConversationStore &store)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto t0 = std::chrono::steady_clock::now();
+  // Read first: a store that changes while the index is built makes the saved file stale, never wrong
+  const auto generation = store.generation();
+  reset();
+  if (load(generation)) {
+    LOG_MSG << "Chat search index opened," << searchable_ << "message(s) in"
+      << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count() << "ms";
+    return;
+  }
+  for (const auto &c : store.list()) {
+    updateLocked(store, c["id"].get<std::string>());
+  }
+  LOG_MSG << "Chat search index rebuilt," << searchable_ << "message(s) in"
+    << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count() << "ms";
+  saveLocked(generation);
+}
+
+void ChatSearchIndex::update(const ConversationStore &store, const std::string &id)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  updateLocked(store, id);
+}
+
+void ChatSearchIndex::updateLocked(const ConversationStore &store, const std::string &id)
+{
+  auto it = convIds_.find(id);
+  if (it == convIds_.end()) {
+    it = convIds_.emplace(id, static_cast<uint32_t>(convNames_.size())).first;
+    convNames_.push_back(id);
+    convDocs_.emplace_back();
+  }
+  const uint32_t conv = it->second;
+  const size_t have = convDocs_[conv].size();
+  const size_t count = store.count(id);
+  if (count < have) {
+    truncateLocked(id, count);
+  } else if (have < count) {
+    for (const auto &m : store.messages(id, have)) {
+      addDoc(conv, m);
+    }
+  }
+}
+
+void ChatSearchIndex::truncate(const std::string &id, size_t keep)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  truncateLocked(id, keep);
+}
+
+void ChatSearchIndex::truncateLocked(const std::string &id, size_t keep)
+{
+  auto it = convIds_.find(id);
+  if (it == convIds_.end()) {
+    return;
+  }
+  auto &docs = convDocs_[it->second];
+  for (size_t i = keep; i < docs.size(); ++i) {
+    auto &d = docs_[docs[i]];
+    if (d.flags & Searchable) {
+      --searchable_;
+      totalLength_ -= d.length;
+    }
+    d.flags = (d.flags & ~Searchable) | Removed;
+    dirty_ = true;
+  }
+  if (keep < docs.size()) {
+    docs.resize(keep);
+  }
+}
+
+void ChatSearchIndex::addDoc(uint32_t conv, const nlohmann::json &message)
+{
+  const auto id = static_cast<uint32_t>(docs_.size());
+  Doc doc{ conv, static_cast<uint32_t>(convDocs_[conv].size()), 0, 0 };
+  const std::string role = message.is_object() ? message.value("role", "") : "";
+  if ((role == "user" || role == "assistant") && message.contains("content") && message["content"].is_string()) {
+    const auto words = terms(message["content"].get<std::string>());
+    if (!words.empty()) {
+      std::unordered_map<std::string_view, uint32_t> tf;
+      for (const auto &w : words) ++tf[w];
+      for (const auto &[term, n] : tf) {
+        auto &p = delta_[std::string(term)];
+        putVarint(p.bytes, id - p.last);
+        putVarint(p.bytes, n);
+        p.last = id;
+        ++p.df;
+      }
+      doc.length = static_cast<uint32_t>(words.size());
+      doc.flags = Searchable | (role == "assistant" ? static_cast<uint32_t>(Assistant) : uint32_t(0));
+      totalLength_ += doc.length;
+      ++searchable_;
+    }
+  }
+  docs_.push_back(doc);
+  convDocs_[conv].push_back(id);
+  dirty_ = true;
+}
+
+std::string_view ChatSearchIndex::basePostings(const std::string &term, uint32_t &df) const
+{
+  df = 0;
+  const auto end = baseTerms_ + baseTermCount_;
+  const auto it = std::lower_bound(baseTerms_, end, term, [this](const TermEntry &e, const std::string &t) {
+    return std::string_view(baseStrings_ + e.offset, e.length) < t;
+    });
+  if (it == end || std::string_view(baseStrings_ + it->offset, it->length) != term) {
+    return {};
+  }
+  df = it->df;
+  return { reinterpret_cast<const char *>(basePostings_) + it->postingsOffset, static_cast<size_t>(it->postingsLength) };
+}
+
+bool ChatSearchIndex::save(uint64_t generation)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return saveLocked(generation);
+}
+
+bool ChatSearchIndex::saveLocked(uint64_t generation)
+{
+  if (!dirty_ && mapping_) {
+    return true;
+  }
+  // Removed docs are dropped. Ids stay in the same order, so the saved postings
+  // followed by the newer ones are still sorted and can be merged as streams.
+  std::vector<uint32_t> newId(docs_.size(), UINT32_MAX);
+  std::vector<uint32_t> newConv(convNames_.size(), UINT32_MAX);
+  std::vector<ConvEntry> convs;
+  std::vector<Doc> docs;
+  std::string strings;
+  for (uint32_t i = 0; i < docs_.size(); ++i) {
+    auto d = docs_[i];
+    if (d.flags & Removed) continue;
+    if (newConv[d.conv] == UINT32_MAX) {
+      newConv[d.conv] = static_cast<uint32_t>(convs.size());
+      convs.push_back({ static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(convNames_[d.conv].size()) });
+      strings += convNames_[d.conv];
+    }
+    d.conv = newConv[d.conv];
+    newId[i] = static_cast<uint32_t>(docs.size());
+    docs.push_back(d);
+  }
+
+  std::vector<const std::string *> deltaTerms;
+  deltaTerms.reserve(delta_.size());
+  for (const auto &t : delta_) deltaTerms.push_back(&t.first);
+  std::sort(deltaTerms.begin(), deltaTerms.end(), [](const std::string *a, const std::string *b) { return *a < *b; });
+
+  std::vector<TermEntry> terms;
+  std::string postings;
+  auto emit = [&](std::string_view term, std::string_view saved, const Postings *added) {
+    const size_t start = postings.size();
+    uint32_t last = 0, df = 0;
+    auto put = [&](uint32_t doc, uint32_t tf) {
+      const uint32_t id = doc < newId.size() ? newId[doc] : UINT32_MAX;
+      if (id == UINT32_MAX) return;
+      putVarint(postings, id - last);
+      putVarint(postings, tf);
+      last = id;
+      ++df;
+      };
+    forEachPosting(saved, put);
+    if (added) forEachPosting(added->bytes, put);
+    if (df) {
+      terms.push_back({ static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(term.size()), df, 0, start, postings.size() - start });
+      strings.append(term);
+    }
+    };
+  auto termOf = [this](size_t i) { return std::string_view(baseStrings_ + baseTerms_[i].offset, baseTerms_[i].length); };
+  auto savedOf = [this](size_t i) {
+    return std::string_view(reinterpret_cast<const char *>(basePostings_) + baseTerms_[i].postingsOffset,
+      static_cast<size_t>(baseTerms_[i].postingsLength));
+    };
+  size_t bi = 0, di = 0;
+  while (bi < baseTermCount_ || di < deltaTerms.size()) {
+    if (di == deltaTerms.size() || (bi < baseTermCount_ && termOf(bi) < *deltaTerms[di])) {
+      emit(termOf(bi), savedOf(bi), nullptr);
+      ++bi;
+    } else if (bi == baseTermCount_ || *deltaTerms[di] < termOf(bi)) {
+      emit(*deltaTerms[di], {}, &delta_.at(*deltaTerms[di]));
+      ++di;
+    } else {
+      emit(termOf(bi), savedOf(bi), &delta_.at(*deltaTerms[di]));
+      ++bi;
+      ++di;
+    }
+  }
+
+  FileHeader h{};
+  std::memcpy(h.magic, fileMagic, sizeof(fileMagic));
+  h.generation = generation;
+  h.totalLength = totalLength_;
+  h.convs = static_cast<uint32_t>(convs.size());
+  h.docs = static_cast<uint32_t>(docs.size());
+  h.terms = static_cast<uint32_t>(terms.size());
+  std::string content;
+  content.reserve(sizeof(h) + convs.size() * sizeof(ConvEntry) + docs.size() * sizeof(Doc) +
+    terms.size() * sizeof(TermEntry) + strings.size() + postings.size() + 32);
+  content.resize(sizeof(h));
+  h.convsOffset = content.size();
+  for (const auto &c : convs) putPod(content, c);
+  pad8(content);
+  h.docsOffset = content.size();
+  content.append(reinterpret_cast<const char *>(docs.data()), docs.size() * sizeof(Doc));
+  h.termsOffset = content.size();
+  content.append(reinterpret_cast<const char *>(terms.data()), terms.size() * sizeof(TermEntry));
+  h.stringsOffset = content.size();
+  content += strings;
+  pad8(content);
+  h.postingsOffset = content.size();
+  content += postings;
+  h.fileSize = content.size();
+  std::memcpy(content.data(), &h, sizeof(h));
+
+  // The new file replaces the one that is mapped (which Windows won't do while it is)
+  unmap();
+  const bool written = writeFileAtomically(path_, content);
+  reset();
+  if (!written || !load(generation)) {
+    LOG_MSG << "Failed to save the chat search index to" << path_;
+    return false;
+  }
+  return true;
+}
+
+std::vector<ChatSearchIndex::Hit> ChatSearchIndex::search(const std::string &query, size_t limit) const
+{
+  auto words = terms(query);
+  std::sort(words.begin(), words.end());
+  words.erase(std::unique(words.begin(), words.end()), words.end());
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<Hit> res;
+  if (searchable_ == 0 || words.empty() || limit == 0) {
+    return res;
+  }
+  const double avgLength = static_cast<double>(totalLength_) / searchable_;
+  std::vector<float> scores(docs_.size(), 0.0f);
+  std::vector<uint32_t> matched;
+  for (const auto &w : words) {
+    uint32_t df = 0;
+    const auto saved = basePostings(w, df);
+    const auto it = delta_.find(w);
+    if (it != delta_.end()) df += it->second.df;
+    if (df == 0) continue;
+    // df still counts removed docs until the next save
+    const double n = static_cast<double>((std::max)(searchable_, size_t(df)));
+    const double idf = std::log(1.0 + (n - df + 0.5) / (df + 0.5));
+    auto score = [&](uint32_t doc, uint32_t tf) {
+      if (docs_.size() <= doc) return;
+      const auto &d = docs_[doc];
+      if (d.flags & Removed) return;
+      if (scores[doc] == 0.0f) matched.push_back(doc);
+      scores[doc] += static_cast<float>(idf * tf * (k1 + 1) / (tf + k1 * (1 - b + b * d.length / avgLength)));
+      };
+    forEachPosting(saved, score);
+    if (it != delta_.end()) forEachPosting(it->second.bytes, score);
+  }
+  const size_t n = (std::min)(limit, matched.size());
+  std::partial_sort(matched.begin(), matched.begin() + n, matched.end(), [&scores](uint32_t a, uint32_t b) {
+    return scores[a] != scores[b] ? scores[b] < scores[a] : b < a; // newer first on ties
+    });
+  for (size_t i = 0; i < n; ++i) {
+    const auto &d = docs_[matched[i]];
+    res.push_back({ convNames_[d.conv], d.message, d.flags & Assistant ? "assistant" : "user", scores[matched[i]] });
+  }
+  return res;
+}
+
+nlohmann::json ChatSearchIndex::query(const ConversationStore &store, const std::string &query, size_t limit) const
+{
+  const auto t0 = std::chrono::steady_clock::now();
+  const auto hits = search(query, limit);
+  const auto words = terms(query);
+  nlohmann::json res = nlohmann::json::array();
+  for (const auto &hit : hits) {
+    const auto m = store.messages(hit.conversationId, hit.message, 1);
+    const auto text = !m.empty() && m[0].contains("content") && m[0]["content"].is_string() ? m[0]["content"].get<std::string>() : "";
+    res.push_back({
+      {"conversationId", hit.conversationId},
+      {"message", hit.message},
+      {"role", hit.role},
+      {"score", hit.score},
+      {"snippet", snippetOf(text, words)}
+      });
+  }
+  return {
+    {"hits", res},
+    {"micros", std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count()}
+  };
+}
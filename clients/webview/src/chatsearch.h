@@ -0,0 +1,96 @@
+#ifndef CHAT_SEARCH_H
+#define CHAT_SEARCH_H
+
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+
+class ConversationStore;
+
+// Full-text index over the user and assistant messages of the stored conversations,
+// ranked with BM25. Postings are (doc delta, term frequency) pairs, varint encoded.
+//
+// The index is saved to one file that is memory-mapped when it is opened: the term
+// dictionary and the postings are searched in place, only the document table is read
+// in. Messages indexed since then go to an in-memory segment with the same encoding,
+// and both are merged by save(). A file saved at another generation of the store is
+// ignored and the index is rebuilt.
+class ChatSearchIndex {
+public:
+  struct Hit {
+    std::string conversationId;
+    size_t message = 0;
+    std::string role;
+    double score = 0;
+  };
+
+  explicit ChatSearchIndex(std::string path);
+  ~ChatSearchIndex();
+
+  ChatSearchIndex(const ChatSearchIndex &) = delete;
+  ChatSearchIndex &operator=(const ChatSearchIndex &) = delete;
+
+  void open(const ConversationStore &store);
+  // Indexes the messages of the conversation the index doesn't have yet.
+  void update(const ConversationStore &store, const std::string &id);
+  // Forgets the messages from `keep` on.
+  void truncate(const std::string &id, size_t keep);
+  void remove(const std::string &id) { truncate(id, 0); }
+  bool save(uint64_t generation);
+
+  std::vector<Hit> search(const std::string &query, size_t limit = 20) const;
+  // {hits: [{conversationId, message, role, score, snippet}], micros}
+  nlohmann::json query(const ConversationStore &store, const std::string &query, size_t limit = 20) const;
+
+  // Lowercased words; identifiers also by their parts (getFileName: getfilename, get,
+  // file, name). Queries are split the same way.
+  static std::vector<std::string> terms(std::string_view text);
+
+private:
+  struct Doc {
+    uint32_t conv;
+    uint32_t message;
+    uint32_t length; // terms
+    uint32_t flags;
+  };
+  struct Postings {
+    std::string bytes;
+    uint32_t last = 0;
+    uint32_t df = 0;
+  };
+  struct TermEntry;
+
+  void reset();
+  bool load(uint64_t generation);
+  void unmap();
+  bool saveLocked(uint64_t generation);
+  void updateLocked(const ConversationStore &store, const std::string &id);
+  void truncateLocked(const std::string &id, size_t keep);
+  void addDoc(uint32_t conv, const nlohmann::json &message);
+  std::string_view basePostings(const std::string &term, uint32_t &df) const;
+
+  const std::string path_;
+  mutable std::mutex mutex_;
+  std::vector<std::string> convNames_;
+  std::unordered_map<std::string, uint32_t> convIds_;
+  std::vector<std::vector<uint32_t>> convDocs_; // doc per message
+  std::vector<Doc> docs_;
+  uint64_t totalLength_ = 0; // of searchable docs
+  size_t searchable_ = 0;
+  // Saved segment, docs [0, docs_.size() at load)
+  void *mapping_ = nullptr;
+  size_t mappingSize_ = 0;
+  const TermEntry *baseTerms_ = nullptr;
+  uint32_t baseTermCount_ = 0;
+  const char *baseStrings_ = nullptr;
+  const uint8_t *basePostings_ = nullptr;
+  // Indexed since
+  std::unordered_map<std::string, Postings> delta_;
+  bool dirty_ = false;
+};
+
+#endif // CHAT_SEARCH_H
@@ -0,0 +1,230 @@
+#include "convstore.h"
+#include "appconfig.h"
+#include "mappedfile.h"
+#include <utils_log/logger.hpp>
+#include <filesystem>
+#include <algorithm>
+#include <cctype>
+
+namespace fs = std::filesystem;
+
+ConversationStore::ConversationStore(std::string path)
+  : path_(std::move(path))
+{
+  load();
+  log_ = std::fopen(path_.c_str(), "ab");
+  if (!log_) {
+    LOG_MSG << "Cannot open" << path_ << "for writing, conversations won't survive a restart";
+  }
+}
+
+ConversationStore::~ConversationStore()
+{
+  if (log_) {
+    std::fclose(log_);
+  }
+  unmap();
+}
+
+bool ConversationStore::isValidId(const std::string &id)
+{
+  return !id.empty() && id.size() <= 64 && std::all_of(id.begin(), id.end(), [](char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '-';
+    });
+}
+
+void ConversationStore::load()
+{
+  std::error_code ec;
+  const auto size = static_cast<size_t>(fs::file_size(path_, ec));
+  if (ec || size == 0) {
+    return;
+  }
+  mapping_ = mapFile(path_, size);
+  if (!mapping_) {
+    LOG_MSG << "Cannot map" << path_ << "- starting without stored conversations";
+    return;
+  }
+  mappingSize_ = size;
+  generation_ = size;
+  const std::string_view log(static_cast<const char *>(mapping_), size);
+  index(log);
+  size_t live = 0;
+  for (const auto &c : conversations_) live += c.second.size();
+  LOG_MSG << "Loaded" << conversations_.size() << "conversation(s)," << live << "message(s) from" << path_;
+  const bool torn = log.back() != '\n';
+  if (torn) {
+    LOG_MSG << "Dropping the incomplete last record of" << path_;
+  }
+  if (torn || (1000 < records_ - live && live < records_ - live)) {
+    compact();
+  }
+}
+
+void ConversationStore::index(std::string_view log)
+{
+  size_t pos = 0;
+  while (pos < log.size()) {
+    const size_t nl = log.find('\n', pos);
+    if (nl == std::string_view::npos) {
+      break; // torn
+    }
+    const auto line = log.substr(pos, nl - pos);
+    pos = nl + 1;
+    ++records_;
+    const size_t t1 = line.find('\t');
+    if (t1 == std::string_view::npos || line.size() < t1 + 3 || line[t1 + 2] != '\t') {
+      continue;
+    }
+    const std::string id(line.substr(0, t1));
+    const auto payload = line.substr(t1 + 3);
+    switch (line[t1 + 1]) {
+    case 'M':
+      conversations_[id].push_back({ payload, {} });
+      break;
+    case 'T': {
+      auto it = conversations_.find(id);
+      const size_t keep = std::strtoull(std::string(payload).c_str(), nullptr, 10);
+      if (it != conversations_.end() && keep < it->second.size()) {
+        it->second.resize(keep);
+      }
+      break;
+    }
+    case 'D':
+      conversations_.erase(id);
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+// Rewrites the log with live messages only. Called from load(), before anything is appended.
+void ConversationStore::compact()
+{
+  std::string content;
+  for (const auto &c : conversations_) {
+    for (const auto &m : c.second) {
+      content.append(c.first).append("\tM\t").append(m.json()).append("\n");
+    }
+  }
+  conversations_.clear();
+  records_ = 0;
+  unmap();
+  if (!writeFileAtomically(path_, content)) {
+    LOG_MSG << "Failed to compact" << path_;
+  }
+  generation_ = content.size();
+  compacted_ = std::move(content);
+  index(compacted_);
+}
+
+void ConversationStore::unmap()
+{
+  if (mapping_) {
+    unmapFile(mapping_, mappingSize_);
+    mapping_ = nullptr;
+    mappingSize_ = 0;
+  }
+}
+
+void ConversationStore::writeRecord(const std::string &id, char op, const std::string &payload)
+{
+  ++records_;
+  std::string line = id;
+  line.append(1, '\t').append(1, op).append(1, '\t').append(payload).append(1, '\n');
+  generation_ += line.size();
+  if (!log_) {
+    return;
+  }
+  if (std::fwrite(line.data(), 1, line.size(), log_) != line.size() || std::fflush(log_) != 0) {
+    LOG_MSG << "Failed to append to" << path_;
+  }
+}
+
+size_t ConversationStore::count(const std::string &id) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = conversations_.find(id);
+  return it != conversations_.end() ? it->second.size() : 0;
+}
+
+nlohmann::json ConversationStore::messages(const std::string &id, size_t from, size_t count) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return messagesLocked(id, from, count);
+}
+
+nlohmann::json ConversationStore::messagesLocked(const std::string &id, size_t from, size_t count) const
+{
+  nlohmann::json res = nlohmann::json::array();
+  auto it = conversations_.find(id);
+  if (it == conversations_.end()) {
+    return res;
+  }
+  const auto &all = it->second;
+  for (size_t i = from; i < all.size() && i - from < count; ++i) {
+    auto j = nlohmann::json::parse(all[i].json(), nullptr, false);
+    if (!j.is_discarded()) {
+      res.push_back(std::move(j));
+    }
+  }
+  return res;
+}
+
+nlohmann::json ConversationStore::list() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  nlohmann::json res = nlohmann::json::array();
+  for (const auto &c : conversations_) {
+    res.push_back({ {"id", c.first}, {"messages", c.second.size()} });
+  }
+  return res;
+}
+
+bool ConversationStore::splice(const std::string &id, size_t keep, const nlohmann::json &added, nlohmann::json &all)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = conversations_.find(id);
+  const size_t have = it != conversations_.end() ? it->second.size() : 0;
+  if (have < keep) {
+    return false;
+  }
+  if (keep < have) {
+    writeRecord(id, 'T', std::to_string(keep));
+    it->second.resize(keep);
+  }
+  for (const auto &m : added) {
+    appendLocked(id, m);
+  }
+  all = messagesLocked(id);
+  return true;
+}
+
+void ConversationStore::append(const std::string &id, const nlohmann::json &message)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  appendLocked(id, message);
+}
+
+void ConversationStore::appendLocked(const std::string &id, const nlohmann::json &message)
+{
+  // dump() escapes newlines, so a message is always one line
+  std::string payload = message.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+  writeRecord(id, 'M', payload);
+  conversations_[id].push_back({ {}, std::move(payload) });
+}
+
+uint64_t ConversationStore::generation() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return generation_;
+}
+
+void ConversationStore::remove(const std::string &id)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (conversations_.erase(id)) {
+    writeRecord(id, 'D', "");
+  }
+}
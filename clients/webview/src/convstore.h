@@ -0,0 +1,76 @@
+#ifndef CONVERSATION_STORE_H
+#define CONVERSATION_STORE_H
+
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <cstdio>
+#include <cstdint>
+
+// Chat histories kept by the host, so the page only sends what is new in a turn.
+//
+// Stored as an append-only log of one record per line, "<id>\t<op>\t<payload>":
+//   M  a message (JSON object, one line)
+//   T  truncate to <payload> messages (the page dropped or retried answers)
+//   D  conversation deleted
+// At startup the log is memory-mapped and only scanned for line boundaries; messages are
+// parsed when a conversation is first asked for. A torn last line (crash while writing)
+// is cut off, and the log is compacted when most of it is dead records.
+class ConversationStore {
+public:
+  explicit ConversationStore(std::string path);
+  ~ConversationStore();
+
+  ConversationStore(const ConversationStore &) = delete;
+  ConversationStore &operator=(const ConversationStore &) = delete;
+
+  // [A-Za-z0-9_-]{1,64}
+  static bool isValidId(const std::string &id);
+
+  size_t count(const std::string &id) const;
+  // Messages [from, from + count)
+  nlohmann::json messages(const std::string &id, size_t from = 0, size_t count = SIZE_MAX) const;
+  // [{id, messages: count}]
+  nlohmann::json list() const;
+
+  // Keeps the first `keep` messages, appends `added` and returns the whole conversation.
+  // False (nothing changed) if the conversation has fewer than `keep` messages.
+  bool splice(const std::string &id, size_t keep, const nlohmann::json &added, nlohmann::json &all);
+  void append(const std::string &id, const nlohmann::json &message);
+  void remove(const std::string &id);
+  // Changes with every record written; an index built from the store can tell it is stale.
+  uint64_t generation() const;
+
+private:
+  void load();
+  void index(std::string_view log);
+  void compact();
+  void unmap();
+  void writeRecord(const std::string &id, char op, const std::string &payload);
+  void appendLocked(const std::string &id, const nlohmann::json &message);
+  nlohmann::json messagesLocked(const std::string &id, size_t from = 0, size_t count = SIZE_MAX) const;
+
+  // A message's JSON: a view into the log as loaded, or a copy of its own if it was
+  // written since, so that truncating or deleting a conversation frees it
+  struct Message {
+    std::string_view loaded;
+    std::string owned;
+    std::string_view json() const { return owned.empty() ? loaded : std::string_view(owned); }
+  };
+
+  const std::string path_;
+  mutable std::mutex mutex_;
+  // The log as loaded: mapped, or rewritten by compact()
+  void *mapping_ = nullptr;
+  size_t mappingSize_ = 0;
+  std::string compacted_;
+  std::unordered_map<std::string, std::vector<Message>> conversations_; // by conversation id
+  size_t records_ = 0;
+  uint64_t generation_ = 0; // bytes in the log
+  FILE *log_ = nullptr;
+};
+
+#endif // CONVERSATION_STORE_H
@@ -0,0 +1,192 @@
+#include "deadline.h"
+#include <algorithm>
+
+namespace {
+
+  using std::chrono::milliseconds;
+
+  constexpr size_t minSamples = 20;
+  // Used until a route has enough samples
+  constexpr TimeoutPolicy fallback = { milliseconds(3000), milliseconds(60000), milliseconds(60000), milliseconds(300000) };
+
+  double msSince(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t).count();
+  }
+
+  milliseconds learned(double p99, double floorMs) {
+    return milliseconds(static_cast<int64_t>((std::min)((std::max)(4 * p99 + 500, floorMs), 600000.0)));
+  }
+
+} // anonymous namespace
+
+std::chrono::milliseconds Deadline::remaining() const
+{
+  return (std::max)(std::chrono::duration_cast<milliseconds>(at_ - Clock::now()), milliseconds(0));
+}
+
+std::string AdaptiveTimeouts::routeOf(const std::string &path)
+{
+  const auto end = path.find_first_of("?#");
+  const auto first = path.find('/', 1);
+  if (first == std::string::npos || end <= first) {
+    return path.substr(0, end);
+  }
+  const auto second = path.find('/', first + 1);
+  return path.substr(0, (std::min)(second, end));
+}
+
+TimeoutPolicy AdaptiveTimeouts::policy(const std::string &route, const std::unordered_map<std::string, RouteTimeoutConfig> &config) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return policyLocked(route, config);
+}
+
+std::chrono::milliseconds AdaptiveTimeouts::doomedBelow(const std::string &route) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = routes_.find(route);
+  if (it == routes_.end() || it->second.count < minSamples) {
+    return milliseconds(0);
+  }
+  // Even the fastest tenth of the requests took this long to start answering
+  return milliseconds(static_cast<int64_t>(percentileLocked(it->second, 0, 0.1)));
+}
+
+std::chrono::milliseconds AdaptiveTimeouts::totalPercentile(const std::string &route, double p) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = routes_.find(route);
+  if (it == routes_.end() || it->second.count < minSamples) {
+    return milliseconds(0);
+  }
+  return milliseconds(static_cast<int64_t>(percentileLocked(it->second, 2, p)));
+}
+
+void AdaptiveTimeouts::observe(const std::string &route, double firstByteMs, double maxIdleMs, double totalMs)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto &s = routes_[route];
+  if (s.ring.size() < window) {
+    s.ring.push_back({ firstByteMs, maxIdleMs, totalMs });
+  } else {
+    s.ring[s.next] = { firstByteMs, maxIdleMs, totalMs };
+  }
+  s.next = (s.next + 1) % window;
+  ++s.count;
+}
+
+nlohmann::json AdaptiveTimeouts::stats(const std::unordered_map<std::string, RouteTimeoutConfig> &config) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  nlohmann::json res = nlohmann::json::object();
+  for (const auto &[route, s] : routes_) {
+    auto &r = res[route];
+    r["samples"] = s.count;
+    const char *names[3] = { "firstByteMs", "idleMs", "totalMs" };
+    for (size_t i = 0; i < 3; ++i) {
+      r[names[i]] = {
+        {"p50", percentileLocked(s, i, 0.5)},
+        {"p90", percentileLocked(s, i, 0.9)},
+        {"p99", percentileLocked(s, i, 0.99)}
+      };
+    }
+    const auto p = policyLocked(route, config);
+    r["policy"] = {
+      {"connectMs", p.connect.count()},
+      {"firstByteMs", p.firstByte.count()},
+      {"idleMs", p.idle.count()},
+      {"totalMs", p.total.count()}
+    };
+  }
+  return res;
+}
+
+double AdaptiveTimeouts::percentileLocked(const Samples &s, size_t which, double p) const
+{
+  if (s.ring.empty()) return 0;
+  std::vector<double> values;
+  values.reserve(s.ring.size());
+  for (const auto &sample : s.ring) values.push_back(sample[which]);
+  auto nth = values.begin() + static_cast<ptrdiff_t>(p * (values.size() - 1));
+  std::nth_element(values.begin(), nth, values.end());
+  return *nth;
+}
+
+TimeoutPolicy AdaptiveTimeouts::policyLocked(const std::string &route, const std::unordered_map<std::string, RouteTimeoutConfig> &config) const
+{
+  auto configured = [&config, &route](int RouteTimeoutConfig::*field) {
+    auto it = config.find(route);
+    if (it != config.end() && 0 < it->second.*field) return it->second.*field;
+    it = config.find("default");
+    return it != config.end() ? it->second.*field : 0;
+    };
+  auto it = routes_.find(route);
+  const bool learning = it != routes_.end() && minSamples <= it->second.count;
+  auto pick = [&](int RouteTimeoutConfig::*field, milliseconds fallbackMs, size_t which, double floorMs) {
+    if (const int ms = configured(field)) return milliseconds(ms);
+    return learning ? learned(percentileLocked(it->second, which, 0.99), floorMs) : fallbackMs;
+    };
+  return {
+    configured(&RouteTimeoutConfig::connectMs) ? milliseconds(configured(&RouteTimeoutConfig::connectMs)) : fallback.connect,
+    pick(&RouteTimeoutConfig::firstByteMs, fallback.firstByte, 0, 2000),
+    pick(&RouteTimeoutConfig::idleMs, fallback.idle, 1, 2000),
+    pick(&RouteTimeoutConfig::totalMs, fallback.total, 2, 30000)
+  };
+}
+
+UpstreamReply timedGet(UpstreamPool &pool, AdaptiveTimeouts &timeouts, const std::string &host, int port,
+  const std::string &path, const TimeoutPolicy &policy, const Deadline &deadline)
+{
+  auto cli = pool.acquire(host, port);
+  return timedGet(cli, timeouts, path, policy, deadline);
+}
+
+UpstreamReply timedGet(UpstreamPool::Lease &cli, AdaptiveTimeouts &timeouts,
+  const std::string &path, const TimeoutPolicy &policy, const Deadline &deadline)
+{
+  UpstreamReply reply;
+  const auto remaining = deadline.remaining();
+  // Not enough time left to get an answer even on a good day: give up before going upstream
+  if (remaining <= milliseconds(0) || remaining <= timeouts.doomedBelow(AdaptiveTimeouts::routeOf(path))) {
+    reply.status = 504;
+    return reply;
+  }
+  // The socket timeouts are per read: first byte and idle gaps are checked on top
+  const auto readTimeout = (std::min)((std::max)(policy.firstByte, policy.idle), remaining);
+  cli->set_read_timeout(readTimeout);
+  cli->set_connection_timeout((std::min)(policy.connect, remaining));
+  cli->set_write_timeout(remaining);
+
+  const auto start = std::chrono::steady_clock::now();
+  auto last = start;
+  double firstByteMs = 0;
+  double maxIdleMs = 0;
+  bool late = false;
+  httplib::Headers headers = { {Deadline::header, std::to_string(remaining.count())} };
+  auto result = cli->Get(path, headers,
+    [&](const httplib::Response &) {
+      firstByteMs = msSince(start);
+      last = std::chrono::steady_clock::now();
+      late = policy.firstByte.count() < firstByteMs || deadline.expired();
+      return !late;
+    },
+    [&](const char *data, size_t len) {
+      maxIdleMs = (std::max)(maxIdleMs, msSince(last));
+      last = std::chrono::steady_clock::now();
+      late = policy.idle.count() < maxIdleMs || deadline.expired();
+      if (late) return false;
+      reply.body.append(data, len);
+      return true;
+    });
+  const double totalMs = msSince(start);
+  if (!result) {
+    cli.discard();
+    reply.body.clear();
+    reply.status = late || deadline.expired() || readTimeout.count() <= totalMs ? 504 : 503;
+    return reply;
+  }
+  timeouts.observe(AdaptiveTimeouts::routeOf(path), firstByteMs, maxIdleMs, totalMs);
+  reply.status = result->status;
+  reply.contentType = result->get_header_value("Content-Type");
+  return reply;
+}
@@ -0,0 +1,86 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include "appconfig.h"
+#include "upstreampool.h"
+#include <nlohmann/json.hpp>
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Time budget of a proxied request. It comes from the caller (X-Request-Deadline-Ms:
+// the milliseconds it is still willing to wait) and/or the route's total timeout,
+// whichever ends first, and is passed on to the embedder in the same header.
+class Deadline {
+public:
+  using Clock = std::chrono::steady_clock;
+  static constexpr const char *header = "X-Request-Deadline-Ms";
+
+  explicit Deadline(std::chrono::milliseconds budget) : at_(Clock::now() + budget) {}
+
+  Deadline earliest(const Deadline &other) const { return at_ < other.at_ ? *this : other; }
+  std::chrono::milliseconds remaining() const;
+  bool expired() const { return at_ <= Clock::now(); }
+
+private:
+  Clock::time_point at_;
+};
+
+struct TimeoutPolicy {
+  std::chrono::milliseconds connect;
+  std::chrono::milliseconds firstByte;
+  std::chrono::milliseconds idle;
+  std::chrono::milliseconds total;
+};
+
+// Timeouts per route, from config or learned from the latencies seen so far: once a
+// route has enough samples, each unset timeout is a multiple of its 99th percentile
+// (with a floor), so slow routes get room and a hung fast one is given up early.
+class AdaptiveTimeouts {
+public:
+  // "/api/chat/stream?x" -> "/api/chat"
+  static std::string routeOf(const std::string &path);
+
+  TimeoutPolicy policy(const std::string &route, const std::unordered_map<std::string, RouteTimeoutConfig> &config) const;
+  // Less than this much time left: the request would most likely not make it (0 if unknown)
+  std::chrono::milliseconds doomedBelow(const std::string &route) const;
+  // Percentile p of the route's total time (0 if unknown)
+  std::chrono::milliseconds totalPercentile(const std::string &route, double p) const;
+
+  void observe(const std::string &route, double firstByteMs, double maxIdleMs, double totalMs);
+
+  // {<route>: {samples, firstByteMs: {p50, p90, p99}, idleMs: {...}, totalMs: {...}, policy: {...}}}
+  nlohmann::json stats(const std::unordered_map<std::string, RouteTimeoutConfig> &config) const;
+
+private:
+  static constexpr size_t window = 256;
+  struct Samples {
+    std::vector<std::array<double, 3>> ring; // firstByte, maxIdle, total
+    size_t next = 0;
+    size_t count = 0;
+  };
+  double percentileLocked(const Samples &s, size_t which, double p) const;
+  TimeoutPolicy policyLocked(const std::string &route, const std::unordered_map<std::string, RouteTimeoutConfig> &config) const;
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, Samples> routes_;
+};
+
+// Answer of an upstream GET made within a policy and a deadline: status 503 when the
+// upstream couldn't be reached, 504 when a timeout or the deadline ran out.
+struct UpstreamReply {
+  int status = 0;
+  std::string body;
+  std::string contentType;
+};
+
+UpstreamReply timedGet(UpstreamPool &pool, AdaptiveTimeouts &timeouts, const std::string &host, int port,
+  const std::string &path, const TimeoutPolicy &policy, const Deadline &deadline);
+// The same on a client leased by the caller, e.g. to be able to stop() it from another thread
+UpstreamReply timedGet(UpstreamPool::Lease &cli, AdaptiveTimeouts &timeouts,
+  const std::string &path, const TimeoutPolicy &policy, const Deadline &deadline);
+
+#endif // DEADLINE_H
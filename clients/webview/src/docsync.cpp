@@ -0,0 +1,182 @@
+#include "docsync.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace {
+
+  uint64_t fnv1a(std::string_view s, uint64_t h = 1469598103934665603ull) {
+    for (unsigned char c : s) {
+      h ^= c;
+      h *= 1099511628211ull;
+    }
+    return h;
+  }
+
+  struct Hashed {
+    uint64_t path = 0; // 0: not a document
+    uint64_t hash = 0;
+  };
+
+  Hashed hashOf(const nlohmann::json &doc) {
+    Hashed res;
+    auto path = doc.is_object() ? doc.find("path") : doc.end();
+    if (!doc.is_object() || path == doc.end() || !path->is_string()) {
+      return res;
+    }
+    res.path = fnv1a(path->get_ref<const std::string &>());
+    uint64_t h = res.path;
+    for (const char *key : { "size", "lastModified" }) {
+      auto it = doc.find(key);
+      if (it != doc.end() && it->is_number_integer()) {
+        const int64_t v = it->get<int64_t>();
+        h = fnv1a(std::string_view(reinterpret_cast<const char *>(&v), sizeof(v)), h);
+      } else {
+        h = fnv1a(it == doc.end() ? std::string() : it->dump(), fnv1a("\x1f", h));
+      }
+    }
+    res.hash = h;
+    return res;
+  }
+
+  // Entries of large lists are hashed by several threads
+  std::vector<Hashed> hashAll(const nlohmann::json &documents) {
+    std::vector<Hashed> res(documents.size());
+    const size_t threads = documents.size() < 4096 ? 1 :
+      (std::min)(size_t(std::max(1u, std::thread::hardware_concurrency())), size_t(8));
+    const size_t chunk = (res.size() + threads - 1) / threads;
+    auto work = [&](size_t from) {
+      const size_t to = (std::min)(from + chunk, res.size());
+      for (size_t i = from; i < to; ++i) {
+        res[i] = hashOf(documents[i]);
+      }
+      };
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < threads; ++t) {
+      pool.emplace_back(work, t * chunk);
+    }
+    work(0);
+    for (auto &t : pool) t.join();
+    return res;
+  }
+
+  uint64_t nowMillis() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count());
+  }
+
+} // anonymous namespace
+
+uint64_t DocumentHistory::update(const std::string &source, nlohmann::json documents)
+{
+  if (!documents.is_array()) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return snapshots_[source].version;
+  }
+  const auto hashed = hashAll(documents);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto &snap = snapshots_[source];
+  const bool first = snap.version == 0;
+  // Most refreshes change nothing: check that before building anything
+  size_t same = 0;
+  for (const auto &h : hashed) {
+    if (!h.path) continue;
+    auto old = snap.entries.find(h.path);
+    same += old != snap.entries.end() && old->second.hash == h.hash;
+  }
+  if (!first && same == snap.entries.size() && same == size_t(std::count_if(hashed.begin(), hashed.end(), [](const Hashed &h) { return h.path != 0; }))) {
+    return snap.version;
+  }
+
+  Delta delta;
+  std::unordered_map<uint64_t, Entry> entries;
+  entries.reserve(hashed.size());
+  for (size_t i = 0; i < hashed.size(); ++i) {
+    if (!hashed[i].path) continue;
+    auto old = snap.entries.find(hashed[i].path);
+    if (old == snap.entries.end()) {
+      if (!first) delta.added.push_back(documents[i]["path"].get<std::string>());
+    } else if (old->second.hash != hashed[i].hash) {
+      delta.modified.push_back(documents[i]["path"].get<std::string>());
+    }
+    entries[hashed[i].path] = Entry{ hashed[i].hash, i };
+  }
+  for (const auto &[path, entry] : snap.entries) {
+    if (entries.find(path) == entries.end()) {
+      delta.removed.push_back(snap.documents[entry.index]["path"].get<std::string>());
+    }
+  }
+  snap.entries = std::move(entries);
+  snap.documents = std::move(documents);
+  const uint64_t version = (std::max)(snap.version + 1, nowMillis());
+  if (first) {
+    snap.base = version;
+  } else {
+    delta.version = version;
+    snap.deltaEntries += delta.size();
+    snap.deltas.push_back(std::move(delta));
+    while (!snap.deltas.empty() && (maxVersions_ < snap.deltas.size() || snap.entries.size() < snap.deltaEntries)) {
+      snap.deltaEntries -= snap.deltas.front().size();
+      snap.base = snap.deltas.front().version;
+      snap.deltas.pop_front();
+    }
+  }
+  snap.version = version;
+  return version;
+}
+
+nlohmann::json DocumentHistory::since(const std::string &source, uint64_t version, bool list) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  nlohmann::json res = { {"source", source} };
+  auto it = snapshots_.find(source);
+  if (it == snapshots_.end()) {
+    res["version"] = 0;
+    res["full"] = true;
+    res["documents"] = nlohmann::json::array();
+    return res;
+  }
+  const auto &snap = it->second;
+  res["version"] = snap.version;
+  if (version < snap.base || snap.version < version) {
+    res["full"] = true;
+    if (list) res["documents"] = snap.documents;
+    return res;
+  }
+
+  // Net change of each path over the deltas after `version`
+  struct Change {
+    bool before; // existed at `version`
+    bool after;
+  };
+  std::unordered_map<std::string, Change> changes;
+  for (const auto &delta : snap.deltas) {
+    if (delta.version <= version) continue;
+    for (const auto &path : delta.added) {
+      changes.try_emplace(path, Change{ false, true }).first->second.after = true;
+    }
+    for (const auto &path : delta.modified) {
+      changes.try_emplace(path, Change{ true, true }).first->second.after = true;
+    }
+    for (const auto &path : delta.removed) {
+      changes.try_emplace(path, Change{ true, false }).first->second.after = false;
+    }
+  }
+  auto added = nlohmann::json::array();
+  auto modified = nlohmann::json::array();
+  auto removed = nlohmann::json::array();
+  for (const auto &[path, change] : changes) {
+    if (!change.after) {
+      if (change.before) removed.push_back(path);
+      continue;
+    }
+    (change.before ? modified : added).push_back(snap.documents[snap.entries.at(fnv1a(path)).index]);
+  }
+  res["full"] = false;
+  res["added"] = std::move(added);
+  res["modified"] = std::move(modified);
+  res["removed"] = std::move(removed);
+  return res;
+}
@@ -0,0 +1,60 @@
+#ifndef DOC_SYNC_H
+#define DOC_SYNC_H
+
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+
+// Versioned snapshots of the document list (/api/documents) of each embedder instance,
+// so the page can ask for what changed since the version it holds instead of the
+// whole list.
+//
+// Every update() that changes the list gets a new version and keeps its delta (paths
+// added, removed and modified, by a hash of path, size and lastModified). Deltas are
+// dropped oldest first once they hold more entries than the list itself; a client
+// behind the oldest one gets the full list again. Versions start from the clock in
+// milliseconds, so those handed out by an earlier run of the host are older than any
+// kept delta and resync as well.
+class DocumentHistory {
+public:
+  explicit DocumentHistory(size_t maxVersions = 64) : maxVersions_(maxVersions) {}
+
+  // Version of the list after `documents` ([{path, size, lastModified}]) of `source`
+  uint64_t update(const std::string &source, nlohmann::json documents);
+
+  // {source, version, full: true, documents: [...]} or
+  // {source, version, full: false, added: [...], modified: [...], removed: [path...]}.
+  // Without `list` a full answer leaves out the documents.
+  nlohmann::json since(const std::string &source, uint64_t version, bool list = true) const;
+
+private:
+  struct Entry {
+    uint64_t hash; // of path, size and lastModified
+    size_t index;  // in documents
+  };
+  struct Delta {
+    uint64_t version;
+    std::vector<std::string> added;
+    std::vector<std::string> modified;
+    std::vector<std::string> removed;
+    size_t size() const { return added.size() + modified.size() + removed.size(); }
+  };
+  struct Snapshot {
+    uint64_t version = 0;
+    uint64_t base = 0; // oldest version the deltas lead on from
+    nlohmann::json documents = nlohmann::json::array(); // as the embedder listed them
+    std::unordered_map<uint64_t, Entry> entries; // by fnv-1a of the path
+    std::deque<Delta> deltas;
+    size_t deltaEntries = 0;
+  };
+
+  const size_t maxVersions_;
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, Snapshot> snapshots_;
+};
+
+#endif // DOC_SYNC_H
@@ -0,0 +1,106 @@
+#include "events.h"
+#include <algorithm>
+#include <memory>
+
+EventHub::Subscription::~Subscription()
+{
+  std::lock_guard<std::mutex> lock(hub_->mutex_);
+  hub_->queues_.erase(id_);
+}
+
+std::vector<EventHub::Event> EventHub::Subscription::next(std::chrono::milliseconds timeout)
+{
+  std::unique_lock<std::mutex> lock(hub_->mutex_);
+  auto &queue = hub_->queues_[id_];
+  hub_->cv_.wait_for(lock, timeout, [this, &queue] { return hub_->closed_ || !queue.pending.empty(); });
+  std::vector<Event> res;
+  if (hub_->closed_) {
+    return res;
+  }
+  res.reserve(queue.pending.size());
+  for (auto &[slot, e] : queue.pending) {
+    res.push_back(std::move(e));
+  }
+  queue.pending.clear();
+  std::sort(res.begin(), res.end(), [](const Event &a, const Event &b) { return a.id < b.id; });
+  return res;
+}
+
+bool EventHub::Subscription::closed() const
+{
+  std::lock_guard<std::mutex> lock(hub_->mutex_);
+  return hub_->closed_;
+}
+
+std::unique_ptr<EventHub::Subscription> EventHub::subscribe(const std::set<std::string> &topics)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  const uint64_t id = ++nextSubscriber_;
+  auto &queue = queues_[id];
+  queue.topics = topics;
+  // Starts from the current state
+  for (const auto &[slot, e] : kept_) {
+    if (topics.empty() || topics.count(e.topic)) {
+      queue.pending.emplace(slot, e);
+    }
+  }
+  return std::make_unique<Subscription>(*this, id);
+}
+
+void EventHub::publish(const std::string &topic, const std::string &key, nlohmann::json data)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_) return;
+    const auto slot = slotOf(topic, key);
+    Event &e = kept_[slot];
+    e = Event{ ++nextEvent_, topic, key, std::move(data) };
+    ++published_;
+    for (auto &[id, queue] : queues_) {
+      if (!queue.topics.empty() && !queue.topics.count(topic)) continue;
+      auto [it, added] = queue.pending.insert_or_assign(slot, e);
+      coalesced_ += !added;
+    }
+  }
+  cv_.notify_all();
+}
+
+void EventHub::forget(const std::string &topic, const std::string &key)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  kept_.erase(slotOf(topic, key));
+}
+
+bool EventHub::hasSubscribers(const std::string &topic) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return std::any_of(queues_.begin(), queues_.end(), [&topic](const auto &item) {
+    return item.second.topics.empty() || item.second.topics.count(topic);
+    });
+}
+
+void EventHub::close()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+  }
+  cv_.notify_all();
+}
+
+nlohmann::json EventHub::stats() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return {
+    {"subscribers", queues_.size()},
+    {"published", published_},
+    {"coalesced", coalesced_},
+    {"kept", kept_.size()}
+  };
+}
+
+std::string EventHub::format(const Event &e)
+{
+  return "id: " + std::to_string(e.id) + "\nevent: " + e.topic + "\ndata: " +
+    e.data.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace) + "\n\n";
+}
@@ -0,0 +1,87 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <nlohmann/json.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Host-to-page push channel, served as server-sent events on GET /host/events.
+//
+// Producers publish state changes on a topic ("health", "instances", ...) under a key
+// (the instance, or "" for one per topic). Each key only ever has its latest event
+// pending: a subscriber that is behind gets the newest state once, not every step in
+// between. The latest event of each key is also kept, so a new subscriber (a page that
+// just loaded or reconnected) starts from the current state without asking for it.
+class EventHub {
+public:
+  struct Event {
+    uint64_t id = 0;
+    std::string topic;
+    std::string key;
+    nlohmann::json data;
+  };
+
+  class Subscription {
+  public:
+    Subscription(EventHub &hub, uint64_t id) : hub_(&hub), id_(id) {}
+    Subscription(const Subscription &) = delete;
+    Subscription &operator=(const Subscription &) = delete;
+    ~Subscription();
+
+    // Pending events in the order they were published. Waits up to timeout for the
+    // first one; empty on timeout or once the hub is closed.
+    std::vector<Event> next(std::chrono::milliseconds timeout);
+    bool closed() const;
+
+  private:
+    EventHub *hub_;
+    uint64_t id_;
+  };
+
+  // Empty topics: all of them
+  std::unique_ptr<Subscription> subscribe(const std::set<std::string> &topics);
+
+  void publish(const std::string &topic, const std::string &key, nlohmann::json data);
+  // Drops the kept event of a key that is gone for good (e.g. a stopped instance)
+  void forget(const std::string &topic, const std::string &key);
+
+  // Producers skip the work of what nobody listens to
+  bool hasSubscribers(const std::string &topic) const;
+
+  // Wakes all subscribers for the last time
+  void close();
+
+  // {subscribers, published, coalesced, kept}
+  nlohmann::json stats() const;
+
+  // One event in text/event-stream framing
+  static std::string format(const Event &e);
+
+private:
+  struct Queue {
+    std::set<std::string> topics;
+    std::map<std::string, Event> pending; // by topic + key
+  };
+
+  static std::string slotOf(const std::string &topic, const std::string &key) { return topic + '\n' + key; }
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::unordered_map<uint64_t, Queue> queues_;
+  std::map<std::string, Event> kept_; // latest event per topic + key
+  uint64_t nextSubscriber_ = 0;
+  uint64_t nextEvent_ = 0;
+  size_t published_ = 0;
+  size_t coalesced_ = 0;
+  bool closed_ = false;
+};
+
+#endif // EVENTS_H
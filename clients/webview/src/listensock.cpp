@@ -0,0 +1,187 @@
+#include "listensock.h"
+#include <utils_log/logger.hpp>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#endif
+
+namespace {
+
+  std::string lastSocketError() {
+#ifdef _WIN32
+    return std::to_string(WSAGetLastError());
+#else
+    return strerror(errno);
+#endif
+  }
+
+} // anonymous namespace
+
+ListenSocket::~ListenSocket()
+{
+  close();
+}
+
+bool ListenSocket::bindTcp(const std::string &host, int port, int backlog)
+{
+  close();
+
+#ifdef _WIN32
+  WSADATA wsaData;
+  WSAStartup(MAKEWORD(2, 2), &wsaData); // ref-counted, balanced in close()
+  // Created without WSA_FLAG_NO_HANDLE_INHERIT so the handle can be inherited by the embedder.
+  handle_ = WSASocketW(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, 0);
+  if (handle_ != InvalidHandle) {
+    // Only made inheritable for the duration of the embedder's CreateProcess call.
+    SetHandleInformation(reinterpret_cast<HANDLE>(handle_), HANDLE_FLAG_INHERIT, 0);
+    BOOL exclusive = TRUE;
+    setsockopt(handle_, SOL_SOCKET, SO_EXCLUSIVEADDRUSE, reinterpret_cast<const char *>(&exclusive), sizeof(exclusive));
+  }
+#else
+  int type = SOCK_STREAM;
+#ifdef SOCK_CLOEXEC
+  type |= SOCK_CLOEXEC;
+#endif
+  handle_ = ::socket(AF_INET, type, 0);
+  if (handle_ != InvalidHandle) {
+    // Inherited explicitly by the embedder through ProcessManager, never by accident.
+    fcntl(handle_, F_SETFD, FD_CLOEXEC);
+    int yes = 1;
+    setsockopt(handle_, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  }
+#endif
+  if (handle_ == InvalidHandle) {
+    LOG_MSG << "ListenSocket: socket() failed:" << lastSocketError();
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    return false;
+  }
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+  if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+    LOG_MSG << "ListenSocket: invalid IPv4 address" << host;
+    close();
+    return false;
+  }
+  if (::bind(handle_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+    LOG_MSG << "ListenSocket: bind to" << host << port << "failed:" << lastSocketError();
+    close();
+    return false;
+  }
+  if (::listen(handle_, backlog) != 0) {
+    LOG_MSG << "ListenSocket: listen failed:" << lastSocketError();
+    close();
+    return false;
+  }
+
+  sockaddr_in bound{};
+  socklen_t len = sizeof(bound);
+  if (::getsockname(handle_, reinterpret_cast<sockaddr *>(&bound), &len) != 0) {
+    LOG_MSG << "ListenSocket: getsockname failed:" << lastSocketError();
+    close();
+    return false;
+  }
+  host_ = host;
+  port_ = ntohs(bound.sin_port);
+  LOG_MSG << "ListenSocket: listening on" << LOG_NOSPACE << host_ << ":" << port_;
+  return true;
+}
+
+#ifndef _WIN32
+bool ListenSocket::bindUnix(const std::string &path, int backlog)
+{
+  close();
+
+  sockaddr_un addr{};
+  if (sizeof(addr.sun_path) <= path.size()) {
+    LOG_MSG << "ListenSocket: socket path too long" << path;
+    return false;
+  }
+  int type = SOCK_STREAM;
+#ifdef SOCK_CLOEXEC
+  type |= SOCK_CLOEXEC;
+#endif
+  handle_ = ::socket(AF_UNIX, type, 0);
+  if (handle_ == InvalidHandle) {
+    LOG_MSG << "ListenSocket: socket() failed:" << lastSocketError();
+    return false;
+  }
+  fcntl(handle_, F_SETFD, FD_CLOEXEC);
+
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path.c_str(), path.size());
+  ::unlink(path.c_str()); // left behind by a crashed session
+  if (::bind(handle_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+    LOG_MSG << "ListenSocket: bind to" << path << "failed:" << lastSocketError();
+    close();
+    return false;
+  }
+  path_ = path;
+  // The directory is private already, this is for when it's shared after all
+  ::chmod(path.c_str(), 0600);
+  if (::listen(handle_, backlog) != 0) {
+    LOG_MSG << "ListenSocket: listen failed:" << lastSocketError();
+    close();
+    return false;
+  }
+  LOG_MSG << "ListenSocket: listening on" << path_;
+  return true;
+}
+#endif
+
+void ListenSocket::close()
+{
+  if (handle_ == InvalidHandle) {
+    return;
+  }
+#ifdef _WIN32
+  closesocket(handle_);
+  WSACleanup();
+#else
+  ::close(handle_);
+  if (!path_.empty()) {
+    ::unlink(path_.c_str());
+    path_.clear();
+  }
+#endif
+  handle_ = InvalidHandle;
+  port_ = 0;
+}
+
+std::string privateRuntimeDir()
+{
+#ifdef _WIN32
+  return "";
+#else
+  static const std::string dir = [] {
+    const char *base = std::getenv("XDG_RUNTIME_DIR");
+    const std::string d = std::string(base && *base ? base : "/tmp") + "/phenix-code-" + std::to_string(getuid());
+    if (::mkdir(d.c_str(), 0700) != 0 && errno != EEXIST) {
+      LOG_MSG << "Cannot create runtime directory" << d << LOG_NOSPACE << ":" << lastSocketError();
+      return std::string();
+    }
+    // Someone else's directory, or a symlink planted there, would defeat the point
+    struct stat st {};
+    if (::lstat(d.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077)) {
+      LOG_MSG << "Runtime directory" << d << "is not private, not using it";
+      return std::string();
+    }
+    return d;
+    }();
+  return dir;
+#endif
+}
@@ -0,0 +1,61 @@
+#ifndef LISTEN_SOCKET_H
+#define LISTEN_SOCKET_H
+
+#include <string>
+#include <cstdint>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#endif
+
+// Listening socket created and bound by the host, then handed to an embedder
+// process at spawn time (systemd-style socket activation, see sd_listen_fds(3)).
+// Connections queue in the kernel backlog while the embedder is still loading,
+// and the same socket can be handed over to a replacement process.
+class ListenSocket {
+public:
+#ifdef _WIN32
+  using Handle = SOCKET;
+  static constexpr Handle InvalidHandle = INVALID_SOCKET;
+#else
+  using Handle = int;
+  static constexpr Handle InvalidHandle = -1;
+#endif
+
+  ListenSocket() = default;
+  ~ListenSocket();
+
+  ListenSocket(const ListenSocket &) = delete;
+  ListenSocket &operator=(const ListenSocket &) = delete;
+
+  // Binds host:port and starts listening. Port 0 picks an ephemeral port,
+  // which is then available through port().
+  bool bindTcp(const std::string &host, int port = 0, int backlog = 128);
+#ifndef _WIN32
+  // Binds a Unix domain socket at path (a stale file there is replaced), only accessible
+  // to the user. The file is removed again on close().
+  bool bindUnix(const std::string &path, int backlog = 128);
+#endif
+  void close();
+
+  bool isValid() const { return handle_ != InvalidHandle; }
+  Handle handle() const { return handle_; }
+  const std::string &host() const { return host_; }
+  int port() const { return port_; }
+  const std::string &path() const { return path_; } // Unix domain sockets only
+
+private:
+  Handle handle_ = InvalidHandle;
+  std::string host_;
+  int port_ = 0;
+  std::string path_;
+};
+
+// Directory for the embedders' Unix domain sockets, private to the user: under
+// $XDG_RUNTIME_DIR if set, else in the temp directory. Empty if unavailable (Windows).
+std::string privateRuntimeDir();
+
+#endif // LISTEN_SOCKET_H
@@ -3,6 +3,28 @@
 #include <nlohmann/json.hpp>
 #include <utils_log/logger.hpp>
 #include "procmngr.h"
+#include "listensock.h"
+#include "appconfig.h"
+#include "projregistry.h"
+#include "startprof.h"
+#include "mdrender.h"
+#include "sserelay.h"
+#include "convstore.h"
+#include "attachstore.h"
+#include "tokcount.h"
+#include "chatsearch.h"
+#include "pathindex.h"
+#include "payloadcodec.h"
+#include "docsync.h"
+#include "upstreampool.h"
+#include "warmup.h"
+#include "reqsched.h"
+#include "deadline.h"
+#include "replicas.h"
+#include "events.h"
+#include "passthrough.h"
+#include "bodyspool.h"
+#include "workerpool.h"
 #include <filesystem>
 #include <string>
 #include <cassert>
@@ -12,13 +34,20 @@
 #include <atomic>
 #include <fstream>
 #include <unordered_map>
+#include <map>
 #include <random>
 #include <memory>
+#include <condition_variable>
+#include <list>
+#include <future>
+#include <algorithm>
+#include <optional>
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #include <commctrl.h>
+#include <shobjidl.h>
 #include "WinDarkTitlebarImpl.h"
 #else
 #include <limits.h>
@@ -36,6 +65,9 @@ namespace fs = std::filesystem;
 
 namespace {
 
+  // Threads of the local HTTP server (proxy, host endpoints, the page's assets)
+  constexpr size_t httpWorkers = 32;
+
   class Webview : public webview::webview {
   public:
     std::function<void()> onDestroyCallback_;
@@ -65,8 +97,7 @@ namespace {
       webview::webview::on_window_destroyed(skip_termination);
     }
 
-    void setAppIcon(const std::string &iconBaseName) {
-      auto assets = findWebAssets();
+    void setAppIcon(const std::string &assets, const std::string &iconBaseName) {
       if (assets.empty()) return;
       std::filesystem::path base = std::filesystem::path(assets) / iconBaseName;
 #if defined(_WIN32)
@@ -119,6 +150,69 @@ namespace {
       return res;
     }
 
+    // Native open dialog over the window, several files at once; empty when cancelled.
+    // Runs a modal loop, so it is called on the UI thread.
+    std::vector<std::string> pickFiles(const std::string &title) {
+      std::vector<std::string> res;
+#ifdef WIN32
+      IFileOpenDialog *dialog = nullptr;
+      if (FAILED(CoCreateInstance(CLSID_FileOpenDialog, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&dialog)))) {
+        return res;
+      }
+      FILEOPENDIALOGOPTIONS options = 0;
+      dialog->GetOptions(&options);
+      dialog->SetOptions(options | FOS_ALLOWMULTISELECT | FOS_FORCEFILESYSTEM | FOS_FILEMUSTEXIST);
+      const int wlen = MultiByteToWideChar(CP_UTF8, 0, title.c_str(), -1, nullptr, 0);
+      std::wstring wtitle(wlen, L'\0');
+      MultiByteToWideChar(CP_UTF8, 0, title.c_str(), -1, wtitle.data(), wlen);
+      dialog->SetTitle(wtitle.c_str());
+      IShellItemArray *items = nullptr;
+      if (SUCCEEDED(dialog->Show((HWND)window().value())) && SUCCEEDED(dialog->GetResults(&items))) {
+        DWORD count = 0;
+        items->GetCount(&count);
+        for (DWORD i = 0; i < count; ++i) {
+          IShellItem *item = nullptr;
+          PWSTR path = nullptr;
+          if (SUCCEEDED(items->GetItemAt(i, &item)) && SUCCEEDED(item->GetDisplayName(SIGDN_FILESYSPATH, &path))) {
+            const int len = WideCharToMultiByte(CP_UTF8, 0, path, -1, nullptr, 0, nullptr, nullptr);
+            std::string utf8(len > 0 ? len - 1 : 0, '\0');
+            WideCharToMultiByte(CP_UTF8, 0, path, -1, utf8.data(), len, nullptr, nullptr);
+            res.push_back(std::move(utf8));
+            CoTaskMemFree(path);
+          }
+          if (item) item->Release();
+        }
+        items->Release();
+      }
+      dialog->Release();
+#elif defined(__APPLE__)
+      NSOpenPanel *panel = [NSOpenPanel openPanel];
+      [panel setCanChooseFiles : YES];
+      [panel setCanChooseDirectories : NO];
+      [panel setAllowsMultipleSelection : YES];
+      [panel setMessage : [NSString stringWithUTF8String : title.c_str()]];
+      if ([panel runModal] == NSModalResponseOK) {
+        for (NSURL *url in [panel URLs]) {
+          res.push_back([[url path] UTF8String]);
+        }
+      }
+#elif defined(__linux__)
+      GtkWidget *dialog = gtk_file_chooser_dialog_new(title.c_str(), GTK_WINDOW(window()), GTK_FILE_CHOOSER_ACTION_OPEN,
+        "_Cancel", GTK_RESPONSE_CANCEL, "_Open", GTK_RESPONSE_ACCEPT, nullptr);
+      gtk_file_chooser_set_select_multiple(GTK_FILE_CHOOSER(dialog), TRUE);
+      if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+        GSList *files = gtk_file_chooser_get_filenames(GTK_FILE_CHOOSER(dialog));
+        for (GSList *f = files; f; f = f->next) {
+          res.push_back(static_cast<gchar *>(f->data));
+          g_free(f->data);
+        }
+        g_slist_free(files);
+      }
+      gtk_widget_destroy(dialog);
+#endif
+      return res;
+    }
+
 
     static std::string getExecutableDir() {
       LOG_START;
@@ -176,35 +270,6 @@ namespace {
 
   };
 
-  struct AppConfig {
-    int width = 700;
-    int height = 900;
-    int port = 8590;
-    std::string host = "127.0.0.1";
-    std::unordered_map<std::string, std::string> uiPrefs;
-    mutable std::mutex mutex_;
-
-    nlohmann::json toJson() const {
-      nlohmann::json j;
-      j["window"] = {
-          {"width", width},
-          {"height", height}
-      };
-      j["api"] = {
-          {"host", host},
-          {"port", port}
-      };
-      j["uiPrefs"] = nlohmann::json::array();
-      for (const auto &item : uiPrefs) {
-        j["uiPrefs"].push_back({
-          {"key", item.first},
-          {"value", item.second}
-        });
-      }
-      return j;
-    }
-  };
-
   std::string getConfigPath() {
     const std::string exeDir = Webview::getExecutableDir();
     static std::vector<std::string> paths = {
@@ -225,106 +290,43 @@ namespace {
     return prefsPath;
   }
 
-  void savePrefsToFile(const AppConfig &prefs) {
-    const auto prefsPath = getConfigPath();
-    nlohmann::json j = prefs.toJson();
-    std::ofstream out(prefsPath);
-    if (out.is_open()) {
-      out << j.dump(2) << std::endl;
-      out.close();
-      LOG_MSG << "Updated appconfig.json with new server URL";
-    } else {
-      LOG_MSG << "Failed to update" << prefsPath;
-      throw std::runtime_error("Failed to update appconfig.json");
+  // Everything the UI reads at startup, preloaded into the page so it needs no bridge round-trips
+  nlohmann::json hostPrefsSnapshot(const AppConfig &cfg, ProjectRegistry &projects)
+  {
+    auto j = cfg.toUiJson();
+    std::vector<std::string> paths;
+    auto it = cfg.uiPrefs.find("EmbedderSettingsFilePaths");
+    if (it != cfg.uiPrefs.end() && !it->second.empty()) {
+      try {
+        paths = nlohmann::json::parse(it->second).get<std::vector<std::string>>();
+      } catch (const std::exception &ex) {
+        LOG_MSG << "Invalid EmbedderSettingsFilePaths:" << ex.what();
+      }
     }
+    j["projects"] = projects.lookupMany(paths);
+    return j;
   }
 
-  void fetchOrCreatePrefsJson(AppConfig &prefs) {
-    LOG_START;
-    const auto prefsPath = getConfigPath();
-    std::ifstream f(prefsPath);
-    if (f.is_open()) {
-      std::stringstream ss;
-      ss << f.rdbuf();
-      try {
-        auto j = nlohmann::json::parse(ss.str());
-        if (j.contains("window") && j["window"].is_object()) {
-          const auto &w = j["window"];
-          if (w.contains("width") && w["width"].is_number_integer()) {
-            prefs.width = w["width"].get<int>();
-          }
-          if (w.contains("height") && w["height"].is_number_integer()) {
-            prefs.height = w["height"].get<int>();
-          }
-        }
-        if (j.contains("api") && j["api"].is_object()) {
-          const auto &w = j["api"];
-          if (w.contains("host") && w["host"].is_string()) {
-            prefs.host = w["host"];
-          }
-          if (w.contains("port") && w["port"].is_number_integer()) {
-            prefs.port = w["port"].get<int>();
-          }
-        }
-        if (j.contains("uiPrefs") && j["uiPrefs"].is_array()) {
-          for (const auto &item : j["uiPrefs"]) {
-            if (item.contains("key") && item.contains("value") &&
-                item["key"].is_string() && item["value"].is_string()) {
-              prefs.uiPrefs.insert({
-                item["key"].get<std::string>(),
-                item["value"].get<std::string>()
-                });
-            }
-          }
-        }
-      } catch (const std::exception &e) {
-        LOG_MSG << "Error parsing appconfig.json:" << e.what();
+  // Attachments sent as {filename, digest} get their content back from the spool. The
+  // embedder only takes inline content, so this is where it is put back in.
+  bool inlineAttachments(nlohmann::json &j, const AttachmentStore &store, std::string &error) {
+    if (!j.contains("attachments") || !j["attachments"].is_array()) {
+      return true;
+    }
+    for (auto &a : j["attachments"]) {
+      if (!a.is_object() || !a.contains("digest") || a.contains("content")) {
+        continue;
       }
-    } else {
-      nlohmann::json j = prefs.toJson();
-      try {
-        std::ofstream out(prefsPath);
-        if (out.is_open()) {
-          out << j.dump(2) << std::endl;
-          out.close();
-          LOG_MSG << "Created default appconfig.json at:" << prefsPath;
-        } else {
-          LOG_MSG << "Failed to create appconfig.json at:" << prefsPath;
-        }
-      } catch (const std::exception &e) {
-        LOG_MSG << "Error writing appconfig.json:" << e.what();
+      const std::string digest = a["digest"].is_string() ? a["digest"].get<std::string>() : "";
+      auto content = store.read(digest);
+      if (!content) {
+        error = "Unknown attachment: " + a.value("filename", digest);
+        return false;
       }
+      a["content"] = std::move(*content);
+      a.erase("digest");
     }
-    if (prefs.host == "localhost") prefs.host = "127.0.0.1";
-    prefs.width = (std::min)((std::max)(prefs.width, 200), 1400);
-    prefs.height = (std::min)((std::max)(prefs.height, 300), 1000);
-  }
-
-  std::string hashString(const std::string &str) {
-    std::hash<std::string> hasher;
-    std::stringstream ss;
-    ss << std::hex << std::setfill('0') << std::setw(16) << hasher(str);
-    return ss.str();
-  }
-
-  std::string getProjectId(const std::string &path)
-  {
-    nlohmann::json j;
-    std::ifstream file(path);
-    if (!file.is_open()) {
-      throw std::runtime_error("Cannot open settings file: " + path);
-    }
-    file >> j;
-    std::string s;
-    s = j["source"].value("project_id", "");
-    if (s.empty()) {
-      // Auto-generate
-      auto absPath = std::filesystem::absolute(path).lexically_normal();
-      std::string dirName = absPath.parent_path().filename().string();
-      std::string pathHash = hashString(absPath.generic_string()).substr(0, 8);
-      s = dirName + "-" + pathHash;
-    }
-    return s;
+    return true;
   }
 
   std::string generateAppKey() {
@@ -342,42 +344,237 @@ namespace {
   struct ProcessesHolder {
     mutable std::mutex mutex;
 
-    ProcessManager *getOrCreateProcess(const std::string &appKey, const std::string &projectId) {
+    struct Endpoint {
+      std::string appKey;
+      std::string projectId;
+      std::string host;
+      int port = 0; // 0 when the embedder bound its own port
+      std::string unixPath; // its Unix domain socket, if it was given one
+    };
+
+    struct LaunchInfo {
+      std::string exePath;
+      std::string configPath;
+    };
+
+    // With active == false the process is registered as a standby that does not serve
+    // its project until promote() is called (see rollingRestart).
+    ProcessManager *getOrCreateProcess(const std::string &appKey, const std::string &projectId, bool active = true) {
       std::lock_guard<std::mutex> lock(mutex);
-      auto it = embedderProcesses_.find(appKey);
-      if (it != embedderProcesses_.end()) {
-        return it->second.get();
+      auto it = embedders_.find(appKey);
+      if (it != embedders_.end()) {
+        return it->second.proc.get();
       }
-      auto procMgr = std::make_unique<ProcessManager>();
-      ProcessManager *procPtr = procMgr.get();
-      embedderProcesses_[appKey] = std::move(procMgr);
-      projectIdToAppKey_[projectId] = appKey;
-      appKeyToProjectId_[appKey] = projectId;
-      return procPtr;
+      auto &entry = embedders_[appKey];
+      entry.proc = std::make_unique<ProcessManager>();
+      entry.projectId = projectId;
+      if (active) {
+        projectIdToAppKey_[projectId] = appKey;
+      }
+      return entry.proc.get();
+    }
+
+    // One more process serving a project that has an active one; requests are spread over
+    // them (see ReplicaBalancer). Needs a socket from createStandbyListenSocket. With
+    // serving == false it is left out of getReplicaGroups() until setServing().
+    ProcessManager *createReplicaProcess(const std::string &appKey, const std::string &projectId, bool serving = true) {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto &entry = embedders_[appKey];
+      entry.proc = std::make_unique<ProcessManager>();
+      entry.projectId = projectId;
+      entry.replica = true;
+      entry.serving = serving;
+      return entry.proc.get();
+    }
+
+    void setServing(const std::string &appKey, bool serving) {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = embedders_.find(appKey);
+      if (it != embedders_.end()) {
+        it->second.serving = serving;
+      }
+    }
+
+    std::vector<std::string> getReplicaKeys(const std::string &projectId) const {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::vector<std::string> res;
+      for (const auto &[appKey, entry] : embedders_) {
+        if (entry.replica && entry.projectId == projectId) res.push_back(appKey);
+      }
+      return res;
+    }
+
+    // Endpoints serving each project with replicas: the active process first
+    std::vector<std::vector<ReplicaBalancer::Endpoint>> getReplicaGroups() const {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::vector<std::vector<ReplicaBalancer::Endpoint>> res;
+      for (const auto &[projectId, activeKey] : projectIdToAppKey_) {
+        const auto active = getEndpointImpl(activeKey);
+        if (active.port <= 0) continue;
+        std::vector<ReplicaBalancer::Endpoint> group = { {active.host, active.port} };
+        for (const auto &[appKey, entry] : embedders_) {
+          if (!entry.replica || !entry.serving || entry.projectId != projectId) continue;
+          const auto ep = getEndpointImpl(appKey);
+          if (0 < ep.port) group.push_back({ ep.host, ep.port });
+        }
+        if (1 < group.size()) res.push_back(std::move(group));
+      }
+      return res;
     }
 
     void discardProcess(const std::string &appKey) {
       std::lock_guard<std::mutex> lock(mutex);
-      auto it = embedderProcesses_.find(appKey);
-      if (it != embedderProcesses_.end()) {
-        embedderProcesses_.erase(it);
-        auto projIt = appKeyToProjectId_.find(appKey);
-        if (projIt != appKeyToProjectId_.end()) {
-          projectIdToAppKey_.erase(projIt->second);
-          appKeyToProjectId_.erase(projIt);
+      auto it = embedders_.find(appKey);
+      if (it != embedders_.end()) {
+        const std::string projectId = it->second.projectId;
+        embedders_.erase(it);
+        auto projIt = projectIdToAppKey_.find(projectId);
+        if (projIt != projectIdToAppKey_.end() && projIt->second == appKey) {
+          listenSockets_.erase(projectId);
+          projectIdToAppKey_.erase(projIt);
+        }
+      }
+    }
+
+    void setLaunchInfo(const std::string &appKey, const LaunchInfo &info) {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = embedders_.find(appKey);
+      if (it != embedders_.end()) {
+        it->second.launch = info;
+      }
+    }
+
+    LaunchInfo getLaunchInfo(const std::string &appKey) const {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = embedders_.find(appKey);
+      return it != embedders_.end() ? it->second.launch : LaunchInfo{};
+    }
+
+    // Listening socket owned by the host for the process' project. It outlives the embedder
+    // process so that a replacement started for the same project inherits it.
+    ListenSocket *getOrCreateListenSocket(const std::string &appKey, const std::string &host) {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = embedders_.find(appKey);
+      if (it == embedders_.end()) {
+        return nullptr;
+      }
+      auto &sock = listenSockets_[it->second.projectId];
+      if (!sock || !sock->isValid()) {
+        sock = std::make_shared<ListenSocket>();
+        if (!sock->bindTcp(host)) {
+          listenSockets_.erase(it->second.projectId);
+          return nullptr;
         }
       }
+      it->second.socket = sock;
+      return sock.get();
+    }
+
+    // A fresh socket of the process' own, for a replica.
+    ListenSocket *createStandbyListenSocket(const std::string &appKey, const std::string &host) {
+      auto sock = std::make_shared<ListenSocket>();
+      if (!sock->bindTcp(host)) {
+        return nullptr;
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = embedders_.find(appKey);
+      if (it == embedders_.end()) {
+        return nullptr;
+      }
+      it->second.socket = sock;
+      return sock.get();
+    }
+
+    // A Unix domain socket of the process' own in the private runtime directory, handed
+    // over next to its TCP socket. Null where there are none (Windows) or binding failed.
+    ListenSocket *createUnixSocket(const std::string &appKey) {
+      const auto dir = privateRuntimeDir();
+      if (dir.empty()) {
+        return nullptr;
+      }
+      auto sock = std::make_shared<ListenSocket>();
+#ifndef _WIN32
+      if (!sock->bindUnix(dir + "/" + appKey.substr(0, 16) + ".sock")) {
+        return nullptr;
+      }
+#endif
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = embedders_.find(appKey);
+      if (it == embedders_.end()) {
+        return nullptr;
+      }
+      it->second.unixSocket = sock;
+      return sock.get();
+    }
+
+    // Makes appKey the process serving its project; returns the previously active appKey.
+    std::string promote(const std::string &appKey) {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = embedders_.find(appKey);
+      if (it == embedders_.end()) {
+        return "";
+      }
+      const std::string &projectId = it->second.projectId;
+      std::string prev = projectIdToAppKey_[projectId];
+      projectIdToAppKey_[projectId] = appKey;
+      if (it->second.socket) {
+        listenSockets_[projectId] = it->second.socket;
+      }
+      return prev;
+    }
+
+    Endpoint getEndpoint(const std::string &appKey) const {
+      std::lock_guard<std::mutex> lock(mutex);
+      return getEndpointImpl(appKey);
+    }
+
+    std::vector<Endpoint> getEndpoints() const {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::vector<Endpoint> res;
+      for (const auto &item : embedders_) {
+        res.push_back(getEndpointImpl(item.first));
+      }
+      return res;
     }
 
     ProcessManager *getProcessWithApiKey(const std::string &appKey) const {
       std::lock_guard<std::mutex> lock(mutex);
-      auto it = embedderProcesses_.find(appKey);
-      if (it != embedderProcesses_.end()) {
-        return it->second.get();
+      auto it = embedders_.find(appKey);
+      if (it != embedders_.end()) {
+        return it->second.proc.get();
       }
       return nullptr;
     }
 
+    // False once the process exited or was discarded
+    bool isRunning(const std::string &appKey) {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = embedders_.find(appKey);
+      return it != embedders_.end() && it->second.proc->testUpdatedRunningStatus();
+    }
+
+    struct Usage {
+      Endpoint endpoint;
+      uint64_t pid = 0;
+      double cpuSeconds = 0;
+      uint64_t rssBytes = 0;
+    };
+
+    // Processes the platform reports usage for (see ProcessManager::getResourceUsage)
+    std::vector<Usage> getResourceUsage() const {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::vector<Usage> res;
+      for (const auto &[appKey, entry] : embedders_) {
+        Usage u;
+        if (entry.proc->getResourceUsage(u.cpuSeconds, u.rssBytes)) {
+          u.endpoint = getEndpointImpl(appKey);
+          u.pid = entry.proc->getProcessId();
+          res.push_back(std::move(u));
+        }
+      }
+      return res;
+    }
+
     std::string getApiKeyFromProjectId(const std::string &projectId) const {
       std::lock_guard<std::mutex> lock(mutex);
       auto it = projectIdToAppKey_.find(projectId);
@@ -388,72 +585,1066 @@ namespace {
     }
 
     void waitToStopThenTerminate() {
-      for (auto &proc : embedderProcesses_) {
-        if (proc.second->waitForCompletion(10000)) {
-          LOG_MSG << "Embedder process" << proc.second->getProcessId() << "exited cleanly";
+      for (auto &item : embedders_) {
+        auto &proc = item.second.proc;
+        if (proc->waitForCompletion(10000)) {
+          LOG_MSG << "Embedder process" << proc->getProcessId() << "exited cleanly";
         } else {
-          LOG_MSG << "Embedder process" << proc.second->getProcessId() << "did not exit in time, terminating...";
-          proc.second->stopProcess();
+          LOG_MSG << "Embedder process" << proc->getProcessId() << "did not exit in time, terminating...";
+          proc->stopProcess();
+        }
+      }
+    }
+
+  private:
+    struct Entry {
+      std::unique_ptr<ProcessManager> proc;
+      std::string projectId;
+      LaunchInfo launch;
+      std::shared_ptr<ListenSocket> socket; // shared with the project while active
+      std::shared_ptr<ListenSocket> unixSocket;
+      bool replica = false;
+      bool serving = true; // replicas only: in the project's group
+    };
+
+    Endpoint getEndpointImpl(const std::string &appKey) const {
+      Endpoint ep;
+      ep.appKey = appKey;
+      auto it = embedders_.find(appKey);
+      if (it != embedders_.end()) {
+        ep.projectId = it->second.projectId;
+        if (it->second.socket && it->second.socket->isValid()) {
+          ep.host = it->second.socket->host();
+          ep.port = it->second.socket->port();
         }
+        if (it->second.unixSocket && it->second.unixSocket->isValid()) {
+          ep.unixPath = it->second.unixSocket->path();
+        }
+      }
+      return ep;
+    }
+
+    std::unordered_map<std::string, Entry> embedders_; // by appKey
+    std::unordered_map<std::string, std::string> projectIdToAppKey_; // the active process of each project
+    std::unordered_map<std::string, std::shared_ptr<ListenSocket>> listenSockets_; // by projectId
+  };
+
+  // Over unixPath when given: the process' own socket, where its TCP port may be shared
+  bool sendEmbedderShutdown(std::string host, int port, const std::string &appKey, const std::string &unixPath = "") {
+    if (host == "localhost") host = "127.0.0.1";
+    UpstreamPool transport(1);
+    if (!unixPath.empty()) transport.setUnixSocket(host, port, unixPath);
+    auto cli = transport.connect(host, port);
+    httplib::Headers headers = { {"X-App-Key", appKey} };
+    auto result = cli->Post("/api/shutdown", headers, "", "application/json");
+    return result && result->status == 200;
+  }
+
+  // Sockets handed to a starting embedder: its TCP socket and, if enabled, a Unix domain socket
+  void handOverSockets(ProcessesHolder &procUtil, ProcessManager &proc, const std::string &appKey, ListenSocket &tcp, bool unixSocket) {
+    std::vector<uint64_t> sockets = { static_cast<uint64_t>(tcp.handle()) };
+    std::vector<std::string> names = { "http" };
+    if (auto *sock = unixSocket ? procUtil.createUnixSocket(appKey) : nullptr) {
+      sockets.push_back(static_cast<uint64_t>(sock->handle()));
+      names.push_back("http-unix");
+    }
+    proc.setListenSockets(sockets, names);
+  }
+
+  // Moves the proxy's requests to the embedder onto its Unix domain socket once it answers
+  // there. Until then, or if it never does (it may only serve the first socket it's handed),
+  // they go over TCP.
+  bool useUnixSocketWhenReady(ProcessesHolder &procUtil, UpstreamPool &upstreams, const std::string &appKey, int timeoutMs, const std::atomic<bool> &cancel) {
+    const auto ep = procUtil.getEndpoint(appKey);
+    if (ep.unixPath.empty() || ep.port <= 0) {
+      return false;
+    }
+    UpstreamPool probe(1);
+    probe.setUnixSocket(ep.host, ep.port, ep.unixPath);
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (std::chrono::steady_clock::now() < deadline && !cancel && procUtil.getProcessWithApiKey(appKey)) {
+      auto cli = probe.acquire(ep.host, ep.port, std::chrono::seconds(2));
+      auto res = cli->Get("/api/health");
+      if (res && res->status == 200) {
+        upstreams.setUnixSocket(ep.host, ep.port, ep.unixPath);
+        LOG_MSG << "Embedder on port" << ep.port << "reached over" << ep.unixPath;
+        return true;
+      }
+      cli.discard();
+      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+    LOG_MSG << "Embedder on port" << ep.port << "does not answer on" << ep.unixPath << LOG_NOSPACE << ", staying on TCP";
+    return false;
+  }
+
+  // Asks the embedder to shut down and waits for it, terminating it if it takes too long
+  void stopEmbedderProcess(ProcessManager &proc, const std::string &host, int port, const std::string &appKey) {
+    if (0 < port && sendEmbedderShutdown(host, port, appKey)) {
+      LOG_MSG << "Shutdown request sent to embedder process" << proc.getProcessId();
+    } else {
+      LOG_MSG << "Failed to send shutdown request to embedder process" << proc.getProcessId();
+    }
+    if (proc.waitForCompletion(10000)) {
+      LOG_MSG << "Embedder process" << proc.getProcessId() << "exited cleanly";
+    } else {
+      LOG_MSG << "Embedder process" << proc.getProcessId() << "did not exit in time, terminating...";
+      proc.stopProcess();
+    }
+  }
+
+  // An embedder process for the "instances" topic of the push channel, keyed by its appKey
+  void publishInstance(EventHub &events, const ProcessesHolder::Endpoint &ep, const std::string &state, bool replica = false) {
+    events.publish("instances", ep.appKey, {
+      {"appKey", ep.appKey}, {"projectId", ep.projectId}, {"host", ep.host}, {"port", ep.port}, {"state", state}, {"replica", replica}
+      });
+    if (state == "stopped") {
+      events.forget("instances", ep.appKey);
+      events.forget("resources", ep.appKey);
+    }
+  }
+
+  // Proxied requests in flight per upstream "host:port", so that an instance being replaced
+  // can be drained before it is shut down. The count is kept per generation of the upstream:
+  // a request is counted under the generation current when it is tracked, and advance()
+  // starts a new one when the transport behind host:port changes, so that the requests
+  // still on the previous process can be waited for while new ones keep coming.
+  struct InflightTracker {
+    class Guard {
+    public:
+      Guard(InflightTracker &t, std::string key, uint64_t generation) : tracker_(&t), key_(std::move(key)), generation_(generation) {}
+      Guard(Guard &&other) noexcept : tracker_(std::exchange(other.tracker_, nullptr)), key_(std::move(other.key_)), generation_(other.generation_) {}
+      Guard(const Guard &) = delete;
+      Guard &operator=(const Guard &) = delete;
+      Guard &operator=(Guard &&) = delete;
+      ~Guard() { if (tracker_) tracker_->release(key_, generation_); }
+    private:
+      InflightTracker *tracker_;
+      std::string key_;
+      uint64_t generation_;
+    };
+
+    // Called before the request picks its connection, so that it never counts under a
+    // generation older than the transport it is sent over
+    Guard track(const std::string &host, int port) {
+      auto key = std::format("{}:{}", host, port);
+      uint64_t generation = 0;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &u = upstreams_[key];
+        generation = u.generation;
+        ++u.counts[generation];
+      }
+      return Guard(*this, std::move(key), generation);
+    }
+
+    // Requests tracked from now on count under a new generation; returns the one that ended.
+    // The transport is to be switched before this call.
+    uint64_t advance(const std::string &host, int port) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return upstreams_[std::format("{}:{}", host, port)].generation++;
+    }
+
+    int count(const std::string &host, int port, uint64_t generation) const {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = upstreams_.find(std::format("{}:{}", host, port));
+      if (it == upstreams_.end()) return 0;
+      auto gen = it->second.counts.find(generation);
+      return gen != it->second.counts.end() ? gen->second : 0;
+    }
+
+    // True if the generation's requests were done before the deadline.
+    bool waitIdle(const std::string &host, int port, uint64_t generation, std::chrono::milliseconds timeout) {
+      const auto key = std::format("{}:{}", host, port);
+      std::unique_lock<std::mutex> lock(mutex_);
+      return cv_.wait_for(lock, timeout, [this, &key, generation] {
+        auto it = upstreams_.find(key);
+        return it == upstreams_.end() || !it->second.counts.count(generation);
+        });
+    }
+
+  private:
+    struct Upstream {
+      uint64_t generation = 0;
+      std::map<uint64_t, int> counts; // in flight by generation, none when zero
+    };
+
+    void release(const std::string &key, uint64_t generation) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = upstreams_.find(key);
+        if (it != upstreams_.end()) {
+          auto gen = it->second.counts.find(generation);
+          if (gen != it->second.counts.end() && --gen->second <= 0) {
+            it->second.counts.erase(gen);
+          }
+        }
+      }
+      cv_.notify_all();
+    }
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::unordered_map<std::string, Upstream> upstreams_;
+  };
+
+  // Progress and timings of the blue/green restarts, by projectId.
+  struct RestartReports {
+    // False while a restart of the project is still running: one at a time per project
+    bool begin(const std::string &projectId, const std::string &oldAppKey) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto &r = reports_[projectId];
+      if (r.json.value("status", "") == "running") {
+        return false;
+      }
+      r = Report{};
+      r.start = std::chrono::steady_clock::now();
+      r.json = {
+        {"projectId", projectId},
+        {"oldAppKey", oldAppKey},
+        {"status", "running"},
+        {"phase", "starting"},
+        {"phases", nlohmann::json::array()}
+      };
+      return true;
+    }
+
+    void phase(const std::string &projectId, const std::string &name, const nlohmann::json &extra = {}) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto &r = reports_[projectId];
+      auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - r.start).count();
+      nlohmann::json p = { {"name", name}, {"atMs", ms} };
+      if (extra.is_object()) p.update(extra);
+      r.json["phase"] = name;
+      r.json["phases"].push_back(p);
+      LOG_MSG << "Restart" << projectId << LOG_NOSPACE << ": " << name << "at" << ms << "ms";
+    }
+
+    nlohmann::json finish(const std::string &projectId, bool ok, const std::string &message) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto &r = reports_[projectId];
+      r.json["status"] = ok ? "success" : "error";
+      r.json["message"] = message;
+      r.json["totalMs"] = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - r.start).count();
+      return r.json;
+    }
+
+    void set(const std::string &projectId, const std::string &key, const nlohmann::json &value) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      reports_[projectId].json[key] = value;
+    }
+
+    nlohmann::json get(const std::string &projectId) const {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = reports_.find(projectId);
+      return it != reports_.end() ? it->second.json : nlohmann::json();
+    }
+
+  private:
+    struct Report {
+      std::chrono::steady_clock::time_point start;
+      nlohmann::json json;
+    };
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Report> reports_;
+  };
+
+  // One /api/health probe over TCP, or over the Unix domain socket at unixPath
+  bool embedderHealthy(const std::string &host, int port, const std::string &unixPath = "") {
+    UpstreamPool transport(1);
+    if (!unixPath.empty()) transport.setUnixSocket(host, port, unixPath);
+    auto cli = transport.connect(host, port);
+    cli->set_connection_timeout(1, 0);
+    cli->set_read_timeout(5, 0);
+    auto res = cli->Get("/api/health");
+    return res && res->status == 200;
+  }
+
+  // Until the embedder answers /api/health on its TCP socket, or on its own Unix domain socket
+  // with ownSocket (the TCP one may be shared); false if it exits, is stopped or the time
+  // runs out first
+  bool waitEmbedderReady(ProcessesHolder &procUtil, const std::string &appKey, int timeoutMs, const std::atomic<bool> &cancel, bool ownSocket = false) {
+    const auto ep = procUtil.getEndpoint(appKey);
+    if (ep.port <= 0 || (ownSocket && ep.unixPath.empty())) {
+      return false;
+    }
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (std::chrono::steady_clock::now() < deadline && !cancel) {
+      if (!procUtil.isRunning(appKey)) {
+        return false;
+      }
+      if (embedderHealthy(ep.host, ep.port, ownSocket ? ep.unixPath : "")) {
+        return true;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+    return false;
+  }
+
+  // Replacement of a running embedder on the listening socket of its project: the address
+  // stays the same and no connection is refused meanwhile. The new process is started next
+  // to the old one with a Unix domain socket of its own, probed there (on the shared port
+  // either could answer), and the proxy switches to it before the old one is drained and
+  // shut down. If it can't be reached on a socket of its own, the restart is refused and
+  // the old process keeps serving.
+  nlohmann::json rollingRestart(
+    ProcessesHolder &procUtil, ConfigStore &config, InflightTracker &inflight, UpstreamPool &upstreams, RestartReports &reports,
+    const std::string &oldAppKey, ProcessesHolder::LaunchInfo launch, int drainMs, const std::atomic<bool> &cancel)
+  {
+    const auto oldEp = procUtil.getEndpoint(oldAppKey);
+    const std::string projectId = oldEp.projectId;
+    if (!reports.begin(projectId, oldAppKey)) {
+      return { {"status", "error"}, {"message", "A restart of this project is already running"} };
+    }
+    auto fail = [&](const std::string &msg) {
+      LOG_MSG << "Restart" << projectId << "failed:" << msg;
+      return reports.finish(projectId, false, msg);
+      };
+    if (!procUtil.getProcessWithApiKey(oldAppKey)) return fail("Embedder appKey not found: " + oldAppKey);
+    if (oldEp.port <= 0) return fail("Rolling restart requires socket activation (embedder.socketActivation)");
+    const auto prevLaunch = procUtil.getLaunchInfo(oldAppKey);
+    if (launch.exePath.empty()) launch.exePath = prevLaunch.exePath;
+    if (launch.configPath.empty()) launch.configPath = prevLaunch.configPath;
+    if (!std::filesystem::exists(launch.exePath)) return fail("Embedder executable not found: " + launch.exePath);
+    if (!std::filesystem::exists(launch.configPath)) return fail("Embedder config file not found: " + launch.configPath);
+
+    const bool unixSockets = config.get()->unixSockets;
+    // Where the old process has a socket of its own, its shutdown request can't reach the new one
+    const bool oldOwnSocket = !oldEp.unixPath.empty() && embedderHealthy(oldEp.host, oldEp.port, oldEp.unixPath);
+    const auto newAppKey = generateAppKey();
+    auto proc = procUtil.getOrCreateProcess(newAppKey, projectId, false);
+    procUtil.setLaunchInfo(newAppKey, launch);
+    auto sock = procUtil.getOrCreateListenSocket(newAppKey, oldEp.host);
+    if (!sock) {
+      procUtil.discardProcess(newAppKey);
+      return fail("The project's listening socket is gone");
+    }
+    // Given regardless of embedder.unixSockets: it is how the new process is told apart
+    handOverSockets(procUtil, *proc, newAppKey, *sock, true);
+    const auto newEp = procUtil.getEndpoint(newAppKey);
+    if (newEp.unixPath.empty()) {
+      procUtil.discardProcess(newAppKey);
+      return fail("Rolling restart needs a Unix domain socket for the new instance, none could be created");
+    }
+    reports.set(projectId, "newAppKey", newAppKey);
+
+    if (!proc->startProcess(launch.exePath, { "--config", launch.configPath, "serve", "--appkey", newAppKey })) {
+      procUtil.discardProcess(newAppKey);
+      return fail("Failed to start embedder process, the old one keeps serving");
+    }
+    reports.phase(projectId, "spawned", { {"pid", proc->getProcessId()}, {"port", oldEp.port} });
+    if (!waitEmbedderReady(procUtil, newAppKey, 60000, cancel, true)) {
+      proc->stopProcess();
+      procUtil.discardProcess(newAppKey);
+      return fail("New instance did not answer on its Unix socket, the old one keeps serving");
+    }
+    reports.phase(projectId, "ready");
+
+    // Switch: the proxy's connections go to the new process' socket from here on. Requests
+    // counted under the generation that ends here were sent to the old process (see
+    // InflightTracker); they are given drainMs to complete.
+    upstreams.setUnixSocket(newEp.host, newEp.port, newEp.unixPath);
+    const auto generation = inflight.advance(oldEp.host, oldEp.port);
+    procUtil.promote(newAppKey);
+    reports.phase(projectId, "switched", { {"inflight", inflight.count(oldEp.host, oldEp.port, generation)} });
+    bool drained = false;
+    const auto drainDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(drainMs);
+    while (!drained && !cancel && std::chrono::steady_clock::now() < drainDeadline) {
+      drained = inflight.waitIdle(oldEp.host, oldEp.port, generation, std::chrono::milliseconds(250));
+    }
+    reports.phase(projectId, "drained", { {"complete", drained}, {"inflight", inflight.count(oldEp.host, oldEp.port, generation)} });
+    if (auto oldProc = procUtil.getProcessWithApiKey(oldAppKey)) {
+      // Over the shared port the request may land on the new process, which refuses the old
+      // appKey; the old one is then terminated after the wait
+      if (!sendEmbedderShutdown(oldEp.host, oldEp.port, oldAppKey, oldOwnSocket ? oldEp.unixPath : std::string())) {
+        LOG_MSG << "Failed to send shutdown request to embedder process" << oldProc->getProcessId();
+      }
+      if (!oldProc->waitForCompletion(10000)) {
+        LOG_MSG << "Embedder process" << oldProc->getProcessId() << "did not exit in time, terminating...";
+        oldProc->stopProcess();
+      }
+    }
+    procUtil.discardProcess(oldAppKey);
+    reports.phase(projectId, "stopped");
+    if (!unixSockets) {
+      // Only the new process is left on the shared port
+      upstreams.removeUnixSocket(oldEp.host, oldEp.port);
+    }
+    auto res = reports.finish(projectId, true, "Embedder restarted");
+    res["appKey"] = newAppKey;
+    res["host"] = oldEp.host;
+    res["port"] = oldEp.port;
+    return res;
+  }
+
+  // After a restart of the project's active process, its replicas are replaced too, so that
+  // requests are never balanced or hedged across two versions. The new ones start on sockets
+  // of their own and take over the group once they answer; the old ones are then drained of
+  // the requests they still have and shut down. Returns the appKeys of the new replicas.
+  std::vector<std::string> restartReplicas(
+    ProcessesHolder &procUtil, ReplicaBalancer &replicas, UpstreamPool &upstreams, EventHub &events,
+    const std::string &projectId, const ProcessesHolder::LaunchInfo &launch, bool unixSockets, int drainMs, const std::atomic<bool> &cancel)
+  {
+    const auto oldKeys = procUtil.getReplicaKeys(projectId);
+    std::vector<std::string> newKeys;
+    for (size_t i = 0; i < oldKeys.size() && !cancel; ++i) {
+      const auto key = generateAppKey();
+      auto proc = procUtil.createReplicaProcess(key, projectId, false);
+      procUtil.setLaunchInfo(key, launch);
+      ListenSocket *sock = procUtil.createStandbyListenSocket(key, "127.0.0.1");
+      if (sock) {
+        handOverSockets(procUtil, *proc, key, *sock, unixSockets);
+      }
+      if (!sock || !proc->startProcess(launch.exePath, { "--config", launch.configPath, "serve", "--appkey", key })) {
+        LOG_MSG << "Failed to start embedder replica" << i + 1 << "for projectId" << projectId;
+        procUtil.discardProcess(key);
+        continue;
+      }
+      publishInstance(events, procUtil.getEndpoint(key), "starting", true);
+      newKeys.push_back(key);
+    }
+    std::vector<std::string> ready;
+    for (const auto &key : newKeys) {
+      if (waitEmbedderReady(procUtil, key, 60000, cancel)) {
+        if (unixSockets) useUnixSocketWhenReady(procUtil, upstreams, key, 5000, cancel);
+        ready.push_back(key);
+        continue;
+      }
+      LOG_MSG << "Embedder replica" << key.substr(0, 8) << "did not become ready, dropping it";
+      if (auto proc = procUtil.getProcessWithApiKey(key)) proc->stopProcess();
+      publishInstance(events, procUtil.getEndpoint(key), "stopped", true);
+      procUtil.discardProcess(key);
+    }
+    // Switch: only the new versions from here on
+    for (const auto &key : ready) procUtil.setServing(key, true);
+    for (const auto &key : oldKeys) procUtil.setServing(key, false);
+    replicas.setGroups(procUtil.getReplicaGroups());
+    for (const auto &key : ready) publishInstance(events, procUtil.getEndpoint(key), "ready", true);
+
+    const auto drainDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(drainMs);
+    for (const auto &key : oldKeys) {
+      const auto ep = procUtil.getEndpoint(key);
+      while (!cancel && 0 < replicas.outstanding(ep.host, ep.port) && std::chrono::steady_clock::now() < drainDeadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      }
+      if (auto proc = procUtil.getProcessWithApiKey(key)) {
+        stopEmbedderProcess(*proc, ep.host, ep.port, key);
+      }
+      upstreams.removeUnixSocket(ep.host, ep.port);
+      publishInstance(events, ep, "stopped", true);
+      procUtil.discardProcess(key);
+    }
+    LOG_MSG << "Replaced" << oldKeys.size() << "embedder replica(s) of projectId" << projectId << "with" << ready.size();
+    return ready;
+  }
+
+  // The route's total timeout, or sooner if the caller said it won't wait that long
+  Deadline requestDeadline(const httplib::Request &req, const TimeoutPolicy &policy)
+  {
+    Deadline deadline(policy.total);
+    if (req.has_header(Deadline::header)) {
+      const long long ms = std::strtoll(req.get_header_value(Deadline::header).c_str(), nullptr, 10);
+      deadline = deadline.earliest(Deadline(std::chrono::milliseconds((std::max)(ms, 0ll))));
+    }
+    return deadline;
+  }
+
+  void respondTimedOut(httplib::Response &res)
+  {
+    res.status = 504;
+    res.set_content("{\"error\": \"Deadline exceeded\"}", "application/json");
+  }
+
+  void respondTooLarge(httplib::Response &res)
+  {
+    res.status = 413;
+    res.set_content("{\"error\": \"Request body too large\"}", "application/json");
+  }
+
+  // The scheduler refused the request: its class queue is full or it waited too long
+  void respondShed(httplib::Response &res, const RequestScheduler::Slot &slot)
+  {
+    res.status = 429;
+    res.set_header("Retry-After", std::to_string(slot.retryAfterSeconds()));
+    res.set_content("{\"error\": \"Too many requests\"}", "application/json");
+  }
+
+} // anonymous namespace
+
+int main(int argc, char *argv[]) {
+  LOG_START;
+  bool profileStartup = false;
+  for (int i = 1; i < argc; ++i) {
+    if (std::string(argv[i]) == "--startup-profile") profileStartup = true;
+  }
+  StartupProfiler startup(profileStartup);
+  startup.mark("main");
+
+  // Asset discovery, config load and the server bind run on worker threads while the main
+  // thread constructs the webview, which dominates cold start.
+  auto assetsFuture = std::async(std::launch::async, [&startup] {
+    auto path = Webview::findWebAssets();
+    startup.mark("assets-found");
+    return path;
+    });
+  auto configFuture = std::async(std::launch::async, [&startup] {
+    AppConfig cfg;
+    fetchOrCreatePrefsJson(cfg, getConfigPath());
+    startup.mark("config-loaded");
+    return cfg;
+    });
+
+  httplib::Server svr;
+  std::promise<int> portPromise;
+  auto portFuture = portPromise.get_future();
+  std::promise<bool> listenGate; // set once routes and mount point are in place
+  std::thread serverThread([&svr, &startup, &portPromise, gate = listenGate.get_future()]() mutable {
+    LOG_START;
+    // Inherited by accepted sockets. Streamed events are batched by the chat relay's
+    // frames (or deliberately not, in latency mode), never by Nagle.
+    svr.set_tcp_nodelay(true);
+    // Requests waiting for an upstream slot (see RequestScheduler) hold a worker; the
+    // scheduler sheds before they take them all
+    svr.new_task_queue = [] { return new httplib::ThreadPool(httpWorkers); };
+    const int port = svr.bind_to_any_port("127.0.0.1");
+    startup.mark("server-bound");
+    portPromise.set_value(port);
+    if (port < 0 || !gate.get()) {
+      return;
+    }
+    // Already listening since the bind: the page's first requests wait in the backlog, not in a sleep
+    LOG_MSG << "Starting HTTP server on http://127.0.0.1:" << port;
+    svr.listen_after_bind();
+    LOG_MSG << "HTTP server stopped";
+    });
+
+  std::unique_ptr<Webview> webview;
+  try {
+    webview = std::make_unique<Webview>(
+#ifdef _DEBUG
+      true
+#else
+      true // for now
+#endif
+      , nullptr);
+    startup.mark("webview-created");
+  } catch (const std::exception &e) {
+    LOG_MSG << "Webview error:" << e.what();
+  }
+
+  const std::string assetsPath = assetsFuture.get();
+  const int serverPort = portFuture.get();
+  if (!webview || assetsPath.empty() || serverPort < 0) {
+    if (assetsPath.empty()) {
+      LOG_MSG << "Error: Could not find web assets (index.html)";
+      LOG_MSG << "Please build the SPA client first:";
+      LOG_MSG << "  cd ../spa-svelte && npm run build";
+    }
+    if (serverPort < 0) {
+      LOG_MSG << "Error: Could not bind the HTTP server";
+    }
+    listenGate.set_value(false);
+    serverThread.join();
+    return 1;
+  }
+
+  ProcessesHolder procUtil;
+  InflightTracker inflight;
+  RestartReports restartReports;
+  std::atomic<bool> quitting{ false };
+  std::list<std::thread> restartThreads;
+  std::list<std::thread> backgroundThreads;
+
+  ConfigStore config(configFuture.get());
+  const auto prefs = config.get(); // startup values (window size, persistence settings)
+  PrefsWriter prefsWriter(getConfigPath(), [&config]
+    {
+      return config.get()->toJson();
+    }, std::chrono::milliseconds(prefs->persistDebounceMs), prefs->persistJournal);
+  // External edits of appconfig.json take effect without a restart
+  ConfigWatcher configWatcher(getConfigPath(), config, prefsWriter);
+  ProjectRegistry projects(prefs->projectCache
+    ? (fs::path(getConfigPath()).parent_path() / "projects.cache.json").string() : std::string());
+  MarkdownCache markdownCache;
+  RelayMetrics relayMetrics;
+  ConversationStore conversations((fs::path(getConfigPath()).parent_path() / "conversations.log").string());
+  AttachmentStore attachments((fs::path(getConfigPath()).parent_path() / "attachments").string());
+  TokenCounter tokenCounter;
+  PathIndex pathIndex;
+  PayloadCache payloadCache;
+  DocumentHistory documentHistory;
+  UpstreamPool upstreams;
+  // Waiting and running proxied requests leave some server threads to /host/..., the page's
+  // assets and the event streams
+  RequestScheduler scheduler(RequestScheduler::Limits{ .workers = httpWorkers - 8 });
+  AdaptiveTimeouts timeouts;
+  ReplicaBalancer replicas;
+  EventHub events;
+  // After the proxy switches to another instance (or one comes back), what the UI asks for first
+  // is fetched ahead; see warmup.h
+  UpstreamWarmer warmer(upstreams, { "/api/settings", "/api/stats", "/api/documents" });
+  // Items of /host/batch requests, shared by all of them
+  WorkerPool batchWorkers(8);
+  config.subscribe([&warmer](const ConfigStore::Snapshot &prev, const ConfigStore::Snapshot &next)
+    {
+      if (prev->host != next->host || prev->port != next->port) {
+        warmer.warm(next->host, next->port, "switch");
+      }
+    });
+  ChatSearchIndex chatIndex((fs::path(getConfigPath()).parent_path() / "chatsearch.idx").string());
+  backgroundThreads.emplace_back([&chatIndex, &conversations] {
+    chatIndex.open(conversations);
+    });
+
+  LOG_MSG << "Loading Svelte app from: " << fs::absolute(assetsPath).string();
+
+  svr.set_mount_point("/", fs::absolute(assetsPath).string().c_str());
+
+  svr.set_logger([](const auto &req, const auto &res) {
+    LOG_MSG << req.method << req.path << "->" << res.status;
+    });
+
+  // Rendered chat answers (see ChatStreamRelay), so the page can show them again without marked
+  svr.Get("/host/markdown/([0-9a-f-]+)", [&markdownCache](const httplib::Request &req, httplib::Response &res) {
+    const auto html = markdownCache.get(req.matches[1]);
+    if (!html) {
+      res.status = 404;
+      res.set_content("{\"error\": \"Not cached\"}", "application/json");
+      return;
+    }
+    res.set_content(*html, "text/html; charset=utf-8");
+    });
+
+  svr.Post("/host/markdown", [&markdownCache](const httplib::Request &req, httplib::Response &res) {
+    const auto key = MarkdownCache::keyOf(req.body);
+    auto html = markdownCache.get(key);
+    if (!html) {
+      html = renderMarkdown(req.body, "cb" + generateAppKey().substr(0, 6));
+      markdownCache.put(key, *html);
+    }
+    res.set_header("X-Md-Key", key);
+    res.set_content(*html, "text/html; charset=utf-8");
+    });
+
+  svr.Get("/host/conversations", [&conversations](const httplib::Request &, httplib::Response &res) {
+    res.set_content(conversations.list().dump(), "application/json");
+    });
+
+  svr.Get("/host/conversations/([A-Za-z0-9_-]+)", [&conversations](const httplib::Request &req, httplib::Response &res) {
+    const std::string id = req.matches[1];
+    res.set_content(nlohmann::json{ {"id", id}, {"messages", conversations.messages(id)} }.dump(), "application/json");
+    });
+
+  svr.Delete("/host/conversations/([A-Za-z0-9_-]+)", [&conversations, &chatIndex](const httplib::Request &req, httplib::Response &res) {
+    conversations.remove(req.matches[1]);
+    chatIndex.remove(req.matches[1]);
+    res.set_content("{}", "application/json");
+    });
+
+  // Full-text search over the stored conversations: ?q=<words>&limit=<n>
+  svr.Get("/host/search", [&conversations, &chatIndex](const httplib::Request &req, httplib::Response &res) {
+    const size_t limit = req.has_param("limit") ? std::strtoul(req.get_param_value("limit").c_str(), nullptr, 10) : 20;
+    res.set_content(chatIndex.query(conversations, req.get_param_value("q"), (std::min)(limit, size_t(100))).dump(), "application/json");
+    });
+
+  // Fetches /api/documents of the current embedder into the path index and the version
+  // history. False if the embedder didn't answer with a list.
+  auto syncDocuments = [&config, &inflight, &upstreams, &warmer, &scheduler, &timeouts, &replicas, &pathIndex, &documentHistory](const std::string &host, int port, const std::string &source) {
+    auto inflightGuard = inflight.track(host, port);
+    nlohmann::json documents;
+    if (auto warm = warmer.take(host, port, "/api/documents")) {
+      documents = warm->status == 200 ? nlohmann::json::parse(warm->body, nullptr, false) : nlohmann::json();
+    } else {
+      const auto slot = scheduler.acquire(source, RequestClass::Bulk);
+      if (!slot) {
+        return false;
+      }
+      const auto cfg = config.get();
+      const auto policy = timeouts.policy("/api/documents", cfg->timeouts);
+      const auto reply = hedgedGet(replicas, upstreams, timeouts, host, port, "/api/documents", policy, Deadline(policy.total), cfg->hedgeGets);
+      documents = reply.status == 200 ? nlohmann::json::parse(reply.body, nullptr, false) : nlohmann::json();
+    }
+    if (!documents.is_array()) {
+      return false;
+    }
+    const auto stats = pathIndex.refresh(documents, source);
+    const auto version = documentHistory.update(source, std::move(documents));
+    LOG_MSG << "Document paths:" << stats.total << "added" << stats.added << "removed" << stats.removed << "in" << stats.millis << "ms, version" << version;
+    return true;
+    };
+
+  // What the page used to poll for, watched here once for all pages and published when it
+  // changes (see events.h): whether the embedder answers, what its processes use and the
+  // version of its document list. Each only while some page listens.
+  std::atomic<bool> recheckHealth{ false };
+  std::atomic<bool> recheckIndex{ false };
+  config.subscribe([&recheckHealth, &recheckIndex](const ConfigStore::Snapshot &prev, const ConfigStore::Snapshot &next)
+    {
+      if (prev->host != next->host || prev->port != next->port) {
+        recheckHealth = true;
+        recheckIndex = true;
+      }
+    });
+  backgroundThreads.emplace_back([&config, &events, &upstreams, &procUtil, &documentHistory, &syncDocuments, &quitting, &recheckHealth, &recheckIndex] {
+    using Clock = std::chrono::steady_clock;
+    std::optional<bool> healthy;
+    std::string healthOf;
+    uint64_t indexVersion = 0;
+    std::unordered_map<std::string, std::pair<double, Clock::time_point>> cpuSeen; // by appKey
+    Clock::time_point nextHealth, nextResources;
+    for (; !quitting; std::this_thread::sleep_for(std::chrono::milliseconds(250))) {
+      const auto now = Clock::now();
+      const auto cfg = config.get();
+      const auto endpoint = std::format("{}:{}", cfg->host, cfg->port);
+
+      const bool healthDue = recheckHealth.exchange(false) || nextHealth <= now;
+      if (!events.hasSubscribers("health")) {
+        healthy.reset(); // published again to whoever listens next
+      } else if (healthDue) {
+        auto cli = upstreams.acquire(cfg->host, cfg->port, std::chrono::seconds(2));
+        auto res = cli->Get("/api/health");
+        const bool ok = res && res->status == 200;
+        if (!ok) cli.discard();
+        if (healthy != ok || healthOf != endpoint) {
+          healthy = ok;
+          healthOf = endpoint;
+          events.publish("health", "", { {"ok", ok}, {"host", cfg->host}, {"port", cfg->port} });
+        }
+        // A lost embedder is noticed within 10 s, a returning one within 2 s
+        nextHealth = now + std::chrono::seconds(ok ? 10 : 2);
+      }
+
+      if (nextResources <= now && events.hasSubscribers("resources")) {
+        for (const auto &u : procUtil.getResourceUsage()) {
+          auto &[cpuBefore, at] = cpuSeen[u.endpoint.appKey];
+          const double seconds = std::chrono::duration<double>(now - at).count();
+          const double cpuPercent = at != Clock::time_point() && 0 < seconds ? 100.0 * (u.cpuSeconds - cpuBefore) / seconds : 0.0;
+          cpuBefore = u.cpuSeconds;
+          at = now;
+          events.publish("resources", u.endpoint.appKey, {
+            {"appKey", u.endpoint.appKey}, {"projectId", u.endpoint.projectId}, {"host", u.endpoint.host}, {"port", u.endpoint.port},
+            {"pid", u.pid}, {"cpuPercent", (std::max)(cpuPercent, 0.0)}, {"rssBytes", u.rssBytes}
+            });
+        }
+        nextResources = now + std::chrono::seconds(5);
+      }
+
+      // Only after a change went through the proxy or the backend changed (recheckIndex),
+      // never on a timer: a sync fetches the whole document list
+      if (recheckIndex.exchange(false) && events.hasSubscribers("index")) {
+        if (syncDocuments(cfg->host, cfg->port, endpoint)) {
+          const auto version = documentHistory.since(endpoint, 0, false).value("version", uint64_t(0));
+          if (version != indexVersion) {
+            indexVersion = version;
+            events.publish("index", "", { {"source", endpoint}, {"version", version} });
+          }
+        }
+      }
+    }
+    });
+
+  // Document list of the embedder as changes since the version the page holds: ?since=<version>.
+  // Without it, or when that version is no longer known, the full list is returned (just the
+  // version with list=0).
+  svr.Get("/host/documents", [&config, &documentHistory, &syncDocuments](const httplib::Request &req, httplib::Response &res) {
+    const auto cfg = config.get();
+    const std::string source = cfg->host + ":" + std::to_string(cfg->port);
+    if (!syncDocuments(cfg->host, cfg->port, source) && documentHistory.since(source, 0, false)["version"] == 0) {
+      res.status = 503;
+      res.set_content("{\"error\": \"Backend unavailable\"}", "application/json");
+      return;
+    }
+    const uint64_t since = std::strtoull(req.get_param_value("since").c_str(), nullptr, 10);
+    res.set_content(documentHistory.since(source, since, req.get_param_value("list") != "0").dump(), "application/json");
+    });
+
+  // Context file picker: ?q=<substring>&offset=&limit=, best matches first. The index is
+  // filled by /host/documents, or from /api/documents on refresh=1 or when the embedder changed.
+  svr.Get("/host/documents/search", [&config, &pathIndex, &syncDocuments](const httplib::Request &req, httplib::Response &res) {
+    const auto cfg = config.get();
+    const std::string source = cfg->host + ":" + std::to_string(cfg->port);
+    if (req.get_param_value("refresh") == "1" || pathIndex.source() != source) {
+      if (!syncDocuments(cfg->host, cfg->port, source) && pathIndex.empty()) {
+        res.status = 503;
+        res.set_content("{\"error\": \"Backend unavailable\"}", "application/json");
+        return;
+      }
+    }
+    const size_t offset = std::strtoul(req.get_param_value("offset").c_str(), nullptr, 10);
+    const size_t limit = req.has_param("limit") ? std::strtoul(req.get_param_value("limit").c_str(), nullptr, 10) : 200;
+    res.set_content(pathIndex.search(req.get_param_value("q"), offset, (std::min)(limit, size_t(1000))).dump(), "application/json");
+    });
+
+  // Attachments picked in the page: the raw file as the body, ?name=<filename>
+  svr.Post("/host/attachments", [&attachments](const httplib::Request &req, httplib::Response &res) {
+    try {
+      const auto blob = attachments.ingestData(req.get_param_value("name"), req.body);
+      res.set_content(blob.toJson().dump(), "application/json");
+    } catch (const std::exception &ex) {
+      res.status = 413;
+      res.set_content(nlohmann::json{ {"error", ex.what()} }.dump(), "application/json");
+    }
+    });
+
+  svr.Get("/host/metrics/sse", [&relayMetrics](const httplib::Request &, httplib::Response &res) {
+    res.set_content(relayMetrics.toJson().dump(), "application/json");
+    });
+
+  // Latency percentiles and the timeouts in effect per route
+  svr.Get("/host/metrics/timeouts", [&config, &timeouts](const httplib::Request &, httplib::Response &res) {
+    res.set_content(timeouts.stats(config.get()->timeouts).dump(), "application/json");
+    });
+
+  svr.Get("/host/metrics/replicas", [&replicas](const httplib::Request &, httplib::Response &res) {
+    res.set_content(replicas.stats().dump(), "application/json");
+    });
+
+  // Queue depths, wait and service times of the request classes (see reqsched.h)
+  svr.Get("/host/metrics/scheduler", [&scheduler](const httplib::Request &, httplib::Response &res) {
+    res.set_content(scheduler.stats().dump(), "application/json");
+    });
+
+  svr.Get("/host/metrics/warmup", [&warmer](const httplib::Request &, httplib::Response &res) {
+    res.set_content(warmer.stats().dump(), "application/json");
+    });
+
+  svr.Get("/host/metrics/events", [&events](const httplib::Request &, httplib::Response &res) {
+    res.set_content(events.stats().dump(), "application/json");
+    });
+
+  // Push channel to the page as server-sent events: ?topics=health,instances,... (all without).
+  // Starts with the current state of each topic, then sends changes as they happen.
+  svr.Get("/host/events", [&events](const httplib::Request &req, httplib::Response &res) {
+    std::set<std::string> topics;
+    std::stringstream ss(req.get_param_value("topics"));
+    for (std::string topic; std::getline(ss, topic, ',');) {
+      if (!topic.empty()) topics.insert(topic);
+    }
+    std::shared_ptr<EventHub::Subscription> sub = events.subscribe(topics);
+    res.set_header("Cache-Control", "no-cache");
+    res.set_chunked_content_provider("text/event-stream", [sub](size_t offset, httplib::DataSink &sink) {
+      // The browser reconnects after 2 s if the connection drops
+      std::string out = offset == 0 ? "retry: 2000\n\n" : "";
+      for (const auto &e : sub->next(std::chrono::seconds(15))) {
+        out += EventHub::format(e);
+      }
+      if (sub->closed()) {
+        sink.done();
+        return true;
+      }
+      // A comment now and then, so that a connection gone dead is noticed
+      if (out.empty()) out = ": ping\n\n";
+      return sink.write(out.data(), out.size());
+      });
+    });
+
+  svr.Get("/api/.*", [&config, &inflight, &upstreams, &warmer, &scheduler, &timeouts, &replicas, &payloadCache](const httplib::Request &req, httplib::Response &res) {
+    LOG_START;
+    LOG_MSG << "svr.Get" << req.method << req.path;
+    const auto cfg = config.get();
+    const std::string &host = cfg->host;
+    const int port = cfg->port;
+
+    auto inflightGuard = inflight.track(host, port);
+    // Downloads, ranges and other large bodies are relayed as they arrive, not held
+    // (see passthrough.h); the replica, the in-flight count and the slot are kept until sent
+    const bool streamed = req.has_header("Range") || std::any_of(cfg->streamRoutes.begin(), cfg->streamRoutes.end(),
+      [&req](const std::string &route) { return req.path.rfind(route, 0) == 0; });
+    if (streamed) {
+      const auto policy = timeouts.policy(AdaptiveTimeouts::routeOf(req.path), cfg->timeouts);
+      const auto deadline = requestDeadline(req, policy);
+      auto slot = scheduler.acquire(std::format("{}:{}", host, port), classifyRequest("GET", req.path));
+      if (!slot) {
+        respondShed(res, slot);
+        return;
+      }
+      // The upstream slot too: the body is sent after this handler returns
+      struct Hold {
+        InflightTracker::Guard inflight;
+        ReplicaBalancer::Ticket replica;
+        RequestScheduler::Slot slot;
+      };
+      auto hold = std::make_shared<Hold>(Hold{ std::move(inflightGuard), replicas.pick(host, port), std::move(slot) });
+      const auto &replica = hold->replica;
+      const int status = streamGet(upstreams, timeouts, replica.host(), replica.port(), req, res, policy, deadline, hold);
+      if (status == 503) {
+        res.status = 503;
+        res.set_content("{\"error\": \"Backend unavailable\"}", "application/json");
+      } else if (status == 504) {
+        respondTimedOut(res);
+      }
+      return;
+    }
+    // Answered by the warm-up after a switch or reconnect if it fetched this path
+    UpstreamWarmer::Answer answer;
+    if (auto warm = warmer.take(host, port, req.path)) {
+      LOG_MSG << "Served from warm-up, saved" << warm->micros << "us";
+      answer = std::move(*warm);
+    } else {
+      const auto policy = timeouts.policy(AdaptiveTimeouts::routeOf(req.path), cfg->timeouts);
+      const auto deadline = requestDeadline(req, policy);
+      const auto slot = scheduler.acquire(std::format("{}:{}", host, port), classifyRequest("GET", req.path));
+      if (!slot) {
+        respondShed(res, slot);
+        return;
+      }
+      auto reply = hedgedGet(replicas, upstreams, timeouts, host, port, req.path, policy, deadline, cfg->hedgeGets);
+      warmer.noteResult(host, port, reply.status != 503);
+      if (reply.status == 503) {
+        res.status = 503;
+        res.set_content("{\"error\": \"Backend unavailable\"}", "application/json");
+        return;
+      }
+      if (reply.status == 504) {
+        respondTimedOut(res);
+        return;
+      }
+      answer.status = reply.status;
+      answer.body = std::move(reply.body);
+      answer.contentType = std::move(reply.contentType);
+    }
+    res.status = answer.status;
+    // JSON goes out in a compact encoding if the client asks for one (see payloadcodec.h)
+    const auto encoding = negotiateEncoding(req.get_header_value("Accept"));
+    if (encoding != PayloadEncoding::Json && answer.status == 200 && answer.contentType.find("json") != std::string::npos) {
+      double micros = 0;
+      if (auto encoded = payloadCache.transcode(answer.body, encoding, micros)) {
+        if (micros) {
+          LOG_MSG << "Transcoded" << req.path << "to" << contentTypeOf(encoding) << answer.body.size() << "->" << encoded->size() << "bytes in" << micros << "us";
+        }
+        res.set_header("Vary", "Accept");
+        res.set_content(*encoded, contentTypeOf(encoding));
+        return;
+      }
+    }
+    res.set_content(answer.body, answer.contentType);
+    });
+
+  // Several GETs of the page in one round trip: {"requests": [{id, path, timeoutMs}]} ->
+  // {"responses": [{id, status, body, micros}], micros}. The items run at the same time over
+  // pooled connections, on the batch workers and the request's own thread, each within its
+  // own timeout (504 when it ran out, 429 when shed), and items asking for the same path
+  // share one upstream request. An invalid item gets 400 on its own. JSON bodies are
+  // embedded as they are.
+  svr.Post("/host/batch", [&config, &inflight, &upstreams, &warmer, &scheduler, &timeouts, &replicas, &batchWorkers, &startup](const httplib::Request &req, httplib::Response &res) {
+    const auto t0 = std::chrono::steady_clock::now();
+    const auto j = nlohmann::json::parse(req.body, nullptr, false);
+    if (!j.is_object() || !j.contains("requests") || !j["requests"].is_array() || 32 < j["requests"].size()) {
+      res.status = 400;
+      res.set_content("{\"error\": \"Expected {requests: [{id, path}]}, at most 32\"}", "application/json");
+      return;
+    }
+    const auto cfg = config.get();
+    struct Item {
+      std::string path;
+      std::chrono::milliseconds timeout;
+      int status = 0;
+      std::string body;
+      std::string contentType;
+      double micros = 0;
+    };
+    // Outlives the request if a worker only gets to it afterwards (and finds nothing left)
+    struct Batch {
+      std::vector<Item> items;
+      std::atomic<size_t> next{ 0 };
+      std::mutex mutex;
+      std::condition_variable cv;
+      size_t done = 0;
+    };
+    auto batch = std::make_shared<Batch>();
+    auto &items = batch->items;
+    std::unordered_map<std::string, size_t> byPath;
+    std::vector<size_t> itemOf;
+    std::vector<std::string> invalid; // why, for the items with no upstream request
+    for (const auto &r : j["requests"]) {
+      const bool hasPath = r.is_object() && r.contains("path") && r["path"].is_string();
+      const std::string path = hasPath ? r["path"].get<std::string>() : "";
+      const bool hasTimeout = r.is_object() && r.contains("timeoutMs");
+      if (path.rfind("/api/", 0) != 0 || (hasTimeout && !r["timeoutMs"].is_number())) {
+        invalid.push_back(path.rfind("/api/", 0) != 0 ? "Only /api/ paths can be batched" : "timeoutMs must be a number");
+        itemOf.push_back(SIZE_MAX);
+        continue;
+      }
+      invalid.emplace_back();
+      const double timeoutMs = hasTimeout ? r["timeoutMs"].get<double>() : 10000.0;
+      const auto timeout = std::chrono::milliseconds(static_cast<int>(std::clamp(timeoutMs, 1.0, 60000.0)));
+      auto [it, added] = byPath.emplace(path, items.size());
+      if (added) {
+        items.push_back(Item{ .path = path, .timeout = timeout, .status = 0, .body = {}, .contentType = {}, .micros = 0 });
+      } else {
+        items[it->second].timeout = (std::max)(items[it->second].timeout, timeout);
       }
+      itemOf.push_back(it->second);
     }
 
-  private:
-    std::unordered_map<std::string, std::unique_ptr<ProcessManager>> embedderProcesses_;
-    std::unordered_map<std::string, std::string> projectIdToAppKey_; // we assume 1 to 1 relationship
-    std::unordered_map<std::string, std::string> appKeyToProjectId_;
-  };
-
-} // anonymous namespace
-
-int main() {
-  LOG_START;
-  const std::string assetsPath = Webview::findWebAssets();
-  if (assetsPath.empty()) {
-    LOG_MSG << "Error: Could not find web assets (index.html)";
-    LOG_MSG << "Please build the SPA client first:";
-    LOG_MSG << "  cd ../spa-svelte && npm run build";
-    return 1;
-  }
-
-  ProcessesHolder procUtil;
-
-  AppConfig prefs;
-  fetchOrCreatePrefsJson(prefs);
-
-  LOG_MSG << "Loading Svelte app from: " << fs::absolute(assetsPath).string();
-
-  httplib::Server svr;
-  svr.set_mount_point("/", fs::absolute(assetsPath).string().c_str());
-
-  svr.set_logger([](const auto &req, const auto &res) {
-    LOG_MSG << req.method << req.path << "->" << res.status;
-    });
-
-  svr.Get("/api/.*", [&prefs](const httplib::Request &req, httplib::Response &res) {
-    LOG_START;
-    LOG_MSG << "svr.Get" << req.method << req.path;
-    std::string host;
-    int port;
+    auto fetch = [cfg, &inflight, &upstreams, &warmer, &scheduler, &timeouts, &replicas](Item &item) {
+      const auto start = std::chrono::steady_clock::now();
+      auto inflightGuard = inflight.track(cfg->host, cfg->port);
+      if (auto warm = warmer.take(cfg->host, cfg->port, item.path)) {
+        item.status = warm->status;
+        item.body = std::move(warm->body);
+        item.contentType = std::move(warm->contentType);
+        item.micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        return;
+      }
+      const auto slot = scheduler.acquire(std::format("{}:{}", cfg->host, cfg->port), classifyRequest("GET", item.path));
+      if (!slot) {
+        item.status = 429;
+        return;
+      }
+      const auto policy = timeouts.policy(AdaptiveTimeouts::routeOf(item.path), cfg->timeouts);
+      auto reply = hedgedGet(replicas, upstreams, timeouts, cfg->host, cfg->port, item.path, policy,
+        Deadline(policy.total).earliest(Deadline(item.timeout)), cfg->hedgeGets);
+      item.micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+      item.status = reply.status;
+      item.body = std::move(reply.body);
+      item.contentType = std::move(reply.contentType);
+      };
+    auto work = [batch, fetch] {
+      for (size_t i; (i = batch->next++) < batch->items.size();) {
+        fetch(batch->items[i]);
+        std::lock_guard<std::mutex> lock(batch->mutex);
+        ++batch->done;
+        batch->cv.notify_all();
+      }
+      };
+    // With the workers busy with other batches, this thread gets through the items itself
+    for (size_t i = 1; i < (std::min)(items.size(), batchWorkers.size() + 1); ++i) {
+      batchWorkers.post(work);
+    }
+    work();
     {
-      std::lock_guard<std::mutex> lock(prefs.mutex_);
-      host = prefs.host;
-      port = prefs.port;
+      std::unique_lock<std::mutex> lock(batch->mutex);
+      batch->cv.wait(lock, [&batch] { return batch->done == batch->items.size(); });
     }
 
-    httplib::Client cli(host, port);
-    cli.set_connection_timeout(0, 60 * 1000ull);
-    auto result = cli.Get(req.path.c_str());
-    if (result) {
-      res.status = result->status;
-      res.set_content(result->body, result->get_header_value("Content-Type"));
-    } else {
-      res.status = 503;
-      res.set_content("{\"error\": \"Backend unavailable\"}", "application/json");
+    auto responses = nlohmann::json::array();
+    for (size_t i = 0; i < itemOf.size(); ++i) {
+      nlohmann::json r = { {"id", j["requests"][i].is_object() ? j["requests"][i].value("id", nlohmann::json(i)) : nlohmann::json(i)} };
+      if (itemOf[i] == SIZE_MAX) {
+        r["status"] = 400;
+        r["body"] = { {"error", invalid[i]} };
+      } else {
+        const auto &item = items[itemOf[i]];
+        r["status"] = item.status;
+        r["micros"] = item.micros;
+        if (item.status == 429 || item.status == 503 || item.status == 504) {
+          r["body"] = { {"error", item.status == 429 ? "Too many requests" : item.status == 504 ? "Timed out" : "Backend unavailable"} };
+        } else if (item.contentType.find("json") != std::string::npos) {
+          auto body = nlohmann::json::parse(item.body, nullptr, false);
+          r["body"] = body.is_discarded() ? nlohmann::json(item.body) : std::move(body);
+        } else {
+          r["body"] = item.body;
+        }
+      }
+      responses.push_back(std::move(r));
     }
+    const double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+    LOG_MSG << "Batch of" << itemOf.size() << "requests (" << items.size() << "upstream) in" << micros << "us";
+    startup.mark("batch-served");
+    res.set_content(nlohmann::json{ {"responses", std::move(responses)}, {"micros", micros} }.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace), "application/json");
     });
 
-  svr.Post("/api/.*", [&prefs](const httplib::Request &req, httplib::Response &res) {
+  svr.Post("/api/.*", [&config, &inflight, &upstreams, &scheduler, &timeouts, &replicas, &markdownCache, &relayMetrics, &conversations, &attachments, &tokenCounter, &chatIndex, &recheckIndex](const httplib::Request &req, httplib::Response &res, const httplib::ContentReader &reader) {
     LOG_START;
     LOG_MSG << "svr.Post" << req.method << req.path;
 
@@ -461,43 +1652,224 @@ int main() {
     if (contentType.empty()) {
       contentType = "application/json";
     }
+    // The body is read here, not by httplib up front; one that says it's too large isn't read at all
+    const size_t maxBody = static_cast<size_t>(config.get()->maxBodyMB) << 20;
+    const bool lengthKnown = req.has_header("Content-Length");
+    const uint64_t length = lengthKnown ? std::strtoull(req.get_header_value("Content-Length").c_str(), nullptr, 10) : 0;
+    if (maxBody < length) {
+      respondTooLarge(res);
+      return;
+    }
 
     // Special case for /api/chat - handle streaming
     if (req.path.find("/api/chat") != std::string::npos) {
 
+      // The page may send only what the host doesn't have: new messages of a stored
+      // conversation ({conversationId, baseCount, messages}) and attachments by digest.
+      // The full upstream request is rebuilt here.
+      // The history is also counted and, if it doesn't fit the budget of the target api,
+      // trimmed from the oldest end before it goes out.
+      // It is parsed and rebuilt, so read whole; attachments come by digest, not in it
+      std::string requestBody;
+      bool tooLarge = false;
+      const bool bodyRead = reader([&requestBody, &tooLarge, maxBody](const char *data, size_t len) {
+        tooLarge = maxBody < requestBody.size() + len;
+        if (!tooLarge) requestBody.append(data, len);
+        return !tooLarge;
+        });
+      if (!bodyRead) {
+        if (tooLarge) respondTooLarge(res);
+        else res.status = 400;
+        return;
+      }
+      std::string conversationId;
+      std::shared_ptr<const std::string> body;
+      nlohmann::json historyNote;
+      const auto chatCfg = config.get();
+      const auto &historyTokens = chatCfg->historyTokens;
+      // Always parsed: every answer reports its token count, trimmed or not
+      {
+        auto j = nlohmann::json::parse(requestBody, nullptr, false);
+        if (j.is_object()) {
+          std::string error;
+          if (!inlineAttachments(j, attachments, error)) {
+            res.status = 400;
+            res.set_content(nlohmann::json{ {"error", error} }.dump(), "application/json");
+            return;
+          }
+          if (j.contains("conversationId") && j["conversationId"].is_string()) {
+            conversationId = j["conversationId"].get<std::string>();
+            if (!ConversationStore::isValidId(conversationId) || !j.contains("messages") || !j["messages"].is_array() ||
+                !j.value("baseCount", nlohmann::json(0)).is_number_unsigned()) {
+              res.status = 400;
+              res.set_content("{\"error\": \"Invalid conversation request\"}", "application/json");
+              return;
+            }
+            nlohmann::json all;
+            if (!conversations.splice(conversationId, j.value("baseCount", size_t(0)), j["messages"], all)) {
+              // The page resends the whole history with baseCount 0
+              res.status = 409;
+              res.set_content(nlohmann::json{ {"error", "Conversation out of sync"}, {"stored", conversations.count(conversationId)} }.dump(), "application/json");
+              return;
+            }
+            chatIndex.truncate(conversationId, j.value("baseCount", size_t(0)));
+            chatIndex.update(conversations, conversationId);
+            j["messages"] = std::move(all);
+            j.erase("conversationId");
+            j.erase("baseCount");
+          }
+          if (j.contains("messages") && j["messages"].is_array()) {
+            const std::string api = j.contains("targetapi") && j["targetapi"].is_string() ? j["targetapi"].get<std::string>() : "";
+            auto it = historyTokens.find(api);
+            if (it == historyTokens.end()) {
+              it = historyTokens.find("default");
+            }
+            const size_t budget = it != historyTokens.end() ? static_cast<size_t>(it->second) : 0;
+            // Inlined attachments go out with the history, so they take from its budget
+            size_t attachmentTokens = 0;
+            if (j.contains("attachments") && j["attachments"].is_array()) {
+              for (const auto &a : j["attachments"]) {
+                if (a.is_object() && a.contains("content") && a["content"].is_string()) {
+                  attachmentTokens += TokenCounter::count(a["content"].get<std::string>()) + TokenCounter::count(a.value("filename", "")) + 4;
+                }
+              }
+            }
+            // What is left for the messages; never 0, which would mean "don't trim"
+            const size_t messageBudget = budget ? (std::max)(budget, attachmentTokens + 1) - attachmentTokens : 0;
+            const auto fit = fitHistory(j["messages"], messageBudget, tokenCounter);
+            LOG_MSG << "History ~" << LOG_NOSPACE << fit.tokens << " tokens + " << attachmentTokens << " in attachments, budget " << budget
+              << ", trimmed " << fit.dropped << " message(s) in " << fit.micros << "us";
+            // Sent with every answer, so the page always knows what the request cost
+            historyNote = {
+              {"type", "tokens"},
+              {"tokens", {{"sent", fit.tokens + attachmentTokens}, {"attachments", attachmentTokens}, {"budget", budget},
+                {"dropped", fit.dropped}, {"droppedTokens", fit.droppedTokens}}}
+            };
+            if (fit.dropped) {
+              historyNote["content"] = "[meta]History trimmed to fit " + std::to_string(budget) + " tokens: " +
+                std::to_string(fit.dropped) + " oldest message(s), ~" + std::to_string(fit.droppedTokens) + " tokens";
+            }
+          }
+          body = std::make_shared<const std::string>(j.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace));
+        }
+      }
+      if (!body) {
+        body = std::make_shared<const std::string>(std::move(requestBody));
+      }
+
+      // Held until the stream ends
+      auto slot = std::make_shared<RequestScheduler::Slot>(scheduler.acquire(std::format("{}:{}", chatCfg->host, chatCfg->port), RequestClass::Interactive));
+      if (!*slot) {
+        respondShed(res, *slot);
+        return;
+      }
+
+      const auto policy = timeouts.policy(AdaptiveTimeouts::routeOf(req.path), chatCfg->timeouts);
+      const auto deadline = requestDeadline(req, policy);
+      if (deadline.remaining() <= timeouts.doomedBelow(AdaptiveTimeouts::routeOf(req.path))) {
+        respondTimedOut(res);
+        return;
+      }
+
       // Set up streaming response headers
       res.set_header("Content-Type", "text/event-stream");
       res.set_header("Cache-Control", "no-cache");
       res.set_header("Connection", "keep-alive");
 
+      // The page asks for html next to the raw events; it falls back to marked if this
+      // header doesn't come back
+      const bool renderMd = req.get_header_value("X-Md-Render") == "html" && config.get()->renderMarkdown;
+      if (renderMd) {
+        res.set_header("X-Md-Render", "html");
+      }
+
       res.set_chunked_content_provider(
         "text/event-stream",
-        [&prefs, req, &res, contentType](size_t offset, httplib::DataSink &sink) {
+        [&config, &inflight, &upstreams, &timeouts, &replicas, &markdownCache, &relayMetrics, &conversations, &chatIndex, path = req.path, body, &res, contentType, renderMd, conversationId, historyNote, slot, policy, deadline](size_t offset, httplib::DataSink &sink) {
           LOG_MSG << "Starting chunked content provider, offset:" << offset;
-          std::string host;
-          int port;
-          {
-            std::lock_guard<std::mutex> lock(prefs.mutex_);
-            host = prefs.host;
-            port = prefs.port;
+          // The stream stays on the snapshot it started with, even if the config changes meanwhile
+          const auto cfg = config.get();
+          // A conversation stays on one replica of the project, whose caches know it
+          const auto replica = replicas.pickSticky(cfg->host, cfg->port, conversationId);
+          const std::string &host = replica.host();
+          const int port = replica.port();
+
+          // Keeps a replaced instance alive until this stream completes (see rollingRestart)
+          auto inflightGuard = inflight.track(host, port);
+          auto cli = upstreams.connect(host, port);
+          cli->set_connection_timeout((std::min)(policy.connect, deadline.remaining()));
+          // Per read: the first byte and idle limits are checked on top
+          const auto readTimeout = (std::min)((std::max)(policy.firstByte, policy.idle), deadline.remaining());
+          cli->set_read_timeout(readTimeout);
+          cli->set_write_timeout(deadline.remaining());
+
+          RelayOptions relayOpts;
+          relayOpts.coalesce = cfg->streamMode == "throughput";
+          relayOpts.frame = std::chrono::milliseconds(cfg->streamFrameMs);
+          relayOpts.frameBytes = static_cast<size_t>(cfg->streamFrameBytes);
+          relayOpts.captureAnswer = !conversationId.empty();
+          ChatStreamRelay relay([&sink](const char *data, size_t len)
+            {
+              return sink.write(data, len);
+            }, renderMd ? &markdownCache : nullptr, "cb" + generateAppKey().substr(0, 6), relayOpts, &relayMetrics);
+          if (!historyNote.is_null()) {
+            relay.sendEvent(historyNote);
           }
 
-          httplib::Client cli(host, port);
-          cli.set_connection_timeout(0, 60 * 1000ull);
-
-          httplib::Headers headers = { {"Accept", "text/event-stream"} };
-          auto postRes = cli.Post(
-            req.path.c_str(),
+          // The first chunk, the gaps between events and the deadline are checked as they arrive
+          const auto start = std::chrono::steady_clock::now();
+          auto last = start;
+          double firstByteMs = -1;
+          double maxIdleMs = 0;
+          const char *timedOut = nullptr;
+          httplib::Headers headers = { {"Accept", "text/event-stream"}, {Deadline::header, std::to_string(deadline.remaining().count())} };
+          auto postRes = cli->Post(
+            path.c_str(),
             headers,
-            req.body,
+            *body,
             contentType,
-            [&sink](const char *data, size_t len) -> bool {
+            [&](const char *data, size_t len) -> bool {
               //LOG_MSG << "Received chunk: " << len << " bytes";
-              return sink.write(data, len);
+              const auto now = std::chrono::steady_clock::now();
+              const double gapMs = std::chrono::duration<double, std::milli>(now - last).count();
+              last = now;
+              if (firstByteMs < 0) {
+                firstByteMs = gapMs;
+                if (policy.firstByte.count() < firstByteMs) timedOut = "first response";
+              } else {
+                maxIdleMs = (std::max)(maxIdleMs, gapMs);
+                if (policy.idle.count() < gapMs) timedOut = "next event";
+              }
+              if (!timedOut && deadline.expired()) timedOut = "deadline";
+              return !timedOut && relay.onData(data, len);
             }
           );
+          const auto end = std::chrono::steady_clock::now();
+          const double totalMs = std::chrono::duration<double, std::milli>(end - start).count();
+          if (!postRes && !timedOut) {
+            if (deadline.expired()) {
+              timedOut = "deadline";
+            } else if (readTimeout.count() <= std::chrono::duration<double, std::milli>(end - last).count()) {
+              timedOut = firstByteMs < 0 ? "first response" : "next event";
+            }
+          }
+          if (timedOut) {
+            LOG_MSG << "Chat stream timed out waiting for the" << timedOut << "after" << totalMs << "ms";
+            relay.sendEvent({ {"content", std::string("[meta]Answer stopped: the embedder timed out (") + timedOut + ")"} });
+          } else if (postRes && postRes->status == 200) {
+            timeouts.observe(AdaptiveTimeouts::routeOf(path), (std::max)(firstByteMs, 0.0), maxIdleMs, totalMs);
+          }
 
+          const bool delivered = relay.finish();
           sink.done();
+
+          if (delivered && !timedOut && postRes && postRes->status == 200 && !conversationId.empty()) {
+            const auto answer = relay.answer();
+            if (!answer.empty()) {
+              conversations.append(conversationId, { {"role", "assistant"}, {"content", answer} });
+              chatIndex.update(conversations, conversationId);
+            }
+          }
           
           if (!postRes) {
             LOG_MSG << "Error: Backend streaming unavailable";
@@ -516,23 +1888,83 @@ int main() {
         });
       
     } else {
-      // Regular POST handling for non-streaming endpoints
-      std::string host;
-      int port;
-      {
-        std::lock_guard<std::mutex> lock(prefs.mutex_);
-        host = prefs.host;
-        port = prefs.port;
+      // Regular POST handling for non-streaming endpoints. These may change the index, so
+      // they go to the active process of the project only, not to its replicas.
+      const auto cfg = config.get();
+      const std::string &host = cfg->host;
+      const int port = cfg->port;
+
+      const auto slot = scheduler.acquire(std::format("{}:{}", host, port), classifyRequest("POST", req.path));
+      if (!slot) {
+        respondShed(res, slot);
+        return;
+      }
+      auto inflightGuard = inflight.track(host, port);
+      const auto route = AdaptiveTimeouts::routeOf(req.path);
+      const auto policy = timeouts.policy(route, cfg->timeouts);
+      const auto deadline = requestDeadline(req, policy);
+      if (deadline.remaining() <= timeouts.doomedBelow(route)) {
+        respondTimedOut(res);
+        return;
+      }
+      auto cli = upstreams.connect(host, port);
+      cli->set_connection_timeout((std::min)(policy.connect, deadline.remaining()));
+      cli->set_read_timeout((std::min)((std::max)(policy.firstByte, policy.idle), deadline.remaining()));
+      cli->set_write_timeout(deadline.remaining());
+
+      const auto start = std::chrono::steady_clock::now();
+      httplib::Headers headers = { {Deadline::header, std::to_string(deadline.remaining().count())} };
+      // The body goes upstream as it arrives from the page, through a spool holding what the
+      // embedder hasn't taken yet (see bodyspool.h)
+      BodySpool spool(maxBody, static_cast<size_t>(cfg->spillKB) << 10);
+      httplib::Result result;
+      std::atomic<bool> sent{ false };
+      std::thread sender([&] {
+        std::vector<char> buf(64 * 1024);
+        if (lengthKnown && length == 0) {
+          result = cli->Post(req.path, headers, "", contentType);
+        } else if (lengthKnown) {
+          result = cli->Post(req.path, headers, static_cast<size_t>(length), [&spool, &buf](size_t, size_t n, httplib::DataSink &sink) {
+            const auto k = spool.read(buf.data(), (std::min)(n, buf.size()));
+            return 0 < k && sink.write(buf.data(), static_cast<size_t>(k));
+            }, contentType);
+        } else {
+          result = cli->Post(req.path, headers, [&spool, &buf](size_t, httplib::DataSink &sink) {
+            const auto k = spool.read(buf.data(), buf.size());
+            if (k == 0) {
+              sink.done();
+              return true;
+            }
+            return 0 < k && sink.write(buf.data(), static_cast<size_t>(k));
+            }, contentType);
+        }
+        sent = true;
+        spool.cancel(); // what the page still sends has nowhere to go
+        });
+      const bool bodyRead = reader([&spool](const char *data, size_t len) { return spool.append(data, len); });
+      // Reading stopped because the page went away, not because the upstream request ended
+      const bool pageGone = !bodyRead && !sent;
+      spool.finish(bodyRead);
+      sender.join();
+      const double totalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      const auto [received, spilled] = spool.totals();
+      if (spilled) {
+        LOG_MSG << "Request body of" << received << "bytes," << spilled << "of them spilled to disk";
       }
 
-      httplib::Client cli(host, port);
-      cli.set_connection_timeout(0, 60 * 1000ull);
-
-      auto result = cli.Post(req.path.c_str(), req.body, contentType);
-
-      if (result) {
+      if (spool.tooLarge()) {
+        respondTooLarge(res);
+      } else if (result) {
+        // Not streamed: the whole answer counts as the first byte
+        timeouts.observe(route, totalMs, 0, totalMs);
+        // May have changed the documents; pages listening on "index" learn it without polling
+        if (result->status == 200) recheckIndex = true;
         res.status = result->status;
         res.set_content(result->body, result->get_header_value("Content-Type"));
+      } else if (pageGone) {
+        res.status = 400;
+      } else if (deadline.expired() || (std::max)(policy.firstByte, policy.idle).count() <= totalMs) {
+        respondTimedOut(res);
       } else {
         res.status = 503;
         res.set_content("{\"error\": \"Backend unavailable\"}", "application/json");
@@ -540,47 +1972,37 @@ int main() {
     }
     });
 
-  std::atomic<bool> serverReady{ false };
-
-  const int serverPort = svr.bind_to_any_port("127.0.0.1");
-  std::thread serverThread([&svr, &serverReady, serverPort]() {
-    LOG_START;
-    LOG_MSG << "Starting HTTP server on http://127.0.0.1:" << serverPort;
-    serverReady = true;
-    svr.listen_after_bind();
-    LOG_MSG << "HTTP server stopped";
-    });
+  listenGate.set_value(true);
+  startup.mark("server-ready");
 
-  // Wait for server to be ready
-  while (!serverReady.load()) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(10));
-  }
-  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  // Answers to the page from worker threads; dropped once the window is gone. Declared
+  // outside the try below, which the threads using them may outlive.
+  std::mutex windowMutex;
+  auto resolveIfOpen = [&webview, &windowMutex, &quitting](const std::string &id, const std::string &result) {
+    std::lock_guard<std::mutex> lock(windowMutex);
+    if (!quitting) webview->resolve(id, 0, result);
+    };
+  // Ingests asked for by the page run one after the other (each hashes its files in parallel)
+  WorkerPool ingestWorker(1);
 
   try {
-    LOG_MSG << "Using window size, w" << prefs.width << ", h" << prefs.height;
+    LOG_MSG << "Using window size, w" << prefs->width << ", h" << prefs->height;
 
 
-    Webview w(
-#ifdef _DEBUG
-      true
-#else
-      true // for now
-#endif
-      , nullptr);
-    w.setAppIcon("logo");
+    Webview &w = *webview;
+    w.setAppIcon(assetsPath, "logo");
     w.set_title(std::format("Phenix Code Assistant - v1.0 [build date: {} {}]", __DATE__, __TIME__));
-    w.set_size(prefs.width, prefs.height, WEBVIEW_HINT_NONE);
-    w.onDestroyCallback_ = [&w, &prefs]
+    w.set_size(prefs->width, prefs->height, WEBVIEW_HINT_NONE);
+    w.onDestroyCallback_ = [&w, &config, &prefsWriter]
       {
         auto [width, height] = w.getWindowSize();
         LOG_MSG << "Saving window size [" << LOG_NOSPACE << width << ", " << height << "]";
-        {
-          std::lock_guard<std::mutex> lock(prefs.mutex_);
-          prefs.width = width;
-          prefs.height = height;
-          savePrefsToFile(prefs);
-        }
+        config.update([&](AppConfig &cfg) {
+          cfg.width = width;
+          cfg.height = height;
+          });
+        prefsWriter.markDirty();
+        prefsWriter.flush();
       };
 #ifdef _WIN32
     HWND hWnd = static_cast<HWND>(w.window().value());
@@ -589,10 +2011,32 @@ int main() {
     auto changeTheme = [&winDarkImpl, hWnd](bool dark) {
       winDarkImpl.setTitleBarTheme(hWnd, dark);
       };
-    changeTheme(prefs.uiPrefs["darkOrLight"] == "dark");
+    auto darkIt = prefs->uiPrefs.find("darkOrLight");
+    changeTheme(darkIt != prefs->uiPrefs.end() && darkIt->second == "dark");
+#else
+    auto changeTheme = [](bool) {};
 #endif
+    // Reloaded files may switch the theme too; the title bar belongs to the UI thread
+    config.subscribe([&w, changeTheme](const ConfigStore::Snapshot &prev, const ConfigStore::Snapshot &next)
+      {
+        auto before = prev->uiPrefs.find("darkOrLight");
+        auto after = next->uiPrefs.find("darkOrLight");
+        if (after != next->uiPrefs.end() && (before == prev->uiPrefs.end() || before->second != after->second)) {
+          const bool dark = after->second == "dark";
+          w.dispatch([changeTheme, dark] { changeTheme(dark); });
+        }
+      });
+    // Keeps window.__hostPrefs current; listeners run in version order, and so do the evals
+    config.subscribe([&w](const ConfigStore::Snapshot &prev, const ConfigStore::Snapshot &next)
+      {
+        auto delta = AppConfig::uiDelta(*prev, *next);
+        if (!delta.is_null()) {
+          const auto js = "window.__hostPrefsApply && window.__hostPrefsApply(" + delta.dump(-1, ' ', true) + ");";
+          w.dispatch([&w, js] { w.eval(js); });
+        }
+      });
 
-    w.bind("setPersistentKey", [&prefs, &svr, changeTheme](const std::string &id, const std::string &data, void *)
+    w.bind("setPersistentKey", [&w, &config, &prefsWriter, changeTheme](const std::string &id, const std::string &data, void *)
       {
         LOG_MSG << "setPersistentKey:" << id << data;
         try {
@@ -602,34 +2046,32 @@ int main() {
             std::string val = j[1];
             LOG_MSG << key << val;
             if (!key.empty()) {
-              std::lock_guard<std::mutex> lock(prefs.mutex_);
-              prefs.uiPrefs[key] = val;
-              savePrefsToFile(prefs);
+              config.update([&](AppConfig &cfg) { cfg.uiPrefs[key] = val; });
+              // Written out by the background writer, coalesced with other changes
+              prefsWriter.record(key, val);
               LOG_MSG << "Saved persistent key:" << key;
-#ifdef _WIN32
               if (key == "darkOrLight") {
                 changeTheme(val == "dark");
               }
-#endif
-              return;
             }
           }
         } catch (const std::exception &ex) {
           LOG_MSG << ex.what();
         }
+        w.resolve(id, 0, "");
       }, nullptr
     );
 
-    w.bind("getPersistentKey", [&prefs, &svr](const std::string &data) -> std::string
+    w.bind("getPersistentKey", [&config](const std::string &data) -> std::string
       {
         LOG_MSG << "getPersistentKey:" << data;
         try {
           auto j = nlohmann::json::parse(data);
           if (j.is_array() && 0 < j.size()) {
             std::string key = j[0].get<std::string>();
-            std::lock_guard<std::mutex> lock(prefs.mutex_);
-            auto it = prefs.uiPrefs.find(key);
-            if (it != prefs.uiPrefs.end()) {
+            const auto cfg = config.get();
+            auto it = cfg->uiPrefs.find(key);
+            if (it != cfg->uiPrefs.end()) {
               return nlohmann::json(it->second).dump();
             }
           }
@@ -640,16 +2082,74 @@ int main() {
       }
     );
 
-    w.bind("setServerUrl", [&prefs, &svr](const std::string &url) -> std::string
+    w.bind("getPersistentKeys", [&config](const std::string &data) -> std::string
+      {
+        try {
+          auto j = nlohmann::json::parse(data);
+          const auto cfg = config.get();
+          nlohmann::json res = nlohmann::json::object();
+          if (j.is_array() && 0 < j.size() && j[0].is_array()) {
+            for (const auto &k : j[0]) {
+              const auto key = k.get<std::string>();
+              auto it = cfg->uiPrefs.find(key);
+              res[key] = it != cfg->uiPrefs.end() ? nlohmann::json(it->second) : nlohmann::json();
+            }
+          }
+          return res.dump();
+        } catch (const std::exception &ex) {
+          LOG_MSG << ex.what();
+        }
+        return "null";
+      }
+    );
+
+    w.bind("setPersistentKeys", [&w, &config, &prefsWriter](const std::string &id, const std::string &data, void *)
+      {
+        LOG_MSG << "setPersistentKeys:" << data;
+        try {
+          auto j = nlohmann::json::parse(data);
+          if (j.is_array() && 0 < j.size() && j[0].is_object()) {
+            std::vector<std::pair<std::string, std::string>> items;
+            for (const auto &[key, val] : j[0].items()) {
+              if (!key.empty() && val.is_string()) {
+                items.emplace_back(key, val.get<std::string>());
+              }
+            }
+            // One publish (and one delta) for the whole batch
+            config.update([&](AppConfig &cfg) {
+              for (const auto &[key, val] : items) cfg.uiPrefs[key] = val;
+              });
+            for (const auto &[key, val] : items) {
+              prefsWriter.record(key, val);
+            }
+          }
+        } catch (const std::exception &ex) {
+          LOG_MSG << ex.what();
+        }
+        w.resolve(id, 0, "");
+      }, nullptr
+    );
+
+    w.bind("getHostPrefs", [&config, &projects](const std::string &) -> std::string
+      {
+        try {
+          return hostPrefsSnapshot(*config.get(), projects).dump();
+        } catch (const std::exception &ex) {
+          LOG_MSG << ex.what();
+        }
+        return "null";
+      }
+    );
+
+    w.bind("setServerUrl", [&config, &prefsWriter](const std::string &url) -> std::string
       {
         LOG_MSG << "setServerUrl:" << url;
         try {
           size_t hostStart = url.find("://") + 3;
           size_t portStart = url.find(":", hostStart);
           size_t pathStart = url.find("/", hostStart);
-          std::lock_guard<std::mutex> lock(prefs.mutex_);
           std::string newHost;
-          int newPort = prefs.port;
+          int newPort = config.get()->port;
           if (portStart != std::string::npos) {
             newHost = url.substr(hostStart, portStart - hostStart);
             std::string portStr = url.substr(portStart + 1, pathStart - portStart - 1);
@@ -658,9 +2158,11 @@ int main() {
             newHost = url.substr(hostStart, pathStart - hostStart);
           }
           if (newHost == "localhost") newHost = "127.0.0.1";
-          prefs.host = newHost;
-          prefs.port = newPort;
-          savePrefsToFile(prefs);
+          config.update([&](AppConfig &cfg) {
+            cfg.host = newHost;
+            cfg.port = newPort;
+            });
+          prefsWriter.markDirty();
           return "{\"status\": \"success\", \"message\": \"Server connection updated\"}";
         } catch (const std::exception &e) {
           LOG_MSG << "Error updating server connection:" << e.what();
@@ -669,12 +2171,12 @@ int main() {
       }
     );
 
-    w.bind("getServerUrl", [&prefs, &svr](const std::string &) -> std::string
+    w.bind("getServerUrl", [&config](const std::string &) -> std::string
       {
-        std::lock_guard<std::mutex> lock(prefs.mutex_);
-        LOG_MSG << "getServerUrl" << prefs.host << prefs.port;
+        const auto cfg = config.get();
+        LOG_MSG << "getServerUrl" << cfg->host << cfg->port;
         try {
-          std::string url = std::format("http://{}:{}", prefs.host, prefs.port);
+          std::string url = std::format("http://{}:{}", cfg->host, cfg->port);
           return nlohmann::json(url).dump();
         } catch (const std::exception &ex) {
           LOG_MSG << ex.what();
@@ -683,13 +2185,13 @@ int main() {
       }
     );
 
-    w.bind("getSettingsFileProjectId", [](const std::string &data) -> std::string
+    w.bind("getSettingsFileProjectId", [&projects](const std::string &data) -> std::string
       {
         LOG_MSG << "getSettingsFileProjectId";
         try {
           auto j = nlohmann::json::parse(data);
           if (j.is_array() && 0 < j.size()) {
-            auto id = getProjectId(j[0]);
+            auto id = projects.lookup(j[0].get<std::string>())->projectId;
             LOG_MSG << "  \"" << LOG_NOSPACE << id << "\"";
             return nlohmann::json(id).dump();
           }
@@ -700,7 +2202,23 @@ int main() {
       }
     );
 
-    w.bind("startEmbedder", [&procUtil](const std::string &data) -> std::string
+    w.bind("getSettingsFilesProjects", [&projects](const std::string &data) -> std::string
+      {
+        try {
+          auto j = nlohmann::json::parse(data);
+          if (j.is_array() && 0 < j.size() && j[0].is_array()) {
+            auto res = projects.lookupMany(j[0].get<std::vector<std::string>>());
+            projects.save();
+            return res.dump();
+          }
+        } catch (const std::exception &ex) {
+          LOG_MSG << ex.what();
+        }
+        return "null";
+      }
+    );
+
+    w.bind("startEmbedder", [&config, &procUtil, &projects, &replicas, &upstreams, &events, &backgroundThreads, &quitting](const std::string &data) -> std::string
       {
         LOG_MSG << "startEmbedder:" << data;
         nlohmann::json res;
@@ -714,15 +2232,73 @@ int main() {
             if (!std::filesystem::exists(configPath))
               throw std::runtime_error("Embedder config file not found: " + configPath);
             auto appKey = generateAppKey();
-            auto projectId = getProjectId(configPath);
+            auto projectId = projects.lookup(configPath)->projectId;
+            const bool socketActivation = config.get()->socketActivation;
+            const bool unixSockets = config.get()->unixSockets;
             auto proc = procUtil.getOrCreateProcess(appKey, projectId);
             assert(proc);
+            procUtil.setLaunchInfo(appKey, { exePath, configPath });
+            ListenSocket *sock = nullptr;
+            if (socketActivation) {
+              sock = procUtil.getOrCreateListenSocket(appKey, "127.0.0.1");
+              if (sock) {
+                handOverSockets(procUtil, *proc, appKey, *sock, unixSockets);
+              } else {
+                LOG_MSG << "Socket activation unavailable, embedder will bind its own port";
+              }
+            }
             if (proc->startProcess(exePath, { "--config", configPath, "serve", "--appkey", appKey })) {
               res["status"] = "success";
               res["message"] = "Embedder started successfully";
               res["projectId"] = projectId;
               res["appKey"] = appKey; // use to id proc
+              if (sock) {
+                // Already accepting: connections queue in the backlog until the embedder is up.
+                res["host"] = sock->host();
+                res["port"] = sock->port();
+              }
               LOG_MSG << "Started embedder process" << proc->getProcessId() << "for projectId" << projectId;
+              // Replicas of the project, each on a socket of its own; the proxy spreads the
+              // requests to the one above over them
+              const int replicaCount = config.get()->replicas;
+              if (1 < replicaCount && !sock) {
+                LOG_MSG << "Embedder replicas need socket activation, starting one process";
+              }
+              for (int i = 1; sock && i < replicaCount; ++i) {
+                const auto replicaKey = generateAppKey();
+                auto replicaProc = procUtil.createReplicaProcess(replicaKey, projectId);
+                procUtil.setLaunchInfo(replicaKey, { exePath, configPath });
+                ListenSocket *replicaSock = procUtil.createStandbyListenSocket(replicaKey, "127.0.0.1");
+                if (replicaSock) {
+                  handOverSockets(procUtil, *replicaProc, replicaKey, *replicaSock, unixSockets);
+                }
+                if (!replicaSock || !replicaProc->startProcess(exePath, { "--config", configPath, "serve", "--appkey", replicaKey })) {
+                  LOG_MSG << "Failed to start embedder replica" << i << "for projectId" << projectId;
+                  procUtil.discardProcess(replicaKey);
+                  break;
+                }
+                LOG_MSG << "Started embedder replica" << replicaProc->getProcessId() << "on port" << replicaSock->port();
+                res["replicas"].push_back(replicaKey);
+              }
+              replicas.setGroups(procUtil.getReplicaGroups());
+              std::vector<std::string> keys = { appKey };
+              for (const auto &key : res.value("replicas", nlohmann::json::array())) {
+                keys.push_back(key.get<std::string>());
+              }
+              for (const auto &key : keys) {
+                publishInstance(events, procUtil.getEndpoint(key), "starting", key != appKey);
+              }
+              // The page learns when the processes answer; the proxy moves to their Unix
+              // sockets as they do
+              if (sock) {
+                backgroundThreads.emplace_back([&procUtil, &upstreams, &events, &quitting, keys, unixSockets] {
+                  for (const auto &key : keys) {
+                    if (!waitEmbedderReady(procUtil, key, 60000, quitting)) continue;
+                    publishInstance(events, procUtil.getEndpoint(key), "ready", key != keys.front());
+                    if (unixSockets) useUnixSocketWhenReady(procUtil, upstreams, key, 5000, quitting);
+                  }
+                  });
+              }
             } else {
               procUtil.discardProcess(appKey);
               throw std::runtime_error("Failed to start embedder process");
@@ -739,40 +2315,46 @@ int main() {
       }
     );
 
-    w.bind("stopEmbedder", [&prefs, &procUtil](const std::string &data) -> std::string
+    w.bind("stopEmbedder", [&procUtil, &replicas, &upstreams, &events](const std::string &data) -> std::string
       {
         LOG_MSG << "stopEmbedder:" << data;
         nlohmann::json res;
         try {
           auto j = nlohmann::json::parse(data);
-          if (j.is_array() && 2 < j.size()) {
+          if (j.is_array() && 0 < j.size()) {
             const std::string appKey = j[0].get<std::string>();
             auto proc = procUtil.getProcessWithApiKey(appKey);
             if (!proc)
               throw std::runtime_error("Embedder appKey not found: " + appKey);
-            std::string host = j[1].get<std::string>();
+            // Host-owned sockets make the endpoint known, otherwise the caller supplies it
+            auto ep = procUtil.getEndpoint(appKey);
+            std::string host = ep.host;
+            int port = ep.port;
+            if (port <= 0 && 2 < j.size()) {
+              host = j[1].get<std::string>();
+              port = j[2].get<int>();
+            }
             if (host.empty())
               throw std::runtime_error("Invalid host for embedder shutdown");
-            const int port = j[2].get<int>();
             if (port <= 0)
               throw std::runtime_error("Invalid port for embedder shutdown");
-            if (host == "localhost") host = "127.0.0.1";
             assert(proc);
-            httplib::Client cli(host, port);
-            httplib::Headers headers = { {"X-App-Key", appKey} };
-            auto result = cli.Post("/api/shutdown", headers, "", "application/json");
-            if (result && result->status == 200) {
-              LOG_MSG << "Shutdown request sent to embedder process" << proc->getProcessId();
-            } else {
-              LOG_MSG << "Failed to send shutdown request to embedder process" << proc->getProcessId();
-            }
-            if (proc->waitForCompletion(10000)) {
-              LOG_MSG << "Embedder process" << proc->getProcessId() << "exited cleanly";
-            } else {
-              LOG_MSG << "Embedder process" << proc->getProcessId() << "did not exit in time, terminating...";
-              proc->stopProcess();
-            }
+            const bool active = procUtil.getApiKeyFromProjectId(ep.projectId) == appKey;
+            upstreams.removeUnixSocket(host, port);
+            stopEmbedderProcess(*proc, host, port, appKey);
             procUtil.discardProcess(appKey);
+            publishInstance(events, ep, "stopped");
+            // Its replicas go with it
+            for (const auto &replicaKey : active ? procUtil.getReplicaKeys(ep.projectId) : std::vector<std::string>{}) {
+              const auto replicaEp = procUtil.getEndpoint(replicaKey);
+              upstreams.removeUnixSocket(replicaEp.host, replicaEp.port);
+              if (auto replicaProc = procUtil.getProcessWithApiKey(replicaKey)) {
+                stopEmbedderProcess(*replicaProc, replicaEp.host, replicaEp.port, replicaKey);
+              }
+              procUtil.discardProcess(replicaKey);
+              publishInstance(events, replicaEp, "stopped", true);
+            }
+            replicas.setGroups(procUtil.getReplicaGroups());
             res["status"] = "success";
             res["message"] = "Embedder stopped successfully";
           } else {
@@ -787,15 +2369,172 @@ int main() {
       }
     );
     
+    w.bind("restartEmbedder", [&](const std::string &id, const std::string &data, void *)
+      {
+        LOG_MSG << "restartEmbedder:" << data;
+        std::string appKey;
+        ProcessesHolder::LaunchInfo launch;
+        int drainMs = 30000;
+        try {
+          auto j = nlohmann::json::parse(data);
+          if (!j.is_array() || j.empty())
+            throw std::runtime_error("Invalid parameters for restartEmbedder");
+          appKey = j[0].get<std::string>();
+          if (1 < j.size() && j[1].is_string()) launch.exePath = j[1].get<std::string>();
+          if (2 < j.size() && j[2].is_string()) launch.configPath = j[2].get<std::string>();
+          if (3 < j.size() && j[3].is_number_integer()) drainMs = j[3].get<int>();
+        } catch (const std::exception &ex) {
+          LOG_MSG << ex.what();
+          w.resolve(id, 0, nlohmann::json{ {"status", "error"}, {"message", ex.what()} }.dump());
+          return;
+        }
+        // Runs off the UI thread; progress is available through getEmbedderRestartStatus meanwhile
+        restartThreads.emplace_back([&, id, appKey, launch, drainMs] {
+          const auto oldEp = procUtil.getEndpoint(appKey);
+          auto res = rollingRestart(procUtil, config, inflight, upstreams, restartReports, appKey, launch, drainMs, quitting);
+          // The project's active endpoint moved to the new process
+          replicas.setGroups(procUtil.getReplicaGroups());
+          if (res.value("status", "") == "success") {
+            const auto newAppKey = res["appKey"].get<std::string>();
+            publishInstance(events, oldEp, "stopped");
+            publishInstance(events, procUtil.getEndpoint(newAppKey), "ready");
+            restartReports.phase(oldEp.projectId, "replicas");
+            res["replicas"] = restartReplicas(procUtil, replicas, upstreams, events, oldEp.projectId,
+              procUtil.getLaunchInfo(newAppKey), config.get()->unixSockets, drainMs, quitting);
+          }
+          resolveIfOpen(id, res.dump());
+          });
+      }, nullptr
+    );
+
+    // Paths for ingestAttachments, from the platform's open dialog
+    w.bind("pickAttachmentFiles", [&w](const std::string &) -> std::string
+      {
+        try {
+          return nlohmann::json(w.pickFiles("Attach files")).dump();
+        } catch (const std::exception &ex) {
+          LOG_MSG << ex.what();
+        }
+        return "[]";
+      }
+    );
+
+    // Local files straight into the attachment spool, hashed on worker threads; the page
+    // only gets the digests back
+    w.bind("ingestAttachments", [&](const std::string &id, const std::string &data, void *)
+      {
+        std::vector<std::string> paths;
+        try {
+          auto j = nlohmann::json::parse(data);
+          if (!j.is_array() || j.empty() || !j[0].is_array())
+            throw std::runtime_error("Invalid parameters for ingestAttachments");
+          paths = j[0].get<std::vector<std::string>>();
+        } catch (const std::exception &ex) {
+          LOG_MSG << ex.what();
+          w.resolve(id, 0, nlohmann::json{ {"error", ex.what()} }.dump());
+          return;
+        }
+        ingestWorker.post([&, id, paths] {
+          resolveIfOpen(id, attachments.ingestFiles(paths).dump());
+          });
+      }, nullptr
+    );
+
+    w.bind("searchChats", [&conversations, &chatIndex](const std::string &data) -> std::string
+      {
+        try {
+          auto j = nlohmann::json::parse(data);
+          if (!j.is_array() || j.empty() || !j[0].is_string())
+            throw std::runtime_error("Invalid parameters for searchChats");
+          const size_t limit = 1 < j.size() && j[1].is_number_unsigned() ? j[1].get<size_t>() : 20;
+          return chatIndex.query(conversations, j[0].get<std::string>(), (std::min)(limit, size_t(100))).dump();
+        } catch (const std::exception &ex) {
+          LOG_MSG << ex.what();
+          return nlohmann::json{ {"error", ex.what()} }.dump();
+        }
+      }
+    );
+
+    w.bind("reportStartupMark", [&startup](const std::string &data) -> std::string
+      {
+        try {
+          auto j = nlohmann::json::parse(data);
+          if (j.is_array() && 0 < j.size()) {
+            const auto phase = j[0].get<std::string>();
+            startup.mark(phase, "page", 1 < j.size() && j[1].is_number() ? j[1].get<double>() : -1);
+            if (phase == "first-paint") {
+              startup.log();
+            }
+          }
+        } catch (const std::exception &ex) {
+          LOG_MSG << ex.what();
+        }
+        return "null";
+      }
+    );
+
+    w.bind("getStartupProfile", [&startup](const std::string &) -> std::string
+      {
+        return startup.enabled() ? startup.toJson().dump() : "null";
+      }
+    );
+
+    w.bind("getEmbedderRestartStatus", [&restartReports](const std::string &data) -> std::string
+      {
+        try {
+          auto j = nlohmann::json::parse(data);
+          if (j.is_array() && 0 < j.size()) {
+            return restartReports.get(j[0].get<std::string>()).dump();
+          }
+        } catch (const std::exception &ex) {
+          LOG_MSG << ex.what();
+        }
+        return "null";
+      }
+    );
+
+    {
+      const auto t0 = std::chrono::steady_clock::now();
+      const auto snapshot = hostPrefsSnapshot(*config.get(), projects).dump(-1, ' ', true);
+      projects.save();
+      LOG_MSG << "Preloading host prefs:" << snapshot.size() << "bytes, built in"
+        << std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count() << "us";
+      // Runs before any page script. Deltas are applied in version order; a reloaded page
+      // starts from this (older) snapshot and refreshes itself through getHostPrefs.
+      w.init("window.__hostPrefs = " + snapshot + ";" + R"(
+        window.__hostPrefsApply = function(d) {
+          var p = window.__hostPrefs || (window.__hostPrefs = { version: 0, uiPrefs: {} });
+          if (d.version <= p.version) return;
+          p.version = d.version;
+          if (d.serverUrl) p.serverUrl = d.serverUrl;
+          if (d.embedder) p.embedder = d.embedder;
+          Object.assign(p.uiPrefs, d.uiPrefs || {});
+          (d.removed || []).forEach(function(k) { delete p.uiPrefs[k]; });
+          window.dispatchEvent(new CustomEvent('hostprefs', { detail: d }));
+        };
+      )");
+    }
+
     w.init(R"(
       window.cppApi = {
         setServerUrl,
         getServerUrl,
         setPersistentKey,
         getPersistentKey,
+        setPersistentKeys,
+        getPersistentKeys,
+        getHostPrefs,
         getSettingsFileProjectId,
+        getSettingsFilesProjects,
         startEmbedder,
         stopEmbedder,
+        restartEmbedder,
+        getEmbedderRestartStatus,
+        reportStartupMark,
+        getStartupProfile,
+        pickAttachmentFiles,
+        ingestAttachments,
+        searchChats,
       };
       window.addEventListener('error', function(e) {
         console.error('JS Error:', e.message, e.filename, e.lineno);
@@ -806,63 +2545,86 @@ int main() {
     const std::string url = "http://127.0.0.1:" + std::to_string(serverPort);
     LOG_MSG << "Navigating to:" << url;
 
+    startup.mark("navigate");
     w.navigate(url);
     w.run();
 
     LOG_MSG << "Webview closed by user.";
-
-    LOG_MSG << "Stopping HTTP server...";
   } catch (const std::exception &e) {
     LOG_MSG << "Webview error:" << e.what();
   }
+  // Also after an error above: nothing may reach the webview once it is destroyed
+  {
+    std::lock_guard<std::mutex> lock(windowMutex);
+    quitting = true;
+  }
+  events.close(); // ends the event streams of the page
+  for (auto &t : restartThreads) {
+    if (t.joinable()) t.join();
+  }
+  for (auto &t : backgroundThreads) {
+    if (t.joinable()) t.join();
+  }
+  configWatcher.stop(); // its listeners reference the webview
+
+  LOG_MSG << "Stopping HTTP server...";
+  webview.reset();
   
   // Graceful shutdown of self-started processes
   {
-    std::string host;
-    int port;
-    {
-      std::lock_guard<std::mutex> lock(prefs.mutex_);
-      host = prefs.host;
-      port = prefs.port;
+    // Embedders on host-owned sockets are reached directly, the rest are looked up via /api/instances
+    bool needLookup = false;
+    for (const auto &ep : procUtil.getEndpoints()) {
+      if (ep.port <= 0) {
+        needLookup = true;
+        continue;
+      }
+      if (sendEmbedderShutdown(ep.host, ep.port, ep.appKey)) {
+        LOG_MSG << "Shutdown request sent to embedder process for project_id:" << ep.projectId;
+      } else {
+        LOG_MSG << "Failed to send shutdown request to embedder process for project_id:" << ep.projectId;
+      }
     }
-    httplib::Client cli(host, port);
-    auto result = cli.Get("/api/instances");
-    if (result && result->status == 200) {
-      try {
-        auto j = nlohmann::json::parse(result->body);
-        if (j.is_object()) {
-          j = j["instances"];
-          for (const auto &item : j) {
-            if (item.contains("project_id") && item["project_id"].is_string()) {
-              std::string project_id = item["project_id"].get<std::string>();
-              std::string host = item.value("host", "");
-              int port = item.value("port", 0);
-              if (host.empty() || port <= 0) {
-                LOG_MSG << "Invalid host/port for instance with project_id:" << project_id;
-                continue;
-              }
-              std::string appKey = procUtil.getApiKeyFromProjectId(project_id);
-              if (appKey.empty()) {
-                LOG_MSG << "Embedder process" << project_id << "not started by this client. Skipped.";
-                continue;
-              }
-              if (host == "localhost") host = "127.0.0.1";
-              httplib::Client cli(host, port);
-              httplib::Headers headers = { {"X-App-Key", appKey} };
-              auto result = cli.Post("/api/shutdown", headers, "", "application/json");
-              if (result && result->status == 200) {
-                LOG_MSG << "Shutdown request sent to embedder process for project_id:" << project_id;
-              } else {
-                LOG_MSG << "Failed to send shutdown request to embedder process for project_id:" << project_id;
+    if (needLookup) {
+      const auto cfg = config.get();
+      httplib::Client cli(cfg->host, cfg->port);
+      auto result = cli.Get("/api/instances");
+      if (result && result->status == 200) {
+        try {
+          auto j = nlohmann::json::parse(result->body);
+          if (j.is_object()) {
+            j = j["instances"];
+            for (const auto &item : j) {
+              if (item.contains("project_id") && item["project_id"].is_string()) {
+                std::string project_id = item["project_id"].get<std::string>();
+                std::string host = item.value("host", "");
+                int port = item.value("port", 0);
+                if (host.empty() || port <= 0) {
+                  LOG_MSG << "Invalid host/port for instance with project_id:" << project_id;
+                  continue;
+                }
+                std::string appKey = procUtil.getApiKeyFromProjectId(project_id);
+                if (appKey.empty()) {
+                  LOG_MSG << "Embedder process" << project_id << "not started by this client. Skipped.";
+                  continue;
+                }
+                if (0 < procUtil.getEndpoint(appKey).port) {
+                  continue; // already asked above
+                }
+                if (sendEmbedderShutdown(host, port, appKey)) {
+                  LOG_MSG << "Shutdown request sent to embedder process for project_id:" << project_id;
+                } else {
+                  LOG_MSG << "Failed to send shutdown request to embedder process for project_id:" << project_id;
+                }
               }
             }
           }
+        } catch (const std::exception &e) {
+          LOG_MSG << "Error parsing /api/instances response:" << e.what();
         }
-      } catch (const std::exception &e) {
-        LOG_MSG << "Error parsing /api/instances response:" << e.what();
+      } else {
+        LOG_MSG << "Failed to query /api/instances";
       }
-    } else {
-      LOG_MSG << "Failed to query /api/instances";
     }
     procUtil.waitToStopThenTerminate();
   }
@@ -872,6 +2634,7 @@ int main() {
     serverThread.join();
     LOG_MSG << "HTTP server thread joined cleanly";
   }
+  chatIndex.save(conversations.generation());
 
   return 0;
 }
\ No newline at end of file
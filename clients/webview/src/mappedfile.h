@@ -0,0 +1,11 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstddef>
+
+// Read-only view of the first `size` bytes of a file, nullptr if it can't be mapped.
+void *mapFile(const std::string &path, size_t size);
+void unmapFile(void *view, size_t size);
+
+#endif // MAPPED_FILE_H
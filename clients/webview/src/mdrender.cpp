@@ -0,0 +1,897 @@
+#include "mdrender.h"
+#include <vector>
+#include <cctype>
+#include <cstring>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+
+namespace {
+
+  constexpr size_t npos = std::string::npos;
+
+  void appendEscaped(std::string &out, char c) {
+    switch (c) {
+    case '&': out += "&amp;"; break;
+    case '<': out += "&lt;"; break;
+    case '>': out += "&gt;"; break;
+    case '"': out += "&quot;"; break;
+    case '\'': out += "&#39;"; break;
+    default: out += c;
+    }
+  }
+
+  std::string escapeHtml(const std::string &s) {
+    std::string out;
+    out.reserve(s.size() + s.size() / 8);
+    for (char c : s) appendEscaped(out, c);
+    return out;
+  }
+
+  // Same set as encodeURIComponent
+  std::string urlEncode(const std::string &s) {
+    std::string out;
+    for (unsigned char c : s) {
+      if (std::isalnum(c) || std::strchr("-_.!~*'()", c)) {
+        out += static_cast<char>(c);
+      } else {
+        char buf[4];
+        std::snprintf(buf, sizeof(buf), "%%%02X", c);
+        out += buf;
+      }
+    }
+    return out;
+  }
+
+  bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+  bool isAlnum(char c) { return std::isalnum(static_cast<unsigned char>(c)) != 0; }
+
+  bool isBlank(const std::string &s) {
+    return std::all_of(s.begin(), s.end(), isSpace);
+  }
+
+  int indentOf(const std::string &s) {
+    int n = 0;
+    while (n < static_cast<int>(s.size()) && s[n] == ' ') ++n;
+    return n;
+  }
+
+  std::string trim(const std::string &s) {
+    size_t b = 0, e = s.size();
+    while (b < e && isSpace(s[b])) ++b;
+    while (e > b && isSpace(s[e - 1])) --e;
+    return s.substr(b, e - b);
+  }
+
+  std::string stripIndent(const std::string &s, int n) {
+    return s.substr((std::min)(indentOf(s), n));
+  }
+
+  size_t runLength(const std::string &s, size_t i, char c) {
+    size_t k = 0;
+    while (i + k < s.size() && s[i + k] == c) ++k;
+    return k;
+  }
+
+  bool startsWith(const std::string &s, size_t i, const char *prefix) {
+    return s.compare(i, std::strlen(prefix), prefix) == 0;
+  }
+
+  // Lines of src[from, to), leading tabs expanded to spaces; offsets of each line in src.
+  std::vector<std::string> splitLines(const std::string &src, size_t from, size_t to, std::vector<size_t> *offsets = nullptr) {
+    std::vector<std::string> lines;
+    size_t p = from;
+    while (p < to) {
+      size_t e = src.find('\n', p);
+      if (e == npos || to < e) e = to;
+      std::string line;
+      size_t q = p;
+      for (; q < e && (src[q] == ' ' || src[q] == '\t'); ++q) {
+        if (src[q] == '\t') line.append(4 - line.size() % 4, ' ');
+        else line += ' ';
+      }
+      line.append(src, q, e - q);
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      if (offsets) offsets->push_back(p);
+      lines.push_back(std::move(line));
+      p = e + 1;
+    }
+    return lines;
+  }
+
+  std::string joinLines(const std::vector<std::string> &lines, size_t b, size_t e) {
+    std::string out;
+    for (size_t k = b; k < e; ++k) {
+      if (k != b) out += '\n';
+      out += lines[k];
+    }
+    return out;
+  }
+
+  struct Fence {
+    char ch = 0;
+    size_t len = 0;
+    int indent = 0;
+  };
+
+  bool fenceOpen(const std::string &s, Fence &f) {
+    const int ind = indentOf(s);
+    if (3 < ind || static_cast<int>(s.size()) <= ind) return false;
+    const char c = s[ind];
+    if (c != '`' && c != '~') return false;
+    const size_t k = runLength(s, ind, c);
+    if (k < 3) return false;
+    if (c == '`' && s.find('`', ind + k) != npos) return false;
+    f = { c, k, ind };
+    return true;
+  }
+
+  bool fenceClose(const std::string &s, const Fence &f) {
+    const int ind = indentOf(s);
+    if (3 < ind) return false;
+    const size_t k = runLength(s, ind, f.ch);
+    return f.len <= k && isBlank(s.substr(ind + k));
+  }
+
+  int atxLevel(const std::string &s) {
+    const int ind = indentOf(s);
+    if (3 < ind) return 0;
+    const size_t k = runLength(s, ind, '#');
+    if (k < 1 || 6 < k) return 0;
+    if (ind + k < s.size() && s[ind + k] != ' ') return 0;
+    return static_cast<int>(k);
+  }
+
+  bool isRule(const std::string &s) {
+    const int ind = indentOf(s);
+    if (3 < ind) return false;
+    char c = 0;
+    int count = 0;
+    for (size_t p = ind; p < s.size(); ++p) {
+      const char x = s[p];
+      if (x == ' ' || x == '\t') continue;
+      if ((x != '-' && x != '*' && x != '_') || (c && x != c)) return false;
+      c = x;
+      ++count;
+    }
+    return 3 <= count;
+  }
+
+  int setextLevel(const std::string &s) {
+    if (3 < indentOf(s)) return 0;
+    const std::string t = trim(s);
+    if (t.empty() || (t[0] != '=' && t[0] != '-')) return 0;
+    if (t.find_first_not_of(t[0]) != npos) return 0;
+    return t[0] == '=' ? 1 : 2;
+  }
+
+  struct ListMarker {
+    bool ordered = false;
+    char ch = 0;
+    int start = 1;
+    int contentIndent = 0; // column where the item's content starts
+    bool empty = false;
+  };
+
+  bool listMarker(const std::string &s, ListMarker &m) {
+    const int ind = indentOf(s);
+    if (3 < ind || static_cast<int>(s.size()) <= ind) return false;
+    size_t after;
+    const char c = s[ind];
+    if (c == '-' || c == '*' || c == '+') {
+      m.ordered = false;
+      m.ch = c;
+      after = ind + 1;
+    } else if (std::isdigit(static_cast<unsigned char>(c))) {
+      size_t q = ind;
+      while (q < s.size() && std::isdigit(static_cast<unsigned char>(s[q])) && q - ind < 9) ++q;
+      if (s.size() <= q || (s[q] != '.' && s[q] != ')')) return false;
+      m.ordered = true;
+      m.ch = s[q];
+      m.start = std::stoi(s.substr(ind, q - ind));
+      after = q + 1;
+    } else {
+      return false;
+    }
+    if (after == s.size()) {
+      m.empty = true;
+      m.contentIndent = static_cast<int>(after) + 1;
+      return true;
+    }
+    if (s[after] != ' ') return false;
+    const size_t q = s.find_first_not_of(' ', after);
+    m.empty = q == npos;
+    size_t spaces = m.empty ? 1 : q - after;
+    if (4 < spaces) spaces = 1; // indented code inside the item
+    m.contentIndent = static_cast<int>(after + spaces);
+    return true;
+  }
+
+  bool isQuote(const std::string &s) {
+    const int ind = indentOf(s);
+    return ind <= 3 && ind < static_cast<int>(s.size()) && s[ind] == '>';
+  }
+
+  bool interruptsParagraph(const std::string &s) {
+    Fence f;
+    ListMarker m;
+    if (fenceOpen(s, f) || atxLevel(s) || isRule(s) || isQuote(s)) return true;
+    return listMarker(s, m) && !m.empty && (!m.ordered || m.start == 1);
+  }
+
+  std::vector<std::string> splitRow(const std::string &s) {
+    std::string t = trim(s);
+    if (!t.empty() && t.front() == '|') t.erase(0, 1);
+    if (!t.empty() && t.back() == '|' && (t.size() < 2 || t[t.size() - 2] != '\\')) t.pop_back();
+    std::vector<std::string> cells;
+    std::string cell;
+    for (size_t p = 0; p < t.size(); ++p) {
+      if (t[p] == '\\' && p + 1 < t.size() && t[p + 1] == '|') {
+        cell += '|';
+        ++p;
+      } else if (t[p] == '|') {
+        cells.push_back(trim(cell));
+        cell.clear();
+      } else {
+        cell += t[p];
+      }
+    }
+    cells.push_back(trim(cell));
+    return cells;
+  }
+
+  bool tableDelim(const std::string &s, std::vector<std::string> &aligns) {
+    if (s.find('-') == npos) return false;
+    aligns.clear();
+    for (const auto &c : splitRow(s)) {
+      if (c.empty()) return false;
+      const bool l = c.front() == ':';
+      const bool r = 1 < c.size() && c.back() == ':';
+      const std::string core = c.substr(l, c.size() - l - r);
+      if (core.empty() || core.find_first_not_of('-') != npos) return false;
+      aligns.push_back(l && r ? "center" : r ? "right" : l ? "left" : "");
+    }
+    return true;
+  }
+
+  bool tableStart(const std::vector<std::string> &lines, size_t i, std::vector<std::string> &aligns) {
+    return lines[i].find('|') != npos && i + 1 < lines.size() &&
+      tableDelim(lines[i + 1], aligns) && splitRow(lines[i]).size() == aligns.size();
+  }
+
+  enum class Block { Fence, Heading, Setext, Rule, Table, Quote, List, IndentedCode, Paragraph };
+
+  size_t scanList(const std::vector<std::string> &lines, size_t i, const ListMarker &first) {
+    int contentIndent = first.contentIndent;
+    size_t j = i + 1, end = i + 1;
+    bool prevBlank = false;
+    while (j < lines.size()) {
+      const auto &s = lines[j];
+      ListMarker m;
+      if (isBlank(s)) {
+        prevBlank = true;
+        ++j;
+      } else if (contentIndent <= indentOf(s)) {
+        end = ++j;
+        prevBlank = false;
+      } else if (!isRule(s) && listMarker(s, m) && m.ordered == first.ordered && m.ch == first.ch) {
+        contentIndent = m.contentIndent;
+        end = ++j;
+        prevBlank = false;
+      } else if (!prevBlank && !interruptsParagraph(s)) {
+        end = ++j; // lazy continuation
+      } else {
+        break;
+      }
+    }
+    return end;
+  }
+
+  // End (exclusive) of the block starting at the non-blank line i. The streaming renderer
+  // relies on this depending only on lines before the next block's first line.
+  size_t scanBlock(const std::vector<std::string> &lines, size_t i, Block &type) {
+    const size_t n = lines.size();
+    Fence f;
+    ListMarker m;
+    std::vector<std::string> aligns;
+    if (fenceOpen(lines[i], f)) {
+      type = Block::Fence;
+      for (size_t j = i + 1; j < n; ++j) {
+        if (fenceClose(lines[j], f)) return j + 1;
+      }
+      return n;
+    }
+    if (atxLevel(lines[i])) {
+      type = Block::Heading;
+      return i + 1;
+    }
+    if (4 <= indentOf(lines[i])) {
+      type = Block::IndentedCode;
+      size_t end = i + 1;
+      for (size_t j = i + 1; j < n && (isBlank(lines[j]) || 4 <= indentOf(lines[j])); ++j) {
+        if (!isBlank(lines[j])) end = j + 1;
+      }
+      return end;
+    }
+    if (isRule(lines[i])) {
+      type = Block::Rule;
+      return i + 1;
+    }
+    if (isQuote(lines[i])) {
+      type = Block::Quote;
+      size_t j = i + 1;
+      while (j < n && !isBlank(lines[j]) && (isQuote(lines[j]) || !interruptsParagraph(lines[j]))) ++j;
+      return j;
+    }
+    if (listMarker(lines[i], m)) {
+      type = Block::List;
+      return scanList(lines, i, m);
+    }
+    if (tableStart(lines, i, aligns)) {
+      type = Block::Table;
+      size_t j = i + 2;
+      while (j < n && !isBlank(lines[j]) && !interruptsParagraph(lines[j])) ++j;
+      return j;
+    }
+    type = Block::Paragraph;
+    size_t j = i + 1;
+    for (; j < n && !isBlank(lines[j]); ++j) {
+      if (setextLevel(lines[j])) {
+        type = Block::Setext;
+        return j + 1;
+      }
+      if (interruptsParagraph(lines[j])) break;
+    }
+    return j;
+  }
+
+  // Line indices where top-level blocks start
+  std::vector<size_t> blockStarts(const std::vector<std::string> &lines) {
+    std::vector<size_t> starts;
+    size_t i = 0;
+    while (i < lines.size()) {
+      if (isBlank(lines[i])) {
+        ++i;
+        continue;
+      }
+      Block type;
+      starts.push_back(i);
+      i = scanBlock(lines, i, type);
+    }
+    return starts;
+  }
+
+  struct Link {
+    std::string text;
+    std::string href;
+    std::string title;
+    size_t end = 0;
+  };
+
+  size_t skipCodeSpan(const std::string &s, size_t i) {
+    const size_t k = runLength(s, i, '`');
+    size_t p = i + k;
+    while ((p = s.find('`', p)) != npos) {
+      const size_t r = runLength(s, p, '`');
+      if (r == k) return p + r;
+      p += r;
+    }
+    return i + k;
+  }
+
+  // [text](href "title") starting at s[i] == '['
+  bool parseLink(const std::string &s, size_t i, Link &l) {
+    const size_t n = s.size();
+    int depth = 0;
+    size_t p = i;
+    while (p < n) {
+      if (s[p] == '\\') {
+        p += 2;
+        continue;
+      }
+      if (s[p] == '`') {
+        p = skipCodeSpan(s, p);
+        continue;
+      }
+      if (s[p] == '[') ++depth;
+      else if (s[p] == ']' && --depth == 0) break;
+      ++p;
+    }
+    if (n <= p + 1 || s[p + 1] != '(') return false;
+    l.text = s.substr(i + 1, p - i - 1);
+    size_t q = p + 2;
+    while (q < n && s[q] == ' ') ++q;
+    if (q < n && s[q] == '<') {
+      const size_t e = s.find('>', q + 1);
+      if (e == npos) return false;
+      l.href = s.substr(q + 1, e - q - 1);
+      q = e + 1;
+    } else {
+      const size_t b = q;
+      int parens = 0;
+      for (; q < n && !isSpace(s[q]); ++q) {
+        if (s[q] == '(') ++parens;
+        else if (s[q] == ')' && parens-- == 0) break;
+      }
+      l.href = s.substr(b, q - b);
+    }
+    while (q < n && s[q] == ' ') ++q;
+    if (q < n && (s[q] == '"' || s[q] == '\'' || s[q] == '(')) {
+      const char close = s[q] == '(' ? ')' : s[q];
+      const size_t e = s.find(close, q + 1);
+      if (e == npos) return false;
+      l.title = s.substr(q + 1, e - q - 1);
+      q = e + 1;
+      while (q < n && s[q] == ' ') ++q;
+    }
+    if (n <= q || s[q] != ')') return false;
+    l.end = q + 1;
+    return true;
+  }
+
+  bool isAutolink(const std::string &s) {
+    if (s.empty() || s.find_first_of(" \t\n<>") != npos) return false;
+    const size_t colon = s.find(':');
+    if (colon != npos && 2 <= colon && colon <= 32 && std::isalpha(static_cast<unsigned char>(s[0]))) return true;
+    const size_t at = s.find('@');
+    return at != npos && 0 < at && s.find('.', at) != npos;
+  }
+
+  class Renderer {
+  public:
+    Renderer(const std::string &idPrefix, int firstCode) : idPrefix_(idPrefix), code_(firstCode) {}
+
+    int codeCount() const { return code_; }
+
+    std::string blocks(const std::vector<std::string> &lines, bool tight = false) {
+      std::string out;
+      size_t i = 0;
+      while (i < lines.size()) {
+        if (isBlank(lines[i])) {
+          ++i;
+          continue;
+        }
+        Block type;
+        const size_t e = scanBlock(lines, i, type);
+        out += block(lines, i, e, type, tight);
+        i = e;
+      }
+      return out;
+    }
+
+  private:
+    std::string block(const std::vector<std::string> &lines, size_t b, size_t e, Block type, bool tight) {
+      switch (type) {
+      case Block::Fence: {
+        Fence f;
+        fenceOpen(lines[b], f);
+        size_t ce = e;
+        if (b + 1 < e && fenceClose(lines[e - 1], f)) --ce;
+        std::string text;
+        for (size_t k = b + 1; k < ce; ++k) {
+          if (k != b + 1) text += '\n';
+          text += stripIndent(lines[k], f.indent);
+        }
+        return codeBlock(text);
+      }
+      case Block::IndentedCode: {
+        std::string text;
+        for (size_t k = b; k < e; ++k) {
+          if (k != b) text += '\n';
+          text += stripIndent(lines[k], 4);
+        }
+        return codeBlock(text);
+      }
+      case Block::Heading: {
+        const int level = atxLevel(lines[b]);
+        std::string text = trim(lines[b].substr(indentOf(lines[b]) + level));
+        // optional closing sequence
+        const size_t hashes = text.find_last_not_of('#');
+        if (hashes == npos) text.clear();
+        else if (hashes + 1 < text.size() && text[hashes] == ' ') text = trim(text.substr(0, hashes));
+        return heading(level, text);
+      }
+      case Block::Setext: {
+        std::vector<std::string> body(lines.begin() + b, lines.begin() + e - 1);
+        for (auto &l : body) l = trim(l);
+        return heading(setextLevel(lines[e - 1]), joinLines(body, 0, body.size()));
+      }
+      case Block::Rule:
+        return "<hr class=\"hr\" />\n";
+      case Block::Table:
+        return table(lines, b, e);
+      case Block::Quote: {
+        std::vector<std::string> inner;
+        for (size_t k = b; k < e; ++k) {
+          const auto &s = lines[k];
+          if (isQuote(s)) {
+            size_t p = indentOf(s) + 1;
+            if (p < s.size() && s[p] == ' ') ++p;
+            inner.push_back(s.substr(p));
+          } else {
+            inner.push_back(s);
+          }
+        }
+        return "<blockquote>\n" + blocks(inner) + "</blockquote>\n";
+      }
+      case Block::List:
+        return list(lines, b, e);
+      case Block::Paragraph:
+      default: {
+        std::vector<std::string> body(lines.begin() + b, lines.begin() + e);
+        for (auto &l : body) l = l.substr(indentOf(l));
+        std::string text = joinLines(body, 0, body.size());
+        while (!text.empty() && isSpace(text.back())) text.pop_back();
+        if (tight) return inlines(text);
+        return "<p class=\"py-2\">" + inlines(text) + "</p>\n";
+      }
+      }
+    }
+
+    std::string heading(int level, const std::string &text) {
+      const auto tag = "h" + std::to_string(level);
+      return "<" + tag + (level == 3 ? " class=\"h3\"" : "") + ">" + inlines(text) + "</" + tag + ">\n";
+    }
+
+    std::string codeBlock(const std::string &text) {
+      const std::string id = idPrefix_ + "-" + std::to_string(code_++);
+      return
+        "<div class=\"relative my-4\">\n"
+        "  <button\n"
+        "    class=\"absolute top-2 right-2 bg-surface-200-800 hover:bg-surface-300-700 text-xs px-2 py-1 rounded shadow\"\n"
+        "    onclick=\"navigator.clipboard.writeText(document.getElementById('" + id + "').innerText)\">\n"
+        "    Copy\n"
+        "  </button>\n"
+        "  <pre class=\"bg-surface-100-900 py-4 px-8 rounded leading-none\"><code id=\"" + id +
+        "\" class=\"code text-xs whitespace-pre-wrap break-words\">" + escapeHtml(text) + "</code></pre>\n"
+        "</div>\n";
+    }
+
+    std::string table(const std::vector<std::string> &lines, size_t b, size_t e) {
+      std::vector<std::string> aligns;
+      tableDelim(lines[b + 1], aligns);
+      auto cell = [&](const char *tag, const std::string &text, size_t col) {
+        std::string out = std::string("<") + tag;
+        if (!aligns[col].empty()) out += " align=\"" + aligns[col] + "\"";
+        return out + ">" + inlines(text) + "</" + tag + ">\n";
+        };
+      std::string out = "<table>\n<thead>\n<tr>\n";
+      const auto header = splitRow(lines[b]);
+      for (size_t c = 0; c < aligns.size(); ++c) out += cell("th", header[c], c);
+      out += "</tr>\n</thead>\n";
+      if (b + 2 < e) {
+        out += "<tbody>";
+        for (size_t k = b + 2; k < e; ++k) {
+          const auto row = splitRow(lines[k]);
+          out += "<tr>\n";
+          for (size_t c = 0; c < aligns.size(); ++c) out += cell("td", c < row.size() ? row[c] : "", c);
+          out += "</tr>\n";
+        }
+        out += "</tbody>";
+      }
+      return out + "</table>\n";
+    }
+
+    std::string list(const std::vector<std::string> &lines, size_t b, size_t e) {
+      ListMarker first;
+      listMarker(lines[b], first);
+      std::vector<std::vector<std::string>> items;
+      int contentIndent = 0;
+      bool loose = false;
+      bool prevBlank = false;
+      for (size_t k = b; k < e; ++k) {
+        const auto &s = lines[k];
+        ListMarker m;
+        if (!isBlank(s) && (items.empty() || indentOf(s) < contentIndent) && !isRule(s) &&
+            listMarker(s, m) && m.ordered == first.ordered && m.ch == first.ch) {
+          if (prevBlank && !items.empty()) loose = true;
+          contentIndent = m.contentIndent;
+          items.emplace_back();
+          items.back().push_back(m.empty ? "" : s.substr((std::min)(s.size(), static_cast<size_t>(contentIndent))));
+          prevBlank = false;
+        } else if (isBlank(s)) {
+          items.back().push_back("");
+          prevBlank = true;
+        } else {
+          if (prevBlank) loose = true;
+          items.back().push_back(contentIndent <= indentOf(s) ? stripIndent(s, contentIndent) : s.substr(indentOf(s)));
+          prevBlank = false;
+        }
+      }
+      std::string body;
+      for (auto &item : items) {
+        while (!item.empty() && isBlank(item.back())) item.pop_back();
+        std::string prefix;
+        if (!item.empty()) {
+          auto &l = item.front();
+          if (startsWith(l, 0, "[ ] ") || startsWith(l, 0, "[x] ") || startsWith(l, 0, "[X] ")) {
+            prefix = l[1] == ' ' ? "<input disabled=\"\" type=\"checkbox\"> " : "<input checked=\"\" disabled=\"\" type=\"checkbox\"> ";
+            l = l.substr(4);
+          }
+        }
+        body += "<li>" + prefix + blocks(item, !loose) + "</li>\n";
+      }
+      if (first.ordered) {
+        const std::string start = first.start != 1 ? " start=\"" + std::to_string(first.start) + "\"" : "";
+        return "<ol class=\"list-inside list-decimal space-y-1 py-2 pl-4\"" + start + ">\n" + body + "</ol>\n";
+      }
+      return "<ul class=\"list-inside list-disc space-y-1 pl-4\">\n" + body + "</ul>\n";
+    }
+
+    std::string link(const std::string &href, const std::string &title, const std::string &text) {
+      // Same download handling as the link renderer in markdown.ts
+      std::string h = href;
+      const std::string prefix = "/scratch/packages";
+      if (startsWith(h, 0, prefix.c_str()) && prefix.size() < h.size()) {
+        h = "/api/download?file=" + urlEncode(h.substr(prefix.size() + 1));
+      }
+      return "<a href=\"" + escapeHtml(h) + "\" title=\"" + escapeHtml(title.empty() ? "Click to download " + text : title) +
+        "\" download=\"" + escapeHtml(text) + "\" class=\"underline text-primary-500\">" + escapeHtml(text) + "</a>";
+    }
+
+    bool emphasis(const std::string &s, size_t i, std::string &out, size_t &next) {
+      const size_t n = s.size();
+      const char c = s[i];
+      const size_t k = runLength(s, i, c);
+      if ((c == '~' && k != 2) || 3 < k) return false;
+      if (n <= i + k || isSpace(s[i + k])) return false;
+      if (c == '_' && 0 < i && isAlnum(s[i - 1])) return false;
+      size_t p = i + k;
+      while (p < n) {
+        if (s[p] == '\\') {
+          p += 2;
+          continue;
+        }
+        if (s[p] == '`') {
+          p = skipCodeSpan(s, p);
+          continue;
+        }
+        if (s[p] == c) {
+          const size_t r = runLength(s, p, c);
+          if (r == k && !isSpace(s[p - 1]) && (c != '_' || n <= p + r || !isAlnum(s[p + r]))) break;
+          p += r;
+          continue;
+        }
+        ++p;
+      }
+      if (n <= p) return false;
+      const std::string inner = inlines(s.substr(i + k, p - i - k));
+      if (c == '~') out = "<del>" + inner + "</del>";
+      else if (k == 1) out = "<em>" + inner + "</em>";
+      else if (k == 2) out = "<strong>" + inner + "</strong>";
+      else out = "<em><strong>" + inner + "</strong></em>";
+      next = p + k;
+      return true;
+    }
+
+    std::string inlines(const std::string &s) {
+      std::string out;
+      out.reserve(s.size() + 16);
+      const size_t n = s.size();
+      size_t i = 0;
+      while (i < n) {
+        const char c = s[i];
+        switch (c) {
+        case '\\':
+          if (i + 1 < n && s[i + 1] == '\n') {
+            out += "<br>\n";
+            i += 2;
+            continue;
+          }
+          if (i + 1 < n && std::ispunct(static_cast<unsigned char>(s[i + 1]))) {
+            appendEscaped(out, s[i + 1]);
+            i += 2;
+            continue;
+          }
+          break;
+        case '`': {
+          const size_t k = runLength(s, i, '`');
+          const size_t end = skipCodeSpan(s, i);
+          if (end == i + k) {
+            out.append(k, '`');
+            i += k;
+            continue;
+          }
+          std::string code = s.substr(i + k, end - k - i - k);
+          std::replace(code.begin(), code.end(), '\n', ' ');
+          if (2 <= code.size() && code.front() == ' ' && code.back() == ' ' && code.find_first_not_of(' ') != npos) {
+            code = code.substr(1, code.size() - 2);
+          }
+          out += "<code class=\"code\">" + escapeHtml(code) + "</code>";
+          i = end;
+          continue;
+        }
+        case '!': {
+          Link l;
+          if (i + 1 < n && s[i + 1] == '[' && parseLink(s, i + 1, l)) {
+            out += "<img src=\"" + escapeHtml(l.href) + "\" alt=\"" + escapeHtml(l.text) + "\"" +
+              (l.title.empty() ? "" : " title=\"" + escapeHtml(l.title) + "\"") + ">";
+            i = l.end;
+            continue;
+          }
+          break;
+        }
+        case '[': {
+          Link l;
+          if (parseLink(s, i, l)) {
+            out += link(l.href, l.title, l.text);
+            i = l.end;
+            continue;
+          }
+          break;
+        }
+        case '<': {
+          const size_t close = s.find('>', i + 1);
+          if (close != npos) {
+            const std::string inner = s.substr(i + 1, close - i - 1);
+            if (isAutolink(inner)) {
+              const bool email = inner.find(':') == npos;
+              out += link(email ? "mailto:" + inner : inner, "", inner);
+              i = close + 1;
+              continue;
+            }
+          }
+          break;
+        }
+        case '*':
+        case '_':
+        case '~': {
+          std::string html;
+          size_t next;
+          if (emphasis(s, i, html, next)) {
+            out += html;
+            i = next;
+            continue;
+          }
+          const size_t k = runLength(s, i, c);
+          out.append(k, c);
+          i += k;
+          continue;
+        }
+        case ' ': {
+          const size_t k = runLength(s, i, ' ');
+          if (i + k < n && s[i + k] == '\n') {
+            out += 2 <= k ? "<br>\n" : "\n";
+            i += k + 1;
+          } else if (i + k == n) {
+            i += k;
+          } else {
+            out.append(k, ' ');
+            i += k;
+          }
+          continue;
+        }
+        case '&': {
+          size_t p = i + 1;
+          if (p < n && s[p] == '#') ++p;
+          const size_t b = p;
+          while (p < n && p - b < 32 && isAlnum(s[p])) ++p;
+          if (b < p && p < n && s[p] == ';') {
+            out.append(s, i, p + 1 - i); // entity, kept as is
+            i = p + 1;
+            continue;
+          }
+          break;
+        }
+        case 'h':
+        case 'w': {
+          if ((i == 0 || !isAlnum(s[i - 1])) &&
+              (startsWith(s, i, "http://") || startsWith(s, i, "https://") || startsWith(s, i, "www."))) {
+            size_t e = i;
+            while (e < n && !isSpace(s[e]) && s[e] != '<') ++e;
+            while (i < e && std::strchr(".,:;!?\"'*_~", s[e - 1])) --e;
+            std::string url = s.substr(i, e - i);
+            if (!url.empty() && url.back() == ')' &&
+                std::count(url.begin(), url.end(), ')') > std::count(url.begin(), url.end(), '(')) {
+              url.pop_back();
+            }
+            if (8 < url.size()) {
+              out += link(url[0] == 'w' ? "http://" + url : url, "", url);
+              i += url.size();
+              continue;
+            }
+          }
+          break;
+        }
+        default:
+          break;
+        }
+        appendEscaped(out, c);
+        ++i;
+      }
+      return out;
+    }
+
+    const std::string &idPrefix_;
+    int code_;
+  };
+
+} // anonymous namespace
+
+std::string renderMarkdown(const std::string &md, const std::string &idPrefix)
+{
+  Renderer r(idPrefix, 0);
+  return r.blocks(splitLines(md, 0, md.size()));
+}
+
+MarkdownStream::MarkdownStream(std::string idPrefix)
+  : idPrefix_(std::move(idPrefix))
+{
+}
+
+MarkdownStream::Delta MarkdownStream::feed(const std::string &text)
+{
+  src_ += text;
+  return update(false);
+}
+
+MarkdownStream::Delta MarkdownStream::finish()
+{
+  return update(true);
+}
+
+MarkdownStream::Delta MarkdownStream::update(bool final)
+{
+  Delta d;
+  // Only complete lines decide where blocks end; a partial last line just shows in the tail.
+  const size_t lastNl = src_.rfind('\n');
+  const size_t scanEnd = final ? src_.size() : (lastNl == npos || lastNl < committed_ ? committed_ : lastNl + 1);
+  std::vector<size_t> offsets;
+  const auto lines = splitLines(src_, committed_, scanEnd, &offsets);
+  const auto starts = blockStarts(lines);
+  // Everything but the last block is closed: a later line can't change it anymore
+  const size_t closed = final ? starts.size() : (starts.empty() ? 0 : starts.size() - 1);
+  if (0 < closed) {
+    const size_t endLine = final ? lines.size() : starts[closed];
+    Renderer r(idPrefix_, committedCode_);
+    d.append = r.blocks(std::vector<std::string>(lines.begin(), lines.begin() + endLine));
+    committedCode_ = r.codeCount();
+    committedHtml_ += d.append;
+    committed_ = final ? src_.size() : offsets[starts[closed]];
+  }
+  std::string tail;
+  if (!final && committed_ < src_.size()) {
+    Renderer r(idPrefix_, committedCode_);
+    tail = r.blocks(splitLines(src_, committed_, src_.size()));
+  }
+  d.changed = !d.append.empty() || tail != tailHtml_;
+  tailHtml_ = std::move(tail);
+  d.tail = tailHtml_;
+  return d;
+}
+
+std::string MarkdownCache::keyOf(const std::string &md)
+{
+  std::stringstream ss;
+  ss << std::hex << std::setfill('0') << std::setw(16) << std::hash<std::string>{}(md) << "-" << md.size();
+  return ss.str();
+}
+
+void MarkdownCache::put(const std::string &key, const std::string &html)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    bytes_ -= it->second->second.size();
+    lru_.erase(it->second);
+  }
+  lru_.emplace_front(key, html);
+  index_[key] = lru_.begin();
+  bytes_ += html.size();
+  while (maxBytes_ < bytes_ && 1 < lru_.size()) {
+    bytes_ -= lru_.back().second.size();
+    index_.erase(lru_.back().first);
+    lru_.pop_back();
+  }
+}
+
+std::optional<std::string> MarkdownCache::get(const std::string &key)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    return std::nullopt;
+  }
+  lru_.splice(lru_.begin(), lru_, it->second);
+  return it->second->second;
+}
@@ -0,0 +1,66 @@
+#ifndef MD_RENDER_H
+#define MD_RENDER_H
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <optional>
+
+// Renders the CommonMark subset chat answers use (plus GFM tables, strikethrough, task
+// items and bare URLs) to the same markup as the SPA's marked renderer (markdown.ts).
+// Raw HTML is escaped, not passed through. Code block ids are idPrefix-0, idPrefix-1, ...
+std::string renderMarkdown(const std::string &md, const std::string &idPrefix = "codeblock");
+
+// Incremental renderer for one streamed answer. Blocks that can no longer change are
+// rendered once and handed out as `append`; only the last, still open block is rendered
+// again on each feed and handed out as `tail` (replacing the previous tail). Work per
+// feed is bounded by the size of the open block instead of the whole answer.
+class MarkdownStream {
+public:
+  struct Delta {
+    std::string append; // newly closed blocks, to be appended after earlier ones
+    std::string tail;   // current rendering of the open block
+    bool changed = false;
+  };
+
+  explicit MarkdownStream(std::string idPrefix);
+
+  Delta feed(const std::string &text);
+  // End of stream: the open block is closed and comes back as `append`.
+  Delta finish();
+
+  const std::string &source() const { return src_; }
+  std::string html() const { return committedHtml_ + tailHtml_; }
+
+private:
+  Delta update(bool final);
+
+  const std::string idPrefix_;
+  std::string src_;
+  size_t committed_ = 0;   // start of the open block in src_
+  int committedCode_ = 0;  // code blocks in the committed part, keeps ids stable
+  std::string committedHtml_;
+  std::string tailHtml_;
+};
+
+// Rendered answers by markdown source, so they can be shown again without re-rendering.
+class MarkdownCache {
+public:
+  explicit MarkdownCache(size_t maxBytes = 8 * 1024 * 1024) : maxBytes_(maxBytes) {}
+
+  static std::string keyOf(const std::string &md);
+
+  void put(const std::string &key, const std::string &html);
+  std::optional<std::string> get(const std::string &key);
+
+private:
+  using Item = std::pair<std::string, std::string>;
+  const size_t maxBytes_;
+  std::mutex mutex_;
+  std::list<Item> lru_; // most recent first
+  std::unordered_map<std::string, std::list<Item>::iterator> index_;
+  size_t bytes_ = 0;
+};
+
+#endif // MD_RENDER_H
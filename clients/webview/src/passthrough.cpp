@@ -0,0 +1,249 @@
+#include "passthrough.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+  using Clock = std::chrono::steady_clock;
+
+  double msSince(Clock::time_point t)
+  {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+  }
+
+  // One upstream response between the thread reading it and the one writing it out
+  struct Transfer {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::string> chunks;
+    size_t buffered = 0;
+    bool headersIn = false;
+    bool done = false;
+    bool cancelled = false;
+    bool failed = false;
+    int status = 0;
+    httplib::Headers headers;
+    std::unique_ptr<httplib::Client> cli;
+    std::thread reader;
+
+    // Writer side
+    uint64_t position = 0; // offset in the entity of the next byte to come
+    Clock::time_point start = Clock::now();
+    Clock::time_point last = start;
+    double firstByteMs = 0;
+    double maxIdleMs = 0;
+
+    ~Transfer() {
+      cancel();
+      if (reader.joinable()) reader.join();
+    }
+
+    void cancel() {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (done) return;
+        cancelled = true;
+      }
+      cv.notify_all();
+      cli->stop();
+    }
+
+    // The next piece of the body; false at its end or when the upstream failed
+    bool next(std::string &chunk) {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [this] { return done || cancelled || !chunks.empty(); });
+      if (chunks.empty()) return false;
+      chunk = std::move(chunks.front());
+      chunks.pop_front();
+      buffered -= chunk.size();
+      lock.unlock();
+      cv.notify_all();
+      maxIdleMs = (std::max)(maxIdleMs, msSince(last));
+      last = Clock::now();
+      return true;
+    }
+
+    bool complete() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return done && !failed && chunks.empty();
+    }
+  };
+
+  // Headers compare case-insensitively
+  std::string headerOf(const httplib::Headers &headers, const std::string &name)
+  {
+    auto it = headers.find(name);
+    return it != headers.end() ? it->second : std::string();
+  }
+
+  // "bytes 100-199/1000" -> {100, 1000}; total is 0 when unknown ("*")
+  std::pair<uint64_t, uint64_t> parseContentRange(const std::string &value)
+  {
+    uint64_t first = 0;
+    uint64_t total = 0;
+    const auto dash = value.find('-');
+    const auto slash = value.find('/');
+    if (value.rfind("bytes ", 0) == 0 && dash != std::string::npos) {
+      first = std::strtoull(value.c_str() + 6, nullptr, 10);
+    }
+    if (slash != std::string::npos) {
+      total = std::strtoull(value.c_str() + slash + 1, nullptr, 10);
+    }
+    return { first, total };
+  }
+
+  // Entity headers the client gets as the upstream sent them; the framing ones
+  // (Content-Length, Content-Range, Transfer-Encoding) are httplib's to write
+  constexpr const char *passedHeaders[] = {
+    "ETag", "Last-Modified", "Content-Disposition", "Cache-Control", "Expires", "Vary"
+  };
+
+} // anonymous namespace
+
+int streamGet(UpstreamPool &pool, AdaptiveTimeouts &timeouts, const std::string &host, int port,
+  const httplib::Request &req, httplib::Response &res, const TimeoutPolicy &policy, const Deadline &deadline,
+  std::shared_ptr<void> hold)
+{
+  const auto route = AdaptiveTimeouts::routeOf(req.path);
+  const auto remaining = deadline.remaining();
+  if (remaining <= std::chrono::milliseconds(0) || remaining <= timeouts.doomedBelow(route)) {
+    return 504;
+  }
+  auto t = std::make_shared<Transfer>();
+  t->cli = pool.connect(host, port);
+  t->cli->set_connection_timeout((std::min)(policy.connect, remaining));
+  t->cli->set_read_timeout((std::max)(policy.firstByte, policy.idle));
+  t->cli->set_write_timeout(remaining);
+  // The body goes out as it came, so its length and ranges are those of the upstream
+  t->cli->set_decompress(false);
+
+  httplib::Headers headers = { {Deadline::header, std::to_string(remaining.count())} };
+  for (const char *name : { "If-None-Match", "If-Modified-Since" }) {
+    if (req.has_header(name)) headers.emplace(name, req.get_header_value(name));
+  }
+  // Several ranges are cut from the whole entity here
+  if (req.ranges.size() == 1 && req.has_header("Range")) {
+    headers.emplace("Range", req.get_header_value("Range"));
+  }
+
+  // As the client sent it, query (?file=...) included
+  const std::string target = req.target.empty() ? req.path : req.target;
+  Transfer *raw = t.get();
+  t->reader = std::thread([raw, path = target, headers] {
+    auto result = raw->cli->Get(path, headers,
+      [raw](const httplib::Response &r) {
+        std::lock_guard<std::mutex> lock(raw->mutex);
+        raw->status = r.status;
+        raw->headers = r.headers;
+        raw->headersIn = true;
+        raw->firstByteMs = msSince(raw->start);
+        raw->last = Clock::now();
+        raw->cv.notify_all();
+        return !raw->cancelled;
+      },
+      [raw](const char *data, size_t len) {
+        std::unique_lock<std::mutex> lock(raw->mutex);
+        raw->cv.wait(lock, [raw] { return raw->cancelled || raw->buffered < streamBufferBytes; });
+        if (raw->cancelled) return false;
+        raw->chunks.emplace_back(data, len);
+        raw->buffered += len;
+        lock.unlock();
+        raw->cv.notify_all();
+        return true;
+      });
+    std::lock_guard<std::mutex> lock(raw->mutex);
+    raw->done = true;
+    raw->failed = !result;
+    raw->cv.notify_all();
+    });
+
+  {
+    std::unique_lock<std::mutex> lock(t->mutex);
+    if (!t->cv.wait_for(lock, deadline.remaining(), [&t] { return t->headersIn || t->done; })) {
+      lock.unlock();
+      return 504; // t cancels and joins the reader
+    }
+    if (!t->headersIn) {
+      return msSince(t->start) < (std::max)(policy.firstByte, policy.idle).count() ? 503 : 504;
+    }
+  }
+
+  std::string contentType = headerOf(t->headers, "Content-Type");
+  if (contentType.empty()) contentType = "application/octet-stream";
+  for (const char *name : passedHeaders) {
+    if (t->headers.count(name)) {
+      res.set_header(name, headerOf(t->headers, name));
+    }
+  }
+  if (t->status < 200 || 300 <= t->status) {
+    // Errors and 304 are small: passed on whole
+    res.status = t->status;
+    std::string body;
+    for (std::string chunk; t->next(chunk);) body += chunk;
+    if (!body.empty()) res.set_content(body, contentType);
+    return 0;
+  }
+
+  // Where the upstream body sits in the entity and how long that is
+  uint64_t total = std::strtoull(headerOf(t->headers, "Content-Length").c_str(), nullptr, 10);
+  if (t->status == 206) {
+    const auto [first, length] = parseContentRange(headerOf(t->headers, "Content-Range"));
+    t->position = first;
+    total = length;
+  }
+
+  auto finish = [&timeouts, route, t, hold](bool) mutable {
+    if (t->complete()) {
+      timeouts.observe(route, t->firstByteMs, t->maxIdleMs, msSince(t->start));
+    }
+    t->cancel();
+    hold.reset();
+    };
+
+  if (total == 0) {
+    // Length unknown (chunked upstream): relayed chunk by chunk. Ranges need a length,
+    // httplib answers them with 416.
+    res.status = t->status;
+    res.set_chunked_content_provider(contentType, [t](size_t, httplib::DataSink &sink) {
+      std::string chunk;
+      if (!t->next(chunk)) {
+        if (!t->complete()) return false;
+        sink.done();
+        return true;
+      }
+      return sink.write(chunk.data(), chunk.size());
+      }, finish);
+    return 0;
+  }
+
+  // httplib writes ranges from the entity, asking for them in ascending order; the
+  // upstream body is read up to each one and what lies between is dropped
+  res.status = req.ranges.empty() ? t->status : 206;
+  res.set_header("Accept-Ranges", "bytes");
+  res.set_content_provider(static_cast<size_t>(total), contentType, [t, pending = std::string()](size_t offset, size_t length, httplib::DataSink &sink) mutable {
+    if (offset < t->position) {
+      return false; // already gone by
+    }
+    if (pending.empty() && !t->next(pending)) {
+      return false; // the body ended early
+    }
+    const uint64_t end = t->position + pending.size();
+    if (end <= offset) {
+      t->position = end;
+      pending.clear();
+      return true;
+    }
+    const size_t skip = static_cast<size_t>(offset - t->position);
+    const size_t n = (std::min)(pending.size() - skip, length);
+    if (!sink.write(pending.data() + skip, n)) {
+      return false;
+    }
+    t->position = offset + n;
+    pending.erase(0, skip + n);
+    return true;
+    }, finish);
+  return 0;
+}
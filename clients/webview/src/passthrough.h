@@ -0,0 +1,29 @@
+#ifndef PASSTHROUGH_H
+#define PASSTHROUGH_H
+
+#include "deadline.h"
+#include "upstreampool.h"
+#include <httplib.h>
+#include <memory>
+#include <string>
+
+// Upstream GET relayed to the client as it arrives, for downloads and other bodies too
+// large to hold. The thread reading the upstream response and the one writing to the
+// client share a buffer of at most streamBufferBytes, so the host never holds more of the
+// body than that however large it is; a slow client holds back the upstream read.
+//
+// Status and entity headers (ETag, Last-Modified, Content-Disposition, ...) are passed
+// on, and so is a Range request. httplib cuts the ranges out of the entity, so the body
+// is laid out at the offset the upstream says it starts at (Content-Range); bytes before
+// a range that the upstream sent anyway are read and dropped.
+constexpr size_t streamBufferBytes = 256 * 1024;
+
+// Sets up res to stream the answer of path from host:port; the policy's total timeout
+// doesn't apply once the body flows, its idle timeout does. `hold` is released when the
+// body has been sent (e.g. the request's in-flight guard). Returns 0 when res is set up,
+// 503 when the upstream couldn't be reached and 504 when no answer came in time.
+int streamGet(UpstreamPool &pool, AdaptiveTimeouts &timeouts, const std::string &host, int port,
+  const httplib::Request &req, httplib::Response &res, const TimeoutPolicy &policy, const Deadline &deadline,
+  std::shared_ptr<void> hold = nullptr);
+
+#endif // PASSTHROUGH_H
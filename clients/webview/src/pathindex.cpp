@@ -0,0 +1,383 @@
+#include "pathindex.h"
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+  std::string normalized(std::string_view path) {
+    std::string res(path);
+    std::replace(res.begin(), res.end(), '\\', '/');
+    return res;
+  }
+
+  std::string lowered(std::string_view s) {
+    std::string res(s);
+    for (auto &c : res) {
+      if ('A' <= c && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
+    }
+    return res;
+  }
+
+  inline uint32_t trigramAt(std::string_view s, size_t i) {
+    return (uint32_t(uint8_t(s[i])) << 16) | (uint32_t(uint8_t(s[i + 1])) << 8) | uint8_t(s[i + 2]);
+  }
+
+  constexpr uint32_t trigramBuckets = 1u << 18;
+
+  inline uint32_t bucketOf(uint32_t trigram) {
+    return (trigram * 2654435761u) >> (32 - 18);
+  }
+
+  // Distinct buckets of the trigrams of s
+  std::vector<uint32_t> bucketsOf(std::string_view s) {
+    std::vector<uint32_t> res;
+    res.reserve(s.size());
+    for (size_t i = 0; i + 3 <= s.size(); ++i) {
+      res.push_back(bucketOf(trigramAt(s, i)));
+    }
+    std::sort(res.begin(), res.end());
+    res.erase(std::unique(res.begin(), res.end()), res.end());
+    return res;
+  }
+
+  uint64_t fnv1a(std::string_view s) {
+    uint64_t h = 1469598103934665603ull;
+    for (const char c : s) {
+      h = (h ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+    }
+    return h;
+  }
+
+  inline uint64_t edgeKey(uint32_t parent, uint32_t segment) {
+    return (uint64_t(parent) << 32) | segment;
+  }
+
+  // Substring match ranking: in the file name over in a directory, at a word start,
+  // the whole name, shorter paths
+  int scoreOf(std::string_view path, std::string_view query, size_t pos) {
+    const size_t nameStart = path.rfind('/') + 1; // npos + 1 == 0
+    int score = 0;
+    if (nameStart <= pos) {
+      score += 400;
+      if (pos == nameStart) score += 200;
+      if (path.size() - nameStart == query.size()) score += 400;
+    }
+    if (pos == 0 || std::string_view("/_-. ").find(path[pos - 1]) != std::string_view::npos) {
+      score += 100;
+    }
+    return score - static_cast<int>((std::min)(path.size(), size_t(400)) / 2);
+  }
+
+} // anonymous namespace
+
+uint32_t PathIndex::intern(std::string_view segment)
+{
+  auto it = segments_.find(segment);
+  if (it != segments_.end()) {
+    return it->second;
+  }
+  const auto id = static_cast<uint32_t>(segmentNames_.size());
+  segmentNames_.emplace_back(segment);
+  segments_.emplace(segmentNames_.back(), id);
+  return id;
+}
+
+uint32_t PathIndex::child(uint32_t node, uint32_t segment, bool create)
+{
+  auto it = edges_.find(edgeKey(node, segment));
+  if (it != edges_.end()) {
+    return it->second;
+  }
+  if (!create) {
+    return 0;
+  }
+  const auto id = static_cast<uint32_t>(nodes_.size());
+  nodes_.push_back({ segment, node });
+  ++nodes_[node].children;
+  edges_.emplace(edgeKey(node, segment), id);
+  return id;
+}
+
+int32_t PathIndex::add(std::string_view path, uint64_t size, int64_t lastModified)
+{
+  uint32_t node = 0;
+  size_t start = 0;
+  while (true) {
+    const size_t slash = path.find('/', start);
+    const auto segment = path.substr(start, slash == std::string_view::npos ? std::string_view::npos : slash - start);
+    node = child(node, intern(segment), true);
+    if (slash == std::string_view::npos) break;
+    start = slash + 1;
+  }
+  if (0 <= nodes_[node].file) {
+    return -1; // listed twice
+  }
+  const auto id = static_cast<uint32_t>(files_.size());
+  nodes_[node].file = static_cast<int32_t>(id);
+  const auto lower = lowered(path);
+  files_.push_back({ node, static_cast<uint32_t>(lower_.size()), static_cast<uint32_t>(lower.size()), true, size, lastModified });
+  lower_ += lower;
+  byPath_[fnv1a(path)] = id;
+  if (trigrams_.empty()) {
+    trigrams_.resize(trigramBuckets);
+  }
+  for (size_t i = 0; i + 3 <= lower.size(); ++i) {
+    auto &files = trigrams_[bucketOf(trigramAt(lower, i))];
+    if (files.empty() || files.back() != id) {
+      files.push_back(id);
+    }
+  }
+  ++live_;
+  return static_cast<int32_t>(id);
+}
+
+// The trigram postings keep the file until the next rebuild; searches skip it.
+void PathIndex::removeFile(uint32_t file)
+{
+  auto &f = files_[file];
+  f.live = false;
+  originals_.erase(file);
+  byPath_.erase(fnv1a(pathOf(f.node)));
+  --live_;
+  uint32_t node = f.node;
+  nodes_[node].file = -1;
+  while (node != 0 && nodes_[node].children == 0 && nodes_[node].file < 0) {
+    const auto parent = nodes_[node].parent;
+    edges_.erase(edgeKey(parent, nodes_[node].segment));
+    --nodes_[parent].children;
+    node = parent;
+  }
+}
+
+void PathIndex::rebuild()
+{
+  struct Live {
+    std::string path;
+    std::string original;
+    uint64_t size;
+    int64_t lastModified;
+  };
+  std::vector<Live> live;
+  live.reserve(live_);
+  for (uint32_t i = 0; i < files_.size(); ++i) {
+    const auto &f = files_[i];
+    if (f.live) {
+      auto it = originals_.find(i);
+      live.push_back({ pathOf(f.node), it != originals_.end() ? it->second : std::string(), f.size, f.lastModified });
+    }
+  }
+  segmentNames_.clear();
+  segments_.clear();
+  nodes_.assign(1, Node{ 0, 0 });
+  edges_.clear();
+  files_.clear();
+  lower_.clear();
+  trigrams_.clear();
+  byPath_.clear();
+  originals_.clear();
+  live_ = 0;
+  for (const auto &l : live) {
+    const auto id = add(l.path, l.size, l.lastModified);
+    if (0 <= id && !l.original.empty()) {
+      originals_[id] = l.original;
+    }
+  }
+}
+
+std::string PathIndex::originalPath(uint32_t file) const
+{
+  auto it = originals_.find(file);
+  return it != originals_.end() ? it->second : pathOf(files_[file].node);
+}
+
+std::string PathIndex::pathOf(uint32_t node, size_t skip) const
+{
+  std::vector<uint32_t> chain;
+  for (; node != 0; node = nodes_[node].parent) {
+    chain.push_back(nodes_[node].segment);
+  }
+  std::string res;
+  for (size_t i = chain.size() - (std::min)(skip, chain.size()); 0 < i; --i) {
+    res += segmentNames_[chain[i - 1]];
+    if (1 < i) res += '/';
+  }
+  return res;
+}
+
+// Segments all documents start with, at least one left over (as stripCommonPrefix in utils.ts)
+size_t PathIndex::prefixDepth() const
+{
+  auto it = std::find_if(files_.begin(), files_.end(), [](const File &f) { return f.live; });
+  if (it == files_.end()) {
+    return 0;
+  }
+  std::vector<uint32_t> chain; // root first
+  for (uint32_t node = it->node; node != 0; node = nodes_[node].parent) {
+    chain.push_back(node);
+  }
+  chain.push_back(0);
+  std::reverse(chain.begin(), chain.end());
+  size_t depth = 0;
+  while (depth + 1 < chain.size() && nodes_[chain[depth]].children == 1 && nodes_[chain[depth]].file < 0) {
+    ++depth;
+  }
+  return 0 <= nodes_[chain[depth]].file && 0 < depth ? depth - 1 : depth;
+}
+
+PathIndex::RefreshStats PathIndex::refresh(const nlohmann::json &documents, const std::string &source)
+{
+  const auto t0 = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(mutex_);
+  RefreshStats stats;
+  if (nodes_.empty()) {
+    nodes_.push_back({ 0, 0 });
+  }
+  source_ = source;
+  const size_t known = files_.size();
+  std::vector<bool> seen(known, false);
+  files_.reserve(known + documents.size());
+  byPath_.reserve(known + documents.size());
+  edges_.reserve(nodes_.size() + documents.size());
+  segments_.reserve(segmentNames_.size() + documents.size());
+  for (const auto &doc : documents) {
+    if (!doc.is_object() || !doc.contains("path") || !doc["path"].is_string()) {
+      continue;
+    }
+    const auto &original = doc["path"].get_ref<const std::string &>();
+    const auto path = normalized(original);
+    const uint64_t size = doc.contains("size") && doc["size"].is_number_unsigned() ? doc["size"].get<uint64_t>() : 0;
+    const int64_t lastModified = doc.contains("lastModified") && doc["lastModified"].is_number_integer() ? doc["lastModified"].get<int64_t>() : 0;
+    // One lookup per path, the trie is only walked for new ones
+    auto it = byPath_.find(fnv1a(path));
+    if (it != byPath_.end()) {
+      const auto file = it->second;
+      if (file < known) seen[file] = true;
+      files_[file].size = size;
+      files_[file].lastModified = lastModified;
+    } else {
+      const auto id = add(path, size, lastModified);
+      if (0 <= id && path != original) {
+        originals_[id] = original;
+      }
+      ++stats.added;
+    }
+  }
+  for (uint32_t f = 0; f < known; ++f) {
+    if (files_[f].live && !seen[f]) {
+      removeFile(f);
+      ++stats.removed;
+    }
+  }
+  if (1000 < files_.size() && live_ < files_.size() - live_) {
+    rebuild();
+  }
+  stats.total = live_;
+  stats.millis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+  return stats;
+}
+
+std::string PathIndex::source() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return source_;
+}
+
+bool PathIndex::empty() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return live_ == 0;
+}
+
+nlohmann::json PathIndex::search(const std::string &query, size_t offset, size_t limit) const
+{
+  const auto t0 = std::chrono::steady_clock::now();
+  const auto q = lowered(normalized(query));
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto lowerOf = [this](const File &f) { return std::string_view(lower_).substr(f.lowerOffset, f.lowerLength); };
+
+  struct Match {
+    uint32_t file;
+    int score;
+  };
+  std::vector<Match> matches;
+  const auto grams = bucketsOf(q);
+  if (q.empty()) {
+    for (uint32_t f = 0; f < files_.size(); ++f) {
+      if (files_[f].live) matches.push_back({ f, 0 });
+    }
+  } else {
+    // Files with all of the query's trigrams, from the shortest list; without trigrams, all
+    std::vector<const std::vector<uint32_t> *> lists;
+    bool possible = true;
+    for (const auto bucket : grams) {
+      if (trigrams_.empty() || trigrams_[bucket].empty()) {
+        possible = false;
+        break;
+      }
+      lists.push_back(&trigrams_[bucket]);
+    }
+    std::sort(lists.begin(), lists.end(), [](auto a, auto b) { return a->size() < b->size(); });
+    auto check = [&](uint32_t f) {
+      const auto &file = files_[f];
+      if (!file.live) return;
+      for (size_t i = 1; i < lists.size(); ++i) {
+        if (!std::binary_search(lists[i]->begin(), lists[i]->end(), f)) return;
+      }
+      const auto path = lowerOf(file);
+      const size_t pos = path.find(q);
+      if (pos != std::string_view::npos) {
+        matches.push_back({ f, scoreOf(path, q, pos) });
+      }
+      };
+    if (possible && !lists.empty()) {
+      for (const auto f : *lists[0]) check(f);
+    } else if (grams.empty()) {
+      for (uint32_t f = 0; f < files_.size(); ++f) check(f);
+    }
+    // Nothing contains it: paths with most of its trigrams
+    if (matches.empty() && 2 <= grams.size() && !trigrams_.empty()) {
+      std::vector<uint16_t> shared(files_.size(), 0);
+      std::vector<uint32_t> touched;
+      for (const auto bucket : grams) {
+        for (const auto f : trigrams_[bucket]) {
+          if (shared[f]++ == 0) touched.push_back(f);
+        }
+      }
+      const size_t needed = (std::max)(size_t(2), (grams.size() * 3 + 4) / 5);
+      for (const auto f : touched) {
+        if (files_[f].live && needed <= shared[f]) {
+          matches.push_back({ f, shared[f] * 100 - static_cast<int>((std::min)(files_[f].lowerLength, 400u) / 2) });
+        }
+      }
+    }
+    std::sort(matches.begin(), matches.end(), [](const Match &a, const Match &b) {
+      return a.score != b.score ? b.score < a.score : a.file < b.file;
+      });
+  }
+
+  const size_t depth = prefixDepth();
+  nlohmann::json items = nlohmann::json::array();
+  for (size_t i = offset; i < matches.size() && i - offset < limit; ++i) {
+    const auto &f = files_[matches[i].file];
+    items.push_back({
+      {"path", originalPath(matches[i].file)},
+      {"stripped", pathOf(f.node, depth)},
+      {"name", segmentNames_[nodes_[f.node].segment]},
+      {"size", f.size},
+      {"lastModified", f.lastModified}
+      });
+  }
+  std::string prefix;
+  if (depth && !matches.empty()) {
+    const auto node = files_[matches[0].file].node;
+    const auto path = pathOf(node);
+    prefix = path.substr(0, path.size() - pathOf(node, depth).size());
+  }
+  return {
+    {"total", matches.size()},
+    {"offset", offset},
+    {"prefix", prefix},
+    {"items", items},
+    {"micros", std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count()}
+  };
+}
@@ -0,0 +1,82 @@
+#ifndef PATH_INDEX_H
+#define PATH_INDEX_H
+
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+
+// Document paths of the embedder (/api/documents) for the context file picker.
+//
+// Paths are stored as chains of interned segments in a trie, so the directories that
+// 200k files share are kept once and the common prefix falls out of the trie. Substring
+// queries go through a trigram index of the lowercased paths: the postings of the
+// query's trigrams are intersected and only those candidates are compared. If nothing
+// contains the query, paths sharing most of its trigrams are returned instead (typos,
+// transposed words).
+class PathIndex {
+public:
+  struct RefreshStats {
+    size_t added = 0;
+    size_t removed = 0;
+    size_t total = 0;
+    double millis = 0;
+  };
+
+  // Makes the index hold exactly `documents` ([{path, size, lastModified}]); only
+  // paths that came or went are (un)indexed. `source` tells where they came from.
+  RefreshStats refresh(const nlohmann::json &documents, const std::string &source);
+  std::string source() const;
+  bool empty() const;
+
+  // Best matches first (an empty query lists everything in the embedder's order):
+  // {total, offset, prefix, items: [{path, stripped, name, size, lastModified}], micros}.
+  // `stripped` is the path without the prefix all documents share.
+  nlohmann::json search(const std::string &query, size_t offset, size_t limit) const;
+
+private:
+  struct Node {
+    uint32_t segment;
+    uint32_t parent;
+    uint32_t children = 0;
+    int32_t file = -1;
+  };
+  struct File {
+    uint32_t node;
+    uint32_t lowerOffset; // in lower_
+    uint32_t lowerLength;
+    bool live;
+    uint64_t size;
+    int64_t lastModified;
+  };
+
+  uint32_t intern(std::string_view segment);
+  uint32_t child(uint32_t node, uint32_t segment, bool create);
+  int32_t add(std::string_view path, uint64_t size, int64_t lastModified);
+  void removeFile(uint32_t file);
+  void rebuild();
+  std::string pathOf(uint32_t node, size_t skip = 0) const;
+  std::string originalPath(uint32_t file) const;
+  size_t prefixDepth() const;
+
+  mutable std::mutex mutex_;
+  std::string source_;
+  std::deque<std::string> segmentNames_;
+  std::unordered_map<std::string_view, uint32_t> segments_;
+  std::vector<Node> nodes_;                     // [0] is the root
+  std::unordered_map<uint64_t, uint32_t> edges_; // parent << 32 | segment -> node
+  std::vector<File> files_;
+  std::unordered_map<uint64_t, uint32_t> byPath_; // fnv-1a of the path -> live file
+  std::string lower_;                           // lowercased paths, back to back
+  std::unordered_map<uint32_t, std::string> originals_; // paths given with backslashes, as given
+  // Files by trigram, ascending. Trigrams share a list when they hash alike, which only
+  // adds candidates: matches are confirmed on the path.
+  std::vector<std::vector<uint32_t>> trigrams_;
+  size_t live_ = 0;
+};
+
+#endif // PATH_INDEX_H
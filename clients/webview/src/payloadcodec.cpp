@@ -0,0 +1,189 @@
+#include "payloadcodec.h"
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <vector>
+#include <unordered_set>
+#include <cstdlib>
+
+namespace {
+
+  std::string trimmed(std::string s) {
+    const auto first = s.find_first_not_of(" \t");
+    const auto last = s.find_last_not_of(" \t");
+    return first == std::string::npos ? std::string() : s.substr(first, last - first + 1);
+  }
+
+  bool isPath(const std::string &s) {
+    return s.find_first_of("/\\") != std::string::npos;
+  }
+
+  nlohmann::json pathColumn(const std::vector<const std::string *> &values) {
+    nlohmann::json dirs = nlohmann::json::array();
+    nlohmann::json dir = nlohmann::json::array();
+    nlohmann::json name = nlohmann::json::array();
+    std::unordered_map<std::string, size_t> ids;
+    for (const auto *v : values) {
+      const auto cut = v->find_last_of("/\\");
+      const size_t split = cut == std::string::npos ? 0 : cut + 1;
+      auto [it, added] = ids.emplace(v->substr(0, split), ids.size());
+      if (added) {
+        dirs.push_back(it->first);
+      }
+      dir.push_back(it->second);
+      name.push_back(v->substr(split));
+    }
+    return { {"dirs", std::move(dirs)}, {"dir", std::move(dir)}, {"name", std::move(name)} };
+  }
+
+  nlohmann::json table(const nlohmann::json &rows) {
+    std::vector<std::string> keys;
+    std::unordered_set<std::string> seen;
+    for (const auto &row : rows) {
+      for (const auto &item : row.items()) {
+        if (seen.insert(item.key()).second) {
+          keys.push_back(item.key());
+        }
+      }
+    }
+    nlohmann::json columns = nlohmann::json::object();
+    for (const auto &key : keys) {
+      std::vector<const std::string *> strings;
+      size_t paths = 0;
+      for (const auto &row : rows) {
+        auto it = row.find(key);
+        if (it == row.end() || !it->is_string()) {
+          strings.clear();
+          break;
+        }
+        strings.push_back(&it->get_ref<const std::string &>());
+        paths += isPath(*strings.back());
+      }
+      if (!strings.empty() && strings.size() <= 2 * paths) {
+        columns[key] = pathColumn(strings);
+        continue;
+      }
+      nlohmann::json column = nlohmann::json::array();
+      for (const auto &row : rows) {
+        auto it = row.find(key);
+        column.push_back(it == row.end() ? nlohmann::json() : toColumnar(*it));
+      }
+      columns[key] = std::move(column);
+    }
+    return { {"$table", rows.size()}, {"columns", std::move(columns)} };
+  }
+
+} // anonymous namespace
+
+PayloadEncoding negotiateEncoding(const std::string &accept)
+{
+  size_t start = 0;
+  while (start < accept.size()) {
+    size_t end = accept.find(',', start);
+    if (end == std::string::npos) end = accept.size();
+    std::string entry = accept.substr(start, end - start);
+    start = end + 1;
+    std::transform(entry.begin(), entry.end(), entry.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    const auto semicolon = entry.find(';');
+    const auto type = trimmed(entry.substr(0, semicolon));
+    if (semicolon != std::string::npos) {
+      const auto q = entry.find("q=", semicolon);
+      if (q != std::string::npos && std::strtod(entry.c_str() + q + 2, nullptr) <= 0) {
+        continue;
+      }
+    }
+    if (type == "application/vnd.phenix.columnar+json") return PayloadEncoding::Columnar;
+    if (type == "application/cbor") return PayloadEncoding::Cbor;
+    if (type == "application/msgpack" || type == "application/x-msgpack") return PayloadEncoding::MsgPack;
+    if (type == "application/json" || type == "application/*" || type == "*/*") return PayloadEncoding::Json;
+  }
+  return PayloadEncoding::Json;
+}
+
+const char *contentTypeOf(PayloadEncoding encoding)
+{
+  switch (encoding) {
+  case PayloadEncoding::Cbor: return "application/cbor";
+  case PayloadEncoding::MsgPack: return "application/msgpack";
+  case PayloadEncoding::Columnar: return "application/vnd.phenix.columnar+json";
+  default: return "application/json";
+  }
+}
+
+nlohmann::json toColumnar(const nlohmann::json &j)
+{
+  if (j.is_array()) {
+    if (1 < j.size() && std::all_of(j.begin(), j.end(), [](const nlohmann::json &e) { return e.is_object(); })) {
+      return table(j);
+    }
+    nlohmann::json res = nlohmann::json::array();
+    for (const auto &e : j) res.push_back(toColumnar(e));
+    return res;
+  }
+  if (j.is_object()) {
+    nlohmann::json res = nlohmann::json::object();
+    for (const auto &item : j.items()) res[item.key()] = toColumnar(item.value());
+    return res;
+  }
+  return j;
+}
+
+std::string encodePayload(const nlohmann::json &j, PayloadEncoding encoding)
+{
+  switch (encoding) {
+  case PayloadEncoding::Cbor: {
+    const auto bytes = nlohmann::json::to_cbor(j);
+    return std::string(bytes.begin(), bytes.end());
+  }
+  case PayloadEncoding::MsgPack: {
+    const auto bytes = nlohmann::json::to_msgpack(j);
+    return std::string(bytes.begin(), bytes.end());
+  }
+  case PayloadEncoding::Columnar:
+    return toColumnar(j).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+  default:
+    return j.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+  }
+}
+
+std::shared_ptr<const std::string> PayloadCache::transcode(const std::string &json, PayloadEncoding encoding, double &micros)
+{
+  const auto t0 = std::chrono::steady_clock::now();
+  micros = 0;
+  const std::string key = std::to_string(static_cast<int>(encoding)) + ":" +
+    std::to_string(std::hash<std::string>{}(json)) + ":" + std::to_string(json.size());
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it != index_.end() && it->second->source == json) {
+      lru_.splice(lru_.begin(), lru_, it->second);
+      return it->second->encoded;
+    }
+  }
+  const auto j = nlohmann::json::parse(json, nullptr, false);
+  if (j.is_discarded()) {
+    return nullptr;
+  }
+  auto encoded = std::make_shared<const std::string>(encodePayload(j, encoding));
+  micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (auto it = index_.find(key); it != index_.end()) {
+    // Same hash and length, other body: the newer one takes the entry
+    if (it->second->source == json) {
+      return encoded;
+    }
+    bytes_ -= it->second->source.size() + it->second->encoded->size();
+    lru_.erase(it->second);
+    index_.erase(it);
+  }
+  lru_.push_front({ key, json, encoded });
+  index_[key] = lru_.begin();
+  bytes_ += json.size() + encoded->size();
+  while (maxBytes_ < bytes_ && 1 < lru_.size()) {
+    bytes_ -= lru_.back().source.size() + lru_.back().encoded->size();
+    index_.erase(lru_.back().key);
+    lru_.pop_back();
+  }
+  return encoded;
+}
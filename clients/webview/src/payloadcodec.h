@@ -0,0 +1,59 @@
+#ifndef PAYLOAD_CODEC_H
+#define PAYLOAD_CODEC_H
+
+#include <nlohmann/json.hpp>
+#include <string>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+
+// Encodings the gateway can turn an upstream JSON response into, picked from the
+// request's Accept header:
+//   application/cbor, application/msgpack (or x-msgpack)  nlohmann's binary formats
+//   application/vnd.phenix.columnar+json                  JSON with arrays of objects stored by column
+//
+// Columnar layout: an array of objects becomes
+//   {"$table": <rows>, "columns": {<key>: <column>, ...}}
+// where a column is the array of values (null where a row lacks the key) or, for
+// strings that are mostly paths, {"dirs": [...], "dir": [<index>...], "name": [...]}
+// with path = dirs[dir[i]] + name[i]. Tables nested anywhere are converted as well.
+// Scalars and objects stay as they are.
+enum class PayloadEncoding {
+  Json,
+  Cbor,
+  MsgPack,
+  Columnar
+};
+
+// First supported type in the order listed; entries with q=0 are skipped.
+PayloadEncoding negotiateEncoding(const std::string &accept);
+const char *contentTypeOf(PayloadEncoding encoding);
+
+nlohmann::json toColumnar(const nlohmann::json &j);
+std::string encodePayload(const nlohmann::json &j, PayloadEncoding encoding);
+
+// Transcoded responses by encoding and upstream body, so an unchanged response is
+// hashed and compared, not parsed and encoded again. The body is kept next to its
+// encoding, so a hash collision is a miss rather than someone else's response.
+class PayloadCache {
+public:
+  explicit PayloadCache(size_t maxBytes = 32 * 1024 * 1024) : maxBytes_(maxBytes) {}
+
+  // nullptr if the body isn't JSON. `micros` is set to the time spent (0 on a hit).
+  std::shared_ptr<const std::string> transcode(const std::string &json, PayloadEncoding encoding, double &micros);
+
+private:
+  struct Item {
+    std::string key;
+    std::string source;
+    std::shared_ptr<const std::string> encoded;
+  };
+  const size_t maxBytes_;
+  std::mutex mutex_;
+  std::list<Item> lru_; // most recent first
+  std::unordered_map<std::string, std::list<Item>::iterator> index_;
+  size_t bytes_ = 0;
+};
+
+#endif // PAYLOAD_CODEC_H
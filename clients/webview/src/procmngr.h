@@ -8,11 +8,14 @@
 #include <stdexcept>
 #include <mutex>
 #include <cstdint>
+#include <algorithm>
 #include <cstdio> // For popen/pclose alternative on Unix if needed, though waitpid is used
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include <psapi.h>
+#include <cstring>
 struct AutoHandle {
   HANDLE h = NULL;
   void reset(HANDLE new_h = NULL) {
@@ -50,6 +53,10 @@ struct MutableProcessInfo {
 #include <errno.h>
 #include <cstring> // For strerror
 #include <stdexcept>
+#include <fcntl.h>
+#include <fstream>
+
+extern char **environ;
 #endif
 
 namespace ProcessUtils {
@@ -63,6 +70,15 @@ namespace ProcessUtils {
   }
 #endif // _WIN32
 
+  inline std::string joinNames(const std::vector<std::string> &names, char sep) {
+    std::string res;
+    for (size_t i = 0; i < names.size(); ++i) {
+      if (i) res += sep;
+      res += names[i];
+    }
+    return res;
+  }
+
 } // namespace ProcessUtils
 
 class ProcessManager {
@@ -94,6 +110,15 @@ public:
     stopProcess(true);
   }
 
+  // Listening sockets handed to the next started child, systemd-style (sd_listen_fds(3)).
+  // On Unix they become fds 3.. and LISTEN_FDS/LISTEN_PID/LISTEN_FDNAMES are set.
+  // On Windows the handles are inherited and listed in LISTEN_SOCKETS instead.
+  void setListenSockets(const std::vector<uint64_t> &sockets, const std::vector<std::string> &names = {}) {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    listenSockets_ = sockets;
+    listenSocketNames_ = names;
+  }
+
   bool startProcess(const std::string &command, const std::vector<std::string> &args = {}) {
     std::lock_guard<std::recursive_mutex> lock(mutex_);
     if (running_) {
@@ -102,11 +127,36 @@ public:
     }
     running_ = false;
     exitCode_ = -1;
+    const bool activation = !listenSockets_.empty();
 #ifdef _WIN32
     std::string cmdLine = ProcessUtils::quoteArg(command);
     for (const auto &arg : args) {
       cmdLine += " " + ProcessUtils::quoteArg(arg);
     }
+    // Environment block: the parent's variables minus stale LISTEN_*, plus the handed over sockets.
+    std::string envBlock;
+    if (activation) {
+      if (LPCH env = GetEnvironmentStringsA()) {
+        for (LPCH p = env; *p; p += strlen(p) + 1) {
+          if (strncmp(p, "LISTEN_", 7) != 0) {
+            envBlock.append(p, strlen(p) + 1);
+          }
+        }
+        FreeEnvironmentStringsA(env);
+      }
+      std::string handles;
+      for (auto h : listenSockets_) {
+        if (!handles.empty()) handles += ',';
+        handles += std::to_string(h);
+        SetHandleInformation(reinterpret_cast<HANDLE>(h), HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+      }
+      envBlock += "LISTEN_FDS=" + std::to_string(listenSockets_.size()) + '\0';
+      envBlock += "LISTEN_SOCKETS=" + handles + '\0';
+      if (!listenSocketNames_.empty()) {
+        envBlock += "LISTEN_FDNAMES=" + ProcessUtils::joinNames(listenSocketNames_, ':') + '\0';
+      }
+      envBlock += '\0';
+    }
     // CreateProcessA modifies the command line buffer, so create a mutable copy
     std::vector<char> cmdLineBuffer(cmdLine.begin(), cmdLine.end());
     cmdLineBuffer.push_back('\0');
@@ -120,13 +170,16 @@ public:
       cmdLineBuffer.data(),    // Command line (mutable copy needed)
       NULL,                   // Process handle not inheritable
       NULL,                   // Thread handle not inheritable
-      FALSE,                  // Set handle inheritance to FALSE
+      activation ? TRUE : FALSE, // Inherit the listening sockets, if any
       0,                      // No creation flags
-      NULL,                   // Use parent's environment block
+      activation ? envBlock.data() : NULL, // Parent's environment, plus LISTEN_* if any
       NULL,                   // Use parent's starting directory
       &startupInfo,           // Pointer to STARTUPINFO structure
       &tempProcessInfo        // Pointer to PROCESS_INFORMATION structure
     );
+    for (auto h : listenSockets_) {
+      SetHandleInformation(reinterpret_cast<HANDLE>(h), HANDLE_FLAG_INHERIT, 0);
+    }
     if (!success) {
       std::cerr << "Failed to create process. Error: " << GetLastError() << std::endl;
       return false;
@@ -142,6 +195,29 @@ public:
 
 #else
     // Unix/Linux implementation
+    // Everything the child needs is prepared before fork(): only async-signal-safe calls after it.
+    std::vector<std::string> envStrings;
+    std::vector<char *> envp;
+    std::vector<int> tmpFds(listenSockets_.size(), -1);
+    char *pidSlot = nullptr;
+    if (activation) {
+      envStrings.push_back("LISTEN_FDS=" + std::to_string(listenSockets_.size()));
+      if (!listenSocketNames_.empty()) {
+        envStrings.push_back("LISTEN_FDNAMES=" + ProcessUtils::joinNames(listenSocketNames_, ':'));
+      }
+      envStrings.push_back("LISTEN_PID=" + std::string(24, '\0')); // filled in by the child
+      for (char **e = environ; e && *e; ++e) {
+        if (strncmp(*e, "LISTEN_", 7) != 0) {
+          envp.push_back(*e);
+        }
+      }
+      for (auto &e : envStrings) {
+        envp.push_back(e.data());
+      }
+      envp.push_back(nullptr);
+      pidSlot = envStrings.back().data() + strlen("LISTEN_PID=");
+    }
+
     pid = fork();
 
     if (pid == -1) {
@@ -159,6 +235,30 @@ public:
       }
       argv.push_back(nullptr); // NULL terminated
 
+      if (activation) {
+        // Move the sockets above the target range first, so that placing them at 3.. never
+        // clobbers one that has not been moved yet. dup2 clears FD_CLOEXEC on the copies.
+        const int n = static_cast<int>(listenSockets_.size());
+        for (int i = 0; i < n; ++i) {
+          tmpFds[i] = fcntl(static_cast<int>(listenSockets_[i]), F_DUPFD, 3 + n);
+        }
+        for (int i = 0; i < n; ++i) {
+          dup2(tmpFds[i], 3 + i);
+          close(tmpFds[i]);
+          fcntl(3 + i, F_SETFD, 0);
+        }
+        char digits[24];
+        int len = 0;
+        for (pid_t v = getpid(); v > 0 && len < 23; v /= 10) {
+          digits[len++] = static_cast<char>('0' + v % 10);
+        }
+        for (int i = 0; i < len; ++i) {
+          pidSlot[i] = digits[len - 1 - i];
+        }
+        pidSlot[len] = '\0';
+        environ = envp.data();
+      }
+
       // Suppress output in the child process unless user redirected it
       // A more complete solution would redirect child's stdout/stderr, 
       // but for now, we only print the execvp error.
@@ -265,7 +365,7 @@ public:
 
   bool isRunning() const {
     std::lock_guard<std::recursive_mutex> lock(mutex_);
-    return !running_;
+    return running_;
   }
 
   bool testUpdatedRunningStatus() {
@@ -340,7 +440,6 @@ public:
 #else
     if (timeoutMs == -1) {
       // Blocking wait
-      std::lock_guard<std::mutex> lock(mutex_);
       int status;
       if (waitpid(pid, &status, 0) == pid) {
         running_ = false;
@@ -359,7 +458,7 @@ public:
       const int maxSleepMs = 100;
 
       while (true) {
-        if (!isRunning()) {
+        if (!testUpdatedRunningStatus()) {
           return true;
         }
 
@@ -396,6 +495,50 @@ public:
 #endif
   }
 
+  // CPU time used so far (user + kernel) and resident memory; false if not running or
+  // not available on this platform
+  bool getResourceUsage(double &cpuSeconds, uint64_t &rssBytes) const {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    if (!running_) {
+      return false;
+    }
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    PROCESS_MEMORY_COUNTERS pmc{};
+    if (!GetProcessTimes(processInfo_.hProcess, &created, &exited, &kernel, &user) ||
+        !GetProcessMemoryInfo(processInfo_.hProcess, &pmc, sizeof(pmc))) {
+      return false;
+    }
+    auto ticks = [](const FILETIME &ft) { return (static_cast<uint64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime; };
+    cpuSeconds = (ticks(kernel) + ticks(user)) / 1e7; // 100 ns units
+    rssBytes = pmc.WorkingSetSize;
+    return true;
+#elif defined(__linux__)
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    if (!std::getline(stat, line)) {
+      return false;
+    }
+    // Fields after the command name, which may contain spaces: state is field 3, utime 14, stime 15, rss 24
+    std::istringstream fields(line.substr(line.rfind(')') + 2));
+    std::string field;
+    unsigned long long utime = 0, stime = 0;
+    long long rssPages = 0;
+    for (int i = 3; i <= 24 && fields >> field; ++i) {
+      if (i == 14) utime = std::stoull(field);
+      if (i == 15) stime = std::stoull(field);
+      if (i == 24) rssPages = std::stoll(field);
+    }
+    cpuSeconds = static_cast<double>(utime + stime) / sysconf(_SC_CLK_TCK);
+    rssBytes = static_cast<uint64_t>((std::max)(rssPages, 0ll)) * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    return true;
+#else
+    (void)cpuSeconds;
+    (void)rssBytes;
+    return false;
+#endif
+  }
+
 private:
 #ifdef _WIN32
   mutable MutableProcessInfo processInfo_;
@@ -404,6 +547,8 @@ private:
   mutable pid_t pid = -1;
 #endif
 
+  std::vector<uint64_t> listenSockets_;
+  std::vector<std::string> listenSocketNames_;
   bool running_ = false;
   int exitCode_ = 0;
   mutable std::recursive_mutex mutex_;
@@ -0,0 +1,187 @@
+#include "projregistry.h"
+#include "appconfig.h"
+#include <utils_log/logger.hpp>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+  std::string hashString(const std::string &str) {
+    std::hash<std::string> hasher;
+    std::stringstream ss;
+    ss << std::hex << std::setfill('0') << std::setw(16) << hasher(str);
+    return ss.str();
+  }
+
+  // Absolute and normalized, symlinks left as they are: auto-generated project IDs hash
+  // this path and must stay what they were before the registry
+  std::string canonicalPath(const std::string &path) {
+    return fs::absolute(path).lexically_normal().generic_string();
+  }
+
+} // anonymous namespace
+
+nlohmann::json ProjectInfo::toJson() const
+{
+  return {
+    {"settingsPath", settingsPath},
+    {"projectId", projectId},
+    {"sourceRoots", sourceRoots},
+    {"embedder", embedder},
+    {"mtime", mtime},
+    {"size", size}
+  };
+}
+
+ProjectInfo ProjectInfo::fromJson(const nlohmann::json &j)
+{
+  ProjectInfo p;
+  p.settingsPath = j.at("settingsPath").get<std::string>();
+  p.projectId = j.at("projectId").get<std::string>();
+  p.sourceRoots = j.value("sourceRoots", std::vector<std::string>{});
+  p.embedder = j.value("embedder", nlohmann::json());
+  p.mtime = j.at("mtime").get<int64_t>();
+  p.size = j.at("size").get<uintmax_t>();
+  return p;
+}
+
+ProjectRegistry::ProjectRegistry(std::string cachePath)
+  : cachePath_(std::move(cachePath))
+{
+  load();
+}
+
+ProjectRegistry::~ProjectRegistry()
+{
+  save();
+}
+
+ProjectRegistry::Entry ProjectRegistry::lookup(const std::string &path)
+{
+  const auto key = canonicalPath(path);
+  std::error_code ec;
+  const auto size = fs::file_size(key, ec);
+  if (ec) {
+    throw std::runtime_error("Cannot open settings file: " + path);
+  }
+  const auto mtime = static_cast<int64_t>(fs::last_write_time(key, ec).time_since_epoch().count());
+  if (ec) {
+    throw std::runtime_error("Cannot open settings file: " + path);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it != entries_.end() && it->second->mtime == mtime && it->second->size == size) {
+      return it->second;
+    }
+  }
+  // Parsed outside the lock; a concurrent lookup of the same file just parses it twice
+  auto entry = parse(key, mtime, size);
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_[key] = entry;
+  dirty_ = true;
+  return entry;
+}
+
+nlohmann::json ProjectRegistry::lookupMany(const std::vector<std::string> &paths)
+{
+  nlohmann::json res = nlohmann::json::object();
+  for (const auto &path : paths) {
+    try {
+      res[path] = lookup(path)->toJson();
+    } catch (const std::exception &ex) {
+      res[path] = { {"error", ex.what()} };
+    }
+  }
+  return res;
+}
+
+ProjectRegistry::Entry ProjectRegistry::parse(const std::string &canonicalPath, int64_t mtime, uintmax_t size) const
+{
+  std::ifstream file(canonicalPath);
+  if (!file.is_open()) {
+    throw std::runtime_error("Cannot open settings file: " + canonicalPath);
+  }
+  nlohmann::json j;
+  file >> j;
+
+  auto info = std::make_shared<ProjectInfo>();
+  info->settingsPath = canonicalPath;
+  info->mtime = mtime;
+  info->size = size;
+  if (j.contains("source") && j["source"].is_object()) {
+    const auto &src = j["source"];
+    info->projectId = src.value("project_id", "");
+    if (src.contains("paths") && src["paths"].is_array()) {
+      for (const auto &item : src["paths"]) {
+        if (item.is_string()) {
+          info->sourceRoots.push_back(item.get<std::string>());
+        } else if (item.is_object() && item.contains("path") && item["path"].is_string()) {
+          info->sourceRoots.push_back(item["path"].get<std::string>());
+        }
+      }
+    }
+  }
+  if (j.contains("embedding")) {
+    info->embedder = j["embedding"];
+  }
+  if (info->projectId.empty()) {
+    // Auto-generate
+    const fs::path absPath(canonicalPath);
+    std::string dirName = absPath.parent_path().filename().string();
+    std::string pathHash = hashString(absPath.generic_string()).substr(0, 8);
+    info->projectId = dirName + "-" + pathHash;
+  }
+  return info;
+}
+
+void ProjectRegistry::load()
+{
+  if (cachePath_.empty()) {
+    return;
+  }
+  std::ifstream f(cachePath_);
+  if (!f.is_open()) {
+    return;
+  }
+  try {
+    nlohmann::json j;
+    f >> j;
+    for (const auto &item : j.at("projects")) {
+      auto info = std::make_shared<const ProjectInfo>(ProjectInfo::fromJson(item));
+      entries_[info->settingsPath] = std::move(info);
+    }
+    LOG_MSG << "Loaded" << entries_.size() << "project(s) from" << cachePath_;
+  } catch (const std::exception &ex) {
+    // Only a cache: start empty and rebuild it from the settings files
+    LOG_MSG << "Ignoring project cache" << cachePath_ << ":" << ex.what();
+    entries_.clear();
+  }
+}
+
+void ProjectRegistry::save()
+{
+  if (cachePath_.empty()) {
+    return;
+  }
+  nlohmann::json j;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!dirty_) {
+      return;
+    }
+    j["projects"] = nlohmann::json::array();
+    for (const auto &e : entries_) {
+      j["projects"].push_back(e.second->toJson());
+    }
+    dirty_ = false;
+  }
+  if (!writeFileAtomically(cachePath_, j.dump(2) + "\n")) {
+    LOG_MSG << "Failed to write" << cachePath_;
+  }
+}
@@ -0,0 +1,56 @@
+#ifndef PROJECT_REGISTRY_H
+#define PROJECT_REGISTRY_H
+
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+// What the host needs to know about one embedder settings file.
+struct ProjectInfo {
+  std::string settingsPath; // absolute, normalized
+  std::string projectId;
+  std::vector<std::string> sourceRoots;
+  nlohmann::json embedder;  // the settings' "embedding" section, as is
+  int64_t mtime = 0;        // file_time_type ticks, only compared for equality
+  uintmax_t size = 0;
+
+  nlohmann::json toJson() const;
+  static ProjectInfo fromJson(const nlohmann::json &j);
+};
+
+// Index of embedder settings files by absolute, normalized path. Entries are revalidated
+// lazily with a stat (mtime + size); the file is only parsed again when either changed. With
+// a cache path the index survives restarts, so even the first lookup of a session is a stat.
+class ProjectRegistry {
+public:
+  using Entry = std::shared_ptr<const ProjectInfo>;
+
+  explicit ProjectRegistry(std::string cachePath = "");
+  ~ProjectRegistry();
+
+  ProjectRegistry(const ProjectRegistry &) = delete;
+  ProjectRegistry &operator=(const ProjectRegistry &) = delete;
+
+  // Throws if the file cannot be read or parsed.
+  Entry lookup(const std::string &path);
+  // One result per path, keyed by the path as given: the project info or {"error": ...}.
+  nlohmann::json lookupMany(const std::vector<std::string> &paths);
+
+  // Writes the cache file if anything changed since it was loaded or last saved.
+  void save();
+
+private:
+  void load();
+  Entry parse(const std::string &canonicalPath, int64_t mtime, uintmax_t size) const;
+
+  const std::string cachePath_;
+  std::mutex mutex_;
+  std::unordered_map<std::string, Entry> entries_;
+  bool dirty_ = false;
+};
+
+#endif // PROJECT_REGISTRY_H
@@ -0,0 +1,209 @@
+#include "replicas.h"
+#include <algorithm>
+#include <condition_variable>
+#include <format>
+#include <optional>
+#include <thread>
+
+std::string ReplicaBalancer::Endpoint::key() const
+{
+  return std::format("{}:{}", host, port);
+}
+
+ReplicaBalancer::Ticket::~Ticket()
+{
+  if (balancer_) balancer_->release(endpoint_.key());
+}
+
+void ReplicaBalancer::setGroups(const std::vector<std::vector<Endpoint>> &groups)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  groups_.clear();
+  for (const auto &group : groups) {
+    if (!group.empty()) {
+      groups_[group.front().key()] = group;
+    }
+  }
+}
+
+size_t ReplicaBalancer::replicaCount(const std::string &host, int port) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = groups_.find(std::format("{}:{}", host, port));
+  return it != groups_.end() ? (std::max)(it->second.size(), size_t(1)) : 1;
+}
+
+ReplicaBalancer::Ticket ReplicaBalancer::pick(const std::string &host, int port, const std::string &except)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pickLocked(host, port, except);
+}
+
+ReplicaBalancer::Ticket ReplicaBalancer::pickSticky(const std::string &host, int port, const std::string &conversationId)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (conversationId.empty()) {
+    return pickLocked(host, port, "");
+  }
+  auto group = groups_.find(std::format("{}:{}", host, port));
+  auto it = sticky_.find(conversationId);
+  if (it != sticky_.end() && group != groups_.end()) {
+    for (const auto &ep : group->second) {
+      if (ep.key() == it->second) {
+        ++outstanding_[it->second];
+        ++served_[it->second];
+        return Ticket(*this, ep);
+      }
+    }
+  }
+  auto ticket = pickLocked(host, port, "");
+  if (it == sticky_.end()) {
+    stickyOrder_.push_back(conversationId);
+    if (maxSticky < stickyOrder_.size()) {
+      sticky_.erase(stickyOrder_.front());
+      stickyOrder_.pop_front();
+    }
+  }
+  sticky_[conversationId] = ticket.key();
+  return ticket;
+}
+
+void ReplicaBalancer::noteHedge(bool won)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++hedges_;
+  hedgesWon_ += won;
+}
+
+nlohmann::json ReplicaBalancer::stats() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  nlohmann::json groups = nlohmann::json::object();
+  for (const auto &[key, group] : groups_) {
+    auto &g = groups[key];
+    for (const auto &ep : group) {
+      const auto k = ep.key();
+      auto o = outstanding_.find(k);
+      auto s = served_.find(k);
+      g[k] = {
+        {"outstanding", o != outstanding_.end() ? o->second : 0},
+        {"served", s != served_.end() ? s->second : 0}
+      };
+    }
+  }
+  return { {"groups", std::move(groups)}, {"hedges", hedges_}, {"hedgesWon", hedgesWon_}, {"sticky", sticky_.size()} };
+}
+
+ReplicaBalancer::Ticket ReplicaBalancer::pickLocked(const std::string &host, int port, const std::string &except)
+{
+  auto group = groups_.find(std::format("{}:{}", host, port));
+  if (group == groups_.end() || group->second.empty()) {
+    Endpoint ep{ host, port };
+    ++outstanding_[ep.key()];
+    return Ticket(*this, std::move(ep));
+  }
+  const Endpoint *best = nullptr;
+  std::pair<size_t, size_t> bestLoad;
+  for (const auto &ep : group->second) {
+    const auto k = ep.key();
+    if (k == except && 1 < group->second.size()) continue;
+    // Fewest outstanding, then the least served so that idle replicas take turns
+    const std::pair<size_t, size_t> load = { outstanding_[k], served_[k] };
+    if (!best || load < bestLoad) {
+      best = &ep;
+      bestLoad = load;
+    }
+  }
+  const auto k = best->key();
+  ++outstanding_[k];
+  ++served_[k];
+  return Ticket(*this, *best);
+}
+
+size_t ReplicaBalancer::outstanding(const std::string &host, int port) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = outstanding_.find(Endpoint{ host, port }.key());
+  return it != outstanding_.end() ? it->second : 0;
+}
+
+void ReplicaBalancer::release(const std::string &key)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = outstanding_.find(key);
+  if (it != outstanding_.end() && it->second && !--it->second) {
+    outstanding_.erase(it);
+  }
+}
+
+UpstreamReply hedgedGet(ReplicaBalancer &replicas, UpstreamPool &pool, AdaptiveTimeouts &timeouts, const std::string &host, int port,
+  const std::string &path, const TimeoutPolicy &policy, const Deadline &deadline, bool hedge)
+{
+  auto first = replicas.pick(host, port);
+  if (!hedge || replicas.replicaCount(host, port) < 2) {
+    auto cli = pool.acquire(first.host(), first.port());
+    return timedGet(cli, timeouts, path, policy, deadline);
+  }
+  // Until the route has a history, a hedge is only sent when the first replica fails
+  auto delay = timeouts.totalPercentile(AdaptiveTimeouts::routeOf(path), 0.95);
+  if (delay.count() == 0) delay = policy.total;
+
+  struct Race {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<httplib::Client *> active;
+    std::optional<UpstreamReply> answer; // first one that isn't a 503/504
+    UpstreamReply last;
+    size_t started = 1;
+    size_t finished = 0;
+    size_t winner = 0;
+  } race;
+  auto attempt = [&pool, &timeouts, &path, &policy, &deadline, &race](ReplicaBalancer::Ticket ticket, size_t index) {
+    auto cli = pool.acquire(ticket.host(), ticket.port());
+    {
+      std::lock_guard<std::mutex> lock(race.mutex);
+      if (race.answer) {
+        ++race.finished;
+        race.cv.notify_all();
+        return;
+      }
+      race.active.push_back(&*cli);
+    }
+    auto reply = timedGet(cli, timeouts, path, policy, deadline);
+    std::lock_guard<std::mutex> lock(race.mutex);
+    race.active.erase(std::find(race.active.begin(), race.active.end(), &*cli));
+    ++race.finished;
+    if (!race.answer && reply.status != 503 && reply.status != 504) {
+      race.winner = index;
+      race.answer = std::move(reply);
+      // The slower replica's request is of no use any more
+      for (auto *other : race.active) {
+        other->stop();
+      }
+    } else if (!race.answer) {
+      race.last = std::move(reply);
+    }
+    race.cv.notify_all();
+    };
+
+  const std::string firstKey = first.key();
+  std::thread firstThread(attempt, std::move(first), 0);
+  std::thread secondThread;
+  std::unique_lock<std::mutex> lock(race.mutex);
+  race.cv.wait_for(lock, (std::min)(delay, deadline.remaining()), [&race] { return race.answer || race.finished; });
+  if (!race.answer && !deadline.expired()) {
+    ++race.started;
+    lock.unlock();
+    secondThread = std::thread(attempt, replicas.pick(host, port, firstKey), 1);
+    lock.lock();
+  }
+  race.cv.wait(lock, [&race] { return race.answer || race.finished == race.started; });
+  lock.unlock();
+  firstThread.join();
+  if (secondThread.joinable()) secondThread.join();
+
+  if (1 < race.started) {
+    replicas.noteHedge(race.answer && race.winner == 1);
+  }
+  return race.answer ? std::move(*race.answer) : std::move(race.last);
+}
@@ -0,0 +1,85 @@
+#ifndef REPLICAS_H
+#define REPLICAS_H
+
+#include "deadline.h"
+#include "upstreampool.h"
+#include <nlohmann/json.hpp>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Embedder processes serving the same project, grouped under the endpoint of its active
+// process (the one the page selects, api.host:port). A request to that endpoint goes to
+// the replica with the fewest requests outstanding; a chat stays on the replica that
+// answered the conversation before, as long as it's there. Endpoints without replicas
+// are used as they are.
+class ReplicaBalancer {
+public:
+  struct Endpoint {
+    std::string host;
+    int port = 0;
+    std::string key() const;
+  };
+
+  // One outstanding request on a replica, counted until destroyed
+  class Ticket {
+  public:
+    Ticket(ReplicaBalancer &balancer, Endpoint endpoint) : balancer_(&balancer), endpoint_(std::move(endpoint)) {}
+    Ticket(Ticket &&other) noexcept : balancer_(std::exchange(other.balancer_, nullptr)), endpoint_(std::move(other.endpoint_)) {}
+    Ticket(const Ticket &) = delete;
+    Ticket &operator=(const Ticket &) = delete;
+    Ticket &operator=(Ticket &&) = delete;
+    ~Ticket();
+
+    const std::string &host() const { return endpoint_.host; }
+    int port() const { return endpoint_.port; }
+    std::string key() const { return endpoint_.key(); }
+
+  private:
+    ReplicaBalancer *balancer_;
+    Endpoint endpoint_;
+  };
+
+  // Replaces all groups; the first endpoint of each is the active process
+  void setGroups(const std::vector<std::vector<Endpoint>> &groups);
+  // Replicas serving the project of host:port, 1 when it has none
+  size_t replicaCount(const std::string &host, int port) const;
+  // Tickets not yet released for the replica at host:port, whether or not it's still in a group
+  size_t outstanding(const std::string &host, int port) const;
+
+  // Least outstanding, ties taking turns; `except` ("host:port") only if it's the only one
+  Ticket pick(const std::string &host, int port, const std::string &except = "");
+  // The replica the conversation was sent to before, if it is still there
+  Ticket pickSticky(const std::string &host, int port, const std::string &conversationId);
+
+  void noteHedge(bool won);
+
+  // {groups: {<active host:port>: {<replica host:port>: {outstanding, served}}}, hedges, hedgesWon, sticky}
+  nlohmann::json stats() const;
+
+private:
+  static constexpr size_t maxSticky = 1024;
+
+  Ticket pickLocked(const std::string &host, int port, const std::string &except);
+  void release(const std::string &key);
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, std::vector<Endpoint>> groups_; // by the active "host:port"
+  std::unordered_map<std::string, size_t> outstanding_;           // by replica "host:port"
+  std::unordered_map<std::string, size_t> served_;
+  std::unordered_map<std::string, std::string> sticky_;           // conversation id -> replica
+  std::deque<std::string> stickyOrder_;                           // oldest first, for eviction
+  size_t hedges_ = 0;
+  size_t hedgesWon_ = 0;
+};
+
+// Idempotent GET to the project of host:port. With replicas, when no answer came within
+// the route's 95th percentile (or the first replica failed), the request also goes to
+// another replica; the first answer is taken and the other request is stopped.
+UpstreamReply hedgedGet(ReplicaBalancer &replicas, UpstreamPool &pool, AdaptiveTimeouts &timeouts, const std::string &host, int port,
+  const std::string &path, const TimeoutPolicy &policy, const Deadline &deadline, bool hedge = true);
+
+#endif // REPLICAS_H
@@ -0,0 +1,187 @@
+#include "reqsched.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+RequestClass classifyRequest(const std::string &method, const std::string &path)
+{
+  if (path.rfind("/api/chat", 0) == 0) return RequestClass::Interactive;
+  if (path == "/api/health") return RequestClass::Health;
+  if (path.rfind("/api/documents", 0) == 0 || path.rfind("/api/stats", 0) == 0) return RequestClass::Bulk;
+  if (method == "POST") return RequestClass::Bulk; // embed, index, ...
+  return RequestClass::Metadata;
+}
+
+const char *requestClassName(RequestClass c)
+{
+  switch (c) {
+  case RequestClass::Interactive: return "interactive";
+  case RequestClass::Health: return "health";
+  case RequestClass::Metadata: return "metadata";
+  default: return "bulk";
+  }
+}
+
+RequestScheduler::Slot::Slot(Slot &&other) noexcept
+{
+  *this = std::move(other);
+}
+
+RequestScheduler::Slot &RequestScheduler::Slot::operator=(Slot &&other) noexcept
+{
+  if (this != &other) {
+    if (scheduler_) scheduler_->release(*this);
+    scheduler_ = std::exchange(other.scheduler_, nullptr);
+    upstream_ = std::move(other.upstream_);
+    class_ = other.class_;
+    started_ = other.started_;
+    retryAfter_ = other.retryAfter_;
+    waitedMs_ = other.waitedMs_;
+  }
+  return *this;
+}
+
+RequestScheduler::Slot::~Slot()
+{
+  if (scheduler_) scheduler_->release(*this);
+}
+
+RequestScheduler::RequestScheduler(Limits limits) : limits_(std::move(limits))
+{
+}
+
+RequestScheduler::Slot RequestScheduler::acquire(const std::string &upstream, RequestClass c)
+{
+  const size_t cls = static_cast<size_t>(c);
+  const auto enqueued = std::chrono::steady_clock::now();
+  Slot slot;
+  slot.class_ = c;
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto &stats = classes_[cls];
+  size_t blocked = running_;
+  for (const auto &c : classes_) blocked += c.queued;
+  const bool noFreeWorker = limits_.workers && limits_.workers <= blocked + (cls <= 1 ? 0 : limits_.urgentWorkers);
+  if (limits_.queueDepth[cls] <= stats.queued || noFreeWorker) {
+    ++stats.shed;
+    slot.retryAfter_ = retryAfterLocked(cls);
+    return slot;
+  }
+  auto &u = upstreams_[upstream];
+  Waiter waiter;
+  u.queues[cls].push_back(&waiter);
+  ++stats.queued;
+  dispatchLocked();
+  if (!cv_.wait_until(lock, enqueued + limits_.maxWait[cls], [&waiter] { return waiter.granted; })) {
+    auto &queue = u.queues[cls];
+    queue.erase(std::remove(queue.begin(), queue.end(), &waiter), queue.end());
+    --stats.queued;
+    ++stats.shed;
+    slot.retryAfter_ = retryAfterLocked(cls);
+    return slot;
+  }
+  slot.scheduler_ = this;
+  slot.upstream_ = upstream;
+  slot.started_ = std::chrono::steady_clock::now();
+  slot.waitedMs_ = std::chrono::duration<double, std::milli>(slot.started_ - enqueued).count();
+  stats.waitMsTotal += slot.waitedMs_;
+  stats.waitMsMax = (std::max)(stats.waitMsMax, slot.waitedMs_);
+  return slot;
+}
+
+nlohmann::json RequestScheduler::stats() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  nlohmann::json classes = nlohmann::json::object();
+  for (size_t cls = 0; cls < classes_.size(); ++cls) {
+    const auto &s = classes_[cls];
+    classes[requestClassName(static_cast<RequestClass>(cls))] = {
+      {"queued", s.queued},
+      {"running", s.running},
+      {"dispatched", s.dispatched},
+      {"shed", s.shed},
+      {"waitMsAvg", s.dispatched ? s.waitMsTotal / s.dispatched : 0.0},
+      {"waitMsMax", s.waitMsMax},
+      {"serviceMsAvg", s.serviceMsAvg}
+    };
+  }
+  nlohmann::json upstreams = nlohmann::json::object();
+  for (const auto &[key, u] : upstreams_) {
+    size_t queued = 0;
+    for (const auto &q : u.queues) queued += q.size();
+    upstreams[key] = { {"running", u.running}, {"queued", queued} };
+  }
+  return { {"classes", std::move(classes)}, {"upstreams", std::move(upstreams)}, {"running", running_} };
+}
+
+void RequestScheduler::release(Slot &slot)
+{
+  const size_t cls = static_cast<size_t>(slot.class_);
+  const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - slot.started_).count();
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = upstreams_.find(slot.upstream_);
+  if (it != upstreams_.end()) {
+    --it->second.running;
+    if (!it->second.running && std::all_of(it->second.queues.begin(), it->second.queues.end(), [](const auto &q) { return q.empty(); })) {
+      upstreams_.erase(it);
+    }
+  }
+  --running_;
+  auto &stats = classes_[cls];
+  --stats.running;
+  stats.serviceMsAvg = stats.serviceMsAvg ? 0.8 * stats.serviceMsAvg + 0.2 * ms : ms;
+  dispatchLocked();
+}
+
+void RequestScheduler::dispatchLocked()
+{
+  bool granted = false;
+  while (true) {
+    // Metadata gets 3 turns for each Bulk one while both wait
+    const size_t low[2] = { lowCredit_ < 3 ? size_t(2) : size_t(3), lowCredit_ < 3 ? size_t(3) : size_t(2) };
+    const size_t order[4] = { 0, 1, low[0], low[1] };
+    bool picked = false;
+    for (size_t cls : order) {
+      if (limits_.total + (cls <= 1 ? limits_.reserved : 0) <= running_) continue;
+      // Upstreams with a waiting request that may run, taking turns in key order
+      std::vector<const std::string *> ready;
+      for (const auto &[key, u] : upstreams_) {
+        if (!u.queues[cls].empty() && hasRoomLocked(u, cls)) ready.push_back(&key);
+      }
+      if (ready.empty()) continue;
+      std::sort(ready.begin(), ready.end(), [](const std::string *a, const std::string *b) { return *a < *b; });
+      auto next = std::find_if(ready.begin(), ready.end(), [this, cls](const std::string *key) { return lastServed_[cls] < *key; });
+      const std::string &key = **(next != ready.end() ? next : ready.begin());
+      auto &u = upstreams_[key];
+      u.queues[cls].front()->granted = true;
+      u.queues[cls].pop_front();
+      ++u.running;
+      ++running_;
+      auto &stats = classes_[cls];
+      --stats.queued;
+      ++stats.running;
+      ++stats.dispatched;
+      lastServed_[cls] = key;
+      if (cls == 2) ++lowCredit_;
+      if (cls == 3) lowCredit_ = 0;
+      picked = granted = true;
+      break;
+    }
+    if (!picked) break;
+  }
+  if (granted) {
+    cv_.notify_all();
+  }
+}
+
+bool RequestScheduler::hasRoomLocked(const Upstream &u, size_t cls) const
+{
+  return u.running < limits_.perUpstream + (cls <= 1 ? limits_.reserved : 0);
+}
+
+int RequestScheduler::retryAfterLocked(size_t cls) const
+{
+  // Time for the queue ahead to drain at the upstream's concurrency, at least a second
+  const double ms = (classes_[cls].queued + 1) * (classes_[cls].serviceMsAvg ? classes_[cls].serviceMsAvg : 1000.0) /
+    static_cast<double>((std::max)(limits_.perUpstream, size_t(1)));
+  return std::clamp(static_cast<int>(std::ceil(ms / 1000)), 1, 30);
+}
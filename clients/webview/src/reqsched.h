@@ -0,0 +1,120 @@
+#ifndef REQUEST_SCHEDULER_H
+#define REQUEST_SCHEDULER_H
+
+#include <nlohmann/json.hpp>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// What a proxied request is for, in the order the scheduler favours them
+enum class RequestClass {
+  Interactive, // chat submits
+  Health,      // connection checks
+  Metadata,    // small lookups: settings, instances, ...
+  Bulk         // document lists, stats, indexing
+};
+
+RequestClass classifyRequest(const std::string &method, const std::string &path);
+const char *requestClassName(RequestClass c);
+
+// Decides which proxied request goes upstream next, so that a burst of bulk fetches
+// doesn't hold up a chat submit or a health check.
+//
+// Requests wait in one bounded queue per class and upstream ("host:port", i.e. per
+// project instance). Whenever a slot frees up, the waiting request of the most urgent
+// class is dispatched: Interactive and Health strictly first, then Metadata and Bulk
+// by weight (3:1, so bulk isn't starved). Within a class, upstreams take turns.
+// Each upstream runs at most `perUpstream` requests at once, plus `reserved` more for
+// Interactive and Health, and all upstreams together at most `total`.
+//
+// A request is refused (shed) when its class queue is full or it waited longer than
+// its class allows; the caller answers 429 with the suggested Retry-After. Callers block
+// in acquire() on a thread of the HTTP server, so with `workers` set a request is also
+// refused when waiting and running requests would take the last free ones: requests the
+// scheduler can't see behind them (a chat submit, a health check) would queue in the
+// server's own FIFO. Metadata and Bulk leave `urgentWorkers` of them free.
+class RequestScheduler {
+public:
+  struct Limits {
+    size_t perUpstream = 6;
+    size_t reserved = 2;
+    size_t total = 16;
+    size_t workers = 0;       // server threads callers may block, 0 = not limited
+    size_t urgentWorkers = 4; // of those, left for Interactive and Health
+    std::array<size_t, 4> queueDepth = { 32, 16, 64, 16 };
+    std::array<std::chrono::milliseconds, 4> maxWait = {
+      std::chrono::seconds(60), std::chrono::seconds(2), std::chrono::seconds(15), std::chrono::seconds(30) };
+  };
+
+  class Slot {
+  public:
+    Slot() = default;
+    Slot(Slot &&other) noexcept;
+    Slot &operator=(Slot &&other) noexcept;
+    Slot(const Slot &) = delete;
+    Slot &operator=(const Slot &) = delete;
+    ~Slot();
+
+    explicit operator bool() const { return scheduler_ != nullptr; }
+    int retryAfterSeconds() const { return retryAfter_; }
+    double waitedMs() const { return waitedMs_; }
+
+  private:
+    friend class RequestScheduler;
+    RequestScheduler *scheduler_ = nullptr;
+    std::string upstream_;
+    RequestClass class_ = RequestClass::Metadata;
+    std::chrono::steady_clock::time_point started_;
+    int retryAfter_ = 0;
+    double waitedMs_ = 0;
+  };
+
+  RequestScheduler() : RequestScheduler(Limits{}) {}
+  explicit RequestScheduler(Limits limits);
+
+  // Blocks until the request may go upstream; an empty slot means it was shed.
+  // The slot is held until it is destroyed.
+  Slot acquire(const std::string &upstream, RequestClass c);
+
+  // {classes: {<name>: {queued, running, dispatched, shed, waitMsAvg, waitMsMax, serviceMsAvg}},
+  //  upstreams: {<host:port>: {running, queued}}}
+  nlohmann::json stats() const;
+
+private:
+  struct Waiter {
+    bool granted = false;
+  };
+  struct Upstream {
+    size_t running = 0;
+    std::array<std::deque<Waiter *>, 4> queues;
+  };
+  struct ClassStats {
+    size_t queued = 0;
+    size_t running = 0;
+    size_t dispatched = 0;
+    size_t shed = 0;
+    double waitMsTotal = 0;
+    double waitMsMax = 0;
+    double serviceMsAvg = 0; // moving average
+  };
+
+  void release(Slot &slot);
+  void dispatchLocked();
+  bool hasRoomLocked(const Upstream &u, size_t cls) const;
+  int retryAfterLocked(size_t cls) const;
+
+  const Limits limits_;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::unordered_map<std::string, Upstream> upstreams_;
+  std::array<ClassStats, 4> classes_;
+  size_t running_ = 0;
+  std::string lastServed_[4]; // upstream served last per class, for taking turns
+  size_t lowCredit_ = 0;      // Metadata picks since the last Bulk one
+};
+
+#endif // REQUEST_SCHEDULER_H
@@ -0,0 +1,325 @@
+#include "sserelay.h"
+#include <utils_log/logger.hpp>
+#include <nlohmann/json.hpp>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+namespace {
+
+  const std::string metaTagBegin = "[meta]";
+
+  std::vector<std::string> splitPath(std::string p) {
+    std::replace(p.begin(), p.end(), '\\', '/');
+    std::vector<std::string> parts;
+    size_t b = 0, e;
+    while ((e = p.find('/', b)) != std::string::npos) {
+      parts.push_back(p.substr(b, e - b));
+      b = e + 1;
+    }
+    parts.push_back(p.substr(b));
+    return parts;
+  }
+
+  // Same as stripCommonPrefix in the SPA's utils.ts
+  std::vector<std::string> stripCommonPrefix(const std::vector<std::string> &paths) {
+    if (paths.empty()) return {};
+    std::vector<std::vector<std::string>> split;
+    size_t minLen = SIZE_MAX;
+    for (const auto &p : paths) {
+      split.push_back(splitPath(p));
+      minLen = (std::min)(minLen, split.back().size());
+    }
+    size_t prefixLen = 0;
+    for (; prefixLen < minLen; ++prefixLen) {
+      const auto &segment = split[0][prefixLen];
+      if (!std::all_of(split.begin(), split.end(), [&](const auto &s) { return s[prefixLen] == segment; })) break;
+    }
+    if (prefixLen == 0) return paths;
+    if (prefixLen == minLen) --prefixLen; // leave at least one segment
+    std::vector<std::string> res;
+    for (const auto &s : split) {
+      std::string joined;
+      for (size_t i = prefixLen; i < s.size(); ++i) {
+        if (i != prefixLen) joined += '/';
+        joined += s[i];
+      }
+      res.push_back(joined);
+    }
+    return res;
+  }
+
+} // anonymous namespace
+
+nlohmann::json RelayMetrics::toJson() const
+{
+  return {
+    {"streams", streams.load()},
+    {"eventsIn", eventsIn.load()},
+    {"eventsOut", eventsOut.load()},
+    {"contentIn", contentIn.load()},
+    {"contentOut", contentOut.load()},
+    {"bytesIn", bytesIn.load()},
+    {"bytesOut", bytesOut.load()}
+  };
+}
+
+ChatStreamRelay::ChatStreamRelay(Writer out, MarkdownCache *cache, std::string idPrefix, RelayOptions opts, RelayMetrics *metrics)
+  : out_(std::move(out)), cache_(cache), md_(std::move(idPrefix)), opts_(opts), metrics_(metrics)
+{
+  if (metrics_) {
+    ++metrics_->streams;
+  }
+  if (opts_.coalesce && 0 < opts_.frame.count()) {
+    timer_ = std::thread(&ChatStreamRelay::runTimer, this);
+  }
+}
+
+ChatStreamRelay::~ChatStreamRelay()
+{
+  stopTimer();
+}
+
+void ChatStreamRelay::stopTimer()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  if (timer_.joinable()) {
+    timer_.join();
+  }
+}
+
+// Ends the frame when upstream goes quiet with content pending
+void ChatStreamRelay::runTimer()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_) {
+    if (pendingEvents_ == 0) {
+      cv_.wait(lock);
+      continue;
+    }
+    if (cv_.wait_until(lock, pendingSince_ + opts_.frame, [this] { return stop_; })) {
+      break;
+    }
+    if (pendingEvents_ && pendingSince_ + opts_.frame <= std::chrono::steady_clock::now()) {
+      flushPending();
+    }
+  }
+}
+
+bool ChatStreamRelay::onData(const char *data, size_t len)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (failed_) {
+    return false;
+  }
+  bytesIn_ += len;
+  buffer_.append(data, len);
+  size_t pos, start = 0;
+  while (!failed_ && (pos = buffer_.find("\n\n", start)) != std::string::npos) {
+    onEvent(buffer_.substr(start, pos - start));
+    start = pos + 2;
+  }
+  buffer_.erase(0, start);
+  return !failed_;
+}
+
+bool ChatStreamRelay::sendEvent(const nlohmann::json &event)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (failed_) {
+    return false;
+  }
+  flushPending();
+  write("data: " + event.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace) + "\n\n");
+  return !failed_;
+}
+
+bool ChatStreamRelay::finish()
+{
+  stopTimer();
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!buffer_.empty()) {
+    onEvent(buffer_);
+    buffer_.clear();
+  }
+  flushPending();
+  if (cache_ && !done_) {
+    done_ = true;
+    emitDelta(md_.finish(), true);
+  }
+  if (metrics_) {
+    metrics_->eventsIn += eventsIn_;
+    metrics_->eventsOut += eventsOut_;
+    metrics_->contentIn += contentIn_;
+    metrics_->contentOut += contentOut_;
+    metrics_->bytesIn += bytesIn_;
+    metrics_->bytesOut += bytesOut_;
+  }
+  LOG_MSG << "Relayed" << eventsIn_ << "event(s) as" << eventsOut_ << "- content events" << contentIn_ << "->" << contentOut_;
+  return !failed_;
+}
+
+// Same as processResponse in ChatPanel.svelte
+std::string ChatStreamRelay::answer() const
+{
+  std::string res;
+  size_t newlines = 0;
+  for (char c : answer_) {
+    if (c == '\n') {
+      if (++newlines <= 2) res += c;
+    } else {
+      newlines = 0;
+      res += c;
+    }
+  }
+  const size_t b = res.find_first_not_of('\n');
+  if (b == std::string::npos) {
+    return "";
+  }
+  return res.substr(b, res.find_last_not_of('\n') + 1 - b);
+}
+
+bool ChatStreamRelay::onEvent(const std::string &event)
+{
+  ++eventsIn_;
+  const std::string prefix = "data: ";
+  if (done_ || event.compare(0, prefix.size(), prefix) != 0) {
+    return passThrough(event);
+  }
+  const std::string payload = event.substr(prefix.size());
+  if (payload == "[DONE]") {
+    flushPending();
+    done_ = true;
+    if (cache_) {
+      emitDelta(md_.finish(), true);
+    }
+    return write(event + "\n\n");
+  }
+  if (!opts_.coalesce && !cache_ && !opts_.captureAnswer) {
+    return write(event + "\n\n");
+  }
+  nlohmann::json j;
+  try {
+    j = nlohmann::json::parse(payload);
+  } catch (const std::exception &) {
+    return passThrough(event); // nothing to merge or render
+  }
+  if (!j.is_object()) {
+    return passThrough(event);
+  }
+  if (j.contains("sources") && j.value("type", "") == "context_sources") {
+    std::string text = "\n\nSources:  \n";
+    try {
+      for (const auto &a : stripCommonPrefix(j["sources"].get<std::vector<std::string>>())) {
+        text += "*" + a + "*  \n";
+      }
+    } catch (const std::exception &) {
+      text.clear();
+    }
+    return passThrough(event, text);
+  }
+  if (!j.contains("content") || !j["content"].is_string()) {
+    return passThrough(event);
+  }
+  std::string text = j["content"].get<std::string>();
+  if (text.compare(0, metaTagBegin.size(), metaTagBegin) == 0) {
+    return passThrough(event); // progress info, not part of the answer
+  }
+  j.erase("content");
+  if (pendingEvents_ && j != pendingRest_) {
+    flushPending(); // only events that differ in nothing but the text are merged
+  }
+  if (pendingEvents_ == 0) {
+    pendingRaw_ = event;
+    pendingRest_ = std::move(j);
+    pendingSince_ = std::chrono::steady_clock::now();
+    cv_.notify_all();
+  }
+  pendingContent_ += text;
+  ++pendingEvents_;
+  ++contentIn_;
+  if (!opts_.coalesce || opts_.frame.count() == 0 || opts_.frameBytes <= pendingContent_.size() ||
+      pendingSince_ + opts_.frame <= std::chrono::steady_clock::now()) {
+    return flushPending();
+  }
+  return !failed_;
+}
+
+bool ChatStreamRelay::passThrough(const std::string &event, const std::string &markdown)
+{
+  flushPending();
+  write(event + "\n\n");
+  if (opts_.captureAnswer && !done_) {
+    answer_ += markdown;
+  }
+  if (cache_ && !done_ && !markdown.empty() && !failed_) {
+    const auto d = md_.feed(markdown);
+    if (d.changed) {
+      emitDelta(d, false);
+    }
+  }
+  return !failed_;
+}
+
+bool ChatStreamRelay::flushPending()
+{
+  if (pendingEvents_ == 0) {
+    return !failed_;
+  }
+  if (pendingEvents_ == 1) {
+    write(pendingRaw_ + "\n\n");
+  } else {
+    auto j = pendingRest_;
+    j["content"] = pendingContent_;
+    write("data: " + j.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace) + "\n\n");
+  }
+  ++contentOut_;
+  const std::string text = std::move(pendingContent_);
+  pendingContent_.clear();
+  pendingRaw_.clear();
+  pendingEvents_ = 0;
+  if (opts_.captureAnswer) {
+    answer_ += text;
+  }
+  if (cache_ && !failed_) {
+    const auto d = md_.feed(text);
+    if (d.changed) {
+      emitDelta(d, false);
+    }
+  }
+  return !failed_;
+}
+
+bool ChatStreamRelay::emitDelta(const MarkdownStream::Delta &d, bool final)
+{
+  nlohmann::json j = {
+    {"type", "md_delta"},
+    {"seq", seq_++},
+    {"append", d.append},
+    {"tail", d.tail}
+  };
+  if (final) {
+    const auto key = MarkdownCache::keyOf(md_.source());
+    cache_->put(key, md_.html());
+    j["final"] = true;
+    j["key"] = key;
+  }
+  return write("data: " + j.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace) + "\n\n");
+}
+
+bool ChatStreamRelay::write(const std::string &s)
+{
+  if (failed_) {
+    return false;
+  }
+  ++eventsOut_;
+  bytesOut_ += s.size();
+  if (!out_(s.data(), s.size())) {
+    failed_ = true;
+  }
+  return !failed_;
+}
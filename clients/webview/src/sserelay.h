@@ -0,0 +1,106 @@
+#ifndef SSE_RELAY_H
+#define SSE_RELAY_H
+
+#include "mdrender.h"
+#include <nlohmann/json.hpp>
+#include <string>
+#include <functional>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+// Totals over all relayed streams, for /host/metrics/sse.
+struct RelayMetrics {
+  std::atomic<uint64_t> streams{ 0 };
+  std::atomic<uint64_t> eventsIn{ 0 };
+  std::atomic<uint64_t> eventsOut{ 0 };
+  std::atomic<uint64_t> contentIn{ 0 };  // content events from upstream
+  std::atomic<uint64_t> contentOut{ 0 }; // ... and after coalescing
+  std::atomic<uint64_t> bytesIn{ 0 };
+  std::atomic<uint64_t> bytesOut{ 0 };
+
+  nlohmann::json toJson() const;
+};
+
+struct RelayOptions {
+  bool coalesce = false;                // false: latency mode, every event right away
+  std::chrono::milliseconds frame{ 16 };
+  size_t frameBytes = 2048;
+  bool captureAnswer = false;           // keep the answer text for answer()
+};
+
+// Sits between the embedder's /api/chat event stream and the page.
+//
+// Coalescing (throughput mode): consecutive content events are merged into one per frame
+// (frame time after the first of them, or frameBytes of content, whichever comes first).
+// Everything else - [meta] progress, context_sources, [DONE] - goes out right away, after
+// whatever content is pending. Without coalescing (latency mode) every event is
+// forwarded as soon as it is complete.
+//
+// With a cache, the answer is also rendered as it streams in and each flush that changed
+// the rendering is followed by
+//   data: {"type":"md_delta","seq":N,"append":"...","tail":"..."}
+// The last delta (before [DONE] or at the end of the stream) has "final":true and the
+// cache key of the complete html.
+class ChatStreamRelay {
+public:
+  using Writer = std::function<bool(const char *data, size_t len)>;
+
+  // cache == nullptr: no rendering. The writer may be called from the relay's timer
+  // thread too, but never concurrently and never after finish() returned.
+  ChatStreamRelay(Writer out, MarkdownCache *cache, std::string idPrefix,
+    RelayOptions opts = {}, RelayMetrics *metrics = nullptr);
+  ~ChatStreamRelay();
+
+  ChatStreamRelay(const ChatStreamRelay &) = delete;
+  ChatStreamRelay &operator=(const ChatStreamRelay &) = delete;
+
+  // false once the writer failed (client gone)
+  bool onData(const char *data, size_t len);
+  // An event of the host's own, after whatever is pending. Not part of the answer.
+  bool sendEvent(const nlohmann::json &event);
+  // Flushes what is pending and sends the final delta if [DONE] never came.
+  bool finish();
+
+  // The answer as the page ends up storing it (content and sources, trimmed), if captured.
+  std::string answer() const;
+
+private:
+  void runTimer();
+  bool onEvent(const std::string &event);
+  bool passThrough(const std::string &event, const std::string &markdown = "");
+  bool flushPending();
+  bool emitDelta(const MarkdownStream::Delta &d, bool final);
+  bool write(const std::string &s);
+  void stopTimer();
+
+  Writer out_;
+  MarkdownCache *cache_;
+  MarkdownStream md_;
+  const RelayOptions opts_;
+  RelayMetrics *metrics_;
+
+  std::mutex mutex_;
+  std::string buffer_;
+  // Content waiting for the end of the frame: the first event as received (sent verbatim
+  // if nothing joins it), its other fields and the merged text.
+  std::string pendingRaw_;
+  nlohmann::json pendingRest_;
+  std::string pendingContent_;
+  size_t pendingEvents_ = 0;
+  std::chrono::steady_clock::time_point pendingSince_;
+  std::string answer_;
+  uint64_t seq_ = 0;
+  bool done_ = false;
+  bool failed_ = false;
+  uint64_t eventsIn_ = 0, eventsOut_ = 0, contentIn_ = 0, contentOut_ = 0, bytesIn_ = 0, bytesOut_ = 0;
+
+  std::condition_variable cv_;
+  bool stop_ = false;
+  std::thread timer_;
+};
+
+#endif // SSE_RELAY_H
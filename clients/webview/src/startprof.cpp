@@ -0,0 +1,48 @@
+#include "startprof.h"
+#include <utils_log/logger.hpp>
+#include <sstream>
+#include <thread>
+
+StartupProfiler::StartupProfiler(bool enabled)
+  : enabled_(enabled)
+  , t0_(std::chrono::steady_clock::now())
+{
+}
+
+void StartupProfiler::mark(const std::string &phase, const std::string &source, double pageMs)
+{
+  if (!enabled_) {
+    return;
+  }
+  const double atMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0_).count();
+  std::stringstream tid;
+  tid << std::this_thread::get_id();
+  std::lock_guard<std::mutex> lock(mutex_);
+  marks_.push_back({ phase, source, atMs, pageMs, tid.str() });
+}
+
+nlohmann::json StartupProfiler::toJson() const
+{
+  nlohmann::json j;
+  j["enabled"] = enabled_;
+  j["phases"] = nlohmann::json::array();
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto &m : marks_) {
+    nlohmann::json p = { {"phase", m.phase}, {"source", m.source}, {"atMs", m.atMs}, {"thread", m.thread} };
+    if (0 <= m.pageMs) p["pageMs"] = m.pageMs;
+    j["phases"].push_back(p);
+  }
+  return j;
+}
+
+void StartupProfiler::log() const
+{
+  if (!enabled_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  LOG_MSG << "Startup profile (ms since main):";
+  for (const auto &m : marks_) {
+    LOG_MSG << "  " << m.atMs << m.source << m.phase << "thread" << m.thread;
+  }
+}
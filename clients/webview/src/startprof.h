@@ -0,0 +1,40 @@
+#ifndef STARTUP_PROFILER_H
+#define STARTUP_PROFILER_H
+
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+
+// Startup trace enabled with --startup-profile: one timestamp per phase, relative to
+// main() entry, from the host's own phases up to the page's first paint.
+class StartupProfiler {
+public:
+  explicit StartupProfiler(bool enabled);
+
+  bool enabled() const { return enabled_; }
+
+  // Thread-safe, no-op when disabled. pageMs is the page's own performance.now().
+  void mark(const std::string &phase, const std::string &source = "host", double pageMs = -1);
+
+  nlohmann::json toJson() const;
+  // Logs the timeline, with the time spent since the previous phase.
+  void log() const;
+
+private:
+  struct Mark {
+    std::string phase;
+    std::string source;
+    double atMs;
+    double pageMs;
+    std::string thread;
+  };
+
+  const bool enabled_;
+  const std::chrono::steady_clock::time_point t0_;
+  mutable std::mutex mutex_;
+  std::vector<Mark> marks_;
+};
+
+#endif // STARTUP_PROFILER_H
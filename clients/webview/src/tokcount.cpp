@@ -0,0 +1,177 @@
+#include "tokcount.h"
+#include <array>
+#include <chrono>
+#include <vector>
+#include <functional>
+#include <cstdio>
+
+namespace {
+
+  enum Class : uint8_t { Other, Letter, High, Digit, Space, Punct };
+
+  // One lookup per byte instead of a chain of range checks
+  constexpr std::array<uint8_t, 256> makeClasses() {
+    std::array<uint8_t, 256> t{};
+    for (int c = 0; c < 256; ++c) {
+      if (('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z')) t[c] = Letter;
+      else if (0x80 <= c) t[c] = High; // UTF-8 sequences: letters of other scripts, mostly
+      else if ('0' <= c && c <= '9') t[c] = Digit;
+      else if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v') t[c] = Space;
+      else if (0x21 <= c && c <= 0x7e) t[c] = Punct;
+      else t[c] = Other;
+    }
+    return t;
+  }
+
+  constexpr auto classes = makeClasses();
+
+  inline uint8_t cls(std::string_view s, size_t i) {
+    return classes[static_cast<uint8_t>(s[i])];
+  }
+
+  // Common words are one token; longer ones split into pieces of about four letters
+  inline size_t wordTokens(size_t letters) {
+    return letters == 0 ? 0 : letters <= 6 ? 1 : (letters + 3) / 4;
+  }
+
+  // 's 't 're 've 'm 'll 'd
+  inline bool isContraction(std::string_view s, size_t i) {
+    if (s[i] != '\'' || s.size() <= i + 1) return false;
+    size_t k = i + 1;
+    while (k < s.size() && k - i <= 3 && cls(s, k) == Letter) ++k;
+    const size_t len = k - i - 1;
+    return 0 < len && len <= 2 && (s.size() <= k || cls(s, k) != Letter);
+  }
+
+  constexpr size_t messageOverhead = 4; // role and separators
+
+} // anonymous namespace
+
+size_t TokenCounter::count(std::string_view s)
+{
+  size_t tokens = 0;
+  const size_t n = s.size();
+  size_t i = 0;
+  while (i < n) {
+    // A single space before a word, number or symbol is part of that piece
+    if (s[i] == ' ' && i + 1 < n) {
+      const uint8_t next = cls(s, i + 1);
+      if (next == Letter || next == High || next == Digit || next == Punct) ++i;
+    }
+    size_t j = i;
+    switch (cls(s, i)) {
+    case Letter:
+    case High: {
+      size_t ascii = 0, high = 0;
+      for (uint8_t c; j < n && ((c = cls(s, j)) == Letter || c == High); ++j) {
+        if (c == High) ++high;
+        else ++ascii;
+      }
+      tokens += wordTokens(ascii) + (high + 2) / 3;
+      break;
+    }
+    case Digit:
+      while (j < n && cls(s, j) == Digit) ++j;
+      tokens += (j - i + 2) / 3;
+      break;
+    case Punct:
+      if (isContraction(s, i)) {
+        ++j;
+        while (j < n && cls(s, j) == Letter) ++j;
+        tokens += 1;
+        break;
+      }
+      while (j < n && cls(s, j) == Punct && !isContraction(s, j)) ++j;
+      tokens += (j - i + 1) / 2;
+      break;
+    case Space:
+      while (j < n && cls(s, j) == Space) ++j;
+      // the space that belongs to the next word isn't part of this run
+      if (j < n && i + 1 < j && s[j - 1] == ' ') --j;
+      tokens += 1;
+      break;
+    default:
+      ++j;
+      tokens += 1;
+      break;
+    }
+    i = j;
+  }
+  return tokens;
+}
+
+size_t TokenCounter::countMessage(const nlohmann::json &message)
+{
+  const std::string role = message.value("role", "");
+  const auto &content = message.contains("content") ? message["content"] : nlohmann::json();
+  const std::string text = content.is_string() ? content.get<std::string>() : content.dump();
+  const uint64_t key = std::hash<std::string>{}(text) ^ (std::hash<std::string>{}(role) * 0x9e3779b97f4a7c15ull);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = cache_.find(key);
+    if (it != cache_.end()) {
+      return it->second;
+    }
+  }
+  const size_t tokens = count(text) + messageOverhead;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (maxCached_ <= cache_.size()) {
+    cache_.clear(); // histories are re-counted once, then cached again
+  }
+  cache_[key] = static_cast<uint32_t>(tokens);
+  return tokens;
+}
+
+HistoryBudget fitHistory(nlohmann::json &messages, size_t budget, TokenCounter &counter)
+{
+  const auto t0 = std::chrono::steady_clock::now();
+  HistoryBudget res;
+  res.budget = budget;
+  if (!messages.is_array()) {
+    return res;
+  }
+  std::vector<size_t> counts;
+  counts.reserve(messages.size());
+  for (const auto &m : messages) {
+    counts.push_back(counter.countMessage(m));
+    res.tokens += counts.back();
+  }
+  if (budget && budget < res.tokens && 1 < messages.size()) {
+    const std::string noteFormat = "[Earlier conversation trimmed to fit the context: %zu message(s), about %zu tokens]";
+    const size_t noteTokens = TokenCounter::count(noteFormat) + messageOverhead + 4;
+    std::vector<bool> drop(messages.size(), false);
+    // Oldest first, whole turns (a user message takes the answers after it along)
+    for (size_t i = 0; i + 1 < messages.size() && budget < res.tokens + noteTokens; ++i) {
+      if (messages[i].value("role", "") == "system") continue;
+      drop[i] = true;
+      res.tokens -= counts[i];
+      res.droppedTokens += counts[i];
+      ++res.dropped;
+      while (i + 2 < messages.size() && messages[i + 1].value("role", "") == "assistant") {
+        ++i;
+        drop[i] = true;
+        res.tokens -= counts[i];
+        res.droppedTokens += counts[i];
+        ++res.dropped;
+      }
+    }
+    if (res.dropped) {
+      char note[160];
+      std::snprintf(note, sizeof(note), noteFormat.c_str(), res.dropped, res.droppedTokens);
+      nlohmann::json kept = nlohmann::json::array();
+      bool noted = false;
+      for (size_t i = 0; i < messages.size(); ++i) {
+        if (!drop[i]) {
+          kept.push_back(std::move(messages[i]));
+        } else if (!noted) {
+          kept.push_back({ {"role", "system"}, {"content", note} });
+          res.tokens += counter.countMessage(kept.back());
+          noted = true;
+        }
+      }
+      messages = std::move(kept);
+    }
+  }
+  res.micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+  return res;
+}
@@ -0,0 +1,45 @@
+#ifndef TOKEN_COUNT_H
+#define TOKEN_COUNT_H
+
+#include <nlohmann/json.hpp>
+#include <string_view>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+
+// Estimates how many tokens a BPE tokenizer (cl100k/o200k family) makes of a text. The
+// text is pre-tokenised the way those tokenizers split it (words with their leading
+// space, digit groups of up to three, punctuation runs, whitespace runs) and each piece
+// is costed by its length and script. There is no vocabulary, so this is an estimate:
+// close on prose and code, and deliberately not lower than the real count for words
+// the vocabulary wouldn't know.
+class TokenCounter {
+public:
+  explicit TokenCounter(size_t maxCached = 16384) : maxCached_(maxCached) {}
+
+  static size_t count(std::string_view text);
+
+  // Content plus the per-message framing; cached by a hash of role and content, so a
+  // history is only counted once no matter how often it is sent.
+  size_t countMessage(const nlohmann::json &message);
+
+private:
+  const size_t maxCached_;
+  std::mutex mutex_;
+  std::unordered_map<uint64_t, uint32_t> cache_;
+};
+
+struct HistoryBudget {
+  size_t tokens = 0;        // what is sent, marker included
+  size_t budget = 0;
+  size_t dropped = 0;       // messages
+  size_t droppedTokens = 0;
+  double micros = 0;        // time spent counting and trimming
+};
+
+// Drops the oldest turns of messages (a JSON array of {role, content}) until it fits the
+// budget and puts a system note where they were. System messages and the last message
+// are always kept. A budget of 0 only counts.
+HistoryBudget fitHistory(nlohmann::json &messages, size_t budget, TokenCounter &counter);
+
+#endif // TOKEN_COUNT_H
@@ -0,0 +1,104 @@
+#include "upstreampool.h"
+#include <format>
+#ifndef _WIN32
+#include <sys/socket.h>
+#endif
+
+UpstreamPool::Lease::~Lease()
+{
+  if (pool_ && client_ && reusable_) {
+    pool_->release(key_, std::move(client_), unixPath_);
+  }
+}
+
+UpstreamPool::Lease UpstreamPool::acquire(const std::string &host, int port, std::chrono::milliseconds timeout)
+{
+  auto key = std::format("{}:{}", host, port);
+  std::unique_ptr<httplib::Client> client;
+  std::string unixPath;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = idle_.find(key);
+    if (it != idle_.end() && !it->second.empty()) {
+      client = std::move(it->second.back());
+      it->second.pop_back();
+    }
+    auto path = unixPaths_.find(key);
+    if (path != unixPaths_.end()) unixPath = path->second;
+  }
+  if (!client) {
+    client = makeClient(host, port, unixPath);
+  }
+  client->set_connection_timeout(timeout);
+  client->set_read_timeout(timeout);
+  client->set_write_timeout(timeout);
+  return Lease(*this, std::move(key), std::move(client), std::move(unixPath));
+}
+
+std::unique_ptr<httplib::Client> UpstreamPool::connect(const std::string &host, int port) const
+{
+  std::string unixPath;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = unixPaths_.find(std::format("{}:{}", host, port));
+    if (it != unixPaths_.end()) unixPath = it->second;
+  }
+  return makeClient(host, port, unixPath);
+}
+
+void UpstreamPool::setUnixSocket(const std::string &host, int port, const std::string &path)
+{
+  const auto key = std::format("{}:{}", host, port);
+  std::lock_guard<std::mutex> lock(mutex_);
+  unixPaths_[key] = path;
+  idle_.erase(key); // connected over TCP
+}
+
+void UpstreamPool::removeUnixSocket(const std::string &host, int port)
+{
+  const auto key = std::format("{}:{}", host, port);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (unixPaths_.erase(key)) {
+    idle_.erase(key);
+  }
+}
+
+size_t UpstreamPool::idle() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t n = 0;
+  for (const auto &[key, clients] : idle_) n += clients.size();
+  return n;
+}
+
+std::unique_ptr<httplib::Client> UpstreamPool::makeClient(const std::string &host, int port, const std::string &unixPath) const
+{
+  std::unique_ptr<httplib::Client> client;
+#ifndef _WIN32
+  if (!unixPath.empty()) {
+    client = std::make_unique<httplib::Client>(unixPath, port);
+    client->set_address_family(AF_UNIX);
+    // The embedder sees the same Host as over TCP
+    client->set_default_headers({ {"Host", std::format("{}:{}", host, port)} });
+  }
+#endif
+  if (!client) {
+    client = std::make_unique<httplib::Client>(host, port);
+  }
+  client->set_keep_alive(true);
+  return client;
+}
+
+void UpstreamPool::release(const std::string &key, std::unique_ptr<httplib::Client> client, const std::string &unixPath)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Made for a transport the upstream no longer uses
+  auto path = unixPaths_.find(key);
+  if (unixPath != (path != unixPaths_.end() ? path->second : std::string())) {
+    return;
+  }
+  auto &clients = idle_[key];
+  if (clients.size() < maxIdle_) {
+    clients.push_back(std::move(client));
+  }
+}
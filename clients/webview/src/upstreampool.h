@@ -0,0 +1,68 @@
+#ifndef UPSTREAM_POOL_H
+#define UPSTREAM_POOL_H
+
+#include <httplib.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Keep-alive clients per upstream "host:port", so that requests to the embedder reuse
+// an open connection instead of connecting for each one. A client is leased for one
+// request at a time and goes back to the pool when the lease ends, unless the request
+// failed (the connection may be broken) or the pool of that upstream is full.
+//
+// An upstream may also be reachable over a Unix domain socket (see setUnixSocket); its
+// clients then connect there, while host:port stays its address.
+class UpstreamPool {
+public:
+  class Lease {
+  public:
+    Lease(UpstreamPool &pool, std::string key, std::unique_ptr<httplib::Client> client, std::string unixPath)
+      : pool_(&pool), key_(std::move(key)), client_(std::move(client)), unixPath_(std::move(unixPath)) {}
+    Lease(Lease &&) noexcept = default;
+    Lease(const Lease &) = delete;
+    Lease &operator=(const Lease &) = delete;
+    Lease &operator=(Lease &&) = delete;
+    ~Lease();
+
+    httplib::Client *operator->() { return client_.get(); }
+    httplib::Client &operator*() { return *client_; }
+    // The connection is not to be reused (the request failed or was cut short)
+    void discard() { reusable_ = false; }
+
+  private:
+    UpstreamPool *pool_;
+    std::string key_;
+    std::unique_ptr<httplib::Client> client_;
+    std::string unixPath_; // the transport it was made for
+    bool reusable_ = true;
+  };
+
+  explicit UpstreamPool(size_t maxIdle = 8) : maxIdle_(maxIdle) {}
+
+  // A client with the given read timeout (connecting and writing are bounded by it as well)
+  Lease acquire(const std::string &host, int port, std::chrono::milliseconds timeout = std::chrono::seconds(60));
+
+  // A client outside the pool (e.g. for a streamed response), over the same transport
+  std::unique_ptr<httplib::Client> connect(const std::string &host, int port) const;
+
+  // From now on host:port is reached over the Unix domain socket at path, or over TCP again
+  void setUnixSocket(const std::string &host, int port, const std::string &path);
+  void removeUnixSocket(const std::string &host, int port);
+
+  size_t idle() const;
+
+private:
+  std::unique_ptr<httplib::Client> makeClient(const std::string &host, int port, const std::string &unixPath) const;
+  void release(const std::string &key, std::unique_ptr<httplib::Client> client, const std::string &unixPath);
+
+  const size_t maxIdle_;
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, std::vector<std::unique_ptr<httplib::Client>>> idle_;
+  std::unordered_map<std::string, std::string> unixPaths_; // by "host:port"
+};
+
+#endif // UPSTREAM_POOL_H
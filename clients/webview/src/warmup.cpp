@@ -0,0 +1,198 @@
+#include "warmup.h"
+#include <utils_log/logger.hpp>
+#include <algorithm>
+#include <atomic>
+#include <format>
+
+namespace {
+
+  constexpr auto fetchTimeout = std::chrono::seconds(10);
+
+  std::string keyOf(const std::string &host, int port, const std::string &path) {
+    return std::format("{}:{} {}", host, port, path);
+  }
+
+} // anonymous namespace
+
+UpstreamWarmer::UpstreamWarmer(UpstreamPool &pool, std::vector<std::string> paths, std::chrono::milliseconds ttl)
+  : pool_(pool), paths_(std::move(paths)), ttl_(ttl), last_(nlohmann::json::object())
+{
+  thread_ = std::thread([this] { run(); });
+}
+
+UpstreamWarmer::~UpstreamWarmer()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+    cancelLocked();
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) thread_.join();
+}
+
+void UpstreamWarmer::warm(const std::string &host, int port, const std::string &reason)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (quit_) return;
+    cancelLocked();
+    // Entries are there before the fetches start, so requests right after a switch wait for them
+    auto promises = std::make_shared<Promises>(paths_.size());
+    const auto expires = std::chrono::steady_clock::now() + ttl_;
+    for (size_t i = 0; i < paths_.size(); ++i) {
+      entries_[keyOf(host, port, paths_[i])] = Entry{ (*promises)[i].get_future().share(), expires };
+    }
+    pending_ = Job{ host, port, reason, ++generation_, std::move(promises) };
+  }
+  cv_.notify_all();
+}
+
+void UpstreamWarmer::noteResult(const std::string &host, int port, bool ok)
+{
+  bool reconnected = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &down = down_[std::format("{}:{}", host, port)];
+    reconnected = ok && down;
+    down = !ok;
+  }
+  if (reconnected) {
+    warm(host, port, "reconnect");
+  }
+}
+
+std::optional<UpstreamWarmer::Answer> UpstreamWarmer::take(const std::string &host, int port, const std::string &path)
+{
+  std::shared_future<std::optional<Answer>> answer;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    expireLocked();
+    auto it = entries_.find(keyOf(host, port, path));
+    if (it == entries_.end()) {
+      return std::nullopt;
+    }
+    answer = it->second.answer;
+    entries_.erase(it);
+  }
+  try {
+    auto res = answer.get();
+    if (res) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++served_;
+      savedMicros_ += res->micros;
+    }
+    return res;
+  } catch (const std::future_error &) {
+    return std::nullopt; // cancelled before it started
+  }
+}
+
+nlohmann::json UpstreamWarmer::stats() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return {
+    {"warmups", warmups_},
+    {"cancelled", cancelled_},
+    {"served", served_},
+    {"unused", unused_},
+    {"savedMicros", savedMicros_},
+    {"last", last_}
+  };
+}
+
+void UpstreamWarmer::run()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this] { return quit_ || pending_; });
+    if (quit_) break;
+    const Job job = std::move(*pending_);
+    pending_.reset();
+    lock.unlock();
+    process(job);
+    lock.lock();
+  }
+}
+
+void UpstreamWarmer::process(const Job &job)
+{
+  const auto t0 = std::chrono::steady_clock::now();
+  auto &promises = *job.promises;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (job.generation != generation_) return;
+    ++warmups_;
+  }
+
+  std::atomic<bool> aborted = false;
+  auto fetch = [this, &job, &aborted](const std::string &path, std::promise<std::optional<Answer>> &promise) {
+    const auto start = std::chrono::steady_clock::now();
+    auto cli = pool_.acquire(job.host, job.port, fetchTimeout);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (job.generation != generation_) {
+        aborted = true;
+        promise.set_value(std::nullopt);
+        return;
+      }
+      active_.push_back(&*cli);
+    }
+    auto result = cli->Get(path);
+    std::lock_guard<std::mutex> lock(mutex_);
+    active_.erase(std::remove(active_.begin(), active_.end(), &*cli), active_.end());
+    if (!result || job.generation != generation_) {
+      aborted = aborted || job.generation != generation_;
+      cli.discard();
+      promise.set_value(std::nullopt);
+      return;
+    }
+    Answer answer;
+    answer.status = result->status;
+    answer.body = std::move(result->body);
+    answer.contentType = result->get_header_value("Content-Type");
+    answer.micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    promise.set_value(std::move(answer));
+    };
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < paths_.size(); ++i) {
+    workers.emplace_back(fetch, std::cref(paths_[i]), std::ref(promises[i]));
+  }
+  for (auto &t : workers) t.join();
+
+  const double millis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+  std::lock_guard<std::mutex> lock(mutex_);
+  LOG_MSG << "Warm-up of" << job.host << LOG_NOSPACE << ":" << job.port << "(" << job.reason << ")" << (aborted ? "cancelled" : "done") << "in" << millis << "ms";
+  last_ = { {"host", job.host}, {"port", job.port}, {"reason", job.reason}, {"millis", millis}, {"cancelled", aborted.load()} };
+}
+
+void UpstreamWarmer::cancelLocked()
+{
+  if (pending_ || !active_.empty()) {
+    ++cancelled_;
+  }
+  ++generation_;
+  pending_.reset();
+  for (auto *cli : active_) {
+    cli->stop();
+  }
+  active_.clear();
+  // Answers for the instance being left are of no use any more
+  for (const auto &[key, entry] : entries_) {
+    unused_ += entry.answer.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+  }
+  entries_.clear();
+}
+
+void UpstreamWarmer::expireLocked()
+{
+  const auto now = std::chrono::steady_clock::now();
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    if (it->second.expires < now && it->second.answer.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+      ++unused_;
+      it = entries_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
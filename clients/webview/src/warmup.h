@@ -0,0 +1,90 @@
+#ifndef WARMUP_H
+#define WARMUP_H
+
+#include "upstreampool.h"
+#include <nlohmann/json.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Warms an embedder instance the proxy just switched to or reconnected to: the given
+// GET paths are fetched in parallel over the pool (which leaves open connections behind)
+// and kept for the first request that asks for them. A request arriving while its path
+// is still being fetched waits for that answer instead of going upstream again.
+//
+// Each answer is served once and only within `ttl`, so warming never keeps stale data
+// around. Warming another instance cancels the one in progress: requests to the old
+// instance are stopped and its answers dropped.
+class UpstreamWarmer {
+public:
+  struct Answer {
+    int status = 0;
+    std::string body;
+    std::string contentType;
+    double micros = 0; // time the fetch took, saved by the request served
+  };
+  UpstreamWarmer(UpstreamPool &pool, std::vector<std::string> paths, std::chrono::milliseconds ttl = std::chrono::seconds(30));
+  ~UpstreamWarmer();
+
+  UpstreamWarmer(const UpstreamWarmer &) = delete;
+  UpstreamWarmer &operator=(const UpstreamWarmer &) = delete;
+
+  // Returns right away; the work happens on the warmer's thread
+  void warm(const std::string &host, int port, const std::string &reason);
+  // Outcome of a proxied request; warms the instance when it answers again after failing
+  void noteResult(const std::string &host, int port, bool ok);
+
+  // The warmed answer for path, if there is one (waits if it is still being fetched)
+  std::optional<Answer> take(const std::string &host, int port, const std::string &path);
+
+  // {warmups, cancelled, served, unused, savedMicros, last: {host, port, reason, millis}}
+  nlohmann::json stats() const;
+
+private:
+  using Promises = std::vector<std::promise<std::optional<Answer>>>; // one per path
+  struct Job {
+    std::string host;
+    int port = 0;
+    std::string reason;
+    uint64_t generation = 0;
+    std::shared_ptr<Promises> promises;
+  };
+  struct Entry {
+    std::shared_future<std::optional<Answer>> answer;
+    std::chrono::steady_clock::time_point expires;
+  };
+
+  void run();
+  void process(const Job &job);
+  void cancelLocked();
+  void expireLocked();
+
+  UpstreamPool &pool_;
+  const std::vector<std::string> paths_;
+  const std::chrono::milliseconds ttl_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::optional<Job> pending_;
+  bool quit_ = false;
+  uint64_t generation_ = 0;
+  std::unordered_map<std::string, Entry> entries_;   // "host:port path"
+  std::vector<httplib::Client *> active_;            // fetches of the current warm-up
+  std::unordered_map<std::string, bool> down_;       // "host:port" -> last request failed
+  size_t warmups_ = 0;
+  size_t cancelled_ = 0;
+  size_t served_ = 0;
+  size_t unused_ = 0;
+  double savedMicros_ = 0;
+  nlohmann::json last_;
+  std::thread thread_;
+};
+
+#endif // WARMUP_H
@@ -0,0 +1,56 @@
+#include "workerpool.h"
+#include <utils_log/logger.hpp>
+#include <algorithm>
+
+WorkerPool::WorkerPool(unsigned threads)
+{
+  for (unsigned i = 0; i < (std::max)(threads, 1u); ++i) {
+    threads_.emplace_back([this] { run(); });
+  }
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+    tasks_.clear();
+  }
+  cv_.notify_all();
+  for (auto &t : threads_) {
+    t.join();
+  }
+}
+
+void WorkerPool::post(std::function<void()> task)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (quit_) {
+      return;
+    }
+    tasks_.push_back(std::move(task));
+  }
+  cv_.notify_one();
+}
+
+void WorkerPool::run()
+{
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return quit_ || !tasks_.empty(); });
+      if (tasks_.empty()) {
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    try {
+      task();
+    } catch (const std::exception &ex) {
+      LOG_MSG << "Worker task failed:" << ex.what();
+    }
+  }
+}
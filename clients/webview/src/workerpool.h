@@ -0,0 +1,36 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads running posted tasks in the order they came. For work that would
+// otherwise get a thread of its own per call (a page action, the items of a request): the
+// threads stay bounded however many callers there are, the rest waits in the queue.
+class WorkerPool {
+public:
+  explicit WorkerPool(unsigned threads);
+  // Tasks not started yet are dropped, running ones are waited for
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  void post(std::function<void()> task);
+  size_t size() const { return threads_.size(); }
+
+private:
+  void run();
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> tasks_;
+  bool quit_ = false;
+  std::vector<std::thread> threads_;
+};
+
+#endif // WORKERPOOL_H